@@ -0,0 +1,341 @@
+#ifndef _MSC_VER
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+#include "audio_adts.h"
+
+static const int adts_sample_rates[16] = {
+	96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350, 0, 0, 0
+};
+
+int adtsParseHeader(const uint8_t *data, int size, AdtsHeader *header)
+{
+	if (size < ADTS_HEADER_SIZE || data[0] != 0xff || (data[1] & 0xf6) != 0xf0)
+		return -1;    // syncword 0xfff, layer 00
+	header->profile = data[2] >> 6;
+	header->sampleIndex = (data[2] >> 2) & 0x0f;
+	header->sampleRate = adts_sample_rates[header->sampleIndex];
+	header->channels = ((data[2] & 0x01) << 2) | (data[3] >> 6);
+	header->frameLen = ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+	header->headerLen = (data[1] & 0x01) ? 7 : 9;    // protection_absent
+	header->rawBlocks = (data[6] & 0x03) + 1;
+	if (!header->sampleRate || header->frameLen < header->headerLen)
+		return -1;
+	return 0;
+}
+
+void adtsWriteHeader(uint8_t *data, const AdtsHeader *header)
+{
+	data[0] = 0xff;
+	data[1] = 0xf1;    // syncword, mpeg-4, layer 00, protection_absent
+	data[2] = (uint8_t)((header->profile & 0x03) << 6 | (header->sampleIndex & 0x0f) << 2 | (header->channels & 0x04) >> 2);
+	data[3] = (uint8_t)((header->channels & 0x03) << 6 | (header->frameLen >> 11 & 0x03));
+	data[4] = (uint8_t)(header->frameLen >> 3);
+	data[5] = (uint8_t)((header->frameLen & 0x07) << 5 | 0x1f);    // buffer fullness 0x7ff, vbr
+	data[6] = 0xfc;
+}
+
+int adtsHeaderFromParameters(const AVCodecParameters *par, AdtsHeader *header)
+{
+	*header = AdtsHeader();
+	if (par->codec_id != AV_CODEC_ID_AAC || par->channels <= 0 || par->channels > 7)
+		return -1;
+	for (header->sampleIndex = 0; header->sampleIndex < 13; header->sampleIndex++) {
+		if (adts_sample_rates[header->sampleIndex] == par->sample_rate)
+			break;
+	}
+	if (header->sampleIndex == 13)
+		return -1;
+	// audio object type - 1, he-aac is signalled as lc (implicit sbr)
+	header->profile = par->profile < 0 || par->profile > FF_PROFILE_AAC_LTP ? FF_PROFILE_AAC_LOW : par->profile;
+	header->sampleRate = par->sample_rate;
+	header->channels = par->channels;
+	header->headerLen = ADTS_HEADER_SIZE;
+	header->rawBlocks = 1;
+	return 0;
+}
+
+AdtsSink::AdtsSink(int batchSize)
+	:batchSize_(batchSize), count_(0), headers_(NULL), packets_(NULL), ingest_(NULL), syscalls_(0)
+{
+#ifdef _MSC_VER
+	fd_ = NULL;
+#else
+	// every packet takes two iovec
+	if (batchSize_ * 2 > IOV_MAX)
+		batchSize_ = IOV_MAX / 2;
+	fd_ = -1;
+#endif
+}
+
+AdtsSink::~AdtsSink()
+{
+	audioAdtsClose();
+}
+
+int AdtsSink::audioAdtsOpen(string filename)
+{
+#ifdef _MSC_VER
+	fd_ = fopen(filename.c_str(), "wb+");
+	if (!fd_) {
+#else
+	fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd_ < 0) {
+#endif
+		av_log(NULL, AV_LOG_ERROR, "adts open file %s failure.\n", filename.c_str());
+		return -1;
+	}
+	headers_ = (uint8_t *)av_mallocz(batchSize_ * ADTS_HEADER_SIZE);
+	packets_ = (AVPacket **)av_mallocz_array(batchSize_, sizeof(AVPacket *));
+	ingest_ = (int64_t *)av_malloc_array(batchSize_, sizeof(int64_t));
+	if (!headers_ || !packets_ || !ingest_) {
+		av_log(NULL, AV_LOG_ERROR, "adts alloc batch failure.\n");
+		return -1;
+	}
+	for (int i = 0; i < batchSize_; i++) {
+		packets_[i] = av_packet_alloc();
+		if (!packets_[i])
+			return -1;
+	}
+	count_ = 0;
+	return 0;
+}
+
+int AdtsSink::audioAdtsWrite(AudioEncode *encoder, AVPacket *packet)
+{
+	if (!packets_)
+		return -1;
+	if (!encoder->audioEncodeAdts()) {
+		av_log(NULL, AV_LOG_ERROR, "adts needs aac packets, use AudioMuxer for other codecs.\n");
+		return -1;
+	}
+	if (encoder->packetAddHeader((char *)headers_ + count_ * ADTS_HEADER_SIZE, packet->size) < 0)
+		return -1;
+	return queuePacket(packet, encoder->audioEncodeIngestTime());
+}
+
+int AdtsSink::audioAdtsWrite(const AdtsHeader *stream, AVPacket *packet)
+{
+	if (!packets_)
+		return -1;
+	AdtsHeader header = *stream;
+	header.frameLen = ADTS_HEADER_SIZE + packet->size;
+	adtsWriteHeader(headers_ + count_ * ADTS_HEADER_SIZE, &header);
+	return queuePacket(packet, AUDIO_NO_INGEST);
+}
+
+/* the header of slot count_ is written, queue the payload behind it */
+int AdtsSink::queuePacket(AVPacket *packet, int64_t ingest)
+{
+	// encoder packets are refcounted, this only takes a reference to the payload
+	int ret = av_packet_ref(packets_[count_], packet);
+	if (ret < 0) {
+		av_log(NULL, AV_LOG_ERROR, "adts ref packet failure.\n");
+		return ret;
+	}
+	ingest_[count_] = ingest;
+	count_++;
+	if (count_ == batchSize_)
+		return audioAdtsFlush();
+	return 0;
+}
+
+int AdtsSink::audioAdtsFlush()
+{
+	int ret = 0;
+	if (count_ == 0)
+		return 0;
+#ifdef _MSC_VER
+	// no writev on windows, the crt buffers these into large writes
+	for (int i = 0; i < count_ && ret == 0; i++) {
+		if (fwrite(headers_ + i * ADTS_HEADER_SIZE, 1, ADTS_HEADER_SIZE, fd_) != ADTS_HEADER_SIZE ||
+			fwrite(packets_[i]->data, 1, packets_[i]->size, fd_) != (size_t)packets_[i]->size)
+			ret = -1;
+	}
+	syscalls_++;
+#else
+	struct iovec iov[IOV_MAX];
+	int iovcnt = 0;
+	for (int i = 0; i < count_; i++) {
+		iov[iovcnt].iov_base = headers_ + i * ADTS_HEADER_SIZE;
+		iov[iovcnt++].iov_len = ADTS_HEADER_SIZE;
+		iov[iovcnt].iov_base = packets_[i]->data;
+		iov[iovcnt++].iov_len = packets_[i]->size;
+	}
+	struct iovec *cur = iov;
+	while (iovcnt > 0) {
+		ssize_t n = writev(fd_, cur, iovcnt);
+		syscalls_++;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -1;
+			break;
+		}
+		// short write: skip what went out and retry the rest
+		while (iovcnt > 0 && (size_t)n >= cur->iov_len) {
+			n -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			cur->iov_base = (uint8_t *)cur->iov_base + n;
+			cur->iov_len -= n;
+		}
+	}
+#endif
+	if (ret < 0)
+		av_log(NULL, AV_LOG_ERROR, "adts write failure.\n");
+	int64_t now = av_gettime_relative();
+	for (int i = 0; i < count_; i++) {
+		if (ret == 0 && ingest_[i] != AUDIO_NO_INGEST)
+			latency_.audioLatencyRecord(now - ingest_[i]);
+		av_packet_unref(packets_[i]);
+	}
+	count_ = 0;
+	return ret;
+}
+
+int AdtsSink::audioAdtsClose()
+{
+	int ret = 0;
+	if (packets_) {
+		ret = audioAdtsFlush();
+		for (int i = 0; i < batchSize_; i++)
+			av_packet_free(&packets_[i]);
+		av_freep(&packets_);
+	}
+	av_freep(&headers_);
+	av_freep(&ingest_);
+#ifdef _MSC_VER
+	if (fd_)
+		fclose(fd_);
+	fd_ = NULL;
+#else
+	if (fd_ >= 0)
+		close(fd_);
+	fd_ = -1;
+#endif
+	return ret;
+}
+
+AdtsReader::AdtsReader(int blockSize)
+	:blockSize_(FFMAX(blockSize, 16 * 1024)), block_(NULL), pos_(0), len_(0), eof_(0), nextPts_(0),
+	skipped_(0), bitRate_(0), fd_(NULL)
+{
+	memset(&header_, 0, sizeof(header_));
+}
+
+AdtsReader::~AdtsReader()
+{
+	audioReaderClose();
+}
+
+int AdtsReader::audioReaderOpen(string filename)
+{
+	fd_ = fopen(filename.c_str(), "rb");
+	if (!fd_) {
+		av_log(NULL, AV_LOG_ERROR, "adts open input file %s failure.\n", filename.c_str());
+		return -1;
+	}
+	pos_ = len_ = 0;
+	eof_ = 0;
+	nextPts_ = 0;
+	skipped_ = 0;
+	if (fillBlock() < 0)
+		return -1;
+	// first valid header gives the stream parameters, the frames of the block give the bit rate
+	int pos = 0;
+	while (pos + ADTS_HEADER_SIZE <= len_ && adtsParseHeader(block_->data + pos, len_ - pos, &header_) < 0)
+		pos++;
+	if (pos + ADTS_HEADER_SIZE > len_) {
+		av_log(NULL, AV_LOG_ERROR, "adts no header in %s.\n", filename.c_str());
+		return -1;
+	}
+	int64_t bytes = 0, samples = 0;
+	AdtsHeader header;
+	while (pos + ADTS_HEADER_SIZE <= len_ && adtsParseHeader(block_->data + pos, len_ - pos, &header) == 0 &&
+		pos + header.frameLen <= len_) {
+		bytes += header.frameLen - header.headerLen;
+		samples += adtsFrameSamples(&header);
+		pos += header.frameLen;
+	}
+	bitRate_ = samples ? (int)(bytes * 8 * header_.sampleRate / samples) : 0;
+	return 0;
+}
+
+/* keep the unread tail, move it to the front of a new block and fill the rest from the file.
+** the old block stays alive as long as packets reference it */
+int AdtsReader::fillBlock()
+{
+	if (eof_)
+		return 0;
+	AVBufferRef *block = av_buffer_alloc(blockSize_ + AV_INPUT_BUFFER_PADDING_SIZE);
+	if (!block) {
+		av_log(NULL, AV_LOG_ERROR, "adts alloc block failure.\n");
+		return -1;
+	}
+	int tail = len_ - pos_;
+	if (tail > 0)
+		memcpy(block->data, block_->data + pos_, tail);
+	av_buffer_unref(&block_);
+	block_ = block;
+	size_t ret = fread(block_->data + tail, 1, blockSize_ - tail, fd_);
+	if (ret < (size_t)(blockSize_ - tail))
+		eof_ = 1;
+	pos_ = 0;
+	len_ = tail + (int)ret;
+	memset(block_->data + len_, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+	return (int)ret;
+}
+
+int AdtsReader::audioReaderRead(AVPacket *packet)
+{
+	AdtsHeader header;
+	while (1) {
+		int left = len_ - pos_;
+		if (left < ADTS_HEADER_SIZE || (adtsParseHeader(block_->data + pos_, left, &header) == 0 &&
+			header.frameLen > left)) {
+			// frame continues in the next block
+			int ret = fillBlock();
+			if (ret < 0)
+				return -1;
+			if (ret == 0)
+				return AVERROR_EOF;    // a truncated last frame is dropped
+			continue;
+		}
+		if (adtsParseHeader(block_->data + pos_, left, &header) < 0) {
+			pos_++;       // lost sync, search the next syncword
+			skipped_++;
+			continue;
+		}
+		break;
+	}
+	av_packet_unref(packet);
+	packet->buf = av_buffer_ref(block_);
+	if (!packet->buf)
+		return -1;
+	packet->data = block_->data + pos_;
+	packet->size = header.frameLen;
+	packet->pts = packet->dts = nextPts_;
+	packet->duration = adtsFrameSamples(&header);
+	packet->flags |= AV_PKT_FLAG_KEY;
+	nextPts_ += packet->duration;
+	pos_ += header.frameLen;
+	return 0;
+}
+
+void AdtsReader::audioReaderClose()
+{
+	if (skipped_)
+		av_log(NULL, AV_LOG_WARNING, "adts skipped %lld bytes without a valid header.\n", (long long)skipped_);
+	skipped_ = 0;
+	av_buffer_unref(&block_);
+	if (fd_)
+		fclose(fd_);
+	fd_ = NULL;
+}
@@ -0,0 +1,103 @@
+#ifndef __AUDIO_ADTS__H_
+#define __AUDIO_ADTS__H_
+#include "audio_engine.h"
+
+#define ADTS_HEADER_SIZE 7
+
+/*
+** @brief AdtsHeader the fixed + variable adts header fields, filled by adtsParseHeader()
+*/
+struct AdtsHeader {
+	int profile;        // FF_PROFILE_AAC_* (audio object type - 1)
+	int sampleIndex;    // sampling_frequency_index
+	int sampleRate;
+	int channels;       // channel_configuration
+	int frameLen;       // whole adts frame, header included
+	int headerLen;      // 7, or 9 with crc
+	int rawBlocks;      // number_of_raw_data_blocks_in_frame + 1
+};
+
+/* parse the adts header at data, size must be >= ADTS_HEADER_SIZE. 0 on success, -1 no valid header */
+int  adtsParseHeader(const uint8_t *data, int size, AdtsHeader *header);
+/* the 7 byte header (no crc, one raw data block) from profile, sampleIndex, channels and frameLen */
+void adtsWriteHeader(uint8_t *data, const AdtsHeader *header);
+/* profile, sampleIndex, sampleRate and channels of aac codec parameters, -1 when adts cannot carry them */
+int  adtsHeaderFromParameters(const AVCodecParameters *par, AdtsHeader *header);
+/* samples per adts frame (1024 per raw data block) */
+static inline int adtsFrameSamples(const AdtsHeader *header) { return header->rawBlocks * 1024; }
+
+/*
+** @brief AdtsSink batched adts writer, the 7 byte headers go to a header slab and the payload stays in
+** the encoder's packet buffer (only a reference is kept), every audioAdtsFlush() hands all
+** (header, payload) pairs to the kernel in one writev(). no payload copy and one syscall per batch
+** instead of two fwrite per packet, which matters when one process writes hundreds of streams.
+** first call audioAdtsOpen(), then audioAdtsWrite() for every encoded packet, audioAdtsClose() at the end.
+*/
+class AdtsSink {
+public:
+	AdtsSink(int batchSize = 64);
+	~AdtsSink();
+public:
+	int  audioAdtsOpen(string filename);
+	/* queue one encoded packet, the header is built with encoder->packetAddHeader() */
+	int  audioAdtsWrite(AudioEncode *encoder, AVPacket *packet);
+	/* the same without an encoder: the header comes from stream parameters filled by
+	** adtsHeaderFromParameters(), for threads that must not touch the live encoder */
+	int  audioAdtsWrite(const AdtsHeader *stream, AVPacket *packet);
+	int  audioAdtsFlush();
+	int  audioAdtsClose();
+	int64_t audioAdtsSyscalls() const { return syscalls_; }
+	/* capture -> written latency, recorded when writev() returns */
+	const AudioLatencyStats& audioAdtsGetLatency() const { return latency_; }
+private:
+	int        queuePacket(AVPacket *packet, int64_t ingest);
+private:
+	int        batchSize_;
+	int        count_;
+	uint8_t   *headers_;      // batchSize_ * ADTS_HEADER_SIZE
+	AVPacket **packets_;      // references to the queued payloads
+	int64_t   *ingest_;       // capture time of each queued packet
+	AudioLatencyStats latency_;
+	int64_t    syscalls_;
+#ifdef _MSC_VER
+	FILE      *fd_;
+#else
+	int        fd_;
+#endif
+};
+
+/*
+** @brief AdtsReader reads an adts file in large blocks and hands out one packet per adts frame that
+** references the block (header included, pts counts samples from 0). no decoding, no copy and no
+** syscall per packet, so rewrapping and editing run at disk speed.
+** first call audioReaderOpen(), then audioReaderRead() until AVERROR_EOF.
+*/
+class AdtsReader {
+public:
+	AdtsReader(int blockSize = 1 << 20);
+	~AdtsReader();
+public:
+	/* open and parse the first header, the stream parameters are in audioReaderHeader() */
+	int  audioReaderOpen(string filename);
+	void audioReaderClose();
+	/* next adts frame, the packet holds a reference to the block. AVERROR_EOF at the end */
+	int  audioReaderRead(AVPacket *packet);
+	const AdtsHeader& audioReaderHeader() const { return header_; }
+	/* average bit rate of the frames in the first block */
+	int  audioReaderBitRate() const { return bitRate_; }
+private:
+	int  fillBlock();
+private:
+	int           blockSize_;
+	AVBufferRef  *block_;
+	int           pos_;       // next frame in block_
+	int           len_;       // valid bytes in block_
+	int           eof_;
+	int64_t       nextPts_;
+	int64_t       skipped_;   // bytes skipped to resync
+	AdtsHeader    header_;
+	int           bitRate_;
+	FILE         *fd_;
+};
+
+#endif
@@ -0,0 +1,315 @@
+/*
+** audio_alloc_check: counts heap allocations of the real-time path (capture -> resample -> encode -> decode)
+** per frame after warm-up, and fails when a stage allocates at all in steady state.
+** capture reads the bundled capture.pcm through the s16le demuxer (looped), decode eats the packets
+** the encoder just produced, wrapped in adts.
+**
+** linux: malloc / calloc / realloc / posix_memalign are interposed, that covers av_malloc inside the
+**        ffmpeg shared libraries too, every call site is printed with its symbol.
+** windows: only global operator new is counted, the ffmpeg dlls allocate from their own crt.
+**
+** build: g++ -O2 -g audio_alloc_check.cpp audio_engine.cpp audio_dsp.cpp audio_remix.cpp audio_decimate.cpp -Iinclude -Llib -lavdevice
+**        -lavformat -lavcodec -lswresample -lswscale -lavutil -ldl -o audio_alloc_check
+**        windows: the audio_alloc_check project of ffmpeg_audio_capture.sln
+** usage: audio_alloc_check [frames=2000] [warmup=200] [budget=0]
+**        exit 1 when a stage allocates more than budget times per frame, budget 0: not once.
+**        known failures: stages whose allocations come from inside an ffmpeg 4.4 call the engine cannot
+**        avoid are checked like the others but reported KNOWN FAIL with the reason and do not set the exit
+**        code, a known failure that no longer allocates is reported so it comes off the list. the adts glue
+**        between encode and decode is the harness's own and not counted.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "audio_engine.h"
+
+enum {
+	STAGE_NONE,
+	STAGE_CAPTURE,
+	STAGE_SAMPLE,
+	STAGE_ENCODE,
+	STAGE_DECODE,
+	STAGE_COUNT
+};
+static const char *stage_names[STAGE_COUNT] = { "none", "capture", "resample", "encode", "decode" };
+/* allocations inside libavformat / libavcodec, nothing the engine hands them avoids them */
+static const char *known_failures[STAGE_COUNT] = {
+	NULL,
+	"av_read_frame(): the demuxer allocates every packet",
+	NULL,
+	"avcodec_send_frame() refs every plane, the encoder allocates every packet",
+	"avcodec_send_packet() refs every packet",
+};
+
+#define SITE_DEPTH 6
+#define MAX_SITES  256
+
+struct AllocSite {
+	void   *pc[SITE_DEPTH];
+	int     depth;
+	int     stage;
+	int64_t count;
+};
+
+static atomic<int>     g_counting(0);
+static int             g_stage = STAGE_NONE;
+static int64_t         g_stage_allocs[STAGE_COUNT];
+static int64_t         g_stage_gets[STAGE_COUNT];
+static int64_t         g_last_gets = 0;
+static AllocSite       g_sites[MAX_SITES];
+static int             g_nsites = 0;
+static atomic_flag     g_site_lock = ATOMIC_FLAG_INIT;
+#ifdef _MSC_VER
+static __declspec(thread) int g_in_hook = 0;
+#else
+static __thread int    g_in_hook = 0;
+#endif
+
+/* called from the allocation hooks: must not allocate itself */
+static void record_alloc(void *caller)
+{
+	if (!g_counting || g_in_hook || g_stage == STAGE_NONE)
+		return;
+	g_in_hook = 1;
+	void *pc[SITE_DEPTH + 2];
+	int depth;
+#ifdef __GLIBC__
+	depth = backtrace(pc, SITE_DEPTH + 2) - 2;   // drop record_alloc and the hook
+	if (depth < 0)
+		depth = 0;
+	memmove(pc, pc + 2, depth * sizeof(void *));
+	(void)caller;
+#else
+	pc[0] = caller;
+	depth = 1;
+#endif
+	while (g_site_lock.test_and_set(memory_order_acquire))
+		;
+	g_stage_allocs[g_stage]++;
+	int i;
+	for (i = 0; i < g_nsites; i++) {
+		if (g_sites[i].stage == g_stage && g_sites[i].depth == depth &&
+			!memcmp(g_sites[i].pc, pc, depth * sizeof(void *)))
+			break;
+	}
+	if (i == g_nsites && g_nsites < MAX_SITES) {
+		memcpy(g_sites[i].pc, pc, depth * sizeof(void *));
+		g_sites[i].depth = depth;
+		g_sites[i].stage = g_stage;
+		g_sites[i].count = 0;
+		g_nsites++;
+	}
+	if (i < MAX_SITES)
+		g_sites[i].count++;
+	g_site_lock.clear(memory_order_release);
+	g_in_hook = 0;
+}
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+	record_alloc(NULL);
+	return __libc_malloc(size);
+}
+void *calloc(size_t n, size_t size) __THROW
+{
+	record_alloc(NULL);
+	return __libc_calloc(n, size);
+}
+void *realloc(void *ptr, size_t size) __THROW
+{
+	record_alloc(NULL);
+	return __libc_realloc(ptr, size);
+}
+void *memalign(size_t align, size_t size) __THROW
+{
+	record_alloc(NULL);
+	return __libc_memalign(align, size);
+}
+void *aligned_alloc(size_t align, size_t size) __THROW
+{
+	record_alloc(NULL);
+	return __libc_memalign(align, size);
+}
+int posix_memalign(void **ptr, size_t align, size_t size) __THROW
+{
+	// av_malloc() ends up here
+	record_alloc(NULL);
+	*ptr = __libc_memalign(align, size);
+	return *ptr ? 0 : ENOMEM;
+}
+}
+#endif
+
+/* operator new is counted through the malloc hook on glibc, explicitly elsewhere */
+static void *counted_new(size_t size, void *caller)
+{
+#ifndef __GLIBC__
+	record_alloc(caller);
+#else
+	(void)caller;
+#endif
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+#ifdef _MSC_VER
+#define CALLER_PC _ReturnAddress()
+#else
+#define CALLER_PC __builtin_return_address(0)
+#endif
+void *operator new(size_t size) { return counted_new(size, CALLER_PC); }
+void *operator new[](size_t size) { return counted_new(size, CALLER_PC); }
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+static void print_site(const AllocSite &site)
+{
+	fprintf(stderr, "  %-8s %8lld x", stage_names[site.stage], (long long)site.count);
+	for (int i = 0; i < site.depth; i++) {
+#ifdef __GLIBC__
+		Dl_info info;
+		if (dladdr(site.pc[i], &info) && info.dli_sname) {
+			int status = 0;
+			char *name = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+			fprintf(stderr, " %s%s", i ? "<- " : "", status == 0 ? name : info.dli_sname);
+			free(name);
+			continue;
+		}
+#endif
+		fprintf(stderr, " %s%p", i ? "<- " : "", site.pc[i]);
+	}
+	fprintf(stderr, "\n");
+}
+
+/* switch stage, the pool gets since the last switch go to the stage that is left */
+static void enter_stage(AudioBufferPool *pool, int stage)
+{
+	AudioPoolStats stats;
+	pool->audioPoolGetStats(&stats);
+	if (g_counting)
+		g_stage_gets[g_stage] += stats.gets - g_last_gets;
+	g_last_gets = stats.gets;
+	g_stage = stage;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 2000;
+	int warmup = argc > 2 ? atoi(argv[2]) : 200;
+	int budget = argc > 3 ? atoi(argv[3]) : 0;
+	AVFrame *frame = NULL, *resample_frame = NULL, *dec_frame = NULL;
+	AVPacket *packet = NULL;
+	AVPacket *adts_packet = av_packet_alloc();
+	AudioBufferPool *pool = AudioBufferPool::audioPoolDefault();
+
+	AudioCapture capture("capture.pcm", "s16le");
+	capture.audioSetDeviceOption("sample_rate", "44100");
+	capture.audioSetDeviceOption("channels", "2");
+	capture.audioSetLoop(1);
+	if (capture.audioInit(AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, 1024) < 0) {
+		fprintf(stderr, "capture init fail.\n");
+		return 2;
+	}
+	AudioSample sample(44100, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO, 44100, AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO);
+	AudioEncode encode("aac");
+	AudioDecode decode("aac", 0);
+	if (sample.audioSampleInit() < 0 ||
+		encode.audioEncodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 44100, 128000, FF_PROFILE_AAC_LOW) < 0 ||
+		decode.AudioDecodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 44100, 128000, FF_PROFILE_AAC_LOW) < 0) {
+		fprintf(stderr, "engine init fail.\n");
+		return 2;
+	}
+	av_log_set_level(AV_LOG_ERROR);
+#ifdef __GLIBC__
+	void *dummy[4];
+	backtrace(dummy, 4);   // first call loads libgcc, keep that out of the counts
+#endif
+
+	for (int i = 0; i < warmup + frames; i++) {
+		if (i == warmup) {
+			enter_stage(pool, STAGE_NONE);
+			g_counting = 1;
+		}
+		enter_stage(pool, STAGE_CAPTURE);
+		if (capture.audioCaptureFrame(&frame) < 0) {
+			fprintf(stderr, "capture fail at frame %d.\n", i);
+			return 2;
+		}
+		enter_stage(pool, STAGE_SAMPLE);
+		sample.audioSampleConvert(frame, &resample_frame);
+		enter_stage(pool, STAGE_ENCODE);
+		int ret = encode.audioEncode(resample_frame, &packet);
+		enter_stage(pool, STAGE_NONE);
+		if (ret != 0)
+			continue;
+		if (pool->audioPoolGetPacket(adts_packet, packet->size + 7) < 0)
+			return 2;
+		if (encode.packetAddHeader((char *)adts_packet->data, packet->size) < 0)
+			return 2;
+		memcpy(adts_packet->data + 7, packet->data, packet->size);
+		enter_stage(pool, STAGE_DECODE);
+		decode.audioDecodePacket(adts_packet, &dec_frame);
+		enter_stage(pool, STAGE_NONE);
+	}
+	g_counting = 0;
+
+	int failed = 0;
+	fprintf(stderr, "\nsteady state allocations over %d frames (after %d warm-up frames), budget %d / frame:\n",
+		frames, warmup, budget);
+	fprintf(stderr, "  %-8s %8s %8s %10s\n", "stage", "allocs", "pool gets", "per frame");
+	for (int s = STAGE_CAPTURE; s < STAGE_COUNT; s++) {
+		int over = g_stage_allocs[s] > (int64_t)budget * frames;
+		fprintf(stderr, "  %-8s %8lld %8lld %10.2f  ", stage_names[s], (long long)g_stage_allocs[s],
+			(long long)g_stage_gets[s], (double)g_stage_allocs[s] / frames);
+		if (over && known_failures[s]) {
+			fprintf(stderr, "KNOWN FAIL: %s\n", known_failures[s]);
+		} else if (over) {
+			fprintf(stderr, "FAIL\n");
+			failed = 1;
+		} else if (known_failures[s]) {
+#ifdef __GLIBC__
+			fprintf(stderr, "ok, listed as a known failure: take it off the list\n");
+#else
+			fprintf(stderr, "ok, the ffmpeg dlls are not seen: %s\n", known_failures[s]);
+#endif
+		} else {
+			fprintf(stderr, "ok\n");
+		}
+	}
+	if (g_nsites)
+		fprintf(stderr, "call sites:\n");
+	for (int i = 0; i < g_nsites; i++)
+		print_site(g_sites[i]);
+	AudioPoolStats stats;
+	pool->audioPoolGetStats(&stats);
+	fprintf(stderr, "buffer pool gets:%lld misses:%lld pools:%d\n",
+		(long long)stats.gets, (long long)stats.misses, stats.pools);
+
+	av_packet_free(&adts_packet);
+	capture.audioDeinit();
+	if (failed) {
+		fprintf(stderr, "FAIL\n");
+		return 1;
+	}
+	fprintf(stderr, "OK\n");
+	return 0;
+}
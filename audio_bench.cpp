@@ -0,0 +1,942 @@
+/*
+** audio_bench: micro benchmarks of the engine classes on the bundled fixtures (capture.pcm, encode.aac).
+** google benchmark style report: ns per frame and realtime factor (seconds of audio handled per second
+** of wall time), --json=file writes the results in google benchmark's json layout so runs of two commits
+** can be compared with its compare.py. a full run (or --filter=latency) also prints the algorithmic delay
+** of every encoder case, opus 10 / 20 ms against aac / he-aac, and (or --filter=fixed) the output error of
+** aac_fixed against the float aac decoder, and (or --filter=startup) the session start time with a cold
+** avcodec_open2() against a context from AudioCodecPool (with the warm teardown and the pool misses), and
+** (or --filter=allocs) the heap allocations per frame the pooled capture -> encode -> decode path still
+** makes. the g711 session case is one full duplex telephony leg per step, its realtime factor is the
+** number of legs one core carries.
+**
+** build: g++ -O2 audio_bench.cpp audio_engine.cpp audio_adts.cpp audio_mix.cpp audio_dsp.cpp audio_loudness.cpp audio_remix.cpp
+**        audio_dtx.cpp audio_decimate.cpp audio_g711.cpp -Iinclude -Llib -lavdevice -lavformat -lavcodec -lswresample
+**        -lswscale -lavutil -lpthread -o audio_bench
+**        windows: the audio_bench project of ffmpeg_audio_capture.sln
+** usage: audio_bench [--filter=substring] [--min_time=seconds] [--json=file]
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "audio_engine.h"
+#include "audio_adts.h"
+#include "audio_mix.h"
+#include "audio_loudness.h"
+#include "audio_remix.h"
+#include "audio_dtx.h"
+#include "audio_g711.h"
+
+/* processes one frame, < 0 is a failure */
+typedef function<int()> BenchStep;
+
+struct BenchCase {
+	string name;
+	/* build the fixture, set frame_seconds to the audio duration of one step,
+	** return an empty step and set skip to skip the case */
+	function<BenchStep(double *frame_seconds, string *skip)> setup;
+};
+
+struct BenchResult {
+	string  name;
+	int64_t frames;
+	double  nsPerFrame;
+	double  realtime;
+	string  skip;
+};
+
+static vector<BenchCase> &bench_cases()
+{
+	static vector<BenchCase> cases;
+	return cases;
+}
+
+static void bench_register(string name, function<BenchStep(double *, string *)> setup)
+{
+	BenchCase c;
+	c.name = name;
+	c.setup = setup;
+	bench_cases().push_back(c);
+}
+
+static vector<uint8_t> bench_load_file(const char *name)
+{
+	vector<uint8_t> data;
+	FILE *fd = fopen(name, "rb");
+	if (!fd)
+		return data;
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fd)) > 0)
+		data.insert(data.end(), buf, buf + n);
+	fclose(fd);
+	return data;
+}
+
+/* a 1024 sample stereo frame filled from capture.pcm (s16 interleaved) in the requested format */
+static AVFrame* bench_pcm_frame(AVSampleFormat format, int sample_rate, int nb_samples)
+{
+	static vector<uint8_t> pcm = bench_load_file("capture.pcm");
+	AVFrame *frame = AudioBufferPool::audioPoolDefault()->audioPoolGetFrame(AV_CH_LAYOUT_STEREO, format, nb_samples);
+	if (!frame)
+		return NULL;
+	frame->sample_rate = sample_rate;
+	const int16_t *src = (const int16_t *)pcm.data();
+	int total = (int)(pcm.size() / 2);
+	for (int i = 0; i < nb_samples * 2; i++) {
+		int16_t v = total ? src[i % total] : 0;
+		switch (format) {
+		case AV_SAMPLE_FMT_S16:
+			((int16_t *)frame->data[0])[i] = v;
+			break;
+		case AV_SAMPLE_FMT_FLTP:
+			((float *)frame->data[i & 1])[i >> 1] = v / 32768.0f;
+			break;
+		case AV_SAMPLE_FMT_S16P:
+			((int16_t *)frame->data[i & 1])[i >> 1] = v;
+			break;
+		default:
+			((float *)frame->data[0])[i] = v / 32768.0f;
+			break;
+		}
+	}
+	return frame;
+}
+
+/////////////////////////// cases ///////////////////////////////////////////////////////////////////
+static void bench_capture()
+{
+	bench_register("capture/repacketize/s16le_file", [](double *frame_seconds, string *skip) -> BenchStep {
+		shared_ptr<AudioCapture> capture(new AudioCapture("capture.pcm", "s16le"),
+			[](AudioCapture *c) { c->audioDeinit(); delete c; });
+		capture->audioSetDeviceOption("sample_rate", "44100");
+		capture->audioSetDeviceOption("channels", "2");
+		capture->audioSetLoop(1);
+		if (capture->audioInit(AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, 1024) < 0) {
+			*skip = "capture.pcm not found";
+			return BenchStep();
+		}
+		*frame_seconds = 1024.0 / 44100;
+		return [capture]() {
+			AVFrame *frame = NULL;
+			return capture->audioCaptureFrame(&frame);
+		};
+	});
+}
+
+static void bench_resample()
+{
+	static const int rates[][2] = { { 44100, 44100 }, { 44100, 48000 }, { 48000, 44100 }, { 48000, 16000 } };
+	static const AVSampleFormat formats[][2] = {
+		{ AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLTP }, { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16 }
+	};
+	for (int f = 0; f < 2; f++) {
+		for (int r = 0; r < 4; r++) {
+			AVSampleFormat src_fmt = formats[f][0], dst_fmt = formats[f][1];
+			int src_rate = rates[r][0], dst_rate = rates[r][1];
+			char name[128];
+			snprintf(name, sizeof(name), "resample/%s_to_%s/%d_to_%d", av_get_sample_fmt_name(src_fmt),
+				av_get_sample_fmt_name(dst_fmt), src_rate, dst_rate);
+			bench_register(name, [=](double *frame_seconds, string *skip) -> BenchStep {
+				shared_ptr<AudioSample> sample(new AudioSample(src_rate, src_fmt, AV_CH_LAYOUT_STEREO,
+					dst_rate, dst_fmt, AV_CH_LAYOUT_STEREO));
+				shared_ptr<AVFrame> frame(bench_pcm_frame(src_fmt, src_rate, 1024),
+					[](AVFrame *f) { av_frame_free(&f); });
+				if (sample->audioSampleInit() < 0 || !frame) {
+					*skip = "resampler init failed";
+					return BenchStep();
+				}
+				*frame_seconds = 1024.0 / src_rate;
+				return [sample, frame]() {
+					AVFrame *out = NULL;
+					return sample->audioSampleConvert(frame.get(), &out);
+				};
+			});
+		}
+	}
+}
+
+struct EncodeCase { const char *label; const char *encoder; int profile; int bitrate; int rate; const char *frameMs; };
+
+static const EncodeCase* bench_encode_cases()
+{
+	static const EncodeCase cases[] = {
+		{ "aac_lc", "aac", FF_PROFILE_AAC_LOW, 32000, 44100, NULL },
+		{ "aac_lc", "aac", FF_PROFILE_AAC_LOW, 64000, 44100, NULL },
+		{ "aac_lc", "aac", FF_PROFILE_AAC_LOW, 128000, 44100, NULL },
+		// the native aac encoder has no SBR, HE-AAC needs an ffmpeg built with libfdk_aac
+		{ "he_aac", "libfdk_aac", FF_PROFILE_AAC_HE, 32000, 44100, NULL },
+		{ "he_aac", "libfdk_aac", FF_PROFILE_AAC_HE, 64000, 44100, NULL },
+		{ "opus_20ms", "libopus", FF_PROFILE_UNKNOWN, 32000, 48000, "20" },
+		{ "opus_10ms", "libopus", FF_PROFILE_UNKNOWN, 32000, 48000, "10" },
+		{ NULL, NULL, 0, 0, 0, NULL },
+	};
+	return cases;
+}
+
+/* stereo encoder of the case in its first sample format, NULL with skip set when it is not there */
+static AudioEncode* bench_open_encoder(const EncodeCase &c, string *skip)
+{
+	AVCodec *codec = avcodec_find_encoder_by_name(c.encoder);
+	if (!codec) {
+		*skip = string("encoder ") + c.encoder + " not available";
+		return NULL;
+	}
+	AVSampleFormat format = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+	AudioEncode *encode = new AudioEncode(c.encoder);
+	if (c.frameMs) {
+		encode->audioEncodeSetOption("frame_duration", c.frameMs);
+		encode->audioEncodeSetOption("application", "lowdelay");
+	}
+	if (encode->audioEncodeInit(format, AV_CH_LAYOUT_STEREO, c.rate, c.bitrate, c.profile) < 0) {
+		*skip = "encoder open failed";
+		delete encode;
+		return NULL;
+	}
+	return encode;
+}
+
+/* algorithmic delay of every encode case: what a conference hears on top of the network, the frame the
+** encoder waits for plus its lookahead. printed apart, it is a property of the codec, not a timing */
+static void bench_latency()
+{
+	const EncodeCase *cases = bench_encode_cases();
+	printf("%-48s %10s %12s %14s\n", "Codec latency", "frame ms", "lookahead ms", "algorithmic ms");
+	for (int i = 0; cases[i].label; i++) {
+		const EncodeCase &c = cases[i];
+		char name[128];
+		snprintf(name, sizeof(name), "latency/%s/%dk", c.label, c.bitrate / 1000);
+		string skip;
+		AudioEncode *encode = bench_open_encoder(c, &skip);
+		if (!encode) {
+			printf("%-48s %s\n", name, ("SKIPPED: " + skip).c_str());
+			continue;
+		}
+		AVCodecContext *ctx = encode->audioEncodeGetContext();
+		double ms = 1000.0 / ctx->sample_rate;
+		printf("%-48s %10.1f %12.1f %14.1f\n", name, ctx->frame_size * ms, encode->audioEncodeGetPriming() * ms,
+			encode->audioEncodeGetDelay() * ms);
+		delete encode;
+	}
+	printf("\n");
+}
+
+static void bench_encode()
+{
+	const EncodeCase *cases = bench_encode_cases();
+	for (int i = 0; cases[i].label; i++) {
+		EncodeCase c = cases[i];
+		char name[128];
+		snprintf(name, sizeof(name), "encode/%s/%dk", c.label, c.bitrate / 1000);
+		bench_register(name, [c](double *frame_seconds, string *skip) -> BenchStep {
+			shared_ptr<AudioEncode> encode(bench_open_encoder(c, skip));
+			if (!encode)
+				return BenchStep();
+			AVFrame *tmp = encode->audioEncodeGetFrame();
+			int nb_samples = tmp ? tmp->nb_samples : 1024;
+			AVSampleFormat format = tmp ? (AVSampleFormat)tmp->format : AV_SAMPLE_FMT_FLTP;
+			av_frame_free(&tmp);
+			shared_ptr<AVFrame> frame(bench_pcm_frame(format, c.rate, nb_samples),
+				[](AVFrame *f) { av_frame_free(&f); });
+			shared_ptr<int64_t> pts(new int64_t(0));
+			*frame_seconds = (double)nb_samples / c.rate;
+			return [encode, frame, pts, nb_samples]() {
+				AVPacket *packet = NULL;
+				frame->pts = *pts;
+				*pts += nb_samples;
+				int ret = encode->audioEncode(frame.get(), &packet);
+				return ret == AVERROR(EAGAIN) ? 0 : ret;
+			};
+		});
+	}
+}
+
+/* encode.aac split into packets that reference one buffer */
+static shared_ptr<vector<AVPacket *> > bench_adts_packets(int *sample_rate)
+{
+	vector<uint8_t> file = bench_load_file("encode.aac");
+	shared_ptr<vector<AVPacket *> > packets(new vector<AVPacket *>, [](vector<AVPacket *> *v) {
+		for (size_t i = 0; i < v->size(); i++)
+			av_packet_free(&(*v)[i]);
+		delete v;
+	});
+	AVBufferRef *buf = av_buffer_alloc((int)file.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+	if (!buf)
+		return packets;
+	memcpy(buf->data, file.data(), file.size());
+	AdtsHeader header;
+	for (size_t pos = 0; pos + ADTS_HEADER_SIZE <= file.size(); pos += header.frameLen) {
+		if (adtsParseHeader(&file[pos], (int)(file.size() - pos), &header) < 0 || pos + header.frameLen > file.size())
+			break;
+		AVPacket *packet = av_packet_alloc();
+		packet->buf = av_buffer_ref(buf);
+		packet->data = buf->data + pos;
+		packet->size = header.frameLen;
+		packets->push_back(packet);
+		*sample_rate = header.sampleRate;
+	}
+	av_buffer_unref(&buf);
+	return packets;
+}
+
+static void bench_adts()
+{
+	bench_register("adts/packetAddHeader", [](double *frame_seconds, string *skip) -> BenchStep {
+		shared_ptr<AudioEncode> encode(new AudioEncode("aac"));
+		if (encode->audioEncodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 44100, 128000, FF_PROFILE_AAC_LOW) < 0) {
+			*skip = "encoder open failed";
+			return BenchStep();
+		}
+		shared_ptr<vector<char> > header(new vector<char>(ADTS_HEADER_SIZE));
+		*frame_seconds = 1024.0 / 44100;
+		return [encode, header]() {
+			return encode->packetAddHeader(header->data(), 371);
+		};
+	});
+	bench_register("adts/parse/encode.aac", [](double *frame_seconds, string *skip) -> BenchStep {
+		shared_ptr<vector<uint8_t> > file(new vector<uint8_t>(bench_load_file("encode.aac")));
+		if (file->size() < ADTS_HEADER_SIZE) {
+			*skip = "encode.aac not found";
+			return BenchStep();
+		}
+		shared_ptr<size_t> pos(new size_t(0));
+		*frame_seconds = 1024.0 / 44100;
+		return [file, pos]() {
+			AdtsHeader header;
+			if (*pos + ADTS_HEADER_SIZE > file->size())
+				*pos = 0;
+			if (adtsParseHeader(file->data() + *pos, (int)(file->size() - *pos), &header) < 0)
+				return -1;
+			*pos += header.frameLen;
+			return 0;
+		};
+	});
+}
+
+/* encode.aac to interleaved s16 the way playout needs it: the float decoder through swr (AudioSample), the
+** float decoder with the interleave kernel, aac_fixed with the interleave kernel */
+static shared_ptr<AudioDecode> bench_open_s16_decoder(int fixed, int sample_rate)
+{
+	shared_ptr<AudioDecode> decode(new AudioDecode("aac", 0));
+	decode->audioDecodeSetFixed(fixed);
+	if (decode->AudioDecodeInit(AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO, sample_rate, 0, FF_PROFILE_AAC_LOW) < 0)
+		return shared_ptr<AudioDecode>();
+	return decode;
+}
+
+/* output error of aac_fixed against the float decoder over the whole of encode.aac, both to s16 */
+static void bench_fixed_error()
+{
+	int sample_rate = 44100;
+	shared_ptr<vector<AVPacket *> > packets = bench_adts_packets(&sample_rate);
+	shared_ptr<AudioDecode> ref = bench_open_s16_decoder(0, sample_rate);
+	shared_ptr<AudioDecode> fixed = bench_open_s16_decoder(1, sample_rate);
+	const char *name = "error/aac_fixed_vs_float/encode.aac";
+	printf("%-48s %10s %12s %14s\n", "Decoder error", "samples", "max lsb", "snr dB");
+	if (packets->empty() || !ref || !fixed) {
+		printf("%-48s %s\n\n", name, "SKIPPED: encode.aac not found or decoder open failed");
+		return;
+	}
+	int64_t samples = 0;
+	int max_diff = 0;
+	double signal = 0, noise = 0;
+	for (size_t i = 0; i < packets->size(); i++) {
+		AVFrame *a = NULL, *b = NULL;
+		if (ref->audioDecodePacket((*packets)[i], &a) < 0 || fixed->audioDecodePacket((*packets)[i], &b) < 0)
+			continue;
+		int n = FFMIN(a->nb_samples, b->nb_samples) * a->channels;
+		const int16_t *x = (const int16_t *)a->data[0], *y = (const int16_t *)b->data[0];
+		for (int k = 0; k < n; k++) {
+			int d = x[k] - y[k];
+			max_diff = FFMAX(max_diff, FFABS(d));
+			signal += (double)x[k] * x[k];
+			noise += (double)d * d;
+		}
+		samples += n;
+	}
+	printf("%-48s %10lld %12d %14.1f\n\n", name, (long long)samples, max_diff,
+		noise > 0 ? 10 * log10(signal / noise) : 999.0);
+}
+
+static void bench_decode()
+{
+	for (int path = 0; path < 3; path++) {
+		static const char *paths[] = { "float_swr", "float", "fixed" };
+		char name[128];
+		snprintf(name, sizeof(name), "decode/aac_to_s16/%s/encode.aac", paths[path]);
+		bench_register(name, [path](double *frame_seconds, string *skip) -> BenchStep {
+			int sample_rate = 44100;
+			shared_ptr<vector<AVPacket *> > packets = bench_adts_packets(&sample_rate);
+			shared_ptr<AudioDecode> decode;
+			shared_ptr<AudioSample> sample;
+			if (path == 0) {
+				decode.reset(new AudioDecode("aac", 0));
+				sample.reset(new AudioSample(sample_rate, AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO,
+					sample_rate, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO));
+				if (decode->AudioDecodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, sample_rate, 0, FF_PROFILE_AAC_LOW) < 0 ||
+					sample->audioSampleInit() < 0)
+					decode.reset();
+			} else {
+				decode = bench_open_s16_decoder(path == 2, sample_rate);
+			}
+			if (packets->empty() || !decode) {
+				*skip = "encode.aac not found or decoder open failed";
+				return BenchStep();
+			}
+			shared_ptr<size_t> index(new size_t(0));
+			*frame_seconds = 1024.0 / sample_rate;
+			return [decode, sample, packets, index]() {
+				AVFrame *frame = NULL;
+				AVPacket *packet = (*packets)[*index];
+				*index = (*index + 1) % packets->size();
+				int ret = decode->audioDecodePacket(packet, &frame);
+				if (ret == 0 && sample)
+					ret = sample->audioSampleConvert(frame, &frame);
+				return ret == AVERROR(EAGAIN) ? 0 : ret;
+			};
+		});
+	}
+
+	bench_register("decode/aac/encode.aac", [](double *frame_seconds, string *skip) -> BenchStep {
+		int sample_rate = 44100;
+		shared_ptr<vector<AVPacket *> > packets = bench_adts_packets(&sample_rate);
+		shared_ptr<AudioDecode> decode(new AudioDecode("aac", 0));
+		if (packets->empty() ||
+			decode->AudioDecodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, sample_rate, 0, FF_PROFILE_AAC_LOW) < 0) {
+			*skip = "encode.aac not found or decoder open failed";
+			return BenchStep();
+		}
+		shared_ptr<size_t> index(new size_t(0));
+		*frame_seconds = 1024.0 / sample_rate;
+		return [decode, packets, index]() {
+			AVFrame *frame = NULL;
+			AVPacket *packet = (*packets)[*index];
+			*index = (*index + 1) % packets->size();
+			int ret = decode->audioDecodePacket(packet, &frame);
+			return ret == AVERROR(EAGAIN) ? 0 : ret;
+		};
+	});
+}
+
+static void bench_meter()
+{
+	// what AudioSample / AudioCapture pay per frame once a meter is set, compare with resample/ to see the overhead
+	static const AVSampleFormat formats[] = { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16 };
+	for (int f = 0; f < 2; f++) {
+		AVSampleFormat format = formats[f];
+		char name[128];
+		snprintf(name, sizeof(name), "meter/levels/%s/44100", av_get_sample_fmt_name(format));
+		bench_register(name, [format](double *frame_seconds, string *skip) -> BenchStep {
+			shared_ptr<AudioLevelMeter> meter(new AudioLevelMeter());
+			meter->audioMeterSetInterval(100);
+			shared_ptr<AVFrame> frame(bench_pcm_frame(format, 44100, 1024), [](AVFrame *f) { av_frame_free(&f); });
+			if (!frame) {
+				*skip = "frame alloc failed";
+				return BenchStep();
+			}
+			*frame_seconds = 1024.0 / 44100;
+			return [meter, frame]() {
+				meter->audioMeterFrame(frame.get());
+				return 0;
+			};
+		});
+	}
+	// the r128 tap on the encoder input: k-weighting, blocks and gating histograms, 4x true peak
+	bench_register("meter/r128/fltp/44100", [](double *frame_seconds, string *skip) -> BenchStep {
+		shared_ptr<AudioLoudness> loudness(new AudioLoudness());
+		shared_ptr<AVFrame> frame(bench_pcm_frame(AV_SAMPLE_FMT_FLTP, 44100, 1024), [](AVFrame *f) { av_frame_free(&f); });
+		if (!frame || loudness->audioLoudnessInit(44100, AV_CH_LAYOUT_STEREO) < 0) {
+			*skip = "loudness init failed";
+			return BenchStep();
+		}
+		*frame_seconds = 1024.0 / 44100;
+		return [loudness, frame]() {
+			return loudness->audioLoudnessFrame(frame.get());
+		};
+	});
+}
+
+static void bench_remix()
+{
+	// the AudioRemix matrices against the swr rematrix on the same fltp frames, no resampling
+	static const struct { const char *name; uint64_t in, out; } pairs[] = {
+		{ "5.1_to_stereo", AV_CH_LAYOUT_5POINT1, AV_CH_LAYOUT_STEREO },
+		{ "stereo_to_mono", AV_CH_LAYOUT_STEREO, AV_CH_LAYOUT_MONO },
+	};
+	for (int p = 0; p < 2; p++) {
+		uint64_t in_layout = pairs[p].in, out_layout = pairs[p].out;
+		for (int use_swr = 0; use_swr < 2; use_swr++) {
+			char name[128];
+			snprintf(name, sizeof(name), "remix/%s/%s/48000", use_swr ? "swr" : "simd", pairs[p].name);
+			bench_register(name, [in_layout, out_layout, use_swr](double *frame_seconds, string *skip) -> BenchStep {
+				AudioBufferPool *pool = AudioBufferPool::audioPoolDefault();
+				shared_ptr<AVFrame> stereo(bench_pcm_frame(AV_SAMPLE_FMT_FLTP, 48000, 1024),
+					[](AVFrame *f) { av_frame_free(&f); });
+				shared_ptr<AVFrame> in(pool->audioPoolGetFrame(in_layout, AV_SAMPLE_FMT_FLTP, 1024),
+					[](AVFrame *f) { av_frame_free(&f); });
+				shared_ptr<AVFrame> out(pool->audioPoolGetFrame(out_layout, AV_SAMPLE_FMT_FLTP, 1024),
+					[](AVFrame *f) { av_frame_free(&f); });
+				if (!stereo || !in || !out) {
+					*skip = "frame alloc failed";
+					return BenchStep();
+				}
+				for (int c = 0; c < in->channels; c++)
+					memcpy(in->data[c], stereo->data[c & 1], 1024 * sizeof(float));
+				in->sample_rate = 48000;
+				*frame_seconds = 1024.0 / 48000;
+				if (use_swr) {
+					shared_ptr<SwrContext> swr(swr_alloc_set_opts(NULL, out_layout, AV_SAMPLE_FMT_FLTP, 48000,
+						in_layout, AV_SAMPLE_FMT_FLTP, 48000, 0, NULL), [](SwrContext *s) { swr_free(&s); });
+					if (!swr || swr_init(swr.get()) < 0) {
+						*skip = "swr init failed";
+						return BenchStep();
+					}
+					return [swr, in, out]() {
+						return swr_convert(swr.get(), out->extended_data, 1024, (const uint8_t **)in->extended_data, 1024);
+					};
+				}
+				shared_ptr<AudioRemix> remix(new AudioRemix());
+				if (remix->audioRemixInit(in_layout, out_layout) < 0) {
+					*skip = "remix init failed";
+					return BenchStep();
+				}
+				return [remix, in, out]() {
+					remix->audioRemixPlanes((float *const *)out->extended_data, (const float *const *)in->extended_data, 1024);
+					return 0;
+				};
+			});
+		}
+	}
+}
+
+static void bench_dtx()
+{
+	// capture frame -> gate -> resample -> aac: voice frames pay the full path, silent ones the detector
+	for (int silent = 0; silent < 2; silent++) {
+		char name[128];
+		snprintf(name, sizeof(name), "dtx/aac_lc/%s/44100", silent ? "silence" : "voice");
+		bench_register(name, [silent](double *frame_seconds, string *skip) -> BenchStep {
+			shared_ptr<AudioSample> sample(new AudioSample(44100, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO,
+				44100, AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO));
+			shared_ptr<AudioEncode> encode(new AudioEncode("aac"));
+			shared_ptr<AudioDtx> dtx(new AudioDtx());
+			shared_ptr<AVFrame> frame(bench_pcm_frame(AV_SAMPLE_FMT_S16, 44100, 1024),
+				[](AVFrame *f) { av_frame_free(&f); });
+			if (!frame || sample->audioSampleInit() < 0 ||
+				encode->audioEncodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 44100, 64000, FF_PROFILE_AAC_LOW) < 0 ||
+				dtx->audioDtxInit(sample.get(), encode.get()) < 0) {
+				*skip = "dtx init failed";
+				return BenchStep();
+			}
+			if (silent)
+				memset(frame->data[0], 0, 1024 * 4);
+			shared_ptr<int64_t> pts(new int64_t(0));
+			*frame_seconds = 1024.0 / 44100;
+			return [sample, encode, dtx, frame, pts]() {
+				AVPacket *packet = NULL;
+				frame->pts = *pts;
+				*pts += 1024;
+				int ret = dtx->audioDtxEncode(frame.get(), &packet);
+				while (ret == 0)
+					ret = dtx->audioDtxReceive(&packet);
+				return ret == AVERROR(EAGAIN) ? 0 : ret;
+			};
+		});
+	}
+}
+
+static AVFrame* bench_mono_frame(int sample_rate, int nb_samples)
+{
+	AVFrame *stereo = bench_pcm_frame(AV_SAMPLE_FMT_S16, sample_rate, nb_samples);
+	AVFrame *mono = AudioBufferPool::audioPoolDefault()->audioPoolGetFrame(AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_S16, nb_samples);
+	if (stereo && mono) {
+		for (int i = 0; i < nb_samples; i++)
+			((int16_t *)mono->data[0])[i] = ((const int16_t *)stereo->data[0])[2 * i];
+		mono->sample_rate = sample_rate;
+	}
+	av_frame_free(&stereo);
+	return mono;
+}
+
+static void bench_g711()
+{
+	// 20 ms of 8 kHz mono per step: the lookup tables against libavcodec's pcm_mulaw / pcm_alaw
+	for (int law = 0; law < 2; law++) {
+		for (int lavc = 0; lavc < 2; lavc++) {
+			char name[128];
+			snprintf(name, sizeof(name), "g711/%s/encode/%s", law ? "alaw" : "ulaw", lavc ? "libavcodec" : "table");
+			bench_register(name, [law, lavc](double *frame_seconds, string *skip) -> BenchStep {
+				shared_ptr<AVFrame> frame(bench_mono_frame(8000, 160), [](AVFrame *f) { av_frame_free(&f); });
+				if (!frame) {
+					*skip = "frame alloc failed";
+					return BenchStep();
+				}
+				*frame_seconds = 160.0 / 8000;
+				if (lavc) {
+					AVCodec *codec = avcodec_find_encoder(law ? AV_CODEC_ID_PCM_ALAW : AV_CODEC_ID_PCM_MULAW);
+					shared_ptr<AVCodecContext> ctx(codec ? avcodec_alloc_context3(codec) : NULL,
+						[](AVCodecContext *c) { avcodec_free_context(&c); });
+					shared_ptr<AVPacket> packet(av_packet_alloc(), [](AVPacket *p) { av_packet_free(&p); });
+					if (!ctx || !packet) {
+						*skip = "no pcm g711 encoder";
+						return BenchStep();
+					}
+					ctx->sample_fmt = AV_SAMPLE_FMT_S16;
+					ctx->sample_rate = 8000;
+					ctx->channel_layout = AV_CH_LAYOUT_MONO;
+					ctx->channels = 1;
+					if (avcodec_open2(ctx.get(), codec, NULL) < 0) {
+						*skip = "pcm g711 encoder open failed";
+						return BenchStep();
+					}
+					return [ctx, packet, frame]() {
+						int ret = avcodec_send_frame(ctx.get(), frame.get());
+						if (ret == 0)
+							ret = avcodec_receive_packet(ctx.get(), packet.get());
+						av_packet_unref(packet.get());
+						return ret;
+					};
+				}
+				shared_ptr<AudioG711> g711(new AudioG711(law ? AUDIO_G711_ALAW : AUDIO_G711_ULAW));
+				return [g711, frame]() {
+					AVPacket *packet = NULL;
+					return g711->audioG711Encode(frame.get(), &packet);
+				};
+			});
+		}
+	}
+
+	// one telephony leg for 20 ms, both directions: 48k s16 capture -> AudioSample (AudioDecimator) -> 8k
+	// -> ulaw, and ulaw -> 8k -> 48k. x realtime reads as the legs one core carries
+	bench_register("g711/session/ulaw_duplex/48000", [](double *frame_seconds, string *skip) -> BenchStep {
+		shared_ptr<AudioSample> down(new AudioSample(48000, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_MONO,
+			8000, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_MONO));
+		shared_ptr<AudioSample> up(new AudioSample(8000, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_MONO,
+			48000, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_MONO));
+		shared_ptr<AudioG711> enc(new AudioG711(AUDIO_G711_ULAW));
+		shared_ptr<AudioG711> dec(new AudioG711(AUDIO_G711_ULAW));
+		shared_ptr<AVFrame> frame(bench_mono_frame(48000, 960), [](AVFrame *f) { av_frame_free(&f); });
+		if (!frame || down->audioSampleInit() < 0 || up->audioSampleInit() < 0) {
+			*skip = "session init failed";
+			return BenchStep();
+		}
+		*frame_seconds = 960.0 / 48000;
+		return [down, up, enc, dec, frame]() {
+			AVFrame *narrow = NULL, *wide = NULL;
+			AVPacket *packet = NULL;
+			if (down->audioSampleConvert(frame.get(), &narrow) < 0 || enc->audioG711Encode(narrow, &packet) < 0)
+				return -1;
+			if (dec->audioG711Decode(packet, &narrow) < 0)
+				return -1;
+			return up->audioSampleConvert(narrow, &wide);
+		};
+	});
+}
+
+static void bench_mix()
+{
+	// one step mixes one output frame: a frame pushed into each input, summed, soft clipped
+	static const int inputs[] = { 8, 64 };
+	for (int i = 0; i < 2; i++) {
+		int n = inputs[i];
+		char name[128];
+		snprintf(name, sizeof(name), "mix/%dx_stereo_fltp/48000", n);
+		bench_register(name, [n](double *frame_seconds, string *skip) -> BenchStep {
+			shared_ptr<AudioMixer> mixer(new AudioMixer());
+			shared_ptr<AVFrame> frame(bench_pcm_frame(AV_SAMPLE_FMT_FLTP, 48000, 1024),
+				[](AVFrame *f) { av_frame_free(&f); });
+			if (!frame || mixer->audioMixerInit(48000, AV_CH_LAYOUT_STEREO) < 0) {
+				*skip = "mixer init failed";
+				return BenchStep();
+			}
+			for (int k = 0; k < n; k++)
+				mixer->audioMixerAddStream(48000, AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 1.0f / n);
+			*frame_seconds = 1024.0 / 48000;
+			return [mixer, frame, n]() {
+				for (int k = 0; k < n; k++) {
+					if (mixer->audioMixerPush(k, frame.get()) < 0)
+						return -1;
+				}
+				AVFrame *out = NULL;
+				return mixer->audioMixerMix(&out);
+			};
+		});
+	}
+}
+
+/////////////////////////// runner //////////////////////////////////////////////////////////////////
+static double bench_now()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* one timed session of bench_startup(): start time, and with the pool on the teardown and the misses */
+static void bench_startup_account(AudioCodecPool *pool, const AudioCodecPoolStats *before, int warm, double start_us,
+	double end_us, double *total_us, double *total_end_us, int64_t *total_misses)
+{
+	*total_us += start_us;
+	if (!warm)
+		return;
+	AudioCodecPoolStats after;
+	pool->audioCodecPoolGetStats(&after);
+	*total_end_us += end_us;
+	*total_misses += after.misses - before->misses;
+}
+
+/* session start: construct + open of an encoder (and the aac decoder), every open a cold avcodec_open2()
+** against a context waiting in AudioCodecPool. the destruction is timed apart (warm end us): an encoder
+** that cannot flush is reopened by the pool's refill thread, a session starting before that finished is
+** a miss and pays the cold open. printed apart like the latency table, in us per session */
+static void bench_startup()
+{
+	const int sessions = 20;
+	AudioCodecPool *pool = AudioCodecPool::audioCodecPoolDefault();
+	const EncodeCase *cases = bench_encode_cases();
+	// warm end us: the session teardown with the pool on (the context goes back, an encoder that cannot
+	// flush is freed and queued for the refill thread). warm misses: warm starts that found no idle
+	// context because the refill of the previous session's encoder had not finished yet
+	printf("%-48s %10s %12s %14s %14s %12s\n", "Session startup", "sessions", "cold us", "warm us", "warm end us",
+		"warm misses");
+	for (int i = 0; cases[i].label; i++) {
+		const EncodeCase c = cases[i];
+		char name[128];
+		snprintf(name, sizeof(name), "startup/%s/%dk", c.label, c.bitrate / 1000);
+		AVCodec *codec = avcodec_find_encoder_by_name(c.encoder);
+		if (!codec) {
+			printf("%-48s %s\n", name, (string("SKIPPED: encoder ") + c.encoder + " not available").c_str());
+			continue;
+		}
+		AVSampleFormat format = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+		double us[2] = { 0, 0 }, end_us = 0;
+		int64_t misses = 0;
+		int ok = 1;
+		for (int warm = 0; warm < 2 && ok; warm++) {
+			pool->audioCodecPoolSetMaxIdle(warm ? 4 : 0);
+			// the first session of a run is cold either way, its context primes the pool for the warm ones
+			for (int k = -1; k < sessions && ok; k++) {
+				AudioCodecPoolStats before;
+				pool->audioCodecPoolGetStats(&before);
+				double start = bench_now();
+				AudioEncode *encode = new AudioEncode(c.encoder);
+				if (c.frameMs) {
+					encode->audioEncodeSetOption("frame_duration", c.frameMs);
+					encode->audioEncodeSetOption("application", "lowdelay");
+				}
+				ok = encode->audioEncodeInit(format, AV_CH_LAYOUT_STEREO, c.rate, c.bitrate, c.profile) == 0;
+				double end = bench_now();
+				delete encode;
+				if (k >= 0)
+					bench_startup_account(pool, &before, warm, (end - start) * 1e6, (bench_now() - end) * 1e6,
+						&us[warm], &end_us, &misses);
+			}
+		}
+		if (ok)
+			printf("%-48s %10d %12.0f %14.0f %14.0f %12lld\n", name, sessions, us[0] / sessions, us[1] / sessions,
+				end_us / sessions, (long long)misses);
+		else
+			printf("%-48s %s\n", name, "SKIPPED: encoder open failed");
+	}
+	double us[2] = { 0, 0 }, end_us = 0;
+	int64_t misses = 0;
+	int ok = 1;
+	for (int warm = 0; warm < 2 && ok; warm++) {
+		pool->audioCodecPoolSetMaxIdle(warm ? 4 : 0);
+		for (int k = -1; k < sessions && ok; k++) {
+			AudioCodecPoolStats before;
+			pool->audioCodecPoolGetStats(&before);
+			double start = bench_now();
+			AudioDecode *decode = new AudioDecode("aac", 0);
+			ok = decode->AudioDecodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 44100, 0, FF_PROFILE_AAC_LOW) == 0;
+			double end = bench_now();
+			delete decode;
+			if (k >= 0)
+				bench_startup_account(pool, &before, warm, (end - start) * 1e6, (bench_now() - end) * 1e6,
+					&us[warm], &end_us, &misses);
+		}
+	}
+	if (ok)
+		printf("%-48s %10d %12.0f %14.0f %14.0f %12lld\n", "startup/aac_decoder", sessions, us[0] / sessions,
+			us[1] / sessions, end_us / sessions, (long long)misses);
+	else
+		printf("%-48s %s\n", "startup/aac_decoder", "SKIPPED: decoder open failed");
+	pool->audioCodecPoolSetMaxIdle(4);
+	printf("\n");
+}
+
+/* what the pooled real-time path (capture -> resample -> encode, decode of encode.aac) still allocates per
+** frame in steady state: every AudioBufferPool get av_mallocs its AVBufferRef, a pool miss av_mallocs the
+** payload too, and every encoder packet is allocated inside libavcodec (payload + ref). audio_alloc_check
+** counts the same thing call site by call site */
+static void bench_allocs()
+{
+	const int warmup = 100, frames = 1000;
+	printf("%-48s %10s %12s %14s\n", "Steady state allocations", "frames", "pool allocs", "lavc packets");
+	AudioCapture capture("capture.pcm", "s16le");
+	capture.audioSetDeviceOption("sample_rate", "44100");
+	capture.audioSetDeviceOption("channels", "2");
+	capture.audioSetLoop(1);
+	AudioSample sample(44100, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO, 44100, AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO);
+	AudioEncode encode("aac");
+	AudioDecode decode("aac", 0);
+	int sample_rate = 44100;
+	shared_ptr<vector<AVPacket *> > packets = bench_adts_packets(&sample_rate);
+	if (packets->empty() || capture.audioInit(AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, 1024) < 0 ||
+		sample.audioSampleInit() < 0 ||
+		encode.audioEncodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 44100, 128000, FF_PROFILE_AAC_LOW) < 0 ||
+		decode.AudioDecodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, sample_rate, 0, FF_PROFILE_AAC_LOW) < 0) {
+		printf("%-48s %s\n\n", "allocs/capture_resample_encode_decode", "SKIPPED: fixtures not found or codec open failed");
+		capture.audioDeinit();
+		return;
+	}
+	AudioBufferPool *pool = AudioBufferPool::audioPoolDefault();
+	AudioPoolStats before, after;
+	int64_t lavc_packets = 0;
+	for (int i = 0; i < warmup + frames; i++) {
+		if (i == warmup)
+			pool->audioPoolGetStats(&before);
+		AVFrame *frame = NULL, *resample_frame = NULL, *dec_frame = NULL;
+		AVPacket *packet = NULL;
+		if (capture.audioCaptureFrame(&frame) < 0 || sample.audioSampleConvert(frame, &resample_frame) < 0)
+			break;
+		if (encode.audioEncode(resample_frame, &packet) == 0 && i >= warmup)
+			lavc_packets++;
+		decode.audioDecodePacket((*packets)[i % packets->size()], &dec_frame);
+	}
+	pool->audioPoolGetStats(&after);
+	capture.audioDeinit();
+	// a get is one AVBufferRef, a miss one more payload buffer on top
+	int64_t allocs = (after.gets - before.gets) + (after.misses - before.misses);
+	printf("%-48s %10d %12.2f %14.2f\n\n", "allocs/capture_resample_encode_decode", frames,
+		(double)allocs / frames, (double)lavc_packets / frames);
+}
+
+static BenchResult bench_run(BenchCase &c, double min_time)
+{
+	BenchResult result;
+	result.name = c.name;
+	result.frames = 0;
+	result.nsPerFrame = 0;
+	result.realtime = 0;
+	double frame_seconds = 0;
+	BenchStep step = c.setup(&frame_seconds, &result.skip);
+	av_log_set_level(AV_LOG_QUIET);   // AudioCapture::audioInit() turns debug logging on
+	if (!step)
+		return result;
+	for (int i = 0; i < 16; i++) {   // warm up caches, pools and codec state
+		if (step() < 0) {
+			result.skip = "step failed during warm-up";
+			return result;
+		}
+	}
+	// grow the batch until one batch takes min_time, like google benchmark's iteration estimate
+	int64_t batch = 16;
+	double elapsed = 0;
+	while (1) {
+		double start = bench_now();
+		for (int64_t i = 0; i < batch; i++) {
+			if (step() < 0) {
+				result.skip = "step failed";
+				return result;
+			}
+		}
+		elapsed = bench_now() - start;
+		if (elapsed >= min_time || batch >= ((int64_t)1 << 30))
+			break;
+		batch = elapsed > 0.01 ? (int64_t)(batch * min_time / elapsed * 1.1) + 1 : batch * 10;
+	}
+	result.frames = batch;
+	result.nsPerFrame = elapsed * 1e9 / batch;
+	result.realtime = frame_seconds * batch / elapsed;
+	return result;
+}
+
+static void bench_write_json(const char *file_name, const vector<BenchResult> &results, double min_time)
+{
+	FILE *fd = fopen(file_name, "w");
+	if (!fd) {
+		fprintf(stderr, "open %s fail.\n", file_name);
+		return;
+	}
+	char date[64];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	fprintf(fd, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"library_version\": \"%s\",\n"
+		"    \"min_time\": %g\n  },\n  \"benchmarks\": [\n", date, LIBAVCODEC_IDENT, min_time);
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult &r = results[i];
+		fprintf(fd, "    {\n      \"name\": \"%s\",\n      \"run_type\": \"iteration\",\n", r.name.c_str());
+		if (!r.skip.empty()) {
+			fprintf(fd, "      \"error_occurred\": true,\n      \"error_message\": \"%s\"\n", r.skip.c_str());
+		} else {
+			fprintf(fd, "      \"iterations\": %lld,\n      \"real_time\": %.1f,\n      \"cpu_time\": %.1f,\n"
+				"      \"time_unit\": \"ns\",\n      \"realtime_factor\": %.1f\n",
+				(long long)r.frames, r.nsPerFrame, r.nsPerFrame, r.realtime);
+		}
+		fprintf(fd, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(fd, "  ]\n}\n");
+	fclose(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filter = "";
+	const char *json = NULL;
+	double min_time = 0.5;
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "--filter=", 9))
+			filter = argv[i] + 9;
+		else if (!strncmp(argv[i], "--min_time=", 11))
+			min_time = atof(argv[i] + 11);
+		else if (!strncmp(argv[i], "--json=", 7))
+			json = argv[i] + 7;
+		else {
+			printf("usage: %s [--filter=substring] [--min_time=seconds] [--json=file]\n", argv[0]);
+			return 1;
+		}
+	}
+	av_log_set_level(AV_LOG_QUIET);
+	bench_capture();
+	bench_resample();
+	bench_encode();
+	bench_adts();
+	bench_decode();
+	bench_meter();
+	bench_mix();
+	bench_remix();
+	bench_dtx();
+	bench_g711();
+
+	// the latency table comes with a full run and with --filter=latency
+	if (!*filter || strstr(filter, "latency"))
+		bench_latency();
+	if (!*filter || strstr(filter, "fixed"))
+		bench_fixed_error();
+	if (!*filter || strstr(filter, "startup"))
+		bench_startup();
+	if (!*filter || strstr(filter, "allocs"))
+		bench_allocs();
+	vector<BenchResult> results;
+	printf("%-48s %14s %12s %14s\n", "Benchmark", "ns/frame", "frames", "x realtime");
+	for (size_t i = 0; i < bench_cases().size(); i++) {
+		BenchCase &c = bench_cases()[i];
+		if (!strstr(c.name.c_str(), filter))
+			continue;
+		BenchResult r = bench_run(c, min_time);
+		if (r.skip.empty())
+			printf("%-48s %14.0f %12lld %14.1f\n", r.name.c_str(), r.nsPerFrame, (long long)r.frames, r.realtime);
+		else
+			printf("%-48s %s\n", r.name.c_str(), ("SKIPPED: " + r.skip).c_str());
+		fflush(stdout);
+		results.push_back(r);
+	}
+	if (json)
+		bench_write_json(json, results, min_time);
+	return 0;
+}
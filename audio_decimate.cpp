@@ -0,0 +1,107 @@
+#include <math.h>
+#include <string.h>
+#include "audio_decimate.h"
+#include "audio_dsp.h"
+
+#define DECIMATE_TAPS_PER_STEP 48
+#define DECIMATE_KAISER_BETA   7.0
+
+static double bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+AudioDecimator::AudioDecimator()
+	:down_(1), ratio_(1), channels_(0), taps_(0), phase_(0), delay_(0)
+{
+}
+
+int AudioDecimator::audioDecimatorSupported(int srcRate, int dstRate)
+{
+	if (srcRate <= 0 || dstRate <= 0 || srcRate == dstRate)
+		return 0;
+	int hi = FFMAX(srcRate, dstRate), lo = FFMIN(srcRate, dstRate);
+	return hi % lo == 0 && hi / lo <= 6;
+}
+
+int AudioDecimator::audioDecimatorInit(int srcRate, int dstRate, int channels)
+{
+	if (!audioDecimatorSupported(srcRate, dstRate) || channels <= 0) {
+		av_log(NULL, AV_LOG_ERROR, "decimator: no integer ratio %d -> %d.\n", srcRate, dstRate);
+		return -1;
+	}
+	down_ = srcRate > dstRate;
+	ratio_ = down_ ? srcRate / dstRate : dstRate / srcRate;
+	channels_ = channels;
+	// low pass at the high rate: transition band of the kaiser window ends at the low rate's nyquist
+	int n = DECIMATE_TAPS_PER_STEP * ratio_ + (down_ ? 1 : 0);
+	double width = (70.0 - 8) / (14.36 * n);
+	double fc = 0.5 / ratio_ - width / 2;
+	vector<double> h(n);
+	double center = (n - 1) / 2.0, i0 = bessel_i0(DECIMATE_KAISER_BETA);
+	for (int i = 0; i < n; i++) {
+		double x = i - center;
+		double sinc = x == 0 ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+		double r = x / center;
+		h[i] = sinc * bessel_i0(DECIMATE_KAISER_BETA * sqrt(FFMAX(1 - r * r, 0.0))) / i0;
+	}
+	if (down_) {
+		// symmetric, no reversal needed
+		taps_ = n;
+		coef_.assign(h.begin(), h.end());
+		delay_ = (n - 1) / 2;
+	} else {
+		// phase p of output k*ratio_ + p: taps h[p + t * ratio_] on x[k - t], stored reversed so the
+		// dot product runs forward over the input, times ratio_ for the zeros that were stuffed in
+		taps_ = n / ratio_;
+		coef_.resize(n);
+		for (int p = 0; p < ratio_; p++)
+			for (int t = 0; t < taps_; t++)
+				coef_[p * taps_ + taps_ - 1 - t] = (float)(h[p + t * ratio_] * ratio_);
+		delay_ = (int)(center / ratio_);
+	}
+	history_.assign(channels_ * (taps_ - 1), 0);
+	phase_ = 0;
+	return 0;
+}
+
+int AudioDecimator::audioDecimatorOutSamples(int n) const
+{
+	return down_ ? (n + ratio_ - 1) / ratio_ : n * ratio_;
+}
+
+int AudioDecimator::audioDecimatorProcess(float *const *out, const float *const *in, int n)
+{
+	const AudioDsp *dsp = audioDspGet();
+	int keep = taps_ - 1, produced = 0;
+	scratch_.resize(keep + n);
+	float *x = scratch_.data();
+	for (int c = 0; c < channels_; c++) {
+		float *history = &history_[c * keep];
+		memcpy(x, history, keep * sizeof(float));
+		memcpy(x + keep, in[c], n * sizeof(float));
+		float *dst = out[c];
+		produced = 0;
+		if (down_) {
+			// output j ends at input phase_ + j * ratio_: taps_ samples back from there
+			for (int i = phase_; i < n; i += ratio_)
+				dst[produced++] = dsp->dot(coef_.data(), x + i, taps_);
+		} else {
+			for (int i = 0; i < n; i++) {
+				for (int p = 0; p < ratio_; p++)
+					dst[produced++] = dsp->dot(&coef_[p * taps_], x + i, taps_);
+			}
+		}
+		memcpy(history, x + n, keep * sizeof(float));
+	}
+	if (down_) {
+		int next = phase_ + produced * ratio_;
+		phase_ = next - n;
+	}
+	return produced;
+}
@@ -0,0 +1,38 @@
+#ifndef __AUDIO_DECIMATE__H_
+#define __AUDIO_DECIMATE__H_
+#include <vector>
+#include "audio_engine.h"
+
+/*
+** @brief AudioDecimator integer ratio rate change (2 .. 6: 48k / 16k <-> 8k, 48k <-> 16k) of planar float
+** audio with a kaiser windowed sinc fir, 48 taps per ratio step. going down only every M-th output is
+** computed, going up the filter is split into M phases of 48 taps: both are one AudioDsp dot product
+** (simd) per output sample, no swr state machine. the passband ends a few hundred Hz under the low
+** rate's nyquist (3.3 kHz at 8 kHz), the aliases are ~70 dB down.
+** AudioSample uses it for s16 / fltp when the layouts and the formats match and the ratio fits.
+*/
+class AudioDecimator {
+public:
+	AudioDecimator();
+public:
+	static int audioDecimatorSupported(int srcRate, int dstRate);
+	int  audioDecimatorInit(int srcRate, int dstRate, int channels);
+	/* most output samples n input samples can produce */
+	int  audioDecimatorOutSamples(int n) const;
+	/* n input samples per channel in, returns the output samples written */
+	int  audioDecimatorProcess(float *const *out, const float *const *in, int n);
+	/* filter delay in input samples, the output lags the input by this much */
+	int  audioDecimatorDelay() const { return delay_; }
+private:
+	int           down_;       // 1: decimate by ratio_, 0: interpolate by ratio_
+	int           ratio_;
+	int           channels_;
+	int           taps_;       // per dot product
+	int           phase_;      // decimation: input index of the next output, relative to the new samples
+	int           delay_;
+	vector<float> coef_;       // decimation: taps_; interpolation: ratio_ phases of taps_, reversed
+	vector<float> history_;    // taps_ - 1 per channel
+	vector<float> scratch_;
+};
+
+#endif
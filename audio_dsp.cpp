@@ -0,0 +1,515 @@
+#include <math.h>
+#include "audio_dsp.h"
+extern "C"
+{
+#include "libavutil/cpu.h"
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AUDIO_DSP_X86 1
+#include <immintrin.h>
+/* gcc / clang only emit avx2 inside functions marked for it, msvc takes the intrinsics anywhere */
+#ifdef _MSC_VER
+#define DSP_TARGET_AVX2
+#else
+#define DSP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+/////////////////////////// c ///////////////////////////////////////////////////////////////////
+
+static void mix_add_c(float *dst, const float *src, float gain, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] += src[i] * gain;
+}
+
+static void mix_set_c(float *dst, const float *src, float gain, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = src[i] * gain;
+}
+
+static void mix2_c(float *dst, const float *a, float ga, const float *b, float gb, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = a[i] * ga + b[i] * gb;
+}
+
+static void mix3_c(float *dst, const float *a, float ga, const float *b, float gb, const float *c, float gc, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = a[i] * ga + b[i] * gb + c[i] * gc;
+}
+
+static float dot_c(const float *a, const float *b, int n)
+{
+	float sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static void clip_hard_c(float *data, int n)
+{
+	for (int i = 0; i < n; i++)
+		data[i] = FFMIN(FFMAX(data[i], -1.0f), 1.0f);
+}
+
+/* |y| = min(|x|, k) + (1 - k) * z / (1 + z), z = max(|x| - k, 0) / (1 - k): slope 1 at the knee */
+static inline float clip_soft_one(float x, float knee)
+{
+	float a = fabsf(x);
+	float z = FFMAX(a - knee, 0.0f) / (1.0f - knee);
+	float y = FFMIN(a, knee) + (1.0f - knee) * z / (1.0f + z);
+	return x < 0 ? -y : y;
+}
+
+static void clip_soft_c(float *data, int n, float knee)
+{
+	for (int i = 0; i < n; i++)
+		data[i] = clip_soft_one(data[i], knee);
+}
+
+static void fltp_to_s16_c(int16_t *dst, const float *const *src, int channels, int n)
+{
+	for (int i = 0; i < n; i++)
+		for (int c = 0; c < channels; c++)
+			*dst++ = (int16_t)av_clip_int16(lrintf(src[c][i] * 32768.0f));
+}
+
+static void s16p_to_s16_c(int16_t *dst, const int16_t *const *src, int channels, int n)
+{
+	for (int i = 0; i < n; i++)
+		for (int c = 0; c < channels; c++)
+			*dst++ = src[c][i];
+}
+
+static void s32p_to_s16_c(int16_t *dst, const int32_t *const *src, int channels, int n)
+{
+	for (int i = 0; i < n; i++)
+		for (int c = 0; c < channels; c++)
+			*dst++ = (int16_t)(src[c][i] >> 16);
+}
+
+static void levels_flt_c(const float *data, int n, float *peak, double *sumsq, int64_t *clipped)
+{
+	float p = *peak, sum = 0;
+	int64_t clip = 0;
+	for (int i = 0; i < n; i++) {
+		float a = fabsf(data[i]);
+		p = FFMAX(p, a);
+		sum += data[i] * data[i];
+		clip += a >= 1.0f;
+	}
+	*peak = p;
+	*sumsq += sum;
+	*clipped += clip;
+}
+
+static void levels_s16_c(const int16_t *data, int channels, int n, float *peak, double *sumsq, int64_t *clipped)
+{
+	for (int c = 0; c < channels; c++) {
+		int p = 0, clip = 0;
+		int64_t sum = 0;
+		for (int i = 0; i < n; i++) {
+			int v = data[i * channels + c];
+			int a = FFMIN(FFABS(v), 32767);     // like the simd version, -32768 peaks at 32767
+			p = FFMAX(p, a);
+			sum += v * v;
+			clip += a >= 32767;
+		}
+		peak[c] = FFMAX(peak[c], p / 32768.0f);
+		sumsq[c] += sum / (32768.0 * 32768.0);
+		clipped[c] += clip;
+	}
+}
+
+#ifdef AUDIO_DSP_X86
+/////////////////////////// sse2 ////////////////////////////////////////////////////////////////
+
+static void mix_add_sse(float *dst, const float *src, float gain, int n)
+{
+	__m128 g = _mm_set1_ps(gain);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128 a = _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g));
+		__m128 b = _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_mul_ps(_mm_loadu_ps(src + i + 4), g));
+		_mm_storeu_ps(dst + i, a);
+		_mm_storeu_ps(dst + i + 4, b);
+	}
+	mix_add_c(dst + i, src + i, gain, n - i);
+}
+
+static void mix_set_sse(float *dst, const float *src, float gain, int n)
+{
+	__m128 g = _mm_set1_ps(gain);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+	mix_set_c(dst + i, src + i, gain, n - i);
+}
+
+static void mix2_sse(float *dst, const float *a, float ga, const float *b, float gb, int n)
+{
+	__m128 g0 = _mm_set1_ps(ga), g1 = _mm_set1_ps(gb);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), g0), _mm_mul_ps(_mm_loadu_ps(b + i), g1)));
+	mix2_c(dst + i, a + i, ga, b + i, gb, n - i);
+}
+
+static void mix3_sse(float *dst, const float *a, float ga, const float *b, float gb, const float *c, float gc, int n)
+{
+	__m128 g0 = _mm_set1_ps(ga), g1 = _mm_set1_ps(gb), g2 = _mm_set1_ps(gc);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), g0), _mm_mul_ps(_mm_loadu_ps(b + i), g1));
+		_mm_storeu_ps(dst + i, _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(c + i), g2)));
+	}
+	mix3_c(dst + i, a + i, ga, b + i, gb, c + i, gc, n - i);
+}
+
+static float dot_sse(const float *a, const float *b, int n)
+{
+	__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(s0, s1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_c(a + i, b + i, n - i);
+}
+
+static void clip_hard_sse(float *data, int n)
+{
+	__m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(data + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(data + i), lo), hi));
+	clip_hard_c(data + i, n - i);
+}
+
+static void clip_soft_sse(float *data, int n, float knee)
+{
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 k = _mm_set1_ps(knee), rest = _mm_set1_ps(1.0f - knee);
+	__m128 inv = _mm_set1_ps(1.0f / (1.0f - knee)), one = _mm_set1_ps(1.0f);
+	__m128 zero = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 x = _mm_loadu_ps(data + i);
+		__m128 s = _mm_and_ps(x, sign);
+		__m128 a = _mm_andnot_ps(sign, x);
+		__m128 z = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(a, k), zero), inv);
+		__m128 y = _mm_add_ps(_mm_min_ps(a, k), _mm_mul_ps(rest, _mm_div_ps(z, _mm_add_ps(one, z))));
+		_mm_storeu_ps(data + i, _mm_or_ps(y, s));
+	}
+	clip_soft_c(data + i, n - i, knee);
+}
+
+static void fltp_to_s16_sse(int16_t *dst, const float *const *src, int channels, int n)
+{
+	if (channels != 2) {
+		fltp_to_s16_c(dst, src, channels, n);
+		return;
+	}
+	// cvtps rounds to nearest and gives 0x80000000 on overflow, packs saturates, so clamp the floats first
+	__m128 scale = _mm_set1_ps(32768.0f), lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 l = _mm_mul_ps(_mm_loadu_ps(src[0] + i), scale);
+		__m128 r = _mm_mul_ps(_mm_loadu_ps(src[1] + i), scale);
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_unpacklo_ps(l, r), lo), hi);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_unpackhi_ps(l, r), lo), hi);
+		_mm_storeu_si128((__m128i *)(dst + i * 2), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+	const float *tail[2] = { src[0] + i, src[1] + i };
+	fltp_to_s16_c(dst + i * 2, tail, 2, n - i);
+}
+
+static void s16p_to_s16_sse(int16_t *dst, const int16_t *const *src, int channels, int n)
+{
+	if (channels != 2) {
+		s16p_to_s16_c(dst, src, channels, n);
+		return;
+	}
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i l = _mm_loadu_si128((const __m128i *)(src[0] + i));
+		__m128i r = _mm_loadu_si128((const __m128i *)(src[1] + i));
+		_mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi16(l, r));
+		_mm_storeu_si128((__m128i *)(dst + i * 2 + 8), _mm_unpackhi_epi16(l, r));
+	}
+	const int16_t *tail[2] = { src[0] + i, src[1] + i };
+	s16p_to_s16_c(dst + i * 2, tail, 2, n - i);
+}
+
+static void s32p_to_s16_sse(int16_t *dst, const int32_t *const *src, int channels, int n)
+{
+	if (channels != 2) {
+		s32p_to_s16_c(dst, src, channels, n);
+		return;
+	}
+	// >> 16 leaves every value in int16 range, packs does not saturate anything
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i l = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src[0] + i)), 16);
+		__m128i r = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src[1] + i)), 16);
+		_mm_storeu_si128((__m128i *)(dst + i * 2), _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+	}
+	const int32_t *tail[2] = { src[0] + i, src[1] + i };
+	s32p_to_s16_c(dst + i * 2, tail, 2, n - i);
+}
+
+static void levels_flt_sse(const float *data, int n, float *peak, double *sumsq, int64_t *clipped)
+{
+	__m128 sign = _mm_set1_ps(-0.0f), one = _mm_set1_ps(1.0f);
+	__m128 p = _mm_setzero_ps(), sum = _mm_setzero_ps();
+	__m128i clip = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 x = _mm_loadu_ps(data + i);
+		__m128 a = _mm_andnot_ps(sign, x);
+		p = _mm_max_ps(p, a);
+		sum = _mm_add_ps(sum, _mm_mul_ps(x, x));
+		clip = _mm_sub_epi32(clip, _mm_castps_si128(_mm_cmpge_ps(a, one)));   // true lanes are -1
+	}
+	float lanes[4];
+	int32_t counts[4];
+	_mm_storeu_ps(lanes, p);
+	*peak = FFMAX(*peak, FFMAX(FFMAX(lanes[0], lanes[1]), FFMAX(lanes[2], lanes[3])));
+	_mm_storeu_ps(lanes, sum);
+	*sumsq += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_si128((__m128i *)counts, clip);
+	*clipped += (int64_t)counts[0] + counts[1] + counts[2] + counts[3];
+	levels_flt_c(data + i, n - i, peak, sumsq, clipped);
+}
+
+/* mono and stereo: 8 samples per vector, even lanes left and odd lanes right */
+static void levels_s16_sse(const int16_t *data, int channels, int n, float *peak, double *sumsq, int64_t *clipped)
+{
+	if (channels != 1 && channels != 2) {
+		levels_s16_c(data, channels, n, peak, sumsq, clipped);
+		return;
+	}
+	int total = n * channels;
+	__m128i even = _mm_set1_epi32(0x0000ffff), odd = _mm_set1_epi32((int)0xffff0000);
+	__m128i full = _mm_set1_epi16(32767), zero = _mm_setzero_si128();
+	__m128i p = zero, sum0 = zero, sum1 = zero;
+	int pk[2] = { 0, 0 };
+	int64_t cl[2] = { 0, 0 };
+	int16_t lanes[8];
+	int i = 0;
+	while (i + 8 <= total) {
+		// 16 bit clip counters, emptied every 4096 vectors before they can wrap
+		__m128i clip = zero;
+		int end = FFMIN(total & ~7, i + 8 * 4096);
+		for (; i < end; i += 8) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+			// |-32768| does not fit, subs saturates it to 32767: still the peak and clipped
+			__m128i a = _mm_max_epi16(x, _mm_subs_epi16(zero, x));
+			p = _mm_max_epi16(p, a);
+			clip = _mm_sub_epi16(clip, _mm_cmpeq_epi16(a, full));
+			// madd on one channel's lanes: every 32 bit lane holds one square, < 2^30
+			__m128i l = _mm_and_si128(x, even), r = _mm_and_si128(x, odd);
+			__m128i sq0 = _mm_madd_epi16(l, l), sq1 = _mm_madd_epi16(r, r);
+			sum0 = _mm_add_epi64(sum0, _mm_add_epi64(_mm_unpacklo_epi32(sq0, zero), _mm_unpackhi_epi32(sq0, zero)));
+			sum1 = _mm_add_epi64(sum1, _mm_add_epi64(_mm_unpacklo_epi32(sq1, zero), _mm_unpackhi_epi32(sq1, zero)));
+		}
+		_mm_storeu_si128((__m128i *)lanes, clip);
+		for (int k = 0; k < 8; k++)
+			cl[k & 1] += (uint16_t)lanes[k];
+	}
+	int64_t sums[2][2];
+	_mm_storeu_si128((__m128i *)lanes, p);
+	_mm_storeu_si128((__m128i *)sums[0], sum0);
+	_mm_storeu_si128((__m128i *)sums[1], sum1);
+	for (int k = 0; k < 8; k++)
+		pk[k & 1] = FFMAX(pk[k & 1], lanes[k]);
+	int64_t sq[2] = { sums[0][0] + sums[0][1], sums[1][0] + sums[1][1] };
+	if (channels == 1) {
+		pk[0] = FFMAX(pk[0], pk[1]);
+		cl[0] += cl[1];
+		sq[0] += sq[1];
+	}
+	for (int c = 0; c < channels; c++) {
+		peak[c] = FFMAX(peak[c], pk[c] / 32768.0f);
+		sumsq[c] += sq[c] / (32768.0 * 32768.0);
+		clipped[c] += cl[c];
+	}
+	levels_s16_c(data + i, channels, (total - i) / channels, peak, sumsq, clipped);
+}
+
+/////////////////////////// avx2 ////////////////////////////////////////////////////////////////
+
+DSP_TARGET_AVX2 static void mix_add_avx2(float *dst, const float *src, float gain, int n)
+{
+	__m256 g = _mm256_set1_ps(gain);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256 a = _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g));
+		__m256 b = _mm256_add_ps(_mm256_loadu_ps(dst + i + 8), _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), g));
+		_mm256_storeu_ps(dst + i, a);
+		_mm256_storeu_ps(dst + i + 8, b);
+	}
+	mix_add_c(dst + i, src + i, gain, n - i);
+}
+
+DSP_TARGET_AVX2 static void mix_set_avx2(float *dst, const float *src, float gain, int n)
+{
+	__m256 g = _mm256_set1_ps(gain);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), g));
+	mix_set_c(dst + i, src + i, gain, n - i);
+}
+
+DSP_TARGET_AVX2 static void mix2_avx2(float *dst, const float *a, float ga, const float *b, float gb, int n)
+{
+	__m256 g0 = _mm256_set1_ps(ga), g1 = _mm256_set1_ps(gb);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 x = _mm256_mul_ps(_mm256_loadu_ps(a + i), g0);
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(x, _mm256_mul_ps(_mm256_loadu_ps(b + i), g1)));
+	}
+	mix2_c(dst + i, a + i, ga, b + i, gb, n - i);
+}
+
+DSP_TARGET_AVX2 static void mix3_avx2(float *dst, const float *a, float ga, const float *b, float gb, const float *c,
+	float gc, int n)
+{
+	__m256 g0 = _mm256_set1_ps(ga), g1 = _mm256_set1_ps(gb), g2 = _mm256_set1_ps(gc);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a + i), g0), _mm256_mul_ps(_mm256_loadu_ps(b + i), g1));
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(x, _mm256_mul_ps(_mm256_loadu_ps(c + i), g2)));
+	}
+	mix3_c(dst + i, a + i, ga, b + i, gb, c + i, gc, n - i);
+}
+
+DSP_TARGET_AVX2 static float dot_avx2(const float *a, const float *b, int n)
+{
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+		s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+	}
+	__m256 s = _mm256_add_ps(s0, s1);
+	__m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+	float lanes[4];
+	_mm_storeu_ps(lanes, h);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_c(a + i, b + i, n - i);
+}
+
+DSP_TARGET_AVX2 static void clip_hard_avx2(float *data, int n)
+{
+	__m256 lo = _mm256_set1_ps(-1.0f), hi = _mm256_set1_ps(1.0f);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(data + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(data + i), lo), hi));
+	clip_hard_c(data + i, n - i);
+}
+
+DSP_TARGET_AVX2 static void clip_soft_avx2(float *data, int n, float knee)
+{
+	__m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 k = _mm256_set1_ps(knee), rest = _mm256_set1_ps(1.0f - knee);
+	__m256 inv = _mm256_set1_ps(1.0f / (1.0f - knee)), one = _mm256_set1_ps(1.0f);
+	__m256 zero = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 x = _mm256_loadu_ps(data + i);
+		__m256 s = _mm256_and_ps(x, sign);
+		__m256 a = _mm256_andnot_ps(sign, x);
+		__m256 z = _mm256_mul_ps(_mm256_max_ps(_mm256_sub_ps(a, k), zero), inv);
+		__m256 y = _mm256_add_ps(_mm256_min_ps(a, k), _mm256_mul_ps(rest, _mm256_div_ps(z, _mm256_add_ps(one, z))));
+		_mm256_storeu_ps(data + i, _mm256_or_ps(y, s));
+	}
+	clip_soft_c(data + i, n - i, knee);
+}
+DSP_TARGET_AVX2 static void levels_flt_avx2(const float *data, int n, float *peak, double *sumsq, int64_t *clipped)
+{
+	__m256 sign = _mm256_set1_ps(-0.0f), one = _mm256_set1_ps(1.0f);
+	__m256 p = _mm256_setzero_ps(), sum = _mm256_setzero_ps();
+	__m256i clip = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 x = _mm256_loadu_ps(data + i);
+		__m256 a = _mm256_andnot_ps(sign, x);
+		p = _mm256_max_ps(p, a);
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(x, x));
+		clip = _mm256_sub_epi32(clip, _mm256_castps_si256(_mm256_cmp_ps(a, one, _CMP_GE_OQ)));
+	}
+	float lanes[8];
+	int32_t counts[8];
+	_mm256_storeu_ps(lanes, p);
+	float pk = *peak;
+	for (int k = 0; k < 8; k++)
+		pk = FFMAX(pk, lanes[k]);
+	*peak = pk;
+	_mm256_storeu_ps(lanes, sum);
+	double total = 0;
+	for (int k = 0; k < 8; k++)
+		total += lanes[k];
+	*sumsq += total;
+	_mm256_storeu_si256((__m256i *)counts, clip);
+	for (int k = 0; k < 8; k++)
+		*clipped += counts[k];
+	levels_flt_c(data + i, n - i, peak, sumsq, clipped);
+}
+#endif
+
+static AudioDsp dsp_init()
+{
+	AudioDsp dsp;
+	dsp.mixAdd = mix_add_c;
+	dsp.mixSet = mix_set_c;
+	dsp.mix2 = mix2_c;
+	dsp.mix3 = mix3_c;
+	dsp.dot = dot_c;
+	dsp.clipHard = clip_hard_c;
+	dsp.clipSoft = clip_soft_c;
+	dsp.fltpToS16 = fltp_to_s16_c;
+	dsp.s16pToS16 = s16p_to_s16_c;
+	dsp.s32pToS16 = s32p_to_s16_c;
+	dsp.levelsFlt = levels_flt_c;
+	dsp.levelsS16 = levels_s16_c;
+#ifdef AUDIO_DSP_X86
+	int flags = av_get_cpu_flags();
+	if (flags & AV_CPU_FLAG_SSE2) {
+		dsp.mixAdd = mix_add_sse;
+		dsp.mixSet = mix_set_sse;
+		dsp.mix2 = mix2_sse;
+		dsp.mix3 = mix3_sse;
+		dsp.dot = dot_sse;
+		dsp.clipHard = clip_hard_sse;
+		dsp.clipSoft = clip_soft_sse;
+		dsp.fltpToS16 = fltp_to_s16_sse;
+		dsp.s16pToS16 = s16p_to_s16_sse;
+		dsp.s32pToS16 = s32p_to_s16_sse;
+		dsp.levelsFlt = levels_flt_sse;
+		dsp.levelsS16 = levels_s16_sse;
+	}
+	if (flags & AV_CPU_FLAG_AVX2) {
+		dsp.mixAdd = mix_add_avx2;
+		dsp.mixSet = mix_set_avx2;
+		dsp.mix2 = mix2_avx2;
+		dsp.mix3 = mix3_avx2;
+		dsp.dot = dot_avx2;
+		dsp.clipHard = clip_hard_avx2;
+		dsp.clipSoft = clip_soft_avx2;
+		dsp.levelsFlt = levels_flt_avx2;
+	}
+#endif
+	return dsp;
+}
+
+const AudioDsp* audioDspGet()
+{
+	static const AudioDsp dsp = dsp_init();    // thread safe since c++11
+	return &dsp;
+}
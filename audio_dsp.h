@@ -0,0 +1,39 @@
+#ifndef __AUDIO_DSP__H_
+#define __AUDIO_DSP__H_
+#include "audio_engine.h"
+
+/*
+** @brief AudioDsp sample kernels on float planes, the widest version the cpu runs is picked once by
+** audioDspGet() (avx2, sse2, plain c that the compiler vectorizes for neon). n is any count, the
+** kernels handle the tail themselves, pointers need no alignment.
+*/
+struct AudioDsp {
+	/* dst[i] += src[i] * gain */
+	void (*mixAdd)(float *dst, const float *src, float gain, int n);
+	/* dst[i] = src[i] * gain */
+	void (*mixSet)(float *dst, const float *src, float gain, int n);
+	/* dst[i] = a[i] * ga + b[i] * gb, one pass, dst may be a or b */
+	void (*mix2)(float *dst, const float *a, float ga, const float *b, float gb, int n);
+	/* dst[i] = a[i] * ga + b[i] * gb + c[i] * gc */
+	void (*mix3)(float *dst, const float *a, float ga, const float *b, float gb, const float *c, float gc, int n);
+	/* sum of a[i] * b[i], fir taps */
+	float (*dot)(const float *a, const float *b, int n);
+	/* clamp to [-1, 1] */
+	void (*clipHard)(float *data, int n);
+	/* unity below knee, above it a smooth curve that reaches 1 only at infinity */
+	void (*clipSoft)(float *data, int n, float knee);
+	/* planar float -> interleaved s16 with saturation */
+	void (*fltpToS16)(int16_t *dst, const float *const *src, int channels, int n);
+	/* planar s16 -> interleaved s16 */
+	void (*s16pToS16)(int16_t *dst, const int16_t *const *src, int channels, int n);
+	/* planar s32 -> interleaved s16, the top 16 bits (aac_fixed output is already rounded for this) */
+	void (*s32pToS16)(int16_t *dst, const int32_t *const *src, int channels, int n);
+	/* levels of one float channel, accumulated: peak = max(peak, |x|), sumsq += x^2, clipped += |x| >= 1 */
+	void (*levelsFlt)(const float *data, int n, float *peak, double *sumsq, int64_t *clipped);
+	/* the same for interleaved s16, per channel arrays, full scale 32768, clipped: |x| >= 32767 */
+	void (*levelsS16)(const int16_t *data, int channels, int n, float *peak, double *sumsq, int64_t *clipped);
+};
+
+const AudioDsp* audioDspGet();
+
+#endif
@@ -0,0 +1,260 @@
+#include <math.h>
+#include <string.h>
+#include "audio_dtx.h"
+#include "audio_dsp.h"
+
+/////////////////////////// AudioVad ///////////////////////////////////////////////////////////////
+
+AudioVad::AudioVad()
+	:threshold_(-50.0f), hangoverMs_(300), hangover_(0), active_(0), level_(-HUGE_VALF)
+{
+}
+
+void AudioVad::audioVadSet(float threshold_db, int hangover_ms)
+{
+	threshold_ = threshold_db;
+	hangoverMs_ = FFMAX(hangover_ms, 0);
+}
+
+int AudioVad::audioVadFrame(const AVFrame *frame)
+{
+	const AudioDsp *dsp = audioDspGet();
+	int channels = frame->channels, n = frame->nb_samples;
+	float peak = 0;
+	double sumsq = 0;
+	int64_t clipped = 0;
+	if (n <= 0 || channels <= 0)
+		return active_ || hangover_ > 0;
+	// only the energy of all channels together matters, interleaved data is one long channel
+	switch (frame->format) {
+	case AV_SAMPLE_FMT_FLTP:
+		for (int c = 0; c < channels; c++)
+			dsp->levelsFlt((const float *)frame->extended_data[c], n, &peak, &sumsq, &clipped);
+		break;
+	case AV_SAMPLE_FMT_FLT:
+		dsp->levelsFlt((const float *)frame->data[0], n * channels, &peak, &sumsq, &clipped);
+		break;
+	case AV_SAMPLE_FMT_S16P:
+		for (int c = 0; c < channels; c++)
+			dsp->levelsS16((const int16_t *)frame->extended_data[c], 1, n, &peak, &sumsq, &clipped);
+		break;
+	case AV_SAMPLE_FMT_S16:
+		dsp->levelsS16((const int16_t *)frame->data[0], 1, n * channels, &peak, &sumsq, &clipped);
+		break;
+	default:
+		return 1;       // no level for this format, never gate it
+	}
+	double ms = sumsq / ((double)n * channels);
+	level_ = ms > 0 ? (float)(10 * log10(ms)) : -HUGE_VALF;
+	if (level_ >= threshold_ || (active_ && level_ >= threshold_ - 6)) {
+		int rate = frame->sample_rate > 0 ? frame->sample_rate : 48000;
+		active_ = 1;
+		hangover_ = (int64_t)hangoverMs_ * rate / 1000;
+		return 1;
+	}
+	active_ = 0;
+	if (hangover_ > 0) {
+		hangover_ -= n;
+		return 1;
+	}
+	return 0;
+}
+
+/////////////////////////// AudioDtx ///////////////////////////////////////////////////////////////
+
+AudioDtx::AudioDtx()
+	:mode_(AUDIO_DTX_SILENCE_PACKETS), sample_(NULL), encode_(NULL), silence_(NULL), packet_(NULL), frameSize_(0),
+	rate_(0), inRate_(0), silentIn_(0), silentOut_(0), nextPts_(AV_NOPTS_VALUE), ingest_(AUDIO_NO_INGEST),
+	silentIngest_(AUDIO_NO_INGEST), tail_(0), tailLeft_(0), gap_(0), flushing_(0)
+{
+	memset(&stats_, 0, sizeof(stats_));
+}
+
+AudioDtx::~AudioDtx()
+{
+	av_packet_free(&silence_);
+	av_packet_free(&packet_);
+}
+
+/* one packet of digital silence for the encoder configuration of ctx, encoded once per process */
+int AudioDtx::silencePacket(AVCodecContext *ctx, AVPacket *packet)
+{
+	static mutex lock;
+	static map<string, AVPacket*> cache;
+	char key[256];
+	snprintf(key, sizeof(key), "%s/%d/%llx/%lld/%d/%d/%d", ctx->codec->name, ctx->sample_rate,
+		(unsigned long long)ctx->channel_layout, (long long)ctx->bit_rate, ctx->profile, ctx->frame_size,
+		!!(ctx->flags & AV_CODEC_FLAG_GLOBAL_HEADER));
+	lock_guard<mutex> guard(lock);
+	map<string, AVPacket*>::iterator it = cache.find(key);
+	if (it != cache.end())
+		return av_packet_ref(packet, it->second) < 0 ? -1 : 0;
+
+	// a private encoder with the same settings, the packets after the priming are steady state silence
+	AVCodecContext *enc = avcodec_alloc_context3(ctx->codec);
+	AVFrame *zero = av_frame_alloc();
+	AVPacket *out = av_packet_alloc();
+	int got = 0;
+	if (enc && zero && out) {
+		enc->sample_fmt = ctx->sample_fmt;
+		enc->channel_layout = ctx->channel_layout;
+		enc->channels = ctx->channels;
+		enc->sample_rate = ctx->sample_rate;
+		enc->time_base = ctx->time_base;
+		enc->bit_rate = ctx->bit_rate;
+		enc->profile = ctx->profile;
+		enc->flags = ctx->flags;
+		zero->format = ctx->sample_fmt;
+		zero->channel_layout = ctx->channel_layout;
+		zero->nb_samples = ctx->frame_size;
+		zero->sample_rate = ctx->sample_rate;
+		if (avcodec_open2(enc, ctx->codec, NULL) == 0 && av_frame_get_buffer(zero, 0) == 0) {
+			av_samples_set_silence(zero->extended_data, 0, zero->nb_samples, ctx->channels, ctx->sample_fmt);
+			for (int i = 0; i < 16 && got < 4; i++) {
+				zero->pts = (int64_t)i * ctx->frame_size;
+				if (avcodec_send_frame(enc, zero) < 0)
+					break;
+				while (got < 4 && avcodec_receive_packet(enc, out) == 0) {
+					av_packet_unref(packet);
+					av_packet_move_ref(packet, out);
+					got++;
+				}
+			}
+		}
+	}
+	avcodec_free_context(&enc);
+	av_frame_free(&zero);
+	av_packet_free(&out);
+	if (got < 4) {
+		av_packet_unref(packet);
+		av_log(NULL, AV_LOG_ERROR, "dtx: encode silence packet failure.[%s]\n", key);
+		return -1;
+	}
+	// no priming / padding side data, the timestamps are stamped when it goes out
+	av_packet_free_side_data(packet);
+	packet->pts = packet->dts = AV_NOPTS_VALUE;
+	packet->duration = ctx->frame_size;
+	packet->flags |= AV_PKT_FLAG_KEY;
+	cache[key] = av_packet_clone(packet);
+	return 0;
+}
+
+int AudioDtx::audioDtxInit(AudioSample *sample, AudioEncode *encode, AudioDtxMode mode)
+{
+	AVCodecContext *ctx = encode ? encode->audioEncodeGetContext() : NULL;
+	if (!ctx) {
+		av_log(NULL, AV_LOG_ERROR, "dtx: open the encoder first.\n");
+		return -1;
+	}
+	sample_ = sample;
+	encode_ = encode;
+	mode_ = mode;
+	rate_ = ctx->sample_rate;
+	frameSize_ = ctx->frame_size;
+	packet_ = av_packet_alloc();
+	silence_ = av_packet_alloc();
+	if (!packet_ || !silence_)
+		return -1;
+	if (mode_ == AUDIO_DTX_SILENCE_PACKETS && (frameSize_ <= 0 || silencePacket(ctx, silence_) < 0)) {
+		av_log(NULL, AV_LOG_WARNING, "dtx: no silence packet for %s, gaps are left out.\n", ctx->codec->name);
+		mode_ = AUDIO_DTX_DISCONTINUITY;
+	}
+	return 0;
+}
+
+void AudioDtx::stamp(AVPacket *packet)
+{
+	gap_ = 0;
+	if (mode_ == AUDIO_DTX_DISCONTINUITY && inRate_ > 0) {
+		int64_t owed = av_rescale(silentIn_, rate_, inRate_) - silentOut_;
+		if (owed > 0 && nextPts_ != AV_NOPTS_VALUE) {
+			nextPts_ += owed;
+			gap_ = 1;
+			stats_.gaps++;
+		}
+		silentOut_ += FFMAX(owed, (int64_t)0);
+	}
+	if (nextPts_ == AV_NOPTS_VALUE)
+		nextPts_ = packet->pts;
+	packet->pts = packet->dts = nextPts_;
+	if (nextPts_ != AV_NOPTS_VALUE)
+		nextPts_ += packet->duration > 0 ? packet->duration : frameSize_;
+}
+
+int AudioDtx::audioDtxEncode(AVFrame *frame, AVPacket **packet)
+{
+	if (!encode_)
+		return -1;
+	if (!frame) {
+		flushing_ = 1;
+		return audioDtxReceive(packet);
+	}
+	stats_.frames++;
+	if (inRate_ == 0) {
+		inRate_ = frame->sample_rate > 0 ? frame->sample_rate : rate_;
+		tail_ = av_rescale(encode_->audioEncodeGetPriming() + frameSize_, inRate_, rate_);
+	}
+	// the timeline starts where the encoder's would: first captured sample minus the priming
+	if (nextPts_ == AV_NOPTS_VALUE && frame->pts != AV_NOPTS_VALUE)
+		nextPts_ = av_rescale(frame->pts, rate_, inRate_) - encode_->audioEncodeGetPriming();
+	// the hangover goes on for the encoder delay, what it holds drains before the silence starts
+	int voice = vad_.audioVadFrame(frame);
+	if (voice) {
+		tailLeft_ = tail_;
+	} else if (tailLeft_ > 0) {
+		tailLeft_ -= frame->nb_samples;
+		voice = 1;
+	}
+	if (!voice) {
+		stats_.silentFrames++;
+		silentIn_ += frame->nb_samples;
+		silentIngest_ = frame->reordered_opaque;
+		int64_t voice = stats_.frames - stats_.silentFrames;
+		stats_.savedUs = voice > 0 ? stats_.activeUs * stats_.silentFrames / voice : 0;
+		return audioDtxReceive(packet);
+	}
+	int64_t start = av_gettime_relative();
+	AVFrame *in = frame;
+	AVPacket *out = NULL;
+	int ret = sample_ ? sample_->audioSampleConvert(frame, &in) : 0;
+	if (ret == 0)
+		ret = encode_->audioEncode(in, &out);
+	stats_.activeUs += av_gettime_relative() - start;
+	if (ret == 0) {
+		stamp(out);
+		ingest_ = encode_->audioEncodeIngestTime();
+		*packet = out;
+		return 0;
+	}
+	if (ret != AVERROR(EAGAIN))
+		return -1;
+	return audioDtxReceive(packet);
+}
+
+int AudioDtx::audioDtxReceive(AVPacket **packet)
+{
+	if (!encode_)
+		return -1;
+	// what the encoder holds is older than the silence owed, the tail after the vad drained the voice
+	AVPacket *out = NULL;
+	int ret = flushing_ ? encode_->audioEncode(NULL, &out) : encode_->audioEncodeReceive(&out);
+	if (ret == 0) {
+		stamp(out);
+		ingest_ = encode_->audioEncodeIngestTime();
+		*packet = out;
+		return 0;
+	}
+	if (flushing_ || ret != AVERROR(EAGAIN))
+		return ret;
+	if (mode_ != AUDIO_DTX_SILENCE_PACKETS || inRate_ <= 0 || av_rescale(silentIn_, rate_, inRate_) - silentOut_ < frameSize_)
+		return AVERROR(EAGAIN);
+	silentOut_ += frameSize_;
+	av_packet_unref(packet_);
+	if (av_packet_ref(packet_, silence_) < 0)
+		return -1;
+	stamp(packet_);
+	ingest_ = silentIngest_;
+	stats_.silencePackets++;
+	*packet = packet_;
+	return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef __AUDIO_DTX__H_
+#define __AUDIO_DTX__H_
+#include "audio_engine.h"
+
+/*
+** @brief AudioVad energy voice detector with hangover: a frame is voice when its rms reaches the
+** threshold, it stays voice while the level is within 6 dB under it, and the hangover keeps it open a
+** while after that so word endings and short pauses are not cut. the energy comes from the AudioDsp
+** level kernels (simd), s16 / s16p / flt / fltp frames.
+*/
+class AudioVad {
+public:
+	AudioVad();
+public:
+	/* default -50 dBFS, 300 ms */
+	void  audioVadSet(float threshold_db, int hangover_ms);
+	/* 1 voice or hangover, 0 silence */
+	int   audioVadFrame(const AVFrame *frame);
+	/* rms of the last frame, dBFS */
+	float audioVadLevel() const { return level_; }
+private:
+	float   threshold_;
+	int     hangoverMs_;
+	int64_t hangover_;     // samples of hangover left
+	int     active_;
+	float   level_;
+};
+
+enum AudioDtxMode {
+	AUDIO_DTX_SILENCE_PACKETS,    // silent frames come out as a cached pre-encoded silence packet
+	AUDIO_DTX_DISCONTINUITY,      // nothing comes out, the next packet's pts jumps over the gap
+};
+
+struct AudioDtxStats {
+	int64_t frames;           // captured frames
+	int64_t silentFrames;     // not resampled, not encoded
+	int64_t silencePackets;   // cached packets sent instead
+	int64_t gaps;             // discontinuities (AUDIO_DTX_DISCONTINUITY)
+	int64_t activeUs;         // resample + encode time of the voice frames
+	int64_t savedUs;          // estimate: silent frames times the average cost of a voice frame
+};
+
+/*
+** @brief AudioDtx gate between capture and resample / encode: frames the AudioVad calls silence are not
+** resampled and not encoded. every packet out is stamped on one continuous timeline in encoder samples,
+** so a gap is filled with pre-encoded silence packets (one per configuration: codec, rate, layout,
+** bitrate, profile, built once per process by encoding zeros on a private encoder) or, in
+** AUDIO_DTX_DISCONTINUITY, left out with pts jumping over it.
+** after the vad closes the gate the encoder is still fed for its delay plus a frame (the samples it holds
+** in its lookahead and fifo): the last voice packets come out before the first silence packet / the gap,
+** in order, and the codec overlap decays into real input instead of jumping to the silence packet.
+** first call audioDtxInit(), then audioDtxEncode() for every captured frame and audioDtxReceive()
+** until EAGAIN, like AudioEncode. the packets are owned by AudioDtx / the encoder until the next call.
+*/
+class AudioDtx {
+public:
+	AudioDtx();
+	~AudioDtx();
+public:
+	/* sample may be NULL when the capture format is the encoder's */
+	int  audioDtxInit(AudioSample *sample, AudioEncode *encode, AudioDtxMode mode = AUDIO_DTX_SILENCE_PACKETS);
+	AudioVad& audioDtxVad() { return vad_; }
+	/* captured frame in, first packet out, AVERROR(EAGAIN) when there is none.
+	** frame NULL flushes the encoder, AVERROR_EOF after the last packet */
+	int  audioDtxEncode(AVFrame *frame, AVPacket **packet);
+	int  audioDtxReceive(AVPacket **packet);
+	/* capture time (us) of the last packet out, AUDIO_NO_INGEST if unknown */
+	int64_t audioDtxIngestTime() const { return ingest_; }
+	/* 1 when the last packet out follows a gap left out in AUDIO_DTX_DISCONTINUITY */
+	int  audioDtxGap() const { return gap_; }
+	void audioDtxGetStats(AudioDtxStats *stats) const { *stats = stats_; }
+private:
+	static int silencePacket(AVCodecContext *ctx, AVPacket *packet);
+	void stamp(AVPacket *packet);
+private:
+	AudioVad      vad_;
+	AudioDtxMode  mode_;
+	AudioSample  *sample_;
+	AudioEncode  *encode_;
+	AVPacket     *silence_;       // the cached silence packet
+	AVPacket     *packet_;        // silence packet handed out
+	int           frameSize_;
+	int           rate_;          // encoder rate
+	int           inRate_;        // capture rate
+	int64_t       silentIn_;      // captured samples skipped
+	int64_t       silentOut_;     // encoder samples covered by silence packets / gaps
+	int64_t       nextPts_;
+	int64_t       ingest_;
+	int64_t       silentIngest_;
+	int64_t       tail_;          // capture samples fed to the encoder after the vad closes
+	int64_t       tailLeft_;
+	int           gap_;
+	int           flushing_;
+	AudioDtxStats stats_;
+};
+
+#endif
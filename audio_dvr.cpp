@@ -0,0 +1,200 @@
+#include <string.h>
+#include "audio_dvr.h"
+
+AudioDvr::AudioDvr(int arenaSize, int maxPackets)
+	:arenaSize_(arenaSize), maxPackets_(maxPackets), writePos_(0), bytes_(0), head_(0), tail_(0),
+	evicted_(0), torn_(0), par_(NULL), adtsOk_(0)
+{
+	// the whole memory of the ring, nothing is allocated on the live path afterwards
+	arena_ = (uint8_t *)av_malloc(arenaSize_);
+	entries_ = (DvrEntry *)av_malloc_array(maxPackets_, sizeof(DvrEntry));
+	timeBase_ = av_make_q(0, 1);
+}
+
+AudioDvr::~AudioDvr()
+{
+	av_freep(&arena_);
+	av_freep(&entries_);
+	avcodec_parameters_free(&par_);
+}
+
+int AudioDvr::audioDvrInit(AudioEncode *encode)
+{
+	AVCodecContext *ctx = encode->audioEncodeGetContext();
+	if (!arena_ || !entries_ || !ctx) {
+		av_log(NULL, AV_LOG_ERROR, "dvr init failure, no memory or encoder not opened.\n");
+		return -1;
+	}
+	// a copy, dumps on another thread must not read the live codec context
+	avcodec_parameters_free(&par_);
+	par_ = avcodec_parameters_alloc();
+	if (!par_ || avcodec_parameters_from_context(par_, ctx) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "dvr copy codec parameters failure.\n");
+		avcodec_parameters_free(&par_);
+		return -1;
+	}
+	adtsOk_ = adtsHeaderFromParameters(par_, &adts_) == 0;
+	timeBase_ = ctx->time_base;
+	return 0;
+}
+
+void AudioDvr::evictOldest(int64_t tail)
+{
+	bytes_ -= entries_[tail % maxPackets_].size;
+	evicted_++;
+	tail_.store(tail + 1, memory_order_relaxed);
+}
+
+int AudioDvr::audioDvrPush(AVPacket *packet)
+{
+	if (!par_ || packet->size <= 0 || packet->size > arenaSize_ / 4)
+		return -1;
+	int64_t head = head_.load(memory_order_relaxed);
+	int pos = writePos_;
+	int skipped = 0;
+	if (pos + packet->size > arenaSize_) {
+		skipped = pos;     // the end of the arena stays unused this round
+		pos = 0;
+	}
+	// make room: the index is full, the oldest payload lies where this one goes,
+	// or it lies in the skipped end (it is older than everything at the start)
+	int64_t tail;
+	while ((tail = tail_.load(memory_order_relaxed)) < head) {
+		const DvrEntry &old = entries_[tail % maxPackets_];
+		int full = head - tail >= maxPackets_;
+		int overlap = old.offset < pos + packet->size && old.offset + old.size > pos;
+		int in_skipped = skipped && old.offset >= skipped;
+		if (!full && !overlap && !in_skipped)
+			break;
+		evictOldest(tail);
+	}
+	// tail_ moves before the bytes change: a dump that copied them sees the eviction afterwards
+	atomic_thread_fence(memory_order_release);
+	memcpy(arena_ + pos, packet->data, packet->size);
+	DvrEntry &entry = entries_[head % maxPackets_];
+	entry.pts = packet->pts;
+	entry.duration = (int)packet->duration;
+	entry.offset = pos;
+	entry.size = packet->size;
+	writePos_ = pos + packet->size;
+	bytes_ += packet->size;
+	head_.store(head + 1, memory_order_release);
+	return 0;
+}
+
+/* first sequence whose packet ends after pts, the index is sorted by pts */
+int64_t AudioDvr::findFirst(int64_t pts, int64_t tail, int64_t head)
+{
+	int64_t lo = tail, hi = head;
+	while (lo < hi) {
+		int64_t mid = lo + (hi - lo) / 2;
+		const DvrEntry &entry = entries_[mid % maxPackets_];
+		if (entry.pts + entry.duration <= pts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* copy packet seq out of the ring, AVERROR(EAGAIN) when the writer evicted it meanwhile */
+int AudioDvr::copyPacket(int64_t seq, AVPacket *packet)
+{
+	DvrEntry entry = entries_[seq % maxPackets_];
+	if (entry.size > 0 && entry.offset >= 0 && entry.offset + entry.size <= arenaSize_) {
+		if (AudioBufferPool::audioPoolDefault()->audioPoolGetPacket(packet, entry.size) < 0)
+			return -1;
+		memcpy(packet->data, arena_ + entry.offset, entry.size);
+	}
+	atomic_thread_fence(memory_order_acquire);
+	if (tail_.load(memory_order_relaxed) > seq) {
+		torn_++;
+		av_packet_unref(packet);
+		return AVERROR(EAGAIN);
+	}
+	packet->pts = packet->dts = entry.pts;
+	packet->duration = entry.duration;
+	packet->stream_index = 0;
+	packet->flags |= AV_PKT_FLAG_KEY;
+	return 0;
+}
+
+int64_t AudioDvr::audioDvrDump(int64_t start_ms, int64_t end_ms, string filename, const char *format)
+{
+	if (!par_)
+		return -1;
+	int rate = par_->sample_rate;
+	int64_t start = av_rescale(start_ms, rate, 1000);
+	int64_t end = end_ms < 0 ? INT64_MAX : av_rescale(end_ms, rate, 1000);
+	int adts = format ? !strcmp(format, "adts") :
+		filename.size() > 4 && !filename.compare(filename.size() - 4, 4, ".aac");
+	// what is in the ring now, packets pushed while dumping are not part of it
+	int64_t head = head_.load(memory_order_acquire);
+	int64_t seq = findFirst(start, tail_.load(memory_order_acquire), head);
+
+	AdtsSink adts_sink;
+	AudioMuxer mux;
+	if (adts) {
+		if (!adtsOk_) {
+			av_log(NULL, AV_LOG_ERROR, "dvr stream cannot be adts framed, dump it to a container.\n");
+			return -1;
+		}
+		if (adts_sink.audioAdtsOpen(filename) < 0)
+			return -1;
+	} else if (mux.audioMuxOpen(filename, format) < 0 || mux.audioMuxAddStream(par_, timeBase_) < 0) {
+		return -1;
+	}
+	AVPacket *packet = av_packet_alloc();
+	int64_t written = 0, base = AV_NOPTS_VALUE;
+	int err = packet ? 0 : 1;
+	for (; !err && seq < head; seq++) {
+		int ret = copyPacket(seq, packet);
+		if (ret == AVERROR(EAGAIN))
+			continue;     // the live path was faster, the dump starts a bit later
+		if (ret < 0) {
+			err = 1;
+			break;
+		}
+		if (packet->pts >= end)
+			break;
+		if (adts) {
+			err = adts_sink.audioAdtsWrite(&adts_, packet) < 0;
+		} else {
+			// the file starts at 0
+			if (base == AV_NOPTS_VALUE)
+				base = packet->pts;
+			packet->pts -= base;
+			packet->dts -= base;
+			err = mux.audioMuxWrite(packet) < 0;
+		}
+		written++;
+		av_packet_unref(packet);
+	}
+	av_packet_free(&packet);
+	if ((adts ? adts_sink.audioAdtsClose() : mux.audioMuxClose()) < 0)
+		err = 1;
+	return err ? -1 : written;
+}
+
+int64_t AudioDvr::audioDvrDumpLast(int64_t duration_ms, string filename, const char *format)
+{
+	int64_t head = head_.load(memory_order_acquire);
+	if (!par_ || head == tail_.load(memory_order_acquire))
+		return -1;
+	const DvrEntry &last = entries_[(head - 1) % maxPackets_];
+	int64_t end_ms = av_rescale(last.pts + last.duration, 1000, par_->sample_rate);
+	return audioDvrDump(end_ms - duration_ms, -1, filename, format);
+}
+
+void AudioDvr::audioDvrGetStats(AudioDvrStats *stats)
+{
+	int64_t head = head_.load(memory_order_acquire);
+	int64_t tail = tail_.load(memory_order_acquire);
+	stats->packets = head - tail;
+	stats->bytes = bytes_;
+	stats->firstPts = head > tail ? entries_[tail % maxPackets_].pts : AV_NOPTS_VALUE;
+	stats->lastPts = head > tail ? entries_[(head - 1) % maxPackets_].pts : AV_NOPTS_VALUE;
+	stats->pushed = head;
+	stats->evicted = evicted_;
+	stats->torn = torn_;
+}
@@ -0,0 +1,72 @@
+#ifndef __AUDIO_DVR__H_
+#define __AUDIO_DVR__H_
+#include <atomic>
+#include "audio_adts.h"
+#include "audio_mux.h"
+
+/*
+** @brief AudioDvrStats what the ring holds now and what dumps lost, pts in samples
+*/
+struct AudioDvrStats {
+	int64_t packets;      // packets in the ring
+	int64_t bytes;        // payload bytes in the ring
+	int64_t firstPts;     // oldest packet, AV_NOPTS_VALUE when empty
+	int64_t lastPts;      // newest packet
+	int64_t pushed;       // packets pushed since init
+	int64_t evicted;      // packets dropped to make room
+	int64_t torn;         // packets a dump skipped because the live path overwrote them while copying
+};
+
+/*
+** @brief AudioDvr rolling buffer of the last encoded packets for "save the last N minutes".
+** the payloads live in one arena and the index in one entry array, both allocated by the constructor:
+** memory is fixed, the oldest packets are evicted when either is full.
+** audioDvrPush() runs on the encoding thread and never waits. audioDvrDump() runs on any other thread:
+** it copies the packets out without a lock and checks afterwards that the writer did not evict them
+** meanwhile (sequence numbers), so a dump never blocks the live path.
+** first call audioDvrInit() with the encoder, then audioDvrPush() for every packet from audioEncode().
+*/
+class AudioDvr {
+public:
+	AudioDvr(int arenaSize = 16 << 20, int maxPackets = 64 * 1024);
+	~AudioDvr();
+public:
+	/* copies the stream parameters for the dumps, the encoder is not used afterwards. m4a dumps need
+	** audioEncodeSetGlobalHeader(1) on the encoder. calling it again switches streams, not while a dump runs */
+	int  audioDvrInit(AudioEncode *encode);
+	/* copy one encoded packet into the ring, encoding thread only */
+	int  audioDvrPush(AVPacket *packet);
+	/* packets with pts in [start_ms, end_ms) of the stream into filename. format "adts" (or NULL for a
+	** .aac name) writes adts directly, anything else goes through AudioMuxer. returns packets written */
+	int64_t audioDvrDump(int64_t start_ms, int64_t end_ms, string filename, const char *format = NULL);
+	/* the newest duration_ms */
+	int64_t audioDvrDumpLast(int64_t duration_ms, string filename, const char *format = NULL);
+	void audioDvrGetStats(AudioDvrStats *stats);
+private:
+	struct DvrEntry {
+		int64_t pts;
+		int     duration;
+		int     offset;       // payload in arena_
+		int     size;
+	};
+	void    evictOldest(int64_t tail);
+	int64_t findFirst(int64_t pts, int64_t tail, int64_t head);
+	int     copyPacket(int64_t seq, AVPacket *packet);
+private:
+	uint8_t           *arena_;
+	int                arenaSize_;
+	DvrEntry          *entries_;
+	int                maxPackets_;
+	int                writePos_;     // arena offset of the next payload, writer only
+	atomic<int64_t>    bytes_;
+	atomic<int64_t>    head_;         // sequence of the next packet, entries [tail_, head_) are valid
+	atomic<int64_t>    tail_;         // oldest valid sequence
+	atomic<int64_t>    evicted_;
+	atomic<int64_t>    torn_;
+	AVCodecParameters *par_;         // NULL until audioDvrInit()
+	AdtsHeader         adts_;        // adts stream fields from par_
+	int                adtsOk_;      // 0: par_ is not adts framable
+	AVRational         timeBase_;
+};
+
+#endif
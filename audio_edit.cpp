@@ -0,0 +1,150 @@
+#include "audio_edit.h"
+
+/* one input with the next frame read ahead: a frame past the end of a range stays for the next range */
+struct EditInput {
+	AdtsReader reader;
+	AVPacket  *packet;
+	int        have;
+	EditInput():packet(av_packet_alloc()), have(0) {}
+	~EditInput() { av_packet_free(&packet); }
+};
+
+static int edit_open(EditInput &in, const string &filename)
+{
+	if (!in.packet || in.reader.audioReaderOpen(filename) < 0)
+		return -1;
+	return 0;
+}
+
+static int edit_same_params(const AdtsHeader &a, const AdtsHeader &b)
+{
+	return a.profile == b.profile && a.sampleIndex == b.sampleIndex && a.channels == b.channels;
+}
+
+static int64_t edit_ms_to_samples(int64_t ms, const AdtsHeader &header)
+{
+	return av_rescale(ms, header.sampleRate, 1000);
+}
+
+static int edit_sink_open(AudioFileSink &sink, const string &output)
+{
+	if (sink.audioSinkOpen(output) < 0)
+		return -1;
+	sink.audioSinkSetFlushInterval(0);    // only full buffers, nobody waits for the data
+	return 0;
+}
+
+/* copy the frames that end after from and start before to (samples, to < 0: up to the end) */
+static int64_t edit_copy(EditInput &in, AudioFileSink &sink, int64_t from, int64_t to, int vbr)
+{
+	int64_t frames = 0;
+	while (1) {
+		if (!in.have) {
+			int ret = in.reader.audioReaderRead(in.packet);
+			if (ret == AVERROR_EOF)
+				return frames;
+			if (ret < 0)
+				return -1;
+			in.have = 1;
+		}
+		AVPacket *packet = in.packet;
+		if (to >= 0 && packet->pts >= to)
+			return frames;
+		in.have = 0;
+		if (packet->pts + packet->duration <= from)
+			continue;
+		// the packet shares the reader's block, patch a copy. a header with crc (protection_absent 0) keeps
+		// its fullness, the crc covers it
+		if (vbr && (packet->data[1] & 0x01)) {
+			if (av_packet_make_writable(packet) < 0)
+				return -1;
+			packet->data[5] |= 0x1f;      // buffer_fullness 0x7ff
+			packet->data[6] |= 0xfc;
+		}
+		if (sink.audioSinkWrite(packet->data, packet->size) < 0)
+			return -1;
+		frames++;
+	}
+}
+
+int64_t adtsCut(string input, string output, int64_t start_ms, int64_t end_ms)
+{
+	EditInput in;
+	AudioFileSink sink;
+	if (edit_open(in, input) < 0 || edit_sink_open(sink, output) < 0)
+		return -1;
+	const AdtsHeader &header = in.reader.audioReaderHeader();
+	int64_t from = edit_ms_to_samples(FFMAX(start_ms, 0), header);
+	int64_t to = end_ms < 0 ? -1 : edit_ms_to_samples(end_ms, header);
+	int64_t frames = edit_copy(in, sink, from, to, 0);
+	if (sink.audioSinkClose() < 0)
+		return -1;
+	return frames;
+}
+
+int64_t adtsConcat(const vector<string> &inputs, string output)
+{
+	if (inputs.empty())
+		return -1;
+	// check every input before writing anything, a small block is enough for the first header
+	AdtsHeader first;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		AdtsReader probe(16 * 1024);
+		if (probe.audioReaderOpen(inputs[i]) < 0)
+			return -1;
+		if (i == 0) {
+			first = probe.audioReaderHeader();
+		} else if (!edit_same_params(first, probe.audioReaderHeader())) {
+			av_log(NULL, AV_LOG_ERROR, "concat %s: profile / sample rate / channels differ from %s.\n",
+				inputs[i].c_str(), inputs[0].c_str());
+			return -1;
+		}
+	}
+	AudioFileSink sink;
+	if (edit_sink_open(sink, output) < 0)
+		return -1;
+	int64_t frames = 0;
+	for (size_t i = 0; i < inputs.size() && frames >= 0; i++) {
+		EditInput in;
+		int64_t ret = edit_open(in, inputs[i]) < 0 ? -1 : edit_copy(in, sink, 0, -1, 1);
+		frames = ret < 0 ? -1 : frames + ret;
+	}
+	if (sink.audioSinkClose() < 0)
+		return -1;
+	return frames;
+}
+
+int64_t adtsSplice(string base, string insert, string output, int64_t at_ms, int64_t replace_ms)
+{
+	EditInput in, ins;
+	AudioFileSink sink;
+	if (edit_open(in, base) < 0 || edit_open(ins, insert) < 0)
+		return -1;
+	const AdtsHeader &header = in.reader.audioReaderHeader();
+	if (!edit_same_params(header, ins.reader.audioReaderHeader())) {
+		av_log(NULL, AV_LOG_ERROR, "splice %s: profile / sample rate / channels differ from %s.\n",
+			insert.c_str(), base.c_str());
+		return -1;
+	}
+	if (edit_sink_open(sink, output) < 0)
+		return -1;
+	// splice points on the frame boundary at or before the requested time
+	int frame_samples = adtsFrameSamples(&header);
+	int64_t at = edit_ms_to_samples(FFMAX(at_ms, 0), header);
+	at -= at % frame_samples;
+	int64_t resume = at + edit_ms_to_samples(FFMAX(replace_ms, 0), header);
+	resume -= resume % frame_samples;
+
+	int64_t frames = 0, ret;
+	if ((ret = edit_copy(in, sink, 0, at, 1)) >= 0) {
+		frames += ret;
+		if ((ret = edit_copy(ins, sink, 0, -1, 1)) >= 0) {
+			frames += ret;
+			ret = edit_copy(in, sink, resume, -1, 1);
+			frames += ret;
+		}
+	}
+	if (sink.audioSinkClose() < 0 || ret < 0)
+		return -1;
+	return frames;
+}
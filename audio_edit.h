@@ -0,0 +1,23 @@
+#ifndef __AUDIO_EDIT__H_
+#define __AUDIO_EDIT__H_
+#include <vector>
+#include "audio_adts.h"
+#include "audio_sink.h"
+
+/*
+** packet level adts editing: whole adts frames are copied from AdtsReader blocks into an AudioFileSink,
+** nothing is decoded, so the cost is close to cat. cuts land on frame boundaries (1024 samples per raw
+** block), times are converted with the sample rate of the first header.
+** joined streams get buffer_fullness 0x7ff (vbr) in every header without crc, the bit reservoir state
+** of one encoder means nothing after a join. all return the number of frames written, -1 on error.
+*/
+
+/* frames covering [start_ms, end_ms) of input, end_ms < 0 up to the end of the file */
+int64_t adtsCut(string input, string output, int64_t start_ms, int64_t end_ms);
+/* inputs one after the other, they must share profile, sample rate and channel configuration */
+int64_t adtsConcat(const vector<string> &inputs, string output);
+/* base up to at_ms, then all of insert, then base from at_ms + replace_ms (0: pure insert).
+** the splice points are rounded to the frame boundary at or before them */
+int64_t adtsSplice(string base, string insert, string output, int64_t at_ms, int64_t replace_ms = 0);
+
+#endif
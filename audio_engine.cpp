@@ -1,6 +1,543 @@
 #include "audio_engine.h"
+#include "audio_dsp.h"
+#include "audio_remix.h"
+#include "audio_decimate.h"
 
-int AudioCapture::audioInit(int channel_layout, AVSampleFormat format, int samples)
+/////////////////////////// AudioLatencyStats ӳֱͼ ////////////////////////////////////////////
+static int latency_bucket(int64_t us)
+{
+	if (us < 8)
+		return us < 0 ? 0 : (int)us;
+	int e = 0;
+	while ((us >> (e + 1)) != 0)
+		e++;
+	// 8 ͰӦһ 2 
+	return 8 * (e - 2) + (int)((us >> (e - 3)) & 7);
+}
+
+static int64_t latency_bucket_value(int index)
+{
+	if (index < 8)
+		return index;
+	int e = index / 8 + 2;
+	return (int64_t)(8 + index % 8) << (e - 3);
+}
+
+void AudioLatencyStats::audioLatencyRecord(int64_t us)
+{
+	int index = FFMIN(latency_bucket(us), BUCKETS - 1);
+	buckets_[index]++;
+	count_++;
+	sum_ += us;
+	int64_t max = max_;
+	while (us > max && !max_.compare_exchange_weak(max, us))
+		;
+}
+
+void AudioLatencyStats::audioLatencyReset()
+{
+	for (int i = 0; i < BUCKETS; i++)
+		buckets_[i] = 0;
+	count_ = 0;
+	sum_ = 0;
+	max_ = 0;
+}
+
+int64_t AudioLatencyStats::audioLatencyPercentile(double p) const
+{
+	int64_t count = count_;
+	if (!count)
+		return 0;
+	int64_t target = (int64_t)(count * p / 100.0);
+	int64_t seen = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		seen += buckets_[i];
+		if (seen > target)
+			return latency_bucket_value(i);
+	}
+	return max_;
+}
+
+void AudioLatencyStats::audioLatencyPrint(const char *name) const
+{
+	printf("%s latency(us) count:%lld mean:%.0f p50:%lld p90:%lld p99:%lld max:%lld\n", name,
+		(long long)audioLatencyCount(), audioLatencyMean(), (long long)audioLatencyPercentile(50),
+		(long long)audioLatencyPercentile(90), (long long)audioLatencyPercentile(99), (long long)audioLatencyMax());
+}
+
+/////////////////////////// AudioLevelMeter ƽ ////////////////////////////////////////////////////
+AudioLevelMeter::AudioLevelMeter()
+	:intervalMs_(0), seq_(0)
+{
+	memset(&acc_, 0, sizeof(acc_));
+	memset(&snap_, 0, sizeof(snap_));
+	memset(sumsq_, 0, sizeof(sumsq_));
+}
+
+void AudioLevelMeter::audioMeterSetInterval(int interval_ms)
+{
+	intervalMs_ = interval_ms;
+}
+
+// float ûרŵ kernelɼزһ s16  fltp
+static void meter_flt_interleaved(const float *data, int channels, int n, float *peak, double *sumsq, int64_t *clipped)
+{
+	for (int c = 0; c < channels; c++) {
+		float p = peak[c], sum = 0;
+		for (int i = 0; i < n; i++) {
+			float v = data[i * channels + c];
+			p = FFMAX(p, fabsf(v));
+			sum += v * v;
+			clipped[c] += fabsf(v) >= 1.0f;
+		}
+		peak[c] = p;
+		sumsq[c] += sum;
+	}
+}
+
+void AudioLevelMeter::audioMeterFrame(const AVFrame *frame)
+{
+	int interval = intervalMs_.load(memory_order_relaxed);
+	if (interval <= 0 || !frame || frame->nb_samples <= 0 || frame->channels > AUDIO_METER_CHANNELS)
+		return;
+	const AudioDsp *dsp = audioDspGet();
+	int channels = frame->channels, n = frame->nb_samples;
+	switch (frame->format) {
+	case AV_SAMPLE_FMT_FLTP:
+		for (int c = 0; c < channels; c++)
+			dsp->levelsFlt((const float *)frame->extended_data[c], n, &acc_.peak[c], &sumsq_[c], &acc_.clipped[c]);
+		break;
+	case AV_SAMPLE_FMT_S16P:
+		for (int c = 0; c < channels; c++)
+			dsp->levelsS16((const int16_t *)frame->extended_data[c], 1, n, &acc_.peak[c], &sumsq_[c], &acc_.clipped[c]);
+		break;
+	case AV_SAMPLE_FMT_S16:
+		dsp->levelsS16((const int16_t *)frame->data[0], channels, n, acc_.peak, sumsq_, acc_.clipped);
+		break;
+	case AV_SAMPLE_FMT_FLT:
+		meter_flt_interleaved((const float *)frame->data[0], channels, n, acc_.peak, sumsq_, acc_.clipped);
+		break;
+	default:
+		return;
+	}
+	if (acc_.samples == 0)
+		acc_.pts = frame->pts;
+	acc_.channels = channels;
+	acc_.samples += n;
+	int rate = frame->sample_rate > 0 ? frame->sample_rate : 48000;
+	if (acc_.samples * 1000 >= (int64_t)interval * rate)
+		publish();
+}
+
+void AudioLevelMeter::publish()
+{
+	for (int c = 0; c < acc_.channels; c++)
+		acc_.rms[c] = (float)sqrt(sumsq_[c] / acc_.samples);
+	acc_.index++;
+	//seqlock: дĹ seq_ ߿ǰ seq_ һ¾ضдߴӲȴ
+	uint64_t seq = seq_.load(memory_order_relaxed);
+	seq_.store(seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	snap_ = acc_;
+	seq_.store(seq + 2, memory_order_release);
+	uint64_t index = acc_.index;
+	memset(&acc_, 0, sizeof(acc_));
+	memset(sumsq_, 0, sizeof(sumsq_));
+	acc_.index = index;
+}
+
+int AudioLevelMeter::audioMeterGet(AudioLevels *levels) const
+{
+	while (1) {
+		uint64_t seq = seq_.load(memory_order_acquire);
+		if (seq == 0)
+			return -1;
+		if (seq & 1)
+			continue;
+		*levels = snap_;
+		atomic_thread_fence(memory_order_acquire);
+		if (seq_.load(memory_order_relaxed) == seq)
+			return 0;
+	}
+}
+
+/////////////////////////// AudioBufferPool frame / packet  ///////////////////////////////////
+AudioBufferPool::~AudioBufferPool()
+{
+	// pools are freed once the last buffer is returned
+	for (map<int, AVBufferPool*>::iterator it = pools_.begin(); it != pools_.end(); ++it)
+		av_buffer_pool_uninit(&it->second);
+}
+
+AudioBufferPool* AudioBufferPool::audioPoolDefault()
+{
+	static AudioBufferPool pool;
+	return &pool;
+}
+
+#if FF_API_BUFFER_SIZE_T
+AVBufferRef* AudioBufferPool::poolAlloc(void *opaque, int size)
+#else
+AVBufferRef* AudioBufferPool::poolAlloc(void *opaque, size_t size)
+#endif
+{
+	// only called when the pool is empty
+	AudioBufferPool *pool = (AudioBufferPool *)opaque;
+	pool->misses_++;
+	return av_buffer_alloc(size);
+}
+
+AVBufferRef* AudioBufferPool::poolGet(int size)
+{
+	AVBufferPool *pool = NULL;
+	{
+		lock_guard<mutex> lock(lock_);
+		map<int, AVBufferPool*>::iterator it = pools_.find(size);
+		if (it != pools_.end()) {
+			pool = it->second;
+		} else {
+			pool = av_buffer_pool_init2(size, this, poolAlloc, NULL);
+			if (!pool)
+				return NULL;
+			pools_[size] = pool;
+		}
+	}
+	gets_++;
+	return av_buffer_pool_get(pool);
+}
+
+int AudioBufferPool::audioPoolGetBuffer(AVFrame *frame, int align)
+{
+	int planar = av_sample_fmt_is_planar((AVSampleFormat)frame->format);
+	int ret, i;
+
+	if (!frame->channels)
+		frame->channels = av_get_channel_layout_nb_channels(frame->channel_layout);
+	int planes = planar ? frame->channels : 1;
+	ret = av_samples_get_buffer_size(&frame->linesize[0], frame->channels,
+		frame->nb_samples, (AVSampleFormat)frame->format, align);
+	if (ret < 0)
+		return ret;
+
+	if (planes > AV_NUM_DATA_POINTERS) {
+		frame->extended_data = (uint8_t**)av_mallocz_array(planes, sizeof(*frame->extended_data));
+		frame->extended_buf = (AVBufferRef**)av_mallocz_array((planes - AV_NUM_DATA_POINTERS),
+			sizeof(*frame->extended_buf));
+		if (!frame->extended_data || !frame->extended_buf) {
+			av_freep(&frame->extended_data);
+			av_freep(&frame->extended_buf);
+			return AVERROR(ENOMEM);
+		}
+		frame->nb_extended_buf = planes - AV_NUM_DATA_POINTERS;
+	} else {
+		frame->extended_data = frame->data;
+	}
+
+	for (i = 0; i < FFMIN(planes, AV_NUM_DATA_POINTERS); i++) {
+		frame->buf[i] = poolGet(frame->linesize[0]);
+		if (!frame->buf[i]) {
+			av_frame_unref(frame);
+			return AVERROR(ENOMEM);
+		}
+		frame->extended_data[i] = frame->data[i] = frame->buf[i]->data;
+	}
+	for (i = 0; i < planes - AV_NUM_DATA_POINTERS; i++) {
+		frame->extended_buf[i] = poolGet(frame->linesize[0]);
+		if (!frame->extended_buf[i]) {
+			av_frame_unref(frame);
+			return AVERROR(ENOMEM);
+		}
+		frame->extended_data[i + AV_NUM_DATA_POINTERS] = frame->extended_buf[i]->data;
+	}
+	return 0;
+}
+
+int AudioBufferPool::audioPoolMakeWritable(AVFrame *frame)
+{
+	if (av_frame_is_writable(frame))
+		return 0;
+	// av_frame_unref() clears the audio params, keep them for the new buffer
+	uint64_t channel_layout = frame->channel_layout;
+	int channels = frame->channels;
+	int format = frame->format;
+	int nb_samples = frame->nb_samples;
+	int sample_rate = frame->sample_rate;
+	av_frame_unref(frame);
+	frame->channel_layout = channel_layout;
+	frame->channels = channels;
+	frame->format = format;
+	frame->nb_samples = nb_samples;
+	frame->sample_rate = sample_rate;
+	return audioPoolGetBuffer(frame, 0);
+}
+
+AVFrame* AudioBufferPool::audioPoolGetFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples)
+{
+	AVFrame *frame = av_frame_alloc();
+	if (!frame)
+		return NULL;
+	frame->channel_layout = channel_layout;
+	frame->format = format;
+	frame->nb_samples = nb_samples;
+	if (audioPoolGetBuffer(frame, 0) < 0) {
+		av_frame_free(&frame);
+		return NULL;
+	}
+	return frame;
+}
+
+int AudioBufferPool::audioPoolGetPacket(AVPacket *packet, int size)
+{
+	int pool_size = 1024;
+	while (pool_size < size + AV_INPUT_BUFFER_PADDING_SIZE)
+		pool_size <<= 1;
+	av_packet_unref(packet);
+	packet->buf = poolGet(pool_size);
+	if (!packet->buf)
+		return AVERROR(ENOMEM);
+	packet->data = packet->buf->data;
+	packet->size = size;
+	memset(packet->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+	return 0;
+}
+
+void AudioBufferPool::audioPoolGetStats(AudioPoolStats *stats)
+{
+	lock_guard<mutex> lock(lock_);
+	stats->gets = gets_;
+	stats->misses = misses_;
+	stats->pools = (int)pools_.size();
+}
+
+/////////////////////////// AudioCodecPool ĳ /////////////////////////////////////////
+AudioCodecPool::~AudioCodecPool()
+{
+	{
+		lock_guard<mutex> lock(lock_);
+		stop_ = true;
+	}
+	refillCond_.notify_one();
+	if (refiller_.joinable())
+		refiller_.join();
+	for (map<string, vector<AVCodecContext*> >::iterator it = idle_.begin(); it != idle_.end(); ++it)
+		for (size_t i = 0; i < it->second.size(); i++)
+			avcodec_free_context(&it->second[i]);
+}
+
+AudioCodecPool* AudioCodecPool::audioCodecPoolDefault()
+{
+	static AudioCodecPool pool;
+	return &pool;
+}
+
+string AudioCodecPool::poolKey(const AudioCodecConfig &config)
+{
+	char key[256];
+	string k;
+	if (config.encoder) {
+		snprintf(key, sizeof(key), "e/%s/%d/%d/%llx/%d/%lld/%x/", config.name.c_str(), config.format,
+			config.sampleRate, (unsigned long long)config.channelLayout, config.profile,
+			(long long)config.bitRate, config.flags);
+		k = key + config.options + "/";
+	} else {
+		//ʽprofile òЩֳֻûỰòе
+		snprintf(key, sizeof(key), "d/%s/%d/%llx/", config.name.c_str(), config.sampleRate,
+			(unsigned long long)config.channelLayout);
+		k = key;
+	}
+	for (size_t i = 0; i < config.extradata.size(); i++) {
+		snprintf(key, sizeof(key), "%02x", config.extradata[i]);
+		k += key;
+	}
+	return k;
+}
+
+AVCodecContext* AudioCodecPool::audioCodecOpen(const AudioCodecConfig &config)
+{
+	//avcodec_find_*_by_name ÿζɨһбֻ
+	static mutex lock;
+	static map<string, const AVCodec*> codecs;
+	const AVCodec *codec = NULL;
+	{
+		string name = (config.encoder ? "e/" : "d/") + config.name;
+		lock_guard<mutex> guard(lock);
+		map<string, const AVCodec*>::iterator it = codecs.find(name);
+		if (it != codecs.end()) {
+			codec = it->second;
+		} else {
+			codec = config.encoder ? avcodec_find_encoder_by_name(config.name.c_str()) :
+				avcodec_find_decoder_by_name(config.name.c_str());
+			codecs[name] = codec;
+		}
+	}
+	if (!codec) {
+		av_log(NULL, AV_LOG_ERROR, "audio not find %s : %s\n", config.encoder ? "encoder" : "decoder", config.name.c_str());
+		return NULL;
+	}
+	AVCodecContext *ctx = avcodec_alloc_context3(codec);
+	if (!ctx) {
+		av_log(NULL, AV_LOG_ERROR, "avcodec alloc ctx failed.\n");
+		return NULL;
+	}
+	ctx->sample_fmt = config.format;
+	ctx->channel_layout = config.channelLayout;
+	ctx->channels = av_get_channel_layout_nb_channels(config.channelLayout);
+	ctx->sample_rate = config.sampleRate;
+	ctx->bit_rate = config.bitRate;
+	ctx->profile = config.profile;
+	ctx->flags |= config.flags;
+	if (config.encoder) {
+		ctx->time_base.num = 1;   // pts ԲΪλ
+		ctx->time_base.den = config.sampleRate;
+	}
+	if (!config.extradata.empty()) {
+		ctx->extradata = (uint8_t *)av_mallocz(config.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+		if (!ctx->extradata) {
+			avcodec_free_context(&ctx);
+			return NULL;
+		}
+		memcpy(ctx->extradata, config.extradata.data(), config.extradata.size());
+		ctx->extradata_size = (int)config.extradata.size();
+	}
+	AVDictionary *options = NULL;
+	if (!config.options.empty() && av_dict_parse_string(&options, config.options.c_str(), "=", ":", 0) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "bad codec options %s.\n", config.options.c_str());
+		av_dict_free(&options);
+		avcodec_free_context(&ctx);
+		return NULL;
+	}
+	int ret = avcodec_open2(ctx, codec, &options);
+	if (ret != 0) {
+		av_log(NULL, AV_LOG_ERROR, "avcodec open 2 failed.\n");
+		av_dict_free(&options);
+		avcodec_free_context(&ctx);
+		return NULL;
+	}
+	AVDictionaryEntry *unused = av_dict_get(options, "", NULL, AV_DICT_IGNORE_SUFFIX);
+	if (unused)
+		av_log(NULL, AV_LOG_WARNING, "%s has no option %s.\n", config.name.c_str(), unused->key);
+	av_dict_free(&options);
+	return ctx;
+}
+
+AVCodecContext* AudioCodecPool::audioCodecPoolGet(const AudioCodecConfig &config)
+{
+	gets_++;
+	{
+		lock_guard<mutex> lock(lock_);
+		map<string, vector<AVCodecContext*> >::iterator it = idle_.find(poolKey(config));
+		if (it != idle_.end() && !it->second.empty()) {
+			AVCodecContext *ctx = it->second.back();
+			it->second.pop_back();
+			return ctx;
+		}
+	}
+	misses_++;
+	return audioCodecOpen(config);
+}
+
+void AudioCodecPool::audioCodecPoolPut(const AudioCodecConfig &config, AVCodecContext *ctx)
+{
+	if (!ctx)
+		return;
+	string key = poolKey(config);
+	if (av_codec_is_encoder(ctx->codec) && !(ctx->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH)) {
+		//ڲ״̬(صѧʿ)岻ͷŵµɲ̴߳򿪣߲ avcodec_open2
+		avcodec_free_context(&ctx);
+		lock_guard<mutex> lock(lock_);
+		if (stop_ || (int)idle_[key].size() + refilling_[key] >= maxIdle_)
+			return;
+		refilling_[key]++;
+		refill_.push_back(config);
+		if (!refiller_.joinable())
+			refiller_ = thread(&AudioCodecPool::refillLoop, this);
+		refillCond_.notify_one();
+		return;
+	}
+	{
+		lock_guard<mutex> lock(lock_);
+		if ((int)idle_[key].size() >= maxIdle_) {
+			avcodec_free_context(&ctx);
+			return;
+		}
+	}
+	avcodec_flush_buffers(ctx);
+	ctx->pkt_timebase = av_make_q(0, 1);
+	lock_guard<mutex> lock(lock_);
+	vector<AVCodecContext*> &idle = idle_[key];
+	if ((int)idle.size() < maxIdle_)
+		idle.push_back(ctx);
+	else
+		avcodec_free_context(&ctx);
+}
+
+void AudioCodecPool::refillLoop()
+{
+	unique_lock<mutex> lock(lock_);
+	for (;;) {
+		refillCond_.wait(lock, [this] { return stop_ || !refill_.empty(); });
+		if (stop_)
+			return;
+		AudioCodecConfig config = refill_.front();
+		refill_.pop_front();
+		string key = poolKey(config);
+		lock.unlock();
+		AVCodecContext *ctx = audioCodecOpen(config);
+		lock.lock();
+		refilling_[key]--;
+		if (!ctx)
+			continue;
+		reopens_++;
+		vector<AVCodecContext*> &idle = idle_[key];
+		if ((int)idle.size() < maxIdle_)
+			idle.push_back(ctx);
+		else
+			avcodec_free_context(&ctx);
+	}
+}
+
+int AudioCodecPool::audioCodecPoolWarm(const AudioCodecConfig &config, int count)
+{
+	string key = poolKey(config);
+	for (;;) {
+		{
+			lock_guard<mutex> lock(lock_);
+			if ((int)idle_[key].size() >= FFMIN(count, maxIdle_))
+				return 0;
+		}
+		AVCodecContext *ctx = audioCodecOpen(config);
+		if (!ctx)
+			return -1;
+		lock_guard<mutex> lock(lock_);
+		idle_[key].push_back(ctx);
+	}
+}
+
+void AudioCodecPool::audioCodecPoolSetMaxIdle(int count)
+{
+	lock_guard<mutex> lock(lock_);
+	maxIdle_ = FFMAX(count, 0);
+	for (map<string, vector<AVCodecContext*> >::iterator it = idle_.begin(); it != idle_.end(); ++it) {
+		while ((int)it->second.size() > maxIdle_) {
+			avcodec_free_context(&it->second.back());
+			it->second.pop_back();
+		}
+	}
+}
+
+void AudioCodecPool::audioCodecPoolGetStats(AudioCodecPoolStats *stats)
+{
+	lock_guard<mutex> lock(lock_);
+	stats->gets = gets_;
+	stats->misses = misses_;
+	stats->reopens = reopens_;
+	stats->idle = 0;
+	for (map<string, vector<AVCodecContext*> >::iterator it = idle_.begin(); it != idle_.end(); ++it)
+		stats->idle += (int)it->second.size();
+}
+
+/////////////////////////// AudioCapture ɼʵ /////////////////////////////////////////////////
+int AudioCapture::audioInit(uint64_t channel_layout, AVSampleFormat format, int samples)
 {
 	error[128] = { 0 };
 	av_register_all();
@@ -25,6 +562,7 @@ void AudioCapture::audioDeinit()
 	audioCloseDevice();
 	destoryFrame();
 	av_packet_free(&packet_);
+	av_dict_free(&options_);
 }
 void AudioCapture::destoryFrame()
 {
@@ -39,20 +577,20 @@ int AudioCapture::audioCloseDevice()
 
 	return 0;
 }
-int AudioCapture::createFrame(int channel_layout, AVSampleFormat format, int nb_samples)
+int AudioCapture::createFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples)
 {
 	frame_ = av_frame_alloc();
 	frame_->channel_layout = channel_layout;
 	frame_->format = format;
 	frame_->nb_samples = nb_samples;
-	int ret = av_frame_get_buffer(frame_, 0);
+	int ret = pool_->audioPoolGetBuffer(frame_, 0);
 	if (ret != 0){
 		av_strerror(ret, error, 128);
 		av_log(NULL, AV_LOG_ERROR, "open input failure.[%d][%s]\n", AVERROR(ret), error);
 		return -1;
 	}
-	printf("channel_layout:%d format:%d nb_samples:%d frame_->line_size:%d",
-		channel_layout, format, nb_samples, frame_->linesize[0]);
+	av_log(NULL, AV_LOG_DEBUG, "channel_layout:0x%llx format:%d nb_samples:%d frame_->line_size:%d\n",
+		(unsigned long long)channel_layout, format, nb_samples, frame_->linesize[0]);
 	return 0;
 }
 
@@ -64,45 +602,116 @@ int AudioCapture::audioOpenDevice()
 		return -1;
 	}
 
-	int ret = avformat_open_input(&fmtCtx_, deviceName_.c_str(), inputFmt, NULL);
+	int ret = avformat_open_input(&fmtCtx_, deviceName_.c_str(), inputFmt, &options_);
 	if (ret != 0) {
 		av_strerror(ret, error, 128);
 		av_log(NULL, AV_LOG_ERROR, "open input failure.[ret][%s]\n", AVERROR(ret), error);
 		return -1;
 	}
 	av_dump_format(fmtCtx_, 0, deviceName_.c_str(), 0);
+	sampleRate_ = fmtCtx_->nb_streams > 0 ? fmtCtx_->streams[0]->codecpar->sample_rate : 0;
+	setupPolling();
 	return 0;
 }
 
-int AudioCapture::audioCaptureFrame(AVFrame **frame)
+void AudioCapture::setupPolling()
+{
+	if (!fmtCtx_)
+		return;
+	//гʱʡģʽʱ豸 av_read_frame ȣʡ˯Զ߲
+	if (waitTimeoutMs_ >= 0 || powerSaveMs_ > 0)
+		fmtCtx_->flags |= AVFMT_FLAG_NONBLOCK;
+	else
+		fmtCtx_->flags &= ~AVFMT_FLAG_NONBLOCK;
+	// ûʱ 1/4 ֡ʱȥѣʡģʽõڻ
+	if (powerSaveMs_ > 0)
+		pollIntervalUs_ = (int64_t)powerSaveMs_ * 1000;
+	else if (sampleRate_ > 0 && frame_)
+		pollIntervalUs_ = FFMAX((int64_t)frame_->nb_samples * 1000000 / sampleRate_ / 4, 1000);
+}
+
+void AudioCapture::audioSetWaitTimeout(int timeout_ms)
+{
+	waitTimeoutMs_ = timeout_ms;
+	setupPolling();
+}
+
+void AudioCapture::audioSetPowerSave(int period_ms)
 {
-	static int read_size = -1;
-	static int write_size = 0;
-	//һƬ2184, ֻеһζʱ򣬻 while
-	while(read_size < 0) {
+	powerSaveMs_ = FFMAX(period_ms, 0);
+	setupPolling();
+}
+
+void AudioCapture::audioSetDeviceOption(const char *key, const char *value)
+{
+	av_dict_set(&options_, key, value, 0);
+}
+
+void AudioCapture::audioSetLoop(int loop)
+{
+	loop_ = loop;
+}
+
+int AudioCapture::audioReadPacket()
+{
+	int64_t deadline = waitTimeoutMs_ < 0 ? INT64_MAX : av_gettime_relative() + (int64_t)waitTimeoutMs_ * 1000;
+	while (1) {
+		av_packet_unref(packet_);
 		int ret = av_read_frame(fmtCtx_, packet_);
-		if (ret != 0) {
+		if (ret == AVERROR_EOF && loop_) {
+			if (av_seek_frame(fmtCtx_, -1, 0, AVSEEK_FLAG_BACKWARD) < 0)
+				return ret;
+			continue;
+		}
+		if (ret == 0)
+			packetIngestUs_ = av_gettime_relative();
+		if (ret != AVERROR(EAGAIN))
 			return ret;
+		//豸ʱûݣ˯ߵȴǿת
+		int64_t now = av_gettime_relative();
+		if (now >= deadline)
+			return AVERROR(EAGAIN);
+		av_usleep((unsigned)FFMIN(pollIntervalUs_, deadline - now));
+	}
+}
+
+int AudioCapture::audioCaptureFrame(AVFrame **frame)
+{
+	int frame_size = frame_->nb_samples * frame_->channels *
+		av_get_bytes_per_sample((AVSampleFormat)frame_->format); // 1024 * 2 * 2 = 4096
+	//һ֡(ŽС߳)ʱӻػһµ buffer
+	if (fillSize_ == 0 && pool_->audioPoolMakeWritable(frame_) < 0)
+		return AVERROR(ENOMEM);
+	//һ packet ü֡һƬ(2184)һ֡ʱһ packet  frame->data[0]
+	while (fillSize_ < frame_size) {
+		if (readSize_ <= 0) {
+			//ʧ(ʱ)ʱ frame_  fillSize_ һεý
+			int ret = audioReadPacket();
+			if (ret != 0) {
+				return ret;
+			}
+			audio_trace("read packet.size = %d, fill_size = %d\n", packet_->size, fillSize_);
+			readSize_ = packet_->size;
+			writeSize_ = 0;
 		}
-		printf("read packet.size = %d, read_size = %d\n", packet_->size, read_size);
-		//av_packet_unref(packet_);
-		read_size = packet_->size;
-		write_size = 0;
-	} 
-	if (read_size < 4096) { //һƬ 2184
-		memcpy(frame_->data[0], packet_->data + write_size, read_size);
-		av_read_frame(fmtCtx_, packet_); //һ֡ʱȡ packet ݣ frame->data[0]  4096 - read_size
-		printf("last read_size = %d\n", read_size);
-		int remain_len = 4096 - read_size;
-		memcpy(frame_->data[0] + read_size, packet_->data, remain_len);
-		read_size = packet_->size - remain_len; // packet  read_size  write_size
-		write_size = remain_len;
-	} else {
-		memcpy(frame_->data[0], packet_->data + write_size, 4096);
-		read_size -= 4096;
-		write_size += 4096;
+		if (fillSize_ == 0)
+			frameIngestUs_ = packetIngestUs_;   // ֡ĵһֽڵʱ
+		int len = FFMIN(readSize_, frame_size - fillSize_);
+		memcpy(frame_->data[0] + fillSize_, packet_->data + writeSize_, len);
+		fillSize_ += len;
+		readSize_ -= len;
+		writeSize_ += len;
 	}
-	
+	fillSize_ = 0;
+	// ptsͽϵͳʱ䣬һ
+	frame_->pts = nextPts_;
+	frame_->pkt_duration = frame_->nb_samples;
+	frame_->sample_rate = sampleRate_;
+	frame_->reordered_opaque = frameIngestUs_;
+	nextPts_ += frame_->nb_samples;
+	//տ frame ݻ cache ˳ƽ
+	meter_.audioMeterFrame(frame_);
+
 	//frame_->data[0]ĴСǲƵģŵһ֡
 	//frame_->linesize[0]С
     // pkt.size = 88200˺ü֡ݣֱdata[0]�Խ.
@@ -116,254 +725,441 @@ int AudioCapture::audioCaptureFrame(AVFrame **frame)
 /////////////////////////// AudioSample زʵ///////////////////////////////////////////////////////////////
 AudioSample::~AudioSample()
 {
-	if (srcData_)
-		av_freep(&srcData_[0]);
-	av_freep(srcData_);
-	if (dstData_)
-		av_freep(&dstData_[0]);
-	av_freep(dstData_);
+	av_frame_free(&frame_);
 	swr_free(&swrCtx_);
+	delete remix_;
+	delete decim_;
 }
 
 int AudioSample::audioSampleInit()
 {
+	uint64_t swr_in_layout = srcChLayout_;
+	swrOutLayout_ = dstChLayout_;
+	nextPts_ = AV_NOPTS_VALUE;
+	if (srcChLayout_ == dstChLayout_ && srcFormat_ == dstFormat_ &&
+		(srcFormat_ == AV_SAMPLE_FMT_S16 || srcFormat_ == AV_SAMPLE_FMT_FLTP) &&
+		AudioDecimator::audioDecimatorSupported(srcRate_, dstRate_)) {
+		//(48k/16k <-> 8k 绰·)ֻһ fir swr
+		decim_ = new AudioDecimator();
+		if (decim_->audioDecimatorInit(srcRate_, dstRate_, av_get_channel_layout_nb_channels(srcChLayout_)) == 0)
+			return 0;
+		delete decim_;
+		decim_ = NULL;
+	}
+	if (srcChLayout_ != dstChLayout_ && (srcFormat_ == AV_SAMPLE_FMT_FLTP || dstFormat_ == AV_SAMPLE_FMT_FLTP)) {
+		//任ŵ AudioRemix  simd ٵһswr ֻܲʺ͸ʽ
+		remix_ = new AudioRemix();
+		if (remix_->audioRemixInit(srcChLayout_, dstChLayout_, srcFormat_, dstFormat_) < 0) {
+			delete remix_;
+			remix_ = NULL;
+		} else {
+			int src_channels = av_get_channel_layout_nb_channels(srcChLayout_);
+			int dst_channels = av_get_channel_layout_nb_channels(dstChLayout_);
+			remixBefore_ = srcFormat_ == AV_SAMPLE_FMT_FLTP &&
+				(dst_channels <= src_channels || dstFormat_ != AV_SAMPLE_FMT_FLTP);
+			if (remixBefore_)
+				swr_in_layout = dstChLayout_;
+			else
+				swrOutLayout_ = srcChLayout_;
+		}
+	}
 	swrCtx_ = swr_alloc_set_opts(NULL,
-		dstChLayout_, dstFormat_, dstRate_,
-		srcChLayout_, srcFormat_, srcRate_,
+		swrOutLayout_, dstFormat_, dstRate_,
+		swr_in_layout, srcFormat_, srcRate_,
 		0, NULL);
 	if (!swrCtx_) {
 		av_log(NULL, AV_LOG_ERROR, "create swr ctx fail.\n");
 		return -1;
 	}
-	swr_init(swrCtx_);
-	audioSampleCreateData();
-	
-	return 0;
-}
-
-AVBufferRef* myav_buffer_alloc(int size)
-{
-	AVBufferRef* ret = NULL;
-	uint8_t* data = NULL;
-
-	data = (uint8_t*)av_malloc(size);
-	if (!data)
-		return NULL;
-
-	ret = av_buffer_create(data, size, av_buffer_default_free, NULL, 0);
-	if (!ret)
-		av_freep(&data);
-
-	return ret;
-}
-int my_get_audio_buffer(AVFrame* frame, int align)
-{
-	int channels;
-	int planar = av_sample_fmt_is_planar((AVSampleFormat)frame->format);
-	int planes;
-	int ret, i;
-
-	if (!frame->channels)
-		frame->channels = av_get_channel_layout_nb_channels(frame->channel_layout);
-
-	channels = frame->channels;
-	planes = planar ? channels : 1;
-
-	//CHECK_CHANNELS_CONSISTENCY(frame);
-	if (!frame->linesize[0]) {
-		ret = av_samples_get_buffer_size(&frame->linesize[0], channels,
-			frame->nb_samples, (AVSampleFormat)frame->format,
-			align);
-		if (ret < 0)
-			return ret;
-	}
-
-	if (planes > AV_NUM_DATA_POINTERS) {
-		frame->extended_data = (uint8_t**)av_mallocz_array(planes,
-			sizeof(*frame->extended_data));
-		frame->extended_buf = (AVBufferRef**)av_mallocz_array((planes - AV_NUM_DATA_POINTERS),
-			sizeof(*frame->extended_buf));
-		if (!frame->extended_data || !frame->extended_buf) {
-			av_freep(&frame->extended_data);
-			av_freep(&frame->extended_buf);
-			return AVERROR(ENOMEM);
-		}
-		frame->nb_extended_buf = planes - AV_NUM_DATA_POINTERS;
-	}
-	else
-		frame->extended_data = frame->data;
-
-	printf("FFMIN(planes, AV_NUM_DATA_POINTERS):%d\n", FFMIN(planes, AV_NUM_DATA_POINTERS));
-	for (i = 0; i < FFMIN(planes, AV_NUM_DATA_POINTERS); i++) {
-		printf("================(frame->linesize[0]:%d\n", frame->linesize[0]);
-		printf("i:%d buf[0]:%p\n", i, frame->buf[i]);
-		//frame->buf[i] = av_buffer_alloc(frame->linesize[0]);
-		frame->buf[i] = myav_buffer_alloc(frame->linesize[0]);
-		if (!frame->buf[i]) {
-			av_frame_unref(frame);
-			return AVERROR(ENOMEM);
-		}
-		frame->extended_data[i] = frame->data[i] = frame->buf[i]->data;
-	}
-	for (i = 0; i < planes - AV_NUM_DATA_POINTERS; i++) {
-		frame->extended_buf[i] = av_buffer_alloc(frame->linesize[0]);
-		if (!frame->extended_buf[i]) {
-			av_frame_unref(frame);
-			return AVERROR(ENOMEM);
-		}
-		frame->extended_data[i + AV_NUM_DATA_POINTERS] = frame->extended_buf[i]->data;
+	if (swr_init(swrCtx_) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "init swr ctx fail.\n");
+		return -1;
 	}
+	
 	return 0;
 }
 
-int AudioSample::createDstFrame(int channel_layout, AVSampleFormat format, int nb_samples)
+int AudioSample::createDstFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples)
 {
-	if (frame_) 
+	if (frame_ && nb_samples <= dstCapacity_) 
 		return 0;
-	frame_ = av_frame_alloc();
+	if (!frame_)
+		frame_ = av_frame_alloc();
+	else
+		av_frame_unref(frame_);   // resampler ݣŲˣӳﻻһ
 	frame_->channel_layout = channel_layout;
 	frame_->format = format;
 	frame_->nb_samples = nb_samples;
-	if (frame_->data[0])
-	{
-		av_freep(&frame_->data[0]);
-	}
 
-	int ret = my_get_audio_buffer(frame_, 0);
+	int ret = pool_->audioPoolGetBuffer(frame_, 0);
 	if (ret != 0) {
 		av_log(NULL, AV_LOG_ERROR, "open input failure.[%d][%s]\n", AVERROR(ret));
 		return -1;
 	}
-	frame_->nb_samples = nb_samples;
-	printf("channel_layout:%d format:%d nb_samples:%d frame_->line_size:%d", 
-		channel_layout, format, nb_samples, frame_->linesize[0]);
+	dstCapacity_ = nb_samples;
+	av_log(NULL, AV_LOG_DEBUG, "channel_layout:0x%llx format:%d nb_samples:%d frame_->line_size:%d\n",
+		(unsigned long long)channel_layout, format, nb_samples, frame_->linesize[0]);
 	return 0;
 }
 
-int AudioSample::audioSampleCreateData()
+int AudioSample::decimateConvert(AVFrame *srcFrame, AVFrame **dstFrame)
 {
-	// ز
-	av_samples_alloc_array_and_samples(
-		&dstData_, //ַ
-		&dstLen_, //С
-		av_get_channel_layout_nb_channels(dstChLayout_), //ͨ av_get_channel_layout_nb_channels(ch_layout)
-		1024,    // 4096(ֽ)/2(λ16 bit)/2ͨ
-		dstFormat_, //ʽ Ҫֽ,  ɼʱ frame->data ĳһ
-		0);
-	
-	// ز뻺
-	av_samples_alloc_array_and_samples(
-		&srcData_, //ַ
-		&srcLen_, //С
-		av_get_channel_layout_nb_channels(srcChLayout_), //ͨ av_get_channel_layout_nb_channels(ch_layout)
-		1024,    // 4096(ֽ)/2(λ16 bit)/2ͨ
-		srcFormat_, //ʽ Ҫֽ,  ɼʱ frame->data ĳһ
-		0);
-	printf("samples[%d] dstformaot[%d] dstChLayout_[%d] create sample dst data len = %d\n", 
-		1024, dstFormat_, dstChLayout_, dstLen_);
-	printf("samples[%d] srcformaot[%d] srcChLayout_[%d] create sample src data len = %d\n",
-		1024, srcFormat_, srcChLayout_, srcLen_, srcLen_);
+	const AudioDsp *dsp = audioDspGet();
+	int channels = av_get_channel_layout_nb_channels(srcChLayout_);
+	//srcFrame Ϊ NULL ʱιһξ fir ѹŵβͳ
+	int in_samples = srcFrame ? srcFrame->nb_samples : decim_->audioDecimatorDelay();
+	int out_samples = decim_->audioDecimatorOutSamples(in_samples);
+	if (channels > 64 || createDstFrame(dstChLayout_, dstFormat_, FFMAX(out_samples, 1)) < 0)
+		return -1;
+	frame_->nb_samples = dstCapacity_;
+	if (pool_->audioPoolMakeWritable(frame_) < 0)
+		return -1;
+	const float *in[64];
+	float *out[64];
+	int s16 = dstFormat_ == AV_SAMPLE_FMT_S16;
+	int in_float = srcFrame && !s16 ? 0 : channels * in_samples;
+	decimBuf_.resize(in_float + (s16 ? channels * out_samples : 0));
+	float *buf = decimBuf_.data();
+	for (int c = 0; c < channels; c++) {
+		if (srcFrame && !s16) {
+			in[c] = (const float *)srcFrame->extended_data[c];
+		} else {
+			float *plane = buf + c * in_samples;
+			const int16_t *src = srcFrame ? (const int16_t *)srcFrame->data[0] + c : NULL;
+			for (int i = 0; i < in_samples; i++)
+				plane[i] = src ? src[i * channels] * (1.0f / 32768) : 0;
+			in[c] = plane;
+		}
+		out[c] = s16 ? buf + in_float + c * out_samples : (float *)frame_->extended_data[c];
+	}
+	int nb_samples = decim_->audioDecimatorProcess(out, in, in_samples);
+	if (s16)
+		dsp->fltpToS16((int16_t *)frame_->data[0], out, channels, nb_samples);
+	frame_->nb_samples = nb_samples;
+	frame_->pkt_duration = nb_samples;
+	frame_->sample_rate = dstRate_;
+	// fir Ⱥӳ٣ swr ·һǰ
+	if (srcFrame && srcFrame->pts != AV_NOPTS_VALUE) {
+		int64_t pts = av_rescale_rnd(srcFrame->pts - decim_->audioDecimatorDelay(), dstRate_, srcRate_, AV_ROUND_NEAR_INF);
+		if (nextPts_ == AV_NOPTS_VALUE || FFABS(pts - nextPts_) > dstRate_ / 100)
+			nextPts_ = pts;
+	}
+	frame_->pts = nextPts_;
+	if (nextPts_ != AV_NOPTS_VALUE)
+		nextPts_ += nb_samples;
+	frame_->reordered_opaque = srcFrame ? srcFrame->reordered_opaque : AUDIO_NO_INGEST;
+	meter_.audioMeterFrame(frame_);
+
+	*dstFrame = frame_;
 	return 0;
 }
 
 int AudioSample::audioSampleConvert(AVFrame *srcFrame, AVFrame **dstFrame)
 {
-	int planar = 0;
-	
-	planar = av_sample_fmt_is_planar(srcFormat_);
-	printf(" sdfsdf srcFrame->linesize[0]:%d planar:%d\n", srcFrame->linesize[0], planar);
-	if (planar)
-	{
-		printf("srcFrame->linesize[0]:%d\n", srcFrame->linesize[0]);
-		int channels = av_get_channel_layout_nb_channels(srcChLayout_);
-		//plannarģʽsrcFrame->linesize[0]ŵÿͨĴСǴδȴͨܵsize
-		int plane_len = srcFrame->linesize[0]/channels;    // ÿݳ
-		for (int i = 0; i < channels; i++) {               // ÿдԴ
-			//ʱǴfltp->s16
-			//µķʽ⣬˴ȼ¼
-			memcpy((void*)(srcData_[0]+ plane_len*i), srcFrame->data[i], plane_len);
-		}
-	}
-	else
-	{
-		memcpy((void*)srcData_[0], srcFrame->data[0], srcFrame->linesize[0]);
+	if (decim_)
+		return decimateConvert(srcFrame, dstFrame);
+	if (srcFrame && remix_ && remixBefore_ && remix_->audioRemixFrame(srcFrame, &srcFrame) < 0)
+		return -1;
+	//srcFrame Ϊ NULL ʱ resampler ʣµ
+	const uint8_t **in = srcFrame ? (const uint8_t **)srcFrame->extended_data : NULL;
+	int in_samples = srcFrame ? srcFrame->nb_samples : 0;
+	//resampler ﻹѹŵ(Ϊλ)ĵһӦ pts ǰô
+	int64_t delay = swr_get_delay(swrCtx_, srcRate_);
+	int out_samples = swr_get_out_samples(swrCtx_, in_samples);
+	if (out_samples < 0 || createDstFrame(swrOutLayout_, dstFormat_, FFMAX(out_samples, 1)) < 0)
+		return -1;
+	//һ frame ʱһ buffer
+	frame_->nb_samples = dstCapacity_;
+	if (pool_->audioPoolMakeWritable(frame_) < 0)
+		return -1;
+	//ֱת frameپм仺Ҳضϳ 1024
+	int nb_samples = swr_convert(swrCtx_, frame_->extended_data, dstCapacity_, in, in_samples);
+	if (nb_samples < 0) {
+		av_log(NULL, AV_LOG_ERROR, "swr convert fail.\n");
+		return -1;
 	}
-	int nb_samples = swr_convert(swrCtx_, dstData_, 1024, (const uint8_t **)srcData_, 1024);
-	//int dst_linesize = 0;
-	//int dst_bufsize = av_samples_get_buffer_size(&dst_linesize, av_get_channel_layout_nb_channels(dstChLayout_),
-	//	nb_samples, dstFormat_, 0); 
-	
-	//printf("convert dst_bufsize = %d, dst_linesize = %d, nb_samples = %d\n", dst_bufsize, dst_linesize, nb_samples);
-	
-	printf("dstChLayout_:%d dstFormat_:%d nb_samples:%d\n", dstChLayout_, dstFormat_, nb_samples);
-	createDstFrame(dstChLayout_, dstFormat_, nb_samples);
-	planar = av_sample_fmt_is_planar(dstFormat_);
-	printf("planar:[%d]----convert create dst frame[0] size = %d\n", planar, frame_->linesize[0]);
-	if (planar) {
-		int channels = av_get_channel_layout_nb_channels(srcChLayout_);
-		int plane_len = frame_->linesize[0];               // ÿݳ
-		for (int i = 0; i < channels; i++) {               // ÿдԴ
-			memcpy(frame_->data[i], dstData_[0] + plane_len*i, plane_len);
-		}
-	} else {
-		memcpy(frame_->data[0], dstData_[0], frame_->linesize[0]);
+	audio_trace("dstChLayout_:0x%llx dstFormat_:%d nb_samples:%d delay:%lld\n",
+		(unsigned long long)dstChLayout_, dstFormat_, nb_samples, delay);
+	frame_->nb_samples = nb_samples;
+	frame_->pkt_duration = nb_samples;
+	frame_->sample_rate = dstRate_;
+	//pts ۼӣȷ pts ۼֵ 10ms (ɼжϡseek)ʱ¶
+	if (srcFrame && srcFrame->pts != AV_NOPTS_VALUE) {
+		int64_t pts = av_rescale_rnd(srcFrame->pts - delay, dstRate_, srcRate_, AV_ROUND_NEAR_INF);
+		if (nextPts_ == AV_NOPTS_VALUE || FFABS(pts - nextPts_) > dstRate_ / 100)
+			nextPts_ = pts;
 	}
+	frame_->pts = nextPts_;
+	if (nextPts_ != AV_NOPTS_VALUE)
+		nextPts_ += nb_samples;
+	frame_->reordered_opaque = srcFrame ? srcFrame->reordered_opaque : AUDIO_NO_INGEST;
+	AVFrame *out = frame_;
+	if (remix_ && !remixBefore_ && remix_->audioRemixFrame(frame_, &out) < 0)
+		return -1;
+	meter_.audioMeterFrame(out);
 	
-	*dstFrame = frame_;
+	*dstFrame = out;
 	return 0;
 }
 
 AudioEncode::~AudioEncode()
 {
+	AudioCodecPool::audioCodecPoolDefault()->audioCodecPoolPut(codecConfig_, encodecCtx_);
+	if (fifo_)
+		av_audio_fifo_free(fifo_);
+	av_frame_free(&fifoFrame_);
+	av_dict_free(&options_);
 }
 
-int AudioEncode::audioEncodeInit(AVSampleFormat encodeFormat, int encodeChLayout, int sampleRate, int bitRate, int profile)
+void AudioEncode::audioEncodeSetOption(const char *key, const char *value)
 {
-	AVCodec *codec = avcodec_find_encoder_by_name(encoderName_.c_str());
-	if (!codec) {
-		av_log(NULL, AV_LOG_ERROR, "audio not find encoder : %s\n", encoderName_.c_str());
-		return -1;
-	}
-	encodecCtx_ = avcodec_alloc_context3(codec);
-	if (!encodecCtx_) {
-		av_log(NULL, AV_LOG_ERROR, "avcodec alloc ctx failed.\n");
-		return -1;
-	}
-
-	audio_set_encodec_ctx(encodeFormat, encodeChLayout, sampleRate, bitRate, profile);
+	av_dict_set(&options_, key, value, 0);
+}
 
-	int ret = avcodec_open2(encodecCtx_, codec, NULL);
-	if (ret != 0) {
-		av_log(NULL, AV_LOG_ERROR, "avcodec open 2 failed.\n");
+int AudioEncode::audioEncodeInit(AVSampleFormat encodeFormat, uint64_t encodeChLayout, int sampleRate, int bitRate,
+	int profile)
+{
+	codecConfig_.name = encoderName_;
+	codecConfig_.encoder = 1;
+	codecConfig_.format = encodeFormat;
+	codecConfig_.sampleRate = sampleRate;
+	codecConfig_.channelLayout = encodeChLayout;
+	codecConfig_.profile = profile;
+	codecConfig_.bitRate = bitRate;
+	codecConfig_.flags = globalHeader_ ? AV_CODEC_FLAG_GLOBAL_HEADER : 0;
+	char *options = NULL;
+	if (av_dict_get_string(options_, &options, '=', ':') < 0)
 		return -1;
-	}
+	codecConfig_.options = options ? options : "";
+	av_freep(&options);
+	//Ĵӳãд򿪺õľʡ avcodec_open2
+	encodecCtx_ = AudioCodecPool::audioCodecPoolDefault()->audioCodecPoolGet(codecConfig_);
+	if (!encodecCtx_)
+		return -1;
+	const AVCodec *codec = encodecCtx_->codec;
 	av_init_packet(&packet_);
 	profile_ = profile;
 	channels_ = av_get_channel_layout_nb_channels(encodeChLayout);
 	sampleRate_ = sampleRate;
+	//̶֡ı(aac 1024opus 480/960)زС֡Ҫܹһ֡
+	if (encodecCtx_->frame_size > 0 && !(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)) {
+		fifo_ = av_audio_fifo_alloc(encodeFormat, channels_, encodecCtx_->frame_size * 2);
+		fifoFrame_ = av_frame_alloc();
+		if (!fifo_ || !fifoFrame_) {
+			av_log(NULL, AV_LOG_ERROR, "alloc encode fifo failed.\n");
+			return -1;
+		}
+	}
+	fifoSpanHead_ = 0;
+	fifoSpanCount_ = 0;
+	firstPts_ = AV_NOPTS_VALUE;
+	samplesIn_ = 0;
+	packetsOut_ = 0;
+	flush_ = 0;
 	return 0;
 }
 
 int AudioEncode::audioEncode(AVFrame *frame, AVPacket **packet)
+{
+	if (!frame) {
+		if (flush_ == 0)
+			flush_ = 1;
+		return receivePacket(packet);
+	}
+	//÷ȡ packet ʱ fifo һֱǣܵ޾Ͳ
+	if (fifo_ && av_audio_fifo_size(fifo_) >= encodecCtx_->frame_size * MAX_FIFO_FRAMES) {
+		av_log(NULL, AV_LOG_ERROR, "encode fifo full, call audioEncodeReceive() until EAGAIN.\n");
+		return AVERROR(ENOSPC);
+	}
+	if (firstPts_ == AV_NOPTS_VALUE)
+		firstPts_ = frame->pts;
+	samplesIn_ += frame->nb_samples;
+	int ret = AVERROR(EAGAIN);
+	//һ֡ǰҲûŵʱֱͱ
+	if (!fifo_ || (frame->nb_samples == encodecCtx_->frame_size && av_audio_fifo_size(fifo_) == 0))
+		ret = sendFrame(frame);
+	if (ret == AVERROR(EAGAIN) && fifo_) {
+		if (av_audio_fifo_size(fifo_) == 0)
+			fifoPts_ = frame->pts;
+		if (av_audio_fifo_write(fifo_, (void **)frame->extended_data, frame->nb_samples) < frame->nb_samples) {
+			av_log(NULL, AV_LOG_ERROR, "encode fifo write failed.\n");
+			return -1;
+		}
+		fifoPushIngest(frame->nb_samples, frame->reordered_opaque);
+	} else if (ret < 0) {
+		av_log(NULL, AV_LOG_ERROR, "avcodec send frame failed.\n");
+		return -1;
+	}
+	return receivePacket(packet);
+}
+
+int AudioEncode::audioEncodeReceive(AVPacket **packet)
+{
+	return receivePacket(packet);
+}
+
+int AudioEncode::sendFrame(AVFrame *frame)
 {
 	int ret = avcodec_send_frame(encodecCtx_, frame);
-	//ret >= 0˵óɹ
-	while (ret >= 0) {
+	if (ret == 0 && frame && frame->pts != AV_NOPTS_VALUE) {
+		//һ֡ pts Ͳɼʱ䣬 packet ʱ
+		if (pendingCount_ == MAX_PENDING) {
+			pendingHead_ = (pendingHead_ + 1) % MAX_PENDING;
+			pendingCount_--;
+		}
+		int tail = (pendingHead_ + pendingCount_) % MAX_PENDING;
+		pendingPts_[tail] = frame->pts;
+		pendingIngest_[tail] = frame->reordered_opaque;
+		pendingCount_++;
+	}
+	return ret;
+}
+
+void AudioEncode::fifoPushIngest(int samples, int64_t ingest)
+{
+	//˾ͲһΣһεĲɼʱϣȥ֡Եñʵ
+	if (fifoSpanCount_ == MAX_PENDING) {
+		fifoSpanSamples_[(fifoSpanHead_ + fifoSpanCount_ - 1) % MAX_PENDING] += samples;
+		return;
+	}
+	int tail = (fifoSpanHead_ + fifoSpanCount_) % MAX_PENDING;
+	fifoSpanSamples_[tail] = samples;
+	fifoSpanIngest_[tail] = ingest;
+	fifoSpanCount_++;
+}
+
+/*  fifo  samples 㣬ϵĲɼʱ */
+int64_t AudioEncode::fifoPopIngest(int samples)
+{
+	int64_t ingest = fifoSpanCount_ ? fifoSpanIngest_[fifoSpanHead_] : AUDIO_NO_INGEST;
+	while (samples > 0 && fifoSpanCount_) {
+		int take = FFMIN(samples, fifoSpanSamples_[fifoSpanHead_]);
+		fifoSpanSamples_[fifoSpanHead_] -= take;
+		samples -= take;
+		if (fifoSpanSamples_[fifoSpanHead_] == 0) {
+			fifoSpanHead_ = (fifoSpanHead_ + 1) % MAX_PENDING;
+			fifoSpanCount_--;
+		}
+	}
+	return ingest;
+}
+
+/*  fifo ȡһ֡ͱ frame_size ʱ EAGAINflush ʱʣµĲһ֡Ҳͣͽ */
+int AudioEncode::sendFifo()
+{
+	int frame_size = encodecCtx_->frame_size;
+	int avail = fifo_ ? av_audio_fifo_size(fifo_) : 0;
+	if (avail > 0 && (avail >= frame_size || flush_)) {
+		//ͽȥͱŵãfifoFrame_  buffer  ref һһ֡ãÿ֡ȥ
+		fifoFrame_->format = encodecCtx_->sample_fmt;
+		fifoFrame_->channel_layout = encodecCtx_->channel_layout;
+		fifoFrame_->nb_samples = frame_size;
+		if ((fifoFrame_->buf[0] ? pool_->audioPoolMakeWritable(fifoFrame_) : pool_->audioPoolGetBuffer(fifoFrame_, 0)) < 0)
+			return -1;
+		fifoFrame_->nb_samples = av_audio_fifo_read(fifo_, (void **)fifoFrame_->extended_data, FFMIN(avail, frame_size));
+		fifoFrame_->sample_rate = sampleRate_;
+		fifoFrame_->pts = fifoPts_;
+		fifoFrame_->pkt_duration = fifoFrame_->nb_samples;
+		fifoFrame_->reordered_opaque = fifoPopIngest(fifoFrame_->nb_samples);
+		if (fifoPts_ != AV_NOPTS_VALUE)
+			fifoPts_ += fifoFrame_->nb_samples;
+		return sendFrame(fifoFrame_);
+	}
+	if (flush_ == 1) {
+		flush_ = 2;
+		return sendFrame(NULL);
+	}
+	return AVERROR(EAGAIN);
+}
+
+int AudioEncode::receivePacket(AVPacket **packet)
+{
+	int ret;
+	while (1) {
 		ret = avcodec_receive_packet(encodecCtx_, &packet_);
-		//Ҫһֱȡ֪ʧܣΪܻкö֡Ҫ³
+		if (ret == 0)
+			break;      //ȡһpacket
+		if (ret == AVERROR_EOF)
+			return ret;
+		if (ret != AVERROR(EAGAIN))
+			return -1;  //ֵ˵ʧˡ
+		//Ҫݣ fifo ﲹ
+		ret = sendFifo();
+		if (ret == AVERROR(EAGAIN))
+			return ret;
 		if (ret < 0) {
-			//˵û֡ˣҪ
-			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-				break;
-			}
-			else {
-				return -1;//ֵ˵ʧˡ
+			av_log(NULL, AV_LOG_ERROR, "avcodec send frame failed.\n");
+			return -1;
+		}
+	}
+	//packet pts ͽ֡ initial_padding (ӳ)
+	lastIngestUs_ = AUDIO_NO_INGEST;
+	int64_t key = packet_.pts + encodecCtx_->initial_padding;
+	while (packet_.pts != AV_NOPTS_VALUE && pendingCount_ > 0 && pendingPts_[pendingHead_] <= key) {
+		lastIngestUs_ = pendingIngest_[pendingHead_];
+		pendingHead_ = (pendingHead_ + 1) % MAX_PENDING;
+		pendingCount_--;
+	}
+	if (lastIngestUs_ != AUDIO_NO_INGEST)
+		latency_.audioLatencyRecord(av_gettime_relative() - lastIngestUs_);
+
+	//gapless: ӳǰ packet һ֡油Ǿ
+	// skip samples ͷװ(m4a/mkv)ݴ˲õ
+	packetsOut_++;
+	int frame_size = encodecCtx_->frame_size > 0 ? encodecCtx_->frame_size : (int)packet_.duration;
+	if (firstPts_ != AV_NOPTS_VALUE && packet_.pts != AV_NOPTS_VALUE && frame_size > 0) {
+		int64_t end = firstPts_ + samplesIn_;
+		int64_t skip_start = av_clip64(firstPts_ - packet_.pts, 0, frame_size);
+		int64_t skip_end = flush_ ? av_clip64(packet_.pts + frame_size - end, 0, frame_size) : 0;
+		if (skip_start || skip_end) {
+			uint8_t *side = av_packet_new_side_data(&packet_, AV_PKT_DATA_SKIP_SAMPLES, 10);
+			if (side) {
+				AV_WL32(side, (uint32_t)skip_start);
+				AV_WL32(side + 4, (uint32_t)skip_end);
+				side[8] = 0;   // skip reason
+				side[9] = 0;   // discard reason
 			}
 		}
-		break;  //ȡһpacket
 	}
 	*packet = &packet_;
-	return ret;
+	return 0;
+}
+
+int AudioEncode::audioEncodeGetPriming() const
+{
+	return encodecCtx_ ? encodecCtx_->initial_padding : 0;
+}
+
+int AudioEncode::audioEncodeAdts() const
+{
+	return encodecCtx_ && encodecCtx_->codec_id == AV_CODEC_ID_AAC && sampleIndex.count(sampleRate_) &&
+		channels_ <= 7;
+}
+
+int AudioEncode::audioEncodeGetDelay() const
+{
+	if (!encodecCtx_)
+		return 0;
+	return FFMAX(encodecCtx_->frame_size, 0) + encodecCtx_->initial_padding;
+}
+
+void AudioEncode::audioEncodeGetGapless(int64_t *priming, int64_t *samples, int64_t *padding) const
+{
+	int frame_size = encodecCtx_ ? encodecCtx_->frame_size : 0;
+	*priming = audioEncodeGetPriming();
+	*samples = samplesIn_;
+	//ܳ packet  * frame_sizeȥǰӳٺʵʣµľĩβ
+	*padding = FFMAX(packetsOut_ * frame_size - *priming - samplesIn_, 0);
+}
+
+AVFrame* AudioEncode::audioEncodeGetFrame()
+{
+	//ɱ֡ıû frame_size 20ms
+	int nb_samples = encodecCtx_->frame_size > 0 ? encodecCtx_->frame_size : encodecCtx_->sample_rate / 50;
+	AVFrame *frame = pool_->audioPoolGetFrame(encodecCtx_->channel_layout, encodecCtx_->sample_fmt, nb_samples);
+	if (frame)
+		frame->sample_rate = encodecCtx_->sample_rate;
+	return frame;
 }
 
 /* |- syncword(12) ...             | ID(v)(1)|    layer(2)  | protection_absent(1)|  (16bit)
@@ -371,11 +1167,16 @@ int AudioEncode::audioEncode(AVFrame *frame, AVPacket **packet)
 ** | -channel_nb(2)|
 
 */
-void AudioEncode::packetAddHeader(char *aac_header, int frame_len)
+int AudioEncode::packetAddHeader(char *aac_header, int frame_len)
 {
-	int sampling_frequency_index = sampleIndex.at(sampleRate_);
-	printf("%d\n", sampling_frequency_index);
-	printf("add header sample rate :%d, index: %d\n", sampleRate_, sampling_frequency_index);
+	map<int, int>::const_iterator it = sampleIndex.find(sampleRate_);
+	if (it == sampleIndex.end()) {
+		av_log(NULL, AV_LOG_ERROR, "adts has no sampling frequency index for %d Hz.\n", sampleRate_);
+		return -1;
+	}
+	int sampling_frequency_index = it->second;
+	audio_trace("%d\n", sampling_frequency_index);
+	audio_trace("add header sample rate :%d, index: %d\n", sampleRate_, sampling_frequency_index);
 	//sync word
 	aac_header[0] = 0xff;         //syncword:0xfff                          8bits
 	aac_header[1] = 0xf0;         //syncword:0xfff                          4bits
@@ -387,14 +1188,16 @@ void AudioEncode::packetAddHeader(char *aac_header, int frame_len)
 	aac_header[1] |= 1;           //protection absent:1    set to 1 if there is no CRC and 0 if there is CRC
 	// also : aac_header[0] = 0xff; aac_header[1] = 0xf1;
 	//profile
-	aac_header[2] = (profile_+1) << 6;  //profile:profile  2bits   MPEG-4 Audio Object Type = profile + 1
+	//profile 2bits = MPEG-4 Audio Object Type - 1õ FF_PROFILE_AAC_*HE-AAC  adts ﰴ LC(ʽ SBR) 
+	int adts_profile = (profile_ < 0 || profile_ > FF_PROFILE_AAC_LTP) ? FF_PROFILE_AAC_LOW : profile_;
+	aac_header[2] = adts_profile << 6;
 	//sampling_frequency_index
 	aac_header[2] |= (sampling_frequency_index & 0x0f) << 2; //sampling_frequency_index 4bits ֻ4bitҪ &0x0fո4λ 
 	//private_bit
 	aac_header[2] |= (0 << 1);        //private_bit: 0   1bits      
 	//channels
 	aac_header[2] |= (channels_ & 0x04) >> 2;  //channel 1bit: &0000 0100ȡchannelsλ
-	aac_header[3] |= (channels_ & 0x03) << 6;  //&0000 0011ȡchannelsĵ2λ
+	aac_header[3] = (channels_ & 0x03) << 6;   //&0000 0011ȡchannelsĵ2λ, ֵ buffer һͷĲ
 
 	aac_header[3] |= (0 << 5);               //original0                1bit
 	aac_header[3] |= (0 << 4);               //home0                    1bit
@@ -409,61 +1212,58 @@ void AudioEncode::packetAddHeader(char *aac_header, int frame_len)
 	//buffer fullness 0x7FF ˵ʿɱ
 	aac_header[5] |= 0x1f;                                 //buffer fullness:0x7ff 5bits
 	aac_header[6] = 0xfc;      //?11111100?                  //buffer fullness:0x7ff 6bits
-	return ;
+	return 0;
 }
-void AudioEncode::packetAddHeader(char *aac_header, int profile, int sample_index, int channels, int frame_len)
+AudioDecode::~AudioDecode()
 {
-	int sampling_frequency_index = sampleIndex.at(sampleRate_);
-	printf("add header sample rate :%d, index: %d\n", sampleRate_, sampling_frequency_index);
-	//sync word
-	aac_header[0] = 0xff;         //syncword:0xfff                          8bits
-	aac_header[1] = 0xf0;         //syncword:0xfff                          4bits
-								  //ID
-	aac_header[1] |= (0 << 3);    //ID : 0 for MPEG-4 ;  1 for MPEG-2  
-								  //layer
-	aac_header[1] |= (0 << 1);    //Layer:0  always:00
-								  //protection absent
-	aac_header[1] |= 1;           //protection absent:1    ǰֽڵλΪ 1 
-								  // also : aac_header[0] = 0xff; aac_header[1] = 0xf1;
-								  //profile
-	aac_header[2] = (profile_) << 6;  //profile:profile  2bits
-									  //sampling_frequency_index
-	aac_header[2] |= (sampling_frequency_index & 0x0f) << 2; //sampling_frequency_index 4bits ֻ4bitҪ &0x0fո4λ 
-															 //private_bit
-	aac_header[2] |= (0 << 1);        //private_bit: 0   1bits      
-									  //channels
-	aac_header[2] |= (channels_ & 0x04) >> 2;  //channel 1bit: &0000 0100ȡchannelsλ
-	aac_header[3] |= (channels_ & 0x03) << 6;  //&0000 0011ȡchannelsĵ2λ
-
-	aac_header[3] |= (0 << 5);               //original0                1bit
-	aac_header[3] |= (0 << 4);               //home0                    1bit
-	aac_header[3] |= (0 << 3);               //copyright id bit0        1bit
-	aac_header[3] |= (0 << 2);               //copyright id start0      1bit
-
-											 //frame len һADTS֡ĳȰADTSͷAACԭʼ
-	int adtsLen = frame_len + 7;
-	aac_header[3] |= ((adtsLen & 0x1800) >> 11);           //frame lengthvalue   2bits 
-	aac_header[4] = (uint8_t)((adtsLen & 0x7f8) >> 3);     //frame length:value    м8bits
-	aac_header[5] = (uint8_t)((adtsLen & 0x7) << 5);       //frame length:value    3bits
-														   //buffer fullness 0x7FF ˵ʿɱ
-	aac_header[5] |= 0x1f;                                 //buffer fullness:0x7ff 5bits
-	aac_header[6] = 0xfc;      //?11111100?                  //buffer fullness:0x7ff 6bits
-	return;
+	//ĻسĻỰãصָ
+	if (decodecCtx_) {
+		decodecCtx_->opaque = NULL;
+		decodecCtx_->get_buffer2 = avcodec_default_get_buffer2;
+	}
+	AudioCodecPool::audioCodecPoolDefault()->audioCodecPoolPut(codecConfig_, decodecCtx_);
+	av_frame_free(&decframe_);
+	av_frame_free(&s16Frame_);
+	for (int i = 0; i < AV_NUM_DATA_POINTERS; i++)
+		av_buffer_unref(&spareBuf_[i]);
 }
-void AudioEncode::audio_set_encodec_ctx(AVSampleFormat encodeFormat, int encodeChLayout,
-										 int sampleRate, int bitRate, int profile)
+
+/* һ֡ buffer ߲ʱ AVBufferRef һһ֡avcodec_receive_frame()
+**  av_frame_unref ͷŲҪ avcodec_send_packet ֮ǰѾһ֡ */
+void AudioDecode::keepBuffers()
 {
-	encodecCtx_->sample_fmt = encodeFormat;
-	encodecCtx_->channel_layout = encodeChLayout;
-	encodecCtx_->sample_rate = sampleRate;
-	encodecCtx_->bit_rate = bitRate;
-	encodecCtx_->profile = profile;
-	encodecCtx_->channels = av_get_channel_layout_nb_channels(encodeChLayout);
+	for (int i = 0; i < AV_NUM_DATA_POINTERS && decframe_; i++) {
+		if (decframe_->buf[i] && !spareBuf_[i] && av_buffer_is_writable(decframe_->buf[i])) {
+			spareBuf_[i] = decframe_->buf[i];
+			decframe_->buf[i] = NULL;
+		}
+	}
 }
 
-
-AudioDecode::~AudioDecode()
+/*  get_buffer2 ref ֱӹҵ֡ϣ mallocٴӻ */
+int AudioDecode::decodeGetBuffer(AVCodecContext *ctx, AVFrame *frame, int /*flags*/)
 {
+	AudioDecode *decode = (AudioDecode *)ctx->opaque;
+	int planar = av_sample_fmt_is_planar((AVSampleFormat)frame->format);
+	if (!frame->channels)
+		frame->channels = av_get_channel_layout_nb_channels(frame->channel_layout);
+	int planes = planar ? frame->channels : 1;
+	int ret = av_samples_get_buffer_size(&frame->linesize[0], frame->channels, frame->nb_samples,
+		(AVSampleFormat)frame->format, 0);
+	if (ret < 0)
+		return ret;
+	int reuse = planes > 0 && planes <= AV_NUM_DATA_POINTERS;
+	for (int i = 0; i < planes && reuse; i++)
+		reuse = decode->spareBuf_[i] && decode->spareBuf_[i]->size >= frame->linesize[0];
+	if (!reuse)
+		return decode->pool_->audioPoolGetBuffer(frame, 0);
+	for (int i = 0; i < planes; i++) {
+		frame->buf[i] = decode->spareBuf_[i];
+		decode->spareBuf_[i] = NULL;
+		frame->data[i] = frame->buf[i]->data;
+	}
+	frame->extended_data = frame->data;
+	return 0;
 }
 
 int AudioDecode::AudioDecodeInit(AVSampleFormat decodeFormat, uint64_t decodeChLayout, 
@@ -474,73 +1274,51 @@ int AudioDecode::AudioDecodeInit(AVSampleFormat decodeFormat, uint64_t decodeChL
 	profile_ = profile;
 	channellayout_ = decodeChLayout;
 
-	AVCodec* codec = avcodec_find_decoder_by_name(decoderName_.c_str());
-	if (!codec) {
-		av_log(NULL, AV_LOG_ERROR, "audio not find encoder : %s\n", decoderName_.c_str());
-		return -1;
-	}
-	decodecCtx_ = avcodec_alloc_context3(codec);
-	if (!decodecCtx_) {
-		av_log(NULL, AV_LOG_ERROR, "avcodec alloc ctx failed.\n");
+	//룺aac_fixed ȫ㣬 s32p
+	codecConfig_.name = fixed_ && decoderName_ == "aac" ? "aac_fixed" : decoderName_;
+	codecConfig_.encoder = 0;
+	codecConfig_.format = decodeFormat;
+	codecConfig_.sampleRate = sampleRate;
+	codecConfig_.channelLayout = decodeChLayout;
+	codecConfig_.profile = profile;
+	codecConfig_.bitRate = bitRate;
+	codecConfig_.extradata = extradata_;
+	decodecCtx_ = AudioCodecPool::audioCodecPoolDefault()->audioCodecPoolGet(codecConfig_);
+	if (!decodecCtx_)
 		return -1;
-	}
-
-	audio_set_decodec_ctx(decodeFormat, decodeChLayout, sampleRate, bitRate, profile);
-
-	int ret = avcodec_open2(decodecCtx_, codec, NULL);
-	if (ret != 0) {
-		av_log(NULL, AV_LOG_ERROR, "avcodec open 2 failed.\n");
-		return -1;
-	}
+	// frame Ҳӻ buffer
+	decodecCtx_->opaque = this;
+	decodecCtx_->get_buffer2 = decodeGetBuffer;
 	av_init_packet(&packet_);
-	createdecFrame(decodeChLayout, decodeFormat, 1024);
+	//֡ɽ(aac 1024opus 120~2880)buffer ʱӳãֻ frame
+	if (createdecFrame(decodeChLayout, decodeFormat) < 0)
+		return -1;
 
 	return 0;
 }
 
-void AudioDecode::audio_set_decodec_ctx(AVSampleFormat decodeFormat, uint64_t decodeChLayout,
-	int sampleRate, int bitRate, int profile)
-{
-	decodecCtx_->sample_fmt = decodeFormat;
-	decodecCtx_->channel_layout = decodeChLayout;
-	decodecCtx_->sample_rate = sampleRate;
-	decodecCtx_->bit_rate = bitRate;
-	decodecCtx_->profile = profile;
-	decodecCtx_->channels = av_get_channel_layout_nb_channels(decodeChLayout);
-}
-
 AVFrame* AudioDecode::createFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples)
 {
-	AVFrame *frame = NULL;
-
-	frame = av_frame_alloc();
-	frame->channel_layout = channel_layout;
-	frame->format = format;
-	frame->nb_samples = nb_samples;
-	int ret = av_frame_get_buffer(frame, 0);
-	if (ret != 0) {
-		av_log(NULL, AV_LOG_ERROR, "open input failure.[%d][%s]\n", AVERROR(ret));
+	AVFrame *frame = pool_->audioPoolGetFrame(channel_layout, format, nb_samples);
+	if (!frame) {
+		av_log(NULL, AV_LOG_ERROR, "create frame failure.\n");
 		return NULL;
 	}
 	return frame;
 }
 
-int AudioDecode::createdecFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples)
+int AudioDecode::createdecFrame(uint64_t channel_layout, AVSampleFormat format)
 {
 	if (decframe_)
 		return 0;
 	decframe_ = av_frame_alloc();
-	decframe_->channel_layout = channel_layout;
-	decframe_->format = format;
-	decframe_->nb_samples = nb_samples;
-	printf("channel_layout:%d\n", channel_layout);
-	printf("format:%d\n", format);
-	printf("nb_samples:%d\n", nb_samples);
-	int ret = av_frame_get_buffer(decframe_, 0);
-	if (ret != 0) {
-		av_log(NULL, AV_LOG_ERROR, "open input failure.[%d][%s]\n", AVERROR(ret));
+	if (!decframe_) {
+		av_log(NULL, AV_LOG_ERROR, "create decode frame failure.\n");
 		return -1;
 	}
+	decframe_->channel_layout = channel_layout;
+	decframe_->format = format;
+	av_log(NULL, AV_LOG_DEBUG, "channel_layout:0x%llx format:%d\n", (unsigned long long)channel_layout, format);
 	return 0;
 }
 
@@ -576,7 +1354,8 @@ int AudioDecode::createInstream(string filename)
 
 int AudioDecode::audiodecode_()
 {
-	printf("packet_:%d\n", packet_.size);
+	audio_trace("packet_:%d\n", packet_.size);
+	keepBuffers();
 	int ret = avcodec_send_packet(decodecCtx_, &packet_);
 	//ret >= 0˵óɹ
 	while (ret >= 0) {
@@ -591,11 +1370,99 @@ int AudioDecode::audiodecode_()
 				return -1;//ֵ˵ʧˡ
 			}
 		}
+		decodeTimestamp(decframe_);
 		break;  //ȡһpacket
 	}
 	return ret;
 }
 
+/* ֡ pts ͳһԲΪλadts ûʱİţ
+** ͷҪıӳ٣ʣµŲ buffer ͷָ벻 simd ҪĶ
+** (ֻпͷһ֡)֡ʱ EAGAIN */
+int AudioDecode::decodeTimestamp(AVFrame *frame)
+{
+	if (frame->pts != AV_NOPTS_VALUE && decodecCtx_->pkt_timebase.num && frame->sample_rate > 0)
+		frame->pts = av_rescale_q(frame->pts, decodecCtx_->pkt_timebase, av_make_q(1, frame->sample_rate));
+	if (frame->pts == AV_NOPTS_VALUE)
+		frame->pts = nextPts_;
+	if (skipSamples_ > 0) {
+		int skip = FFMIN(skipSamples_, frame->nb_samples);
+		int planar = av_sample_fmt_is_planar((AVSampleFormat)frame->format);
+		int planes = planar ? frame->channels : 1;
+		int sample_size = av_get_bytes_per_sample((AVSampleFormat)frame->format) * (planar ? 1 : frame->channels);
+		if (skip < frame->nb_samples) {
+			if (av_frame_make_writable(frame) < 0)
+				return -1;
+			for (int i = 0; i < planes; i++)
+				memmove(frame->extended_data[i], frame->extended_data[i] + skip * sample_size,
+					(frame->nb_samples - skip) * sample_size);
+		}
+		frame->nb_samples -= skip;
+		frame->pts += skip;
+		skipSamples_ -= skip;
+	}
+	frame->pkt_duration = frame->nb_samples;
+	nextPts_ = frame->pts + frame->nb_samples;
+	return frame->nb_samples > 0 ? 0 : AVERROR(EAGAIN);
+}
+
+int AudioDecode::audioDecodePacket(AVPacket *packet, AVFrame **dst_frame)
+{
+	keepBuffers();
+	int ret = avcodec_send_packet(decodecCtx_, packet);
+	if (ret < 0 && ret != AVERROR(EAGAIN)) {
+		av_log(NULL, AV_LOG_ERROR, "avcodec send packet failed.\n");
+		return -1;
+	}
+	ret = avcodec_receive_frame(decodecCtx_, decframe_);
+	if (ret < 0)
+		return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? ret : -1;
+	if (decodeTimestamp(decframe_) < 0)
+		return AVERROR(EAGAIN);
+	return interleaveFrame(decframe_, dst_frame);
+}
+
+/* Ҫ s16 ʱѽƽʽֱӽ֯ s16һ simd kernel swr */
+int AudioDecode::interleaveFrame(AVFrame *frame, AVFrame **dst_frame)
+{
+	AVSampleFormat format = (AVSampleFormat)frame->format;
+	if (decodeFormat_ != AV_SAMPLE_FMT_S16 || format == AV_SAMPLE_FMT_S16) {
+		*dst_frame = frame;
+		return 0;
+	}
+	if (format != AV_SAMPLE_FMT_FLTP && format != AV_SAMPLE_FMT_S16P && format != AV_SAMPLE_FMT_S32P) {
+		av_log(NULL, AV_LOG_ERROR, "no s16 interleave for %s.\n", av_get_sample_fmt_name(format));
+		return -1;
+	}
+	if (!s16Frame_ || frame->nb_samples > s16Capacity_ || frame->channels != s16Frame_->channels) {
+		uint64_t layout = frame->channel_layout ? frame->channel_layout : av_get_default_channel_layout(frame->channels);
+		av_frame_free(&s16Frame_);
+		s16Frame_ = createFrame(layout, AV_SAMPLE_FMT_S16, frame->nb_samples);
+		if (!s16Frame_)
+			return -1;
+		s16Capacity_ = frame->nb_samples;
+	}
+	//һ֡ʱһ buffer
+	s16Frame_->nb_samples = s16Capacity_;
+	if (pool_->audioPoolMakeWritable(s16Frame_) < 0)
+		return -1;
+	const AudioDsp *dsp = audioDspGet();
+	int16_t *dst = (int16_t *)s16Frame_->data[0];
+	if (format == AV_SAMPLE_FMT_FLTP)
+		dsp->fltpToS16(dst, (const float *const *)frame->extended_data, frame->channels, frame->nb_samples);
+	else if (format == AV_SAMPLE_FMT_S16P)
+		dsp->s16pToS16(dst, (const int16_t *const *)frame->extended_data, frame->channels, frame->nb_samples);
+	else
+		dsp->s32pToS16(dst, (const int32_t *const *)frame->extended_data, frame->channels, frame->nb_samples);
+	s16Frame_->nb_samples = frame->nb_samples;
+	s16Frame_->pts = frame->pts;
+	s16Frame_->pkt_duration = frame->pkt_duration;
+	s16Frame_->sample_rate = frame->sample_rate;
+	s16Frame_->reordered_opaque = frame->reordered_opaque;
+	*dst_frame = s16Frame_;
+	return 0;
+}
+
 int get_aac_frame_len(UINT8* aac_header)
 {
 	int size = 0;
@@ -608,7 +1475,7 @@ int get_aac_frame_len(UINT8* aac_header)
 	size |= (aac_header[3] & 0b00000011) << 11; //0x03  ǰλҪƵλ13 - 11 = 2 
 	size |= aac_header[4] << 3;                //м8bit,ҪƵǰλ13 - 2 = 11 - 8 = 3
 	size |= (aac_header[5] & 0b11100000) >> 5; //0xe0 3BitҪƵ 
-	printf("size:%d\n", size);
+	audio_trace("size:%d\n", size);
 	return size;
 }
 
@@ -618,16 +1485,19 @@ int AudioDecode::audiodecode(AVFrame **dst_frame)
 	
 	if (decode_type)
 	{
+		av_packet_unref(&packet_);
 		ret = av_read_frame(fmtCtx_, &packet_);
 		if (ret < 0)
 		{
 			av_log(NULL, AV_LOG_ERROR, "av_read_frame error over read file over!\n");
 			return ret;
 		}
+		//demuxer ʱ skip samplesdecodeTimestamp ɲ
+		decodecCtx_->pkt_timebase = fmtCtx_->streams[packet_.stream_index]->time_base;
 	}
 	else
 	{
-		UINT8 aac_data[2048] = { 0 };
+		UINT8 aac_data[7] = { 0 };
 		int aac_frame_len = 0;
 		ret = fread(aac_data, 1, 7, in_fd); //aac header 7ֽ
 		if (ret <= 0)
@@ -637,28 +1507,27 @@ int AudioDecode::audiodecode(AVFrame **dst_frame)
 			return ret;
 		}
 		aac_frame_len = get_aac_frame_len(aac_data);
-		printf("aac_frame_len:%d\n", aac_frame_len);
-		ret = fread(aac_data+7, 1, aac_frame_len - 7, in_fd);
-		if (ret <= 0)
+		audio_trace("aac_frame_len:%d\n", aac_frame_len);
+		//packet ֱӶص bufferÿ֡ av_malloc
+		if (pool_->audioPoolGetPacket(&packet_, aac_frame_len) != 0)
 		{
-			av_log(NULL, AV_LOG_ERROR, "read over !\n");
-			return ret;
+			av_log(NULL, AV_LOG_ERROR, "get pool packet error!\n");
+			return -1;
 		}
-		packet_.size = aac_frame_len;
-		if (packet_.data)
-			packet_.data = (uint8_t*)av_malloc(2048);
-		//memcpy(packet_.data, aac_data, aac_frame_len);
-		int ret = av_packet_from_data(&packet_, aac_data, packet_.size);
-		if (ret != 0)
+		memcpy(packet_.data, aac_data, 7);
+		ret = fread(packet_.data + 7, 1, aac_frame_len - 7, in_fd);
+		if (ret <= 0)
 		{
-			av_log(NULL, AV_LOG_ERROR, "av_packet_from_data error!\n");
+			av_log(NULL, AV_LOG_ERROR, "read over !\n");
 			return ret;
 		}
 	}
-	printf("[%x][%x][%x][%x][%x][%x][%x]\n",
+	audio_trace("[%x][%x][%x][%x][%x][%x][%x]\n",
 		packet_.data[0], packet_.data[1], packet_.data[2], packet_.data[3], packet_.data[4], packet_.data[5], packet_.data[6]);
 	audiodecode_();
 	*dst_frame = decframe_;
+	if (decframe_->nb_samples > 0 && interleaveFrame(decframe_, dst_frame) < 0)
+		return -1;
 	//if (packet_.data)
 	//{
 	//	av_free(packet_.data);
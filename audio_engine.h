@@ -5,6 +5,12 @@
 #endif
 #include <iostream>
 #include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <condition_variable>
 extern "C"
 {
 #include "libavcodec/avcodec.h"
@@ -17,9 +23,217 @@ extern "C"
 #include "libavutil/samplefmt.h"
 #include "libavutil/mem.h"
 #include "libavutil/buffer.h"
+#include "libavutil/time.h"
+#include "libavutil/audio_fifo.h"
+#include "libavutil/intreadwrite.h"
 }
 
 using namespace std;
+
+
+/* ÿ֡ߵĵĬϹصʱ AUDIO_ENGINE_TRACE  */
+#ifdef AUDIO_ENGINE_TRACE
+#define audio_trace printf
+#else
+#define audio_trace(...)
+#endif
+
+/*
+** @brief ʱԼ: frame / packet  pts ԲΪλ (time_base = 1/sample_rate)
+** AVFrame.reordered_opaque ֡ϵͳ(ɼ)ĵʱ av_gettime_relative()λ us
+** AudioSample ԭ frameAudioEncode Ӧ packet  (audioEncodeIngestTime())
+*/
+#define AUDIO_NO_INGEST AV_NOPTS_VALUE
+
+/*
+** @brief AudioLatencyStats latency histogram in microseconds, 8 log buckets per octave (~9% resolution),
+** constant memory, lock free record() so it can sit on the real-time path.
+*/
+class AudioLatencyStats {
+public:
+	AudioLatencyStats() { audioLatencyReset(); }
+public:
+	void    audioLatencyRecord(int64_t us);
+	void    audioLatencyReset();
+	int64_t audioLatencyCount() const { return count_; }
+	int64_t audioLatencyMax() const { return max_; }
+	double  audioLatencyMean() const { return count_ ? (double)sum_ / count_ : 0; }
+	/* p in [0, 100], returns the lower bound of the bucket holding the p-th percentile */
+	int64_t audioLatencyPercentile(double p) const;
+	/* one line: count / mean / p50 / p90 / p99 / max */
+	void    audioLatencyPrint(const char *name) const;
+private:
+	enum { BUCKETS = 8 * 40 };
+	atomic<int64_t> buckets_[BUCKETS];
+	atomic<int64_t> count_;
+	atomic<int64_t> sum_;
+	atomic<int64_t> max_;
+};
+
+#define AUDIO_METER_CHANNELS 8
+
+/*
+** @brief AudioLevels one metering interval, per channel peak / rms (full scale 1.0) and clipped samples
+*/
+struct AudioLevels {
+	int      channels;
+	int64_t  samples;      // per channel, in the interval
+	int64_t  pts;          // first sample of the interval
+	uint64_t index;        // 1, 2, 3 ... one per interval, a gap means the reader missed some
+	float    peak[AUDIO_METER_CHANNELS];
+	float    rms[AUDIO_METER_CHANNELS];
+	int64_t  clipped[AUDIO_METER_CHANNELS];
+};
+
+/*
+** @brief AudioLevelMeter peak / rms / clip meter that AudioCapture and AudioSample run on every frame
+** while the samples are still in cache (AudioDsp kernels), off until audioSetMeter() /
+** audioSampleSetMeter() gives it an interval. every interval the totals are published as a
+** snapshot any thread can read: a sequence lock, the writer never waits, a reader that raced with a
+** publish copies again.
+*/
+class AudioLevelMeter {
+public:
+	AudioLevelMeter();
+public:
+	/* snapshot interval, 0 turns metering off (the default) */
+	void audioMeterSetInterval(int interval_ms);
+	/* levels of one s16 / s16p / flt / fltp frame, on the thread producing the frames */
+	void audioMeterFrame(const AVFrame *frame);
+	/* the latest snapshot, any thread. -1 before the first interval completed */
+	int  audioMeterGet(AudioLevels *levels) const;
+private:
+	void publish();
+private:
+	atomic<int>      intervalMs_;
+	AudioLevels      acc_;         // the running interval, writer only
+	double           sumsq_[AUDIO_METER_CHANNELS];
+	atomic<uint64_t> seq_;         // odd while snap_ is being written
+	AudioLevels      snap_;
+};
+
+/*
+** @brief AudioPoolStats AudioBufferPool counters, hits = gets - misses
+*/
+struct AudioPoolStats {
+	int64_t gets;      // buffers handed out
+	int64_t misses;    // gets that had to av_malloc a new buffer
+	int     pools;     // distinct buffer sizes
+};
+
+/*
+** @brief AudioBufferPool AVBufferPool backed frame / packet buffers, one AVBufferPool per buffer size.
+** a released buffer goes back to its pool instead of av_free, so the sample / payload buffers of frames
+** and packets that outlive one call (queues, threads) are not reallocated in steady state. thread safe.
+** not allocation free: every get still av_mallocs its AVBufferRef (av_buffer_pool_get(), ffmpeg 4.4 has
+** no way around it), so the engine keeps the frames it owns (capture, resample, encoder fifo, decoder
+** output) together with their refs while nobody else holds them and only gets when it must.
+** libavcodec / libavformat allocate on their own: encoder packets, the refs avcodec_send_frame() /
+** avcodec_send_packet() take, demuxer packets.
+** audio_bench --filter=allocs prints the count per frame, audio_alloc_check the call sites.
+** audioPoolDefault() is shared by AudioCapture, AudioSample, AudioEncode and AudioDecode.
+*/
+class AudioBufferPool {
+public:
+	AudioBufferPool() : gets_(0), misses_(0) {}
+	~AudioBufferPool();
+public:
+	static AudioBufferPool* audioPoolDefault();
+	/* like av_frame_get_buffer(): format, nb_samples and channel_layout must be set */
+	int      audioPoolGetBuffer(AVFrame *frame, int align);
+	/* give frame a fresh pooled buffer if someone else still holds a reference to the current one */
+	int      audioPoolMakeWritable(AVFrame *frame);
+	AVFrame* audioPoolGetFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples);
+	/* like av_new_packet(), sizes are rounded up to a power of two so packets share few pools */
+	int      audioPoolGetPacket(AVPacket *packet, int size);
+	void     audioPoolGetStats(AudioPoolStats *stats);
+private:
+	AVBufferRef* poolGet(int size);
+#if FF_API_BUFFER_SIZE_T
+	static AVBufferRef* poolAlloc(void *opaque, int size);
+#else
+	static AVBufferRef* poolAlloc(void *opaque, size_t size);
+#endif
+private:
+	mutex                   lock_;
+	map<int, AVBufferPool*> pools_;
+	atomic<int64_t>         gets_;
+	atomic<int64_t>         misses_;
+};
+
+/*
+** @brief AudioCodecConfig everything avcodec_open2() depends on, the key of AudioCodecPool. a decoder takes
+** its output format and profile from the stream, decoders are pooled by name, rate, layout and extradata
+*/
+struct AudioCodecConfig {
+	AudioCodecConfig() : encoder(0), format(AV_SAMPLE_FMT_NONE), sampleRate(0), channelLayout(0),
+		profile(FF_PROFILE_UNKNOWN), bitRate(0), flags(0) {}
+	string          name;           // avcodec_find_encoder_by_name() / avcodec_find_decoder_by_name()
+	int             encoder;        // 1: encoder, 0: decoder
+	AVSampleFormat  format;
+	int             sampleRate;
+	uint64_t        channelLayout;
+	int             profile;
+	int64_t         bitRate;
+	int             flags;          // AV_CODEC_FLAG_*
+	string          options;        // private options "key=value:key=value", av_dict_get_string() layout
+	vector<uint8_t> extradata;
+};
+
+/*
+** @brief AudioCodecPoolStats AudioCodecPool counters, warm starts = gets - misses
+*/
+struct AudioCodecPoolStats {
+	int64_t gets;      // contexts handed out
+	int64_t misses;    // gets that had to open a context (cold start)
+	int64_t reopens;   // returned encoders that cannot flush, replaced by a context the refill thread opened
+	int     idle;      // opened contexts waiting, all configurations
+};
+
+/*
+** @brief AudioCodecPool opened codec contexts per configuration. avcodec_open2() of he-aac costs milliseconds
+** of table setup, under a burst of connections that is most of a session start: a session takes an idle
+** context instead and hands it back when it ends. decoders and encoders with AV_CODEC_CAP_ENCODER_FLUSH
+** are reset with avcodec_flush_buffers(); an encoder that cannot flush (the native aac among them) keeps
+** its state: it is freed and the pool's refill thread opens the replacement, neither the session that
+** ends nor the next one waits for that avcodec_open2(). a get before the refill finished is a miss.
+** audioCodecPoolWarm() opens contexts ahead of a burst. audioCodecPoolDefault() is shared by AudioEncode
+** and AudioDecode. thread safe.
+*/
+class AudioCodecPool {
+public:
+	AudioCodecPool() : maxIdle_(4), stop_(false), gets_(0), misses_(0), reopens_(0) {}
+	~AudioCodecPool();
+public:
+	static AudioCodecPool* audioCodecPoolDefault();
+	/* find, alloc, configure and open a context for config, no pooling. NULL on failure */
+	static AVCodecContext* audioCodecOpen(const AudioCodecConfig &config);
+	/* an opened context for config: an idle one, or a newly opened one. NULL on failure */
+	AVCodecContext* audioCodecPoolGet(const AudioCodecConfig &config);
+	/* give back a context from audioCodecPoolGet() with the same config */
+	void audioCodecPoolPut(const AudioCodecConfig &config, AVCodecContext *ctx);
+	/* open contexts until count (at most the idle limit) are idle for config */
+	int  audioCodecPoolWarm(const AudioCodecConfig &config, int count);
+	/* idle contexts kept per configuration (4), 0 turns pooling off */
+	void audioCodecPoolSetMaxIdle(int count);
+	void audioCodecPoolGetStats(AudioCodecPoolStats *stats);
+private:
+	static string poolKey(const AudioCodecConfig &config);
+	void refillLoop();
+private:
+	mutex                                 lock_;
+	map<string, vector<AVCodecContext*> > idle_;
+	int                                   maxIdle_;
+	deque<AudioCodecConfig>               refill_;      // encoders to reopen, for the refill thread
+	map<string, int>                      refilling_;   // queued or being opened, per key
+	condition_variable                    refillCond_;
+	thread                                refiller_;    // started by the first encoder that cannot flush
+	bool                                  stop_;
+	atomic<int64_t>                       gets_;
+	atomic<int64_t>                       misses_;
+	atomic<int64_t>                       reopens_;
+};
+
 /*
 ** @brief AudioCapture Ƶɼ࣬Ҫṩɼ豸͵ײ(windows: dshow ; mac: avfoundation)
 ** first call audioInit() init Audio param and open device, then call audioCaptureFrame(), get a frame pcm data.
@@ -27,60 +241,120 @@ using namespace std;
 class AudioCapture {
 public:
 	AudioCapture(string device_name, string lib_name):deviceName_(device_name), libName_(lib_name),
-		packet_(NULL) {}
+		fmtCtx_(NULL), frame_(NULL), packet_(NULL), fillSize_(0), readSize_(0), writeSize_(0),
+		waitTimeoutMs_(-1), powerSaveMs_(0), pollIntervalUs_(10000), loop_(0), options_(NULL),
+		sampleRate_(0), nextPts_(0), packetIngestUs_(AUDIO_NO_INGEST), frameIngestUs_(AUDIO_NO_INGEST),
+		pool_(AudioBufferPool::audioPoolDefault()) {}
 	~AudioCapture() {}
 public:
-	int		audioInit(int channels, AVSampleFormat format, int sample_rate);
+	int		audioInit(uint64_t channel_layout, AVSampleFormat format, int samples);
 	void	audioDeinit();
 	void	destoryFrame();
 	int		audioCloseDevice();
 	int     audioCaptureFrame(AVFrame **frame);
+	/* @brief: how long audioCaptureFrame() sleeps waiting for device data, call before audioInit()
+	** @timeout_ms: -1 wait until data arrives (default), 0 return AVERROR(EAGAIN) at once,
+	**              >0 return AVERROR(EAGAIN) after timeout_ms without data.
+	** AVERROR(EAGAIN) is -35 on mac and -11 on linux, never compare against the raw number.
+	*/
+	void	audioSetWaitTimeout(int timeout_ms);
+	/* @brief: power saving, wake up only every period_ms and drain what the device buffered.
+	** trades up to period_ms of extra latency for fewer wakeups, 0 disables (wake every ~1/4 frame).
+	** the device is read non-blocking while it is on, also with the default wait timeout -1
+	*/
+	void	audioSetPowerSave(int period_ms);
+	/* @brief: device / demuxer option passed to avformat_open_input(), call before audioInit().
+	** a pcm file can stand in for the device: lib_name "s16le", device_name "capture.pcm",
+	** options "sample_rate" / "channels".
+	*/
+	void	audioSetDeviceOption(const char *key, const char *value);
+	/* replay a file backed device from the start at EOF (tests, benchmarks) */
+	void	audioSetLoop(int loop);
+	/* meter the captured frames every interval_ms, 0 (the default) skips the meter */
+	void	audioSetMeter(int interval_ms) { meter_.audioMeterSetInterval(interval_ms); }
+	/* levels of the captured frames */
+	AudioLevelMeter& audioCaptureMeter() { return meter_; }
 private:
-	int		createFrame(int channel_layout, AVSampleFormat format, int nb_samples);
+	int		createFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples);
 	int		audioOpenDevice();
+	int		audioReadPacket();
+	void	setupPolling();
 private:
 	string libName_;
 	string deviceName_;
 	AVFormatContext* fmtCtx_;
 	AVFrame *frame_;
 	AVPacket *packet_;
+	int      fillSize_;     // bytes of frame_ already filled
+	int      readSize_;     // bytes of packet_ not consumed yet
+	int      writeSize_;    // read offset in packet_
+	int      waitTimeoutMs_;
+	int      powerSaveMs_;
+	int64_t  pollIntervalUs_;
+	int      loop_;
+	AVDictionary *options_;
+	int      sampleRate_;
+	int64_t  nextPts_;          // pts (in samples) of the next captured frame
+	int64_t  packetIngestUs_;   // arrival time of packet_
+	int64_t  frameIngestUs_;    // arrival time of the first byte of frame_
+	AudioLevelMeter meter_;
+	AudioBufferPool *pool_;
 	char error[128];
 };
 /*
 ** @brief AudioCapture Ƶز
 ** first call audioInit() init Audio param and open device, then call audioCaptureFrame(), get a frame pcm data.
 */
+class AudioRemix;
+class AudioDecimator;
 class AudioSample {
 public:
-	AudioSample(int srcRate, AVSampleFormat srcFormat, int srcChLayout, int dstRate, AVSampleFormat dstFormat, int dstChLayout):
+	AudioSample(int srcRate, AVSampleFormat srcFormat, uint64_t srcChLayout, int dstRate, AVSampleFormat dstFormat,
+				uint64_t dstChLayout):
 				srcRate_(srcRate),
 				srcFormat_(srcFormat),
 				srcChLayout_(srcChLayout),
 				dstRate_(dstRate),
 				dstFormat_(dstFormat),
 				dstChLayout_(dstChLayout),
-				swrCtx_(NULL), frame_(NULL){}
+				swrCtx_(NULL), remix_(NULL), remixBefore_(0), swrOutLayout_(dstChLayout), decim_(NULL),
+				frame_(NULL), dstCapacity_(0), nextPts_(AV_NOPTS_VALUE),
+				pool_(AudioBufferPool::audioPoolDefault()){}
 	~AudioSample();
 public:
+	/* when the layouts differ and the input or the output is fltp the channels are remixed by AudioRemix
+	** (simd, matrix cached per layout pair), on the side with fewer channels, swr only resamples.
+	** same layout and format (s16 / fltp), integer ratio (48k / 16k <-> 8k): AudioDecimator, no swr */
 	int audioSampleInit();
+	/* every sample the resampler can produce comes out, nb_samples of the output frame varies when the
+	** rates differ. pts counts output samples, the first one is the input pts minus swr_get_delay().
+	** srcFrame NULL drains the samples still buffered in the resampler at the end of the stream. */
 	int audioSampleConvert(AVFrame *srcFrame, AVFrame **dstFrame);
+	/* meter the converted frames every interval_ms, 0 (the default) skips the meter */
+	void audioSampleSetMeter(int interval_ms) { meter_.audioMeterSetInterval(interval_ms); }
+	/* levels of the converted frames, what goes on to the encoder */
+	AudioLevelMeter& audioSampleMeter() { return meter_; }
 private:
-	int createDstFrame(int channel_layout, AVSampleFormat format, int nb_samples);
-	int audioSampleCreateData();
+	int createDstFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples);
+	int decimateConvert(AVFrame *srcFrame, AVFrame **dstFrame);
 private:
 	int			   srcRate_;
 	AVSampleFormat srcFormat_;
-	int			   srcChLayout_;
+	uint64_t	   srcChLayout_;
 	int			   dstRate_;
 	AVSampleFormat dstFormat_;
-	int			   dstChLayout_;
+	uint64_t	   dstChLayout_;
 	SwrContext *swrCtx_;
-	// ׼
-	uint8_t   **srcData_;
-	int         srcLen_;
-	uint8_t   **dstData_;
-	int         dstLen_;
+	AudioRemix *remix_;
+	int         remixBefore_;    // 1: remix the input before swr, 0: remix the swr output
+	uint64_t    swrOutLayout_;
+	AudioDecimator *decim_;
+	vector<float>   decimBuf_;  // s16 <-> float תͳˢõƽ滺
 	AVFrame    *frame_;
+	int         dstCapacity_;   // frame_  buffer ܷµĲ
+	int64_t     nextPts_;       // һ pts ()
+	AudioLevelMeter meter_;
+	AudioBufferPool *pool_;
 };
 
 /*
@@ -95,28 +369,97 @@ map<int, int> sampleIndex = {
 	{ 24000, 0x6 },{ 22050, 0x7 },{ 16000, 0x8 },{ 12000, 0x9 },{ 11025, 0xA },{ 8000 , 0xB }
 };
 public:
-	AudioEncode(string encoderName):encoderName_(encoderName){}
+	AudioEncode(string encoderName):encoderName_(encoderName), encodecCtx_(NULL),
+		pool_(AudioBufferPool::audioPoolDefault()), pendingHead_(0), pendingCount_(0),
+		lastIngestUs_(AUDIO_NO_INGEST), fifo_(NULL), fifoFrame_(NULL), fifoPts_(AV_NOPTS_VALUE),
+		fifoSpanHead_(0), fifoSpanCount_(0), firstPts_(AV_NOPTS_VALUE), samplesIn_(0), packetsOut_(0), flush_(0),
+		globalHeader_(0), options_(NULL){}
 	~AudioEncode();
 public:
-	int  audioEncodeInit(AVSampleFormat encodeFormat, int encodeChLayout, int sampleRate, int bitRate, int profile);
-	/* encode a packet */
+	/* any encoder avcodec_find_encoder_by_name() knows: "aac", "libfdk_aac", "libopus" (48 kHz, s16 / flt
+	** interleaved), ... the frame size is the encoder's, profile is ignored by codecs without profiles.
+	** the opened context comes from AudioCodecPool::audioCodecPoolDefault() and goes back on destruction */
+	int  audioEncodeInit(AVSampleFormat encodeFormat, uint64_t encodeChLayout, int sampleRate, int bitRate, int profile);
+	/* encoder private option for avcodec_open2(), before audioEncodeInit().
+	** libopus: frame_duration "10" / "20" (ms), application "voip" / "lowdelay" */
+	void audioEncodeSetOption(const char *key, const char *value);
+	/* 1 when the packets can be adts framed (aac at a rate adts has an index for), packetAddHeader() and
+	** the adts sinks need it. other codecs go through AudioMuxer (ogg, matroska) or AudioStreamSink raw */
+	int  audioEncodeAdts() const;
+	/* algorithmic delay in samples: a whole frame has to be in before the encoder can start, plus the
+	** encoder's lookahead (priming) */
+	int  audioEncodeGetDelay() const;
+	/* encode a packet. frames of any size are accepted, frames that are not frame_size samples are
+	** regrouped internally, call audioEncodeReceive() until EAGAIN to get all packets. the regroup fifo
+	** holds at most MAX_FIFO_FRAMES encoder frames, a frame that arrives when it is full is refused with
+	** AVERROR(ENOSPC) (packets not drained).
+	** frame NULL flushes: the samples left over and the encoder delay come out as the last packets.
+	** packets carry AV_PKT_DATA_SKIP_SAMPLES for the priming at the start and the padding at the end */
 	int  audioEncode(AVFrame *frame, AVPacket **pakcet);
+	/* next packet from samples already handed to audioEncode(), AVERROR(EAGAIN) when it needs more */
+	int  audioEncodeReceive(AVPacket **packet);
+	/* encoder delay (initial_padding) in samples: decoded output starts this many samples late */
+	int  audioEncodeGetPriming() const;
+	/* priming, real samples encoded and padding at the end, complete once the encoder is flushed.
+	** AudioMuxer output carries it on its own: the m4a edit list starts after initial_padding and ends
+	** with the shortened duration of the last packet, mkv has CodecDelay and the skip samples */
+	void audioEncodeGetGapless(int64_t *priming, int64_t *samples, int64_t *padding) const;
+	/* put the AudioSpecificConfig in extradata instead of in-band (m4a / mkv need it), before audioEncodeInit() */
+	void audioEncodeSetGlobalHeader(int enable) { globalHeader_ = enable; }
+	/* the opened codec context, for muxers (avcodec_parameters_from_context) */
+	AVCodecContext* audioEncodeGetContext() const { return encodecCtx_; }
+	/* a pooled frame in the encoder's format / layout / frame size, av_frame_free() it when done */
+	AVFrame* audioEncodeGetFrame();
+	/* capture time (us) of the samples in the packet last returned by audioEncode(), AUDIO_NO_INGEST if unknown */
+	int64_t  audioEncodeIngestTime() const { return lastIngestUs_; }
+	/* capture -> encoded latency of every packet */
+	const AudioLatencyStats& audioEncodeGetLatency() const { return latency_; }
 
 	/* @briedf :  audioEncode һ֡aac ݺ Ҫøú adts ͷ
 	** @aac_buffer:  user ṩһ buffer Ϊ 7ͷ䵽 buffer 
 	** @frame_len audioEncode һ֡ݵĳ
+	** @return: 0 adts ûжӦ index ʱ -1 (audioEncodeAdts() Ϊ 0)
 	*/
-	void packetAddHeader(char *aac_buffer, int frame_len);
-	void packetAddHeader(char * aac_header, int profile, int sample_index, int channels, int frame_len);
+	int  packetAddHeader(char *aac_buffer, int frame_len);
 private:
-	void audio_set_encodec_ctx(AVSampleFormat encodeFormat, int encodeChLayout, int sampleRate, int bitRate, int profile);
+	int  sendFrame(AVFrame *frame);
+	int  sendFifo();
+	int  receivePacket(AVPacket **packet);
+	void fifoPushIngest(int samples, int64_t ingest);
+	int64_t fifoPopIngest(int samples);
 private:
 	string			encoderName_;
 	AVCodecContext *encodecCtx_;
+	AudioCodecConfig codecConfig_;  // encodecCtx_  AudioCodecPool ʱȥ
 	AVPacket        packet_; 
 	int profile_;
 	int channels_; 
 	int sampleRate_;
+	AudioBufferPool *pool_;
+	// frames sent to the encoder and not yet out as packets: (pts, ingest time)
+	enum { MAX_PENDING = 64, MAX_FIFO_FRAMES = 16 };
+	int64_t pendingPts_[MAX_PENDING];
+	int64_t pendingIngest_[MAX_PENDING];
+	int     pendingHead_;
+	int     pendingCount_;
+	int64_t lastIngestUs_;
+	AudioLatencyStats latency_;
+	//  frame_size С֡ fifo 
+	AVAudioFifo *fifo_;
+	AVFrame *fifoFrame_;
+	int64_t  fifoPts_;
+	// ÿд fifo  (, ɼʱ)֡ǶεĲɼʱ
+	int      fifoSpanSamples_[MAX_PENDING];
+	int64_t  fifoSpanIngest_[MAX_PENDING];
+	int      fifoSpanHead_;
+	int      fifoSpanCount_;
+	// gapless: һ ptsͽȥĲ packet 
+	int64_t  firstPts_;
+	int64_t  samplesIn_;
+	int64_t  packetsOut_;
+	int      flush_;      // 1: յ flush2: Ѿͽ
+	int      globalHeader_;
+	AVDictionary *options_;
 };
 
 
@@ -128,23 +471,44 @@ class AudioDecode
 {
 public:
 	AudioDecode(string decodername, int type)
-		:decoderName_(decodername), decode_type(type)
-	{}
+		:decoderName_(decodername), decodecCtx_(NULL), fmtCtx_(NULL), decframe_(NULL), decode_type(type),
+		in_fd(NULL), pool_(AudioBufferPool::audioPoolDefault()), nextPts_(0), skipSamples_(0), fixed_(0),
+		s16Frame_(NULL), s16Capacity_(0)
+	{
+		memset(spareBuf_, 0, sizeof(spareBuf_));
+	}
 	~AudioDecode();
+	/* decodeFormat AV_SAMPLE_FMT_S16: the planar output of the decoder (fltp, s16p, s32p) is interleaved
+	** by an AudioDsp kernel, no swr. any other format: the frames come out as the decoder makes them */
 	int AudioDecodeInit(AVSampleFormat decodeFormat, uint64_t decodeChLayout, int sampleRate, int bitRate, int profile);
+	/* before AudioDecodeInit(): "aac" opens aac_fixed, integer only (s32p), for boxes without a fast fpu.
+	** with s16 output nothing on the way is float */
+	void audioDecodeSetFixed(int fixed) { fixed_ = fixed; }
+	/* codec setup the packets do not carry (the encoder's extradata: OpusHead, AudioSpecificConfig),
+	** before AudioDecodeInit() */
+	void audioDecodeSetExtradata(const uint8_t *data, int size) { extradata_.assign(data, data + size); }
 	int AudioDecodeDeinit();
 	int createInstream(string filename);
 	/* decode a packet */
 	int  audiodecode_();
 	int  audiodecode(AVFrame **dst_frame);
+	/* decode a packet supplied by the caller (adts framed or raw with extradata), 0: got a frame,
+	** AVERROR(EAGAIN): decoder needs more packets */
+	int  audioDecodePacket(AVPacket *packet, AVFrame **dst_frame);
+	/* drop the first samples of the decoded output, for adts written by AudioEncode pass
+	** audioEncodeGetPriming(), the container signals it itself for m4a / mkv */
+	void audioDecodeSetSkip(int samples) { skipSamples_ = samples; }
 	AVFrame* createFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples);
 
 private:
-	int createdecFrame(uint64_t channel_layout, AVSampleFormat format, int nb_samples);
-	void audio_set_decodec_ctx(AVSampleFormat decodeFormat, uint64_t decodeChLayout,
-		int samples, int bitRate, int profile);
+	int createdecFrame(uint64_t channel_layout, AVSampleFormat format);
+	void keepBuffers();
+	static int decodeGetBuffer(AVCodecContext *ctx, AVFrame *frame, int flags);
+	int decodeTimestamp(AVFrame *frame);
+	int interleaveFrame(AVFrame *frame, AVFrame **dst_frame);
 	string			 decoderName_;
 	AVCodecContext*  decodecCtx_;
+	AudioCodecConfig codecConfig_;
 	AVFormatContext* fmtCtx_;
 	AVPacket         packet_;
 	AVFrame*         decframe_;
@@ -155,6 +519,14 @@ private:
 	uint64_t		channellayout_;
 	int				sampleRate_;
 	AVSampleFormat	decodeFormat_;
+	AudioBufferPool *pool_;
+	int64_t         nextPts_;       // ûʱ packet(adts) ֡
+	int             skipSamples_;
+	vector<uint8_t> extradata_;
+	int             fixed_;
+	AVFrame        *s16Frame_;      // decodeFormat_ Ϊ s16 ʱ֯
+	int             s16Capacity_;
+	AVBufferRef    *spareBuf_[AV_NUM_DATA_POINTERS];   // һ֡ buffer  refһ֡
 	char error[128];
 };
 
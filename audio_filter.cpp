@@ -0,0 +1,327 @@
+#include "audio_filter.h"
+extern "C"
+{
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersrc.h"
+#include "libavfilter/buffersink.h"
+}
+
+struct AudioFilterStage {
+	AVFilterGraph   *graph;
+	AVFilterContext *src;
+	AVFilterContext *sink;
+	AVFrame         *out;      // frames between this stage and the next
+	string           name;
+	int64_t          frames;
+	int64_t          us;
+};
+
+struct AudioFilterChain {
+	vector<AudioFilterStage> stages;
+	int              outRate;
+	AVSampleFormat   outFormat;
+	uint64_t         outLayout;
+	AVRational       outTimeBase;    // of the last sink, output pts are rescaled from it to 1/outRate
+};
+
+static void filter_chain_free(AudioFilterChain *chain)
+{
+	if (!chain)
+		return;
+	for (size_t i = 0; i < chain->stages.size(); i++) {
+		avfilter_graph_free(&chain->stages[i].graph);
+		av_frame_free(&chain->stages[i].out);
+	}
+	delete chain;
+}
+
+/* configured chains nobody uses yet, per key. bounded so a burst of closes does not pin memory */
+#define FILTER_CACHE_MAX 16
+struct AudioFilterCache {
+	map<string, vector<AudioFilterChain*> > chains;
+	~AudioFilterCache() { clear(); }
+	void clear()
+	{
+		for (map<string, vector<AudioFilterChain*> >::iterator it = chains.begin(); it != chains.end(); ++it) {
+			for (size_t i = 0; i < it->second.size(); i++)
+				filter_chain_free(it->second[i]);
+		}
+		chains.clear();
+	}
+};
+static mutex filter_cache_lock;
+static AudioFilterCache filter_cache;
+
+/* "highpass=f=80,volume=0.5" -> one spec per filter. labels or several chains: not linear, one stage */
+static vector<string> filter_split(const string &spec, int profile)
+{
+	vector<string> parts;
+	if (!profile || spec.find_first_of("[;") != string::npos) {
+		parts.push_back(spec);
+		return parts;
+	}
+	string cur;
+	int quoted = 0;
+	for (size_t i = 0; i < spec.size(); i++) {
+		char c = spec[i];
+		if (c == '\\' && i + 1 < spec.size()) {
+			cur += c;
+			cur += spec[++i];
+			continue;
+		}
+		if (c == '\'')
+			quoted = !quoted;
+		if (c == ',' && !quoted) {
+			parts.push_back(cur);
+			cur.clear();
+			continue;
+		}
+		cur += c;
+	}
+	parts.push_back(cur);
+	return parts;
+}
+
+static int filter_build_stage(const string &spec, int rate, AVSampleFormat format, uint64_t layout,
+	AVRational time_base, AudioFilterStage *stage)
+{
+	char args[256];
+	snprintf(args, sizeof(args), "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%" PRIx64,
+		time_base.num, time_base.den, rate, av_get_sample_fmt_name(format), layout);
+	stage->graph = avfilter_graph_alloc();
+	stage->out = av_frame_alloc();
+	stage->name = spec;
+	stage->frames = stage->us = 0;
+	if (!stage->graph || !stage->out)
+		return AVERROR(ENOMEM);
+	stage->graph->nb_threads = 1;       // one session per thread already, no slice threads per filter
+	AVFilterInOut *outputs = avfilter_inout_alloc();
+	AVFilterInOut *inputs = avfilter_inout_alloc();
+	int ret = AVERROR(ENOMEM);
+	if (!outputs || !inputs)
+		goto end;
+	ret = avfilter_graph_create_filter(&stage->src, avfilter_get_by_name("abuffer"), "in", args, NULL, stage->graph);
+	if (ret < 0)
+		goto end;
+	ret = avfilter_graph_create_filter(&stage->sink, avfilter_get_by_name("abuffersink"), "out", NULL, NULL,
+		stage->graph);
+	if (ret < 0)
+		goto end;
+	outputs->name = av_strdup("in");
+	outputs->filter_ctx = stage->src;
+	outputs->pad_idx = 0;
+	outputs->next = NULL;
+	inputs->name = av_strdup("out");
+	inputs->filter_ctx = stage->sink;
+	inputs->pad_idx = 0;
+	inputs->next = NULL;
+	ret = avfilter_graph_parse_ptr(stage->graph, spec.c_str(), &inputs, &outputs, NULL);
+	if (ret >= 0)
+		ret = avfilter_graph_config(stage->graph, NULL);
+end:
+	avfilter_inout_free(&inputs);
+	avfilter_inout_free(&outputs);
+	if (ret < 0)
+		av_log(NULL, AV_LOG_ERROR, "filter \"%s\" failure.\n", spec.c_str());
+	return ret;
+}
+
+static AudioFilterChain* filter_build_chain(const string &spec, int rate, AVSampleFormat format, uint64_t layout,
+	int profile)
+{
+	vector<string> parts = filter_split(spec, profile);
+	AudioFilterChain *chain = new AudioFilterChain;
+	chain->stages.resize(parts.size());
+	for (size_t i = 0; i < parts.size(); i++)
+		chain->stages[i].graph = NULL, chain->stages[i].out = NULL;
+	// the input pts count samples
+	AVRational time_base = av_make_q(1, rate);
+	for (size_t i = 0; i < parts.size(); i++) {
+		if (filter_build_stage(parts[i], rate, format, layout, time_base, &chain->stages[i]) < 0) {
+			filter_chain_free(chain);
+			return NULL;
+		}
+		// the next filter gets what this one negotiated
+		AVFilterContext *sink = chain->stages[i].sink;
+		rate = av_buffersink_get_sample_rate(sink);
+		format = (AVSampleFormat)av_buffersink_get_format(sink);
+		layout = av_buffersink_get_channel_layout(sink);
+		time_base = av_buffersink_get_time_base(sink);
+	}
+	chain->outRate = rate;
+	chain->outFormat = format;
+	chain->outLayout = layout;
+	chain->outTimeBase = time_base;
+	return chain;
+}
+
+static string filter_key(const string &spec, int rate, AVSampleFormat format, uint64_t layout, int profile)
+{
+	char params[96];
+	snprintf(params, sizeof(params), "|%d|%d|%" PRIx64 "|%d", rate, (int)format, layout, profile);
+	return spec + params;
+}
+
+/////////////////////////// AudioFilter ///////////////////////////////////////////////////////////////
+
+AudioFilter::AudioFilter()
+	:chain_(NULL), frame_(av_frame_alloc()), profile_(1), used_(0)
+{
+}
+
+AudioFilter::~AudioFilter()
+{
+	audioFilterClose();
+	av_frame_free(&frame_);
+}
+
+int AudioFilter::audioFilterPrewarm(string spec, int sampleRate, AVSampleFormat format, uint64_t channelLayout,
+	int count, int profile)
+{
+	string key = filter_key(spec, sampleRate, format, channelLayout, profile);
+	for (int i = 0; i < count; i++) {
+		{
+			lock_guard<mutex> lock(filter_cache_lock);
+			if (filter_cache.chains[key].size() >= FILTER_CACHE_MAX)
+				return 0;
+		}
+		// configure outside the lock, other sessions keep taking cached chains meanwhile
+		AudioFilterChain *chain = filter_build_chain(spec, sampleRate, format, channelLayout, profile);
+		if (!chain)
+			return -1;
+		lock_guard<mutex> lock(filter_cache_lock);
+		filter_cache.chains[key].push_back(chain);
+	}
+	return 0;
+}
+
+int AudioFilter::audioFilterInit(string spec, int sampleRate, AVSampleFormat format, uint64_t channelLayout)
+{
+	audioFilterClose();
+	if (!frame_)
+		return AVERROR(ENOMEM);
+	key_ = filter_key(spec, sampleRate, format, channelLayout, profile_);
+	{
+		lock_guard<mutex> lock(filter_cache_lock);
+		vector<AudioFilterChain*> &cached = filter_cache.chains[key_];
+		if (!cached.empty()) {
+			chain_ = cached.back();
+			cached.pop_back();
+		}
+	}
+	if (!chain_)
+		chain_ = filter_build_chain(spec, sampleRate, format, channelLayout, profile_);
+	if (!chain_)
+		return -1;
+	used_ = 0;
+	return 0;
+}
+
+/* frame into stage, everything the stage puts out on into the next one. the last stage keeps its
+** output in the sink for audioFilterReceive() */
+int AudioFilter::push(size_t stage, AVFrame *frame)
+{
+	AudioFilterStage &s = chain_->stages[stage];
+	int64_t start = av_gettime_relative();
+	int ret = av_buffersrc_add_frame_flags(s.src, frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+	if (frame)
+		s.frames++;
+	if (ret < 0 || stage + 1 == chain_->stages.size()) {
+		s.us += av_gettime_relative() - start;
+		return ret;
+	}
+	while (1) {
+		ret = av_buffersink_get_frame(s.sink, s.out);
+		s.us += av_gettime_relative() - start;
+		if (ret == AVERROR(EAGAIN))
+			return 0;
+		if (ret == AVERROR_EOF)
+			return push(stage + 1, NULL);
+		if (ret < 0)
+			return ret;
+		ret = push(stage + 1, s.out);
+		av_frame_unref(s.out);
+		if (ret < 0)
+			return ret;
+		start = av_gettime_relative();
+	}
+}
+
+int AudioFilter::audioFilter(AVFrame *srcFrame, AVFrame **dstFrame)
+{
+	if (!chain_)
+		return -1;
+	used_ = 1;
+	int ret = push(0, srcFrame);
+	if (ret < 0) {
+		av_log(NULL, AV_LOG_ERROR, "filter frame failure.\n");
+		return ret;
+	}
+	return audioFilterReceive(dstFrame);
+}
+
+int AudioFilter::audioFilterReceive(AVFrame **dstFrame)
+{
+	if (!chain_)
+		return -1;
+	AudioFilterStage &last = chain_->stages.back();
+	av_frame_unref(frame_);
+	int64_t start = av_gettime_relative();
+	int ret = av_buffersink_get_frame(last.sink, frame_);
+	last.us += av_gettime_relative() - start;
+	if (ret < 0)
+		return ret;
+	// pts in samples of the output rate, like AudioSample
+	AVRational samples = av_make_q(1, chain_->outRate);
+	if (frame_->pts != AV_NOPTS_VALUE && av_cmp_q(chain_->outTimeBase, samples) != 0)
+		frame_->pts = av_rescale_q(frame_->pts, chain_->outTimeBase, samples);
+	frame_->pkt_duration = frame_->nb_samples;
+	*dstFrame = frame_;
+	return 0;
+}
+
+int AudioFilter::audioFilterGetOutput(int *sampleRate, AVSampleFormat *format, uint64_t *channelLayout) const
+{
+	if (!chain_)
+		return -1;
+	*sampleRate = chain_->outRate;
+	*format = chain_->outFormat;
+	*channelLayout = chain_->outLayout;
+	return 0;
+}
+
+void AudioFilter::audioFilterGetStats(vector<AudioFilterStat> *stats) const
+{
+	stats->clear();
+	if (!chain_)
+		return;
+	for (size_t i = 0; i < chain_->stages.size(); i++) {
+		const AudioFilterStage &s = chain_->stages[i];
+		AudioFilterStat stat = { s.name, s.frames, s.us };
+		stats->push_back(stat);
+	}
+}
+
+void AudioFilter::audioFilterClearCache()
+{
+	lock_guard<mutex> lock(filter_cache_lock);
+	filter_cache.clear();
+}
+
+void AudioFilter::audioFilterClose()
+{
+	av_frame_unref(frame_);
+	if (!chain_)
+		return;
+	if (!used_) {
+		// never saw a frame: as good as a freshly configured chain, the next session takes it
+		lock_guard<mutex> lock(filter_cache_lock);
+		vector<AudioFilterChain*> &cached = filter_cache.chains[key_];
+		if (cached.size() < FILTER_CACHE_MAX) {
+			cached.push_back(chain_);
+			chain_ = NULL;
+		}
+	}
+	filter_chain_free(chain_);
+	chain_ = NULL;
+}
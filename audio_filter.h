@@ -0,0 +1,61 @@
+#ifndef __AUDIO_FILTER__H_
+#define __AUDIO_FILTER__H_
+#include <vector>
+#include "audio_engine.h"
+
+/*
+** @brief AudioFilterStat time spent in one filter of the chain
+*/
+struct AudioFilterStat {
+	string  name;        // the filter as written in the spec: "highpass=f=80"
+	int64_t frames;      // frames into the filter
+	int64_t us;          // wall time in the filter
+};
+
+/* the configured graphs of one session, defined in audio_filter.cpp */
+struct AudioFilterChain;
+
+/*
+** @brief AudioFilter libavfilter stage between AudioSample and AudioEncode ("highpass=f=80,volume=-3dB",
+** loudnorm, aresample ...). frames go in and out by reference, no copy outside the filters themselves.
+** a linear chain is built as one small graph per filter, so audioFilterGetStats() reports the time of
+** every filter. configured graphs are cached per (spec, input parameters): a session closed before it
+** filtered anything hands its graphs back, audioFilterPrewarm() builds them ahead, and a new session
+** with the same spec takes one from the cache instead of parsing, negotiating and configuring again.
+** first call audioFilterInit(), then audioFilter() for every frame (NULL at the end) and
+** audioFilterReceive() until AVERROR(EAGAIN).
+*/
+class AudioFilter {
+public:
+	AudioFilter();
+	~AudioFilter();
+public:
+	/* spec in the ffmpeg -af syntax, input frames have rate / format / layout and pts in samples */
+	int  audioFilterInit(string spec, int sampleRate, AVSampleFormat format, uint64_t channelLayout);
+	/* filter frame (NULL drains), the first output in *dstFrame. AVERROR(EAGAIN): the filters hold the
+	** samples for now (loudnorm, aresample), AVERROR_EOF: drained. *dstFrame is valid until the next call */
+	int  audioFilter(AVFrame *srcFrame, AVFrame **dstFrame);
+	/* more output of the last audioFilter() */
+	int  audioFilterReceive(AVFrame **dstFrame);
+	/* output parameters, what AudioEncode has to be set up for */
+	int  audioFilterGetOutput(int *sampleRate, AVSampleFormat *format, uint64_t *channelLayout) const;
+	void audioFilterGetStats(vector<AudioFilterStat> *stats) const;
+	void audioFilterClose();
+	/* one graph for the whole spec: no per filter time, slightly less overhead. before audioFilterInit() */
+	void audioFilterSetProfile(int enable) { profile_ = enable; }
+	/* configure count sessions worth of graphs for spec now, so audioFilterInit() later is cheap */
+	static int audioFilterPrewarm(string spec, int sampleRate, AVSampleFormat format, uint64_t channelLayout,
+		int count, int profile = 1);
+	/* free every cached graph (also done at exit), e.g. before a long idle period */
+	static void audioFilterClearCache();
+private:
+	int  push(size_t stage, AVFrame *frame);
+private:
+	AudioFilterChain *chain_;
+	string            key_;
+	AVFrame          *frame_;
+	int               profile_;
+	int               used_;      // frames went in, the filter state is not fresh any more
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "audio_g711.h"
+
+/////////////////////////// tables /////////////////////////////////////////////////////////////////
+
+/* the reference (Sun g711.c) conversions, only used to fill the tables */
+static uint8_t ulaw_from_linear(int pcm)
+{
+	int sign = pcm < 0 ? 0x80 : 0;
+	if (sign)
+		pcm = -pcm;
+	pcm = FFMIN(pcm, 32635) + 0x84;
+	int exponent = 7;
+	for (int mask = 0x4000; !(pcm & mask) && exponent > 0; exponent--, mask >>= 1)
+		;
+	int mantissa = (pcm >> (exponent + 3)) & 0x0f;
+	return (uint8_t)~(sign | (exponent << 4) | mantissa);
+}
+
+static int16_t ulaw_to_linear(uint8_t u)
+{
+	u = ~u;
+	int t = (((u & 0x0f) << 3) + 0x84) << ((u & 0x70) >> 4);
+	return (int16_t)((u & 0x80) ? 0x84 - t : t - 0x84);
+}
+
+static uint8_t alaw_from_linear(int pcm)
+{
+	int mask;
+	pcm >>= 3;
+	if (pcm >= 0) {
+		mask = 0xd5;
+	} else {
+		mask = 0x55;
+		pcm = -pcm - 1;
+	}
+	int seg = 0;
+	while (seg < 8 && pcm > (0x20 << seg) - 1)
+		seg++;
+	if (seg >= 8)
+		return (uint8_t)(0x7f ^ mask);
+	int aval = seg << 4;
+	aval |= seg < 2 ? (pcm >> 1) & 0x0f : (pcm >> seg) & 0x0f;
+	return (uint8_t)(aval ^ mask);
+}
+
+static int16_t alaw_to_linear(uint8_t a)
+{
+	a ^= 0x55;
+	int t = (a & 0x0f) << 4;
+	int seg = (a & 0x70) >> 4;
+	if (seg == 0)
+		t += 8;
+	else
+		t = (t + 0x108) << (seg - 1);
+	return (int16_t)((a & 0x80) ? t : -t);
+}
+
+struct G711Tables {
+	uint8_t encode[2][16384];     // indexed by (uint16_t)sample >> 2
+	int16_t decode[2][256];
+	G711Tables()
+	{
+		for (int i = 0; i < 16384; i++) {
+			int pcm = (int16_t)(i << 2);
+			encode[AUDIO_G711_ULAW][i] = ulaw_from_linear(pcm);
+			encode[AUDIO_G711_ALAW][i] = alaw_from_linear(pcm);
+		}
+		for (int i = 0; i < 256; i++) {
+			decode[AUDIO_G711_ULAW][i] = ulaw_to_linear((uint8_t)i);
+			decode[AUDIO_G711_ALAW][i] = alaw_to_linear((uint8_t)i);
+		}
+	}
+};
+
+static const G711Tables& g711_tables()
+{
+	static const G711Tables tables;    // thread safe since c++11
+	return tables;
+}
+
+void g711Encode(AudioG711Law law, uint8_t *dst, const int16_t *src, int n)
+{
+	const uint8_t *table = g711_tables().encode[law];
+	for (int i = 0; i < n; i++)
+		dst[i] = table[(uint16_t)src[i] >> 2];
+}
+
+void g711Decode(AudioG711Law law, int16_t *dst, const uint8_t *src, int n)
+{
+	const int16_t *table = g711_tables().decode[law];
+	for (int i = 0; i < n; i++)
+		dst[i] = table[src[i]];
+}
+
+/////////////////////////// AudioG711 //////////////////////////////////////////////////////////////
+
+AudioG711::AudioG711(AudioG711Law law, int channels)
+	:law_(law), channels_(channels), packet_(NULL), frame_(NULL), capacity_(0), ingest_(AUDIO_NO_INGEST),
+	pool_(AudioBufferPool::audioPoolDefault())
+{
+}
+
+AudioG711::~AudioG711()
+{
+	av_packet_free(&packet_);
+	av_frame_free(&frame_);
+}
+
+int AudioG711::audioG711Encode(const AVFrame *frame, AVPacket **packet)
+{
+	if (frame->format != AV_SAMPLE_FMT_S16 || frame->channels != channels_) {
+		av_log(NULL, AV_LOG_ERROR, "g711 encodes s16 frames with %d channels.\n", channels_);
+		return -1;
+	}
+	if (!packet_ && !(packet_ = av_packet_alloc()))
+		return AVERROR(ENOMEM);
+	int n = frame->nb_samples * channels_;
+	if (pool_->audioPoolGetPacket(packet_, n) < 0)
+		return AVERROR(ENOMEM);
+	g711Encode(law_, packet_->data, (const int16_t *)frame->data[0], n);
+	packet_->pts = packet_->dts = frame->pts;
+	packet_->duration = frame->nb_samples;
+	packet_->flags |= AV_PKT_FLAG_KEY;
+	ingest_ = frame->reordered_opaque;
+	*packet = packet_;
+	return 0;
+}
+
+int AudioG711::audioG711Decode(const AVPacket *packet, AVFrame **frame)
+{
+	int samples = packet->size / channels_;
+	if (samples <= 0)
+		return AVERROR(EAGAIN);
+	if (!frame_ || samples > capacity_) {
+		av_frame_free(&frame_);
+		frame_ = pool_->audioPoolGetFrame(av_get_default_channel_layout(channels_), AV_SAMPLE_FMT_S16, samples);
+		if (!frame_) {
+			av_log(NULL, AV_LOG_ERROR, "create g711 frame failure.\n");
+			return -1;
+		}
+		capacity_ = samples;
+	}
+	frame_->nb_samples = capacity_;
+	if (pool_->audioPoolMakeWritable(frame_) < 0)
+		return -1;
+	g711Decode(law_, (int16_t *)frame_->data[0], packet->data, samples * channels_);
+	frame_->nb_samples = samples;
+	frame_->pts = packet->pts;
+	frame_->pkt_duration = samples;
+	*frame = frame_;
+	return 0;
+}
+
+void AudioG711::audioG711Parameters(AVCodecParameters *par, int sampleRate) const
+{
+	par->codec_type = AVMEDIA_TYPE_AUDIO;
+	par->codec_id = law_ == AUDIO_G711_ULAW ? AV_CODEC_ID_PCM_MULAW : AV_CODEC_ID_PCM_ALAW;
+	par->sample_rate = sampleRate;
+	par->channels = channels_;
+	par->channel_layout = av_get_default_channel_layout(channels_);
+	par->bits_per_coded_sample = 8;
+	par->block_align = channels_;
+	par->bit_rate = (int64_t)sampleRate * 8 * channels_;
+}
@@ -0,0 +1,44 @@
+#ifndef __AUDIO_G711__H_
+#define __AUDIO_G711__H_
+#include "audio_engine.h"
+
+enum AudioG711Law {
+	AUDIO_G711_ULAW,     // pcm_mulaw, north america / japan
+	AUDIO_G711_ALAW,     // pcm_alaw, everywhere else
+};
+
+/* s16 -> g711, one byte per sample: one lookup in a 16k entry table (the top 14 bits of the sample) */
+void g711Encode(AudioG711Law law, uint8_t *dst, const int16_t *src, int n);
+/* g711 -> s16 through a 256 entry table */
+void g711Decode(AudioG711Law law, int16_t *dst, const uint8_t *src, int n);
+
+/*
+** @brief AudioG711 G.711 without libavcodec: a telephony leg is a table lookup per sample, no codec
+** context, no send / receive round trip, a few bytes of state. thousands of legs per process.
+** frames are s16 interleaved at any rate (8 kHz for g711 proper, AudioSample decimates 48k / 16k down
+** through AudioDecimator), the packets are one byte per sample from the buffer pool.
+** audioG711Parameters() fills the stream parameters for AudioMuxer (wav, mkv) or an rtp muxer.
+*/
+class AudioG711 {
+public:
+	AudioG711(AudioG711Law law, int channels = 1);
+	~AudioG711();
+public:
+	/* s16 frame -> packet, pts / duration follow the frame. the packet is valid until the next call */
+	int  audioG711Encode(const AVFrame *frame, AVPacket **packet);
+	/* packet -> s16 frame, valid until the next call */
+	int  audioG711Decode(const AVPacket *packet, AVFrame **frame);
+	/* capture time (us) of the frame last encoded */
+	int64_t audioG711IngestTime() const { return ingest_; }
+	void audioG711Parameters(AVCodecParameters *par, int sampleRate = 8000) const;
+private:
+	AudioG711Law     law_;
+	int              channels_;
+	AVPacket        *packet_;
+	AVFrame         *frame_;
+	int              capacity_;
+	int64_t          ingest_;
+	AudioBufferPool *pool_;
+};
+
+#endif
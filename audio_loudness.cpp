@@ -0,0 +1,293 @@
+#include <math.h>
+#include <string.h>
+#include "audio_loudness.h"
+
+#define LOUDNESS_ABS_GATE -70.0
+#define LOUDNESS_HIST_MIN -70.0
+
+static double loudness_lufs(double energy)
+{
+	return energy > 0 ? -0.691 + 10 * log10(energy) : -HUGE_VAL;
+}
+
+AudioLoudness::AudioLoudness()
+	:sampleRate_(0), channels_(0), blockSamples_(0), blockFill_(0), blockCount_(0), gating_(NULL), range_(NULL),
+	tpFactor_(1), tpTaps_(0), truePeak_(0), samplePeak_(0), samples_(0)
+{
+	memset(blocks_, 0, sizeof(blocks_));
+}
+
+AudioLoudness::~AudioLoudness()
+{
+	delete gating_;
+	delete range_;
+}
+
+int AudioLoudness::audioLoudnessInit(int sampleRate, uint64_t channelLayout)
+{
+	channels_ = av_get_channel_layout_nb_channels(channelLayout);
+	if (sampleRate <= 0 || channels_ <= 0) {
+		av_log(NULL, AV_LOG_ERROR, "loudness: bad sample rate / layout.\n");
+		return -1;
+	}
+	sampleRate_ = sampleRate;
+	// BS.1770 channel weights: lfe does not count, surrounds +1.5 dB
+	weight_.assign(channels_, 1.0);
+	for (int c = 0; c < channels_; c++) {
+		uint64_t ch = av_channel_layout_extract_channel(channelLayout, c);
+		if (ch == AV_CH_LOW_FREQUENCY || ch == AV_CH_LOW_FREQUENCY_2)
+			weight_[c] = 0;
+		else if (ch == AV_CH_BACK_LEFT || ch == AV_CH_BACK_RIGHT || ch == AV_CH_SIDE_LEFT || ch == AV_CH_SIDE_RIGHT)
+			weight_[c] = 1.41;
+	}
+	// k-weighting for this rate, the BS.1770 48 kHz filters moved by the bilinear transform
+	double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+	double k = tan(M_PI * f0 / sampleRate);
+	double vh = pow(10, gain / 20), vb = pow(vh, 0.4996667741545416);
+	double a0 = 1 + k / q + k * k;
+	pb_[0] = (vh + vb * k / q + k * k) / a0;
+	pb_[1] = 2 * (k * k - vh) / a0;
+	pb_[2] = (vh - vb * k / q + k * k) / a0;
+	pa_[0] = 1;
+	pa_[1] = 2 * (k * k - 1) / a0;
+	pa_[2] = (1 - k / q + k * k) / a0;
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / sampleRate);
+	a0 = 1 + k / q + k * k;
+	rb_[0] = 1;
+	rb_[1] = -2;
+	rb_[2] = 1;
+	ra_[0] = 1;
+	ra_[1] = 2 * (k * k - 1) / a0;
+	ra_[2] = (1 - k / q + k * k) / a0;
+	state_.assign(channels_ * 4, 0);
+	blockSum_.assign(channels_, 0);
+	blockSamples_ = (sampleRate + 5) / 10;
+
+	// true peak: windowed sinc interpolator, 12 taps per phase
+	tpFactor_ = sampleRate < 96000 ? 4 : sampleRate < 192000 ? 2 : 1;
+	tpTaps_ = 12;
+	int total = tpFactor_ * tpTaps_;
+	tpCoef_.assign(total, 0);
+	for (int i = 0; i < total; i++) {
+		double x = (i - (total - 1) / 2.0) / tpFactor_;
+		double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+		double window = 0.5 - 0.5 * cos(2 * M_PI * (i + 0.5) / total);
+		// phase p, tap t multiplies the sample t back
+		int p = i % tpFactor_, t = tpTaps_ - 1 - i / tpFactor_;
+		tpCoef_[p * tpTaps_ + t] = (float)(sinc * window);
+	}
+	tpHistory_.assign(channels_ * (tpTaps_ - 1), 0);
+
+	if (!gating_)
+		gating_ = new Histogram;
+	if (!range_)
+		range_ = new Histogram;
+	audioLoudnessReset();
+	return 0;
+}
+
+void AudioLoudness::audioLoudnessReset()
+{
+	if (gating_)
+		memset(gating_, 0, sizeof(*gating_));
+	if (range_)
+		memset(range_, 0, sizeof(*range_));
+	memset(blocks_, 0, sizeof(blocks_));
+	for (size_t c = 0; c < blockSum_.size(); c++)
+		blockSum_[c] = 0;
+	blockFill_ = 0;
+	blockCount_ = 0;
+	truePeak_ = samplePeak_ = 0;
+	samples_ = 0;
+}
+
+void AudioLoudness::histAdd(Histogram *hist, double energy)
+{
+	double lufs = loudness_lufs(energy);
+	if (lufs < LOUDNESS_ABS_GATE)
+		return;
+	int bin = av_clip((int)((lufs - LOUDNESS_HIST_MIN) * 10), 0, HIST_BINS - 1);
+	hist->count[bin]++;
+	hist->energy[bin] += energy;
+}
+
+/* energy sum of the blocks in the bins at or above gate (LUFS) */
+double AudioLoudness::histGatedEnergy(const Histogram *hist, double gate, int64_t *count)
+{
+	int first = av_clip((int)floor((gate - LOUDNESS_HIST_MIN) * 10), 0, HIST_BINS - 1);
+	double energy = 0;
+	int64_t n = 0;
+	for (int i = first; i < HIST_BINS; i++) {
+		energy += hist->energy[i];
+		n += hist->count[i];
+	}
+	*count = n;
+	return energy;
+}
+
+/* k-weighted squares of n samples into the running 100 ms block, closing blocks on the way */
+void AudioLoudness::addSamples(const float *const *planes, int stride, int offset, int n)
+{
+	for (int c = 0; c < channels_; c++) {
+		if (weight_[c] == 0)
+			continue;
+		const float *data = planes[stride ? 0 : c] + (stride ? offset * stride + c : offset);
+		int step = stride ? stride : 1;
+		double *s = &state_[c * 4];
+		double s0 = s[0], s1 = s[1], s2 = s[2], s3 = s[3], sum = 0;
+		for (int i = 0; i < n; i++) {
+			// transposed direct form II, pre filter then high pass
+			double x = data[i * step];
+			double y = pb_[0] * x + s0;
+			s0 = pb_[1] * x - pa_[1] * y + s1;
+			s1 = pb_[2] * x - pa_[2] * y;
+			double z = rb_[0] * y + s2;
+			s2 = rb_[1] * y - ra_[1] * z + s3;
+			s3 = rb_[2] * y - ra_[2] * z;
+			sum += z * z;
+		}
+		s[0] = s0, s[1] = s1, s[2] = s2, s[3] = s3;
+		blockSum_[c] += sum;
+	}
+	blockFill_ += n;
+}
+
+void AudioLoudness::endBlock()
+{
+	double energy = 0;
+	for (int c = 0; c < channels_; c++) {
+		energy += weight_[c] * blockSum_[c] / blockSamples_;
+		blockSum_[c] = 0;
+	}
+	blockFill_ = 0;
+	blocks_[blockCount_ % SHORT_BLOCKS] = energy;
+	blockCount_++;
+	// a 400 ms gating block every 100 ms (75% overlap), a 3 s short-term value every 100 ms for lra
+	if (blockCount_ >= 4) {
+		double sum = 0;
+		for (int i = 1; i <= 4; i++)
+			sum += blocks_[(blockCount_ - i) % SHORT_BLOCKS];
+		histAdd(gating_, sum / 4);
+	}
+	if (blockCount_ >= SHORT_BLOCKS) {
+		double sum = 0;
+		for (int i = 0; i < SHORT_BLOCKS; i++)
+			sum += blocks_[i];
+		histAdd(range_, sum / SHORT_BLOCKS);
+	}
+}
+
+void AudioLoudness::truePeak(const float *data, int stride, int n, int channel)
+{
+	int keep = tpTaps_ - 1;
+	float *history = &tpHistory_[channel * keep];
+	tpScratch_.resize(keep + n);
+	float *x = tpScratch_.data();
+	memcpy(x, history, keep * sizeof(float));
+	float sample_peak = 0;
+	for (int i = 0; i < n; i++) {
+		x[keep + i] = data[i * stride];
+		sample_peak = FFMAX(sample_peak, fabsf(x[keep + i]));
+	}
+	float peak = sample_peak;
+	if (tpFactor_ > 1) {
+		for (int i = 0; i < n; i++) {
+			const float *window = x + i;       // the tpTaps_ samples ending at sample i
+			for (int p = 0; p < tpFactor_; p++) {
+				const float *coef = &tpCoef_[p * tpTaps_];
+				float y = 0;
+				for (int t = 0; t < tpTaps_; t++)
+					y += coef[t] * window[t];
+				peak = FFMAX(peak, fabsf(y));
+			}
+		}
+	}
+	memcpy(history, x + n, keep * sizeof(float));
+	samplePeak_ = FFMAX(samplePeak_, sample_peak);
+	truePeak_ = FFMAX(truePeak_, peak);
+}
+
+int AudioLoudness::audioLoudnessFrame(const AVFrame *frame)
+{
+	if (!gating_ || frame->channels != channels_ ||
+		(frame->format != AV_SAMPLE_FMT_FLTP && frame->format != AV_SAMPLE_FMT_FLT)) {
+		av_log(NULL, AV_LOG_ERROR, "loudness: fltp / flt frames with %d channels.\n", channels_);
+		return -1;
+	}
+	int stride = frame->format == AV_SAMPLE_FMT_FLT ? channels_ : 0;
+	const float *const *planes = (const float *const *)frame->extended_data;
+	for (int c = 0; c < channels_; c++) {
+		if (stride)
+			truePeak(planes[0] + c, stride, frame->nb_samples, c);
+		else
+			truePeak(planes[c], 1, frame->nb_samples, c);
+	}
+	int done = 0;
+	while (done < frame->nb_samples) {
+		int n = FFMIN(frame->nb_samples - done, blockSamples_ - blockFill_);
+		addSamples(planes, stride, done, n);
+		done += n;
+		if (blockFill_ == blockSamples_)
+			endBlock();
+	}
+	samples_ += frame->nb_samples;
+	return 0;
+}
+
+void AudioLoudness::audioLoudnessGet(AudioLoudnessResult *result) const
+{
+	result->momentary = result->shortTerm = result->integrated = -HUGE_VAL;
+	result->lra = 0;
+	result->samples = samples_;
+	result->truePeak = truePeak_ > 0 ? 20 * log10(truePeak_) : -HUGE_VAL;
+	result->samplePeak = samplePeak_ > 0 ? 20 * log10(samplePeak_) : -HUGE_VAL;
+	if (!gating_)
+		return;
+	if (blockCount_ >= 4) {
+		double sum = 0;
+		for (int i = 1; i <= 4; i++)
+			sum += blocks_[(blockCount_ - i) % SHORT_BLOCKS];
+		result->momentary = loudness_lufs(sum / 4);
+	}
+	if (blockCount_ >= SHORT_BLOCKS) {
+		double sum = 0;
+		for (int i = 0; i < SHORT_BLOCKS; i++)
+			sum += blocks_[i];
+		result->shortTerm = loudness_lufs(sum / SHORT_BLOCKS);
+	}
+	// integrated: relative gate 10 LU under the loudness of the blocks above the absolute gate
+	int64_t count;
+	double energy = histGatedEnergy(gating_, LOUDNESS_ABS_GATE, &count);
+	if (count > 0) {
+		double gate = loudness_lufs(energy / count) - 10;
+		energy = histGatedEnergy(gating_, gate, &count);
+		if (count > 0)
+			result->integrated = loudness_lufs(energy / count);
+	}
+	// lra: 10th to 95th percentile of the short-term values above a relative gate 20 LU down
+	energy = histGatedEnergy(range_, LOUDNESS_ABS_GATE, &count);
+	if (count > 0) {
+		double gate = loudness_lufs(energy / count) - 20;
+		int first = av_clip((int)floor((gate - LOUDNESS_HIST_MIN) * 10), 0, HIST_BINS - 1);
+		histGatedEnergy(range_, gate, &count);
+		int64_t low = (int64_t)(count * 0.10), high = (int64_t)(count * 0.95);
+		int64_t seen = 0;
+		double lo = 0, hi = 0;
+		int have_lo = 0;
+		for (int i = first; i < HIST_BINS; i++) {
+			seen += range_->count[i];
+			double lufs = LOUDNESS_HIST_MIN + (i + 0.5) / 10;
+			if (!have_lo && seen > low) {
+				lo = lufs;
+				have_lo = 1;
+			}
+			if (seen > high) {
+				hi = lufs;
+				break;
+			}
+		}
+		result->lra = count > 1 ? hi - lo : 0;
+	}
+}
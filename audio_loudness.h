@@ -0,0 +1,75 @@
+#ifndef __AUDIO_LOUDNESS__H_
+#define __AUDIO_LOUDNESS__H_
+#include <vector>
+#include "audio_engine.h"
+
+/*
+** @brief AudioLoudnessResult EBU R128 / ITU-R BS.1770-4 values, -HUGE_VAL while there is not enough audio
+*/
+struct AudioLoudnessResult {
+	double  momentary;     // LUFS, last 400 ms
+	double  shortTerm;     // LUFS, last 3 s
+	double  integrated;    // LUFS, gated, since init / reset
+	double  lra;           // LU, loudness range
+	double  truePeak;      // dBTP, 4x oversampled (2x at 96 kHz)
+	double  samplePeak;    // dBFS
+	int64_t samples;       // per channel, since init / reset
+};
+
+/*
+** @brief AudioLoudness streaming EBU R128 meter: a tap on the float frames going to the encoder, so the
+** loudness of a program is known when the encoding ends, without decoding it again.
+** k-weighting biquads per channel, 100 ms blocks for momentary (4 blocks) and short-term (30 blocks).
+** the gating for integrated loudness and LRA works on histograms of 0.1 LU bins that keep the count
+** and the energy sum of the blocks in each bin: constant memory however long the program runs, and
+** integrated loudness is exact except for the blocks in the one bin the relative gate cuts through.
+** first call audioLoudnessInit(), then audioLoudnessFrame() for every frame, audioLoudnessGet() any time.
+** one thread: audioLoudnessGet() runs on the thread that feeds the frames.
+*/
+class AudioLoudness {
+public:
+	AudioLoudness();
+	~AudioLoudness();
+public:
+	int  audioLoudnessInit(int sampleRate, uint64_t channelLayout);
+	/* fltp or flt frame with the rate / layout of audioLoudnessInit() */
+	int  audioLoudnessFrame(const AVFrame *frame);
+	void audioLoudnessGet(AudioLoudnessResult *result) const;
+	/* start a new program, the filters keep their state */
+	void audioLoudnessReset();
+private:
+	enum { HIST_BINS = 900, SHORT_BLOCKS = 30 };      // -70 .. +20 LUFS in 0.1 LU
+	struct Histogram {
+		int64_t count[HIST_BINS];
+		double  energy[HIST_BINS];
+	};
+	void   addSamples(const float *const *planes, int stride, int offset, int n);
+	void   endBlock();
+	void   truePeak(const float *data, int stride, int n, int channel);
+	static void   histAdd(Histogram *hist, double energy);
+	static double histGatedEnergy(const Histogram *hist, double gate, int64_t *count);
+private:
+	int              sampleRate_;
+	int              channels_;
+	vector<double>   weight_;          // channel weight, 0 for lfe
+	double           pb_[3], pa_[3];   // k-weighting pre filter (high shelf)
+	double           rb_[3], ra_[3];   // rlb high pass
+	vector<double>   state_;           // 4 per channel: pre filter and high pass state
+	vector<double>   blockSum_;        // per channel weighted square sum of the running 100 ms block
+	int              blockSamples_;    // samples per 100 ms block
+	int              blockFill_;
+	double           blocks_[SHORT_BLOCKS];   // energy of the last 100 ms blocks, ring
+	int64_t          blockCount_;
+	Histogram       *gating_;          // 400 ms blocks, integrated
+	Histogram       *range_;           // 3 s blocks, lra
+	int              tpFactor_;        // oversampling
+	int              tpTaps_;          // taps per phase
+	vector<float>    tpCoef_;          // tpFactor_ phases of tpTaps_
+	vector<float>    tpHistory_;       // tpTaps_ - 1 per channel
+	vector<float>    tpScratch_;
+	double           truePeak_;
+	double           samplePeak_;
+	int64_t          samples_;
+};
+
+#endif
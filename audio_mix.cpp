@@ -0,0 +1,243 @@
+#include <string.h>
+#include "audio_mix.h"
+#include "audio_dsp.h"
+
+AudioMixer::AudioMixer()
+	:sampleRate_(0), channelLayout_(0), channels_(0), format_(AV_SAMPLE_FMT_FLTP), frameSamples_(0),
+	clip_(AUDIO_MIXER_CLIP_SOFT), knee_(0.8f), timeoutUs_(50000), maxQueue_(0), waitSince_(AV_NOPTS_VALUE),
+	nextPts_(0), mixFrame_(NULL), readFrame_(NULL), frame_(NULL), pool_(AudioBufferPool::audioPoolDefault())
+{
+}
+
+AudioMixer::~AudioMixer()
+{
+	for (size_t i = 0; i < streams_.size(); i++) {
+		delete streams_[i]->sample;
+		av_audio_fifo_free(streams_[i]->fifo);
+		delete streams_[i];
+	}
+	av_frame_free(&mixFrame_);
+	av_frame_free(&readFrame_);
+	av_frame_free(&frame_);
+}
+
+int AudioMixer::audioMixerInit(int sampleRate, uint64_t channelLayout, AVSampleFormat format, int frameSamples)
+{
+	if (format != AV_SAMPLE_FMT_FLTP && format != AV_SAMPLE_FMT_S16) {
+		av_log(NULL, AV_LOG_ERROR, "mixer output is fltp or s16.\n");
+		return -1;
+	}
+	sampleRate_ = sampleRate;
+	channelLayout_ = channelLayout;
+	channels_ = av_get_channel_layout_nb_channels(channelLayout);
+	format_ = format;
+	frameSamples_ = frameSamples;
+	maxQueue_ = sampleRate / 2;
+	mixFrame_ = pool_->audioPoolGetFrame(channelLayout, AV_SAMPLE_FMT_FLTP, frameSamples);
+	readFrame_ = pool_->audioPoolGetFrame(channelLayout, AV_SAMPLE_FMT_FLTP, frameSamples);
+	if (format == AV_SAMPLE_FMT_S16)
+		frame_ = pool_->audioPoolGetFrame(channelLayout, AV_SAMPLE_FMT_S16, frameSamples);
+	if (!mixFrame_ || !readFrame_ || (format == AV_SAMPLE_FMT_S16 && !frame_)) {
+		av_log(NULL, AV_LOG_ERROR, "create mixer frame failure.\n");
+		return -1;
+	}
+	return 0;
+}
+
+int AudioMixer::audioMixerAddStream(int sampleRate, AVSampleFormat format, uint64_t channelLayout, float gain)
+{
+	if (!mixFrame_)
+		return -1;
+	MixStream *s = new MixStream;
+	s->sample = NULL;
+	s->gain = gain;
+	s->ended = 0;
+	s->inRate = sampleRate;
+	s->deficit = 0;
+	s->lastIngest = AUDIO_NO_INGEST;
+	s->lastSamples = 0;
+	memset(&s->stats, 0, sizeof(s->stats));
+	s->fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, channels_, frameSamples_ * 2);
+	if (sampleRate != sampleRate_ || format != AV_SAMPLE_FMT_FLTP || channelLayout != channelLayout_) {
+		s->sample = new AudioSample(sampleRate, format, channelLayout, sampleRate_, AV_SAMPLE_FMT_FLTP, channelLayout_);
+		if (s->sample->audioSampleInit() < 0) {
+			delete s->sample;
+			s->sample = NULL;
+			av_audio_fifo_free(s->fifo);
+			s->fifo = NULL;
+		}
+	}
+	if (!s->fifo) {
+		av_log(NULL, AV_LOG_ERROR, "add mixer stream failure.\n");
+		delete s;
+		return -1;
+	}
+	streams_.push_back(s);
+	return (int)streams_.size() - 1;
+}
+
+void AudioMixer::audioMixerSetGain(int index, float gain)
+{
+	if (index >= 0 && index < (int)streams_.size())
+		streams_[index]->gain.store(gain, memory_order_relaxed);
+}
+
+void AudioMixer::audioMixerSetClip(AudioMixerClip clip, float knee)
+{
+	clip_ = clip;
+	knee_ = av_clipf(knee, 0.0f, 0.99f);
+}
+
+void AudioMixer::audioMixerSetTimeout(int late_ms)
+{
+	timeoutUs_ = (int64_t)late_ms * 1000;
+}
+
+void AudioMixer::audioMixerSetMaxQueue(int max_ms)
+{
+	maxQueue_ = FFMAX((int)av_rescale(max_ms, sampleRate_, 1000), frameSamples_);
+}
+
+/* converted samples into the fifo, called with s->lock held */
+int AudioMixer::queueSamples(MixStream *s, AVFrame *frame)
+{
+	int n = frame->nb_samples;
+	int skip = (int)FFMIN(s->deficit, (int64_t)n);
+	s->deficit -= skip;
+	s->stats.dropped += skip;
+	if (n > skip) {
+		uint8_t *planes[AV_NUM_DATA_POINTERS];
+		for (int c = 0; c < channels_ && c < AV_NUM_DATA_POINTERS; c++)
+			planes[c] = frame->extended_data[c] + skip * sizeof(float);
+		if (av_audio_fifo_write(s->fifo, (void **)planes, n - skip) < n - skip)
+			return AVERROR(ENOMEM);
+	}
+	int over = av_audio_fifo_size(s->fifo) - maxQueue_;
+	if (over > 0) {
+		// the output side stopped pulling, keep the newest samples
+		av_audio_fifo_drain(s->fifo, over);
+		s->stats.dropped += over;
+	}
+	s->lastIngest = frame->reordered_opaque;
+	s->lastSamples = n;
+	return 0;
+}
+
+int AudioMixer::audioMixerPush(int index, AVFrame *frame)
+{
+	if (index < 0 || index >= (int)streams_.size())
+		return -1;
+	MixStream *s = streams_[index];
+	AVFrame *in = frame;
+	int ret = 0;
+	if (s->sample) {
+		// the converter is only used by this input's thread, the lock covers the fifo
+		if (s->sample->audioSampleConvert(frame, &in) < 0) {
+			if (frame)
+				return -1;
+			in = NULL;       // nothing left in the resampler
+		}
+	}
+	lock_guard<mutex> lock(s->lock);
+	if (in && in->nb_samples > 0)
+		ret = queueSamples(s, in);
+	if (!frame)
+		s->ended = 1;
+	return ret;
+}
+
+int AudioMixer::audioMixerMix(AVFrame **frame)
+{
+	if (!mixFrame_)
+		return -1;
+	int ready = 1, any = 0, done = 1;
+	for (size_t i = 0; i < streams_.size(); i++) {
+		MixStream *s = streams_[i];
+		lock_guard<mutex> lock(s->lock);
+		int size = av_audio_fifo_size(s->fifo);
+		if (size >= frameSamples_)
+			any = 1;
+		else if (!s->ended)
+			ready = 0;
+		if (!s->ended || size > 0)
+			done = 0;
+	}
+	if (done)
+		return AVERROR_EOF;
+	if (!ready) {
+		// nobody has a frame: the inputs set the pace. somebody has: the late ones get the timeout
+		if (!any)
+			return AVERROR(EAGAIN);
+		int64_t now = av_gettime_relative();
+		if (waitSince_ == AV_NOPTS_VALUE)
+			waitSince_ = now;
+		if (now - waitSince_ < timeoutUs_)
+			return AVERROR(EAGAIN);
+	}
+	waitSince_ = AV_NOPTS_VALUE;
+
+	const AudioDsp *dsp = audioDspGet();
+	if (pool_->audioPoolMakeWritable(mixFrame_) < 0)
+		return AVERROR(ENOMEM);
+	for (int c = 0; c < channels_; c++)
+		memset(mixFrame_->extended_data[c], 0, frameSamples_ * sizeof(float));
+	int64_t ingest = AUDIO_NO_INGEST;
+	for (size_t i = 0; i < streams_.size(); i++) {
+		MixStream *s = streams_[i];
+		int got;
+		{
+			lock_guard<mutex> lock(s->lock);
+			int size = av_audio_fifo_size(s->fifo);
+			got = av_audio_fifo_read(s->fifo, (void **)readFrame_->extended_data, FFMIN(size, frameSamples_));
+			if (got < 0)
+				got = 0;
+			if (got < frameSamples_ && !s->ended) {
+				s->stats.late++;
+				s->deficit += frameSamples_ - got;
+			}
+			s->stats.samples += got;
+			s->stats.queued = av_audio_fifo_size(s->fifo);
+			// capture time of the first sample read: the last push minus what was queued before it
+			if (got > 0 && s->lastIngest != AUDIO_NO_INGEST) {
+				int64_t head = s->lastIngest - av_rescale(size - s->lastSamples, 1000000, sampleRate_);
+				ingest = ingest == AUDIO_NO_INGEST ? head : FFMIN(ingest, head);
+			}
+		}
+		float gain = s->gain.load(memory_order_relaxed);
+		if (got > 0 && gain != 0.0f) {
+			for (int c = 0; c < channels_; c++)
+				dsp->mixAdd((float *)mixFrame_->extended_data[c], (const float *)readFrame_->extended_data[c], gain, got);
+		}
+	}
+	for (int c = 0; c < channels_; c++) {
+		float *data = (float *)mixFrame_->extended_data[c];
+		if (clip_ == AUDIO_MIXER_CLIP_HARD)
+			dsp->clipHard(data, frameSamples_);
+		else if (clip_ == AUDIO_MIXER_CLIP_SOFT)
+			dsp->clipSoft(data, frameSamples_, knee_);
+	}
+	AVFrame *out = mixFrame_;
+	if (format_ == AV_SAMPLE_FMT_S16) {
+		if (pool_->audioPoolMakeWritable(frame_) < 0)
+			return AVERROR(ENOMEM);
+		dsp->fltpToS16((int16_t *)frame_->data[0], (const float *const *)mixFrame_->extended_data, channels_,
+			frameSamples_);
+		out = frame_;
+	}
+	out->pts = nextPts_;
+	out->pkt_duration = frameSamples_;
+	out->sample_rate = sampleRate_;
+	out->reordered_opaque = ingest;
+	nextPts_ += frameSamples_;
+	*frame = out;
+	return 0;
+}
+
+int AudioMixer::audioMixerGetStats(int index, AudioMixerStats *stats)
+{
+	if (index < 0 || index >= (int)streams_.size())
+		return -1;
+	lock_guard<mutex> lock(streams_[index]->lock);
+	*stats = streams_[index]->stats;
+	return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef __AUDIO_MIX__H_
+#define __AUDIO_MIX__H_
+#include <vector>
+#include "audio_engine.h"
+
+enum AudioMixerClip {
+	AUDIO_MIXER_CLIP_NONE,     // float output may go past 1.0, s16 output still saturates
+	AUDIO_MIXER_CLIP_HARD,     // clamp to [-1, 1]
+	AUDIO_MIXER_CLIP_SOFT,     // unity below the knee, smooth above
+};
+
+/*
+** @brief AudioMixerStats counters of one mixer input
+*/
+struct AudioMixerStats {
+	int64_t samples;     // samples mixed
+	int64_t late;        // output frames mixed without (all of) this input's samples
+	int64_t dropped;     // samples thrown away: arrived after they were mixed as silence, or queue overflow
+	int     queued;      // samples waiting, at the output rate
+};
+
+/*
+** @brief AudioMixer sums N capture / decode streams (FLTP or S16, any rate and layout) into one feed.
+** every input has its own gain and is converted to the output rate / layout with AudioSample on the
+** pushing thread, the sum runs with the avx2 / sse kernels of AudioDsp on float planes and ends with
+** hard or soft clipping. an output frame is mixed as soon as every live input has a frame of samples;
+** an input that is later than the timeout is mixed as silence for that frame and its late samples are
+** skipped when they arrive, so one stalled device does not hold up the program feed.
+** first call audioMixerInit() and audioMixerAddStream() for every input, then audioMixerPush() from the
+** input threads and audioMixerMix() on the output thread until AVERROR_EOF.
+*/
+class AudioMixer {
+public:
+	AudioMixer();
+	~AudioMixer();
+public:
+	/* output: FLTP or S16 (interleaved), frameSamples per output frame */
+	int  audioMixerInit(int sampleRate, uint64_t channelLayout, AVSampleFormat format = AV_SAMPLE_FMT_FLTP,
+		int frameSamples = 1024);
+	/* returns the input index, before the first audioMixerPush() */
+	int  audioMixerAddStream(int sampleRate, AVSampleFormat format, uint64_t channelLayout, float gain = 1.0f);
+	/* linear gain, any thread, takes effect with the next output frame */
+	void audioMixerSetGain(int index, float gain);
+	void audioMixerSetClip(AudioMixerClip clip, float knee = 0.8f);
+	/* how long audioMixerMix() waits for a late input once another one has a frame ready (default 50 ms) */
+	void audioMixerSetTimeout(int late_ms);
+	/* an input queues at most max_ms, older samples are dropped (default 500 ms) */
+	void audioMixerSetMaxQueue(int max_ms);
+	/* one input frame, any thread (one per input). NULL: the input ended */
+	int  audioMixerPush(int index, AVFrame *frame);
+	/* next output frame, valid until the next call. AVERROR(EAGAIN): inputs not ready and the timeout not
+	** reached yet, AVERROR_EOF: every input ended and was mixed. pts counts output samples */
+	int  audioMixerMix(AVFrame **frame);
+	int  audioMixerGetStats(int index, AudioMixerStats *stats);
+	int  audioMixerStreams() const { return (int)streams_.size(); }
+private:
+	struct MixStream {
+		mutex         lock;
+		AudioSample  *sample;       // NULL when the input already is FLTP at the output rate / layout
+		AVAudioFifo  *fifo;
+		atomic<float> gain;
+		int           ended;
+		int           inRate;
+		int64_t       deficit;      // samples mixed as silence, to be skipped when they arrive
+		int64_t       lastIngest;   // capture time of the last pushed frame
+		int           lastSamples;  // its samples at the output rate
+		AudioMixerStats stats;
+	};
+	int  queueSamples(MixStream *s, AVFrame *frame);
+private:
+	vector<MixStream*> streams_;
+	int             sampleRate_;
+	uint64_t        channelLayout_;
+	int             channels_;
+	AVSampleFormat  format_;
+	int             frameSamples_;
+	AudioMixerClip  clip_;
+	float           knee_;
+	int64_t         timeoutUs_;
+	int             maxQueue_;
+	int64_t         waitSince_;    // when an output frame first could have been mixed but an input was missing
+	int64_t         nextPts_;
+	AVFrame        *mixFrame_;     // float sums
+	AVFrame        *readFrame_;    // one input's samples
+	AVFrame        *frame_;        // s16 output
+	AudioBufferPool *pool_;
+};
+
+#endif
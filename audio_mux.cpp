@@ -0,0 +1,198 @@
+#include <string.h>
+#include "audio_mux.h"
+
+AudioMuxer::AudioMuxer(int bufferSize, int bufferCount)
+	:sink_(bufferSize, bufferCount), fmtCtx_(NULL), ioCtx_(NULL), options_(NULL), packet_(NULL),
+	headerWritten_(0), ingestUs_(AUDIO_NO_INGEST), size_(0)
+{
+}
+
+AudioMuxer::~AudioMuxer()
+{
+	audioMuxClose();
+}
+
+int AudioMuxer::audioMuxOpen(string filename, const char *format)
+{
+	const char *name = format;
+	int fragmented = 0;
+	if (format && !strcmp(format, "m4a")) {
+		name = "ipod";
+	} else if (format && !strcmp(format, "fmp4")) {
+		name = "mp4";
+		fragmented = 1;
+	}
+	int ret = avformat_alloc_output_context2(&fmtCtx_, NULL, name, filename.c_str());
+	if (ret < 0 || !fmtCtx_) {
+		av_log(NULL, AV_LOG_ERROR, "mux no output format for %s.\n", filename.c_str());
+		return -1;
+	}
+	if (fragmented) {
+		// audio packets are all key frames, frag_keyframe would cut a fragment per packet
+		av_dict_set(&options_, "movflags", "empty_moov+default_base_moof", 0);
+		av_dict_set(&options_, "frag_duration", "1000000", 0);
+	}
+	if (sink_.audioSinkOpen(filename) < 0)
+		return -1;
+	uint8_t *buffer = (uint8_t *)av_malloc(IO_BUFFER_SIZE);
+	ioCtx_ = buffer ? avio_alloc_context(buffer, IO_BUFFER_SIZE, 1, this, NULL, ioWrite, ioSeek) : NULL;
+	packet_ = av_packet_alloc();
+	if (!ioCtx_ || !packet_) {
+		if (!ioCtx_)
+			av_free(buffer);
+		av_log(NULL, AV_LOG_ERROR, "mux alloc io context failure.\n");
+		return -1;
+	}
+	fmtCtx_->pb = ioCtx_;
+	fmtCtx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+	fmtCtx_->flush_packets = 0;    // the sink decides when bytes hit the disk, not every packet
+	headerWritten_ = 0;
+	ingestUs_ = AUDIO_NO_INGEST;
+	size_ = 0;
+	return 0;
+}
+
+void AudioMuxer::audioMuxSetOption(const char *key, const char *value)
+{
+	av_dict_set(&options_, key, value, 0);
+}
+
+int AudioMuxer::audioMuxSetMetadata(const char *key, const char *value)
+{
+	if (!fmtCtx_)
+		return -1;
+	return av_dict_set(&fmtCtx_->metadata, key, value, 0) < 0 ? -1 : 0;
+}
+
+int AudioMuxer::audioMuxAddStream(AudioEncode *encode)
+{
+	AVCodecContext *ctx = encode->audioEncodeGetContext();
+	if (!ctx || !fmtCtx_) {
+		av_log(NULL, AV_LOG_ERROR, "mux add stream before open.\n");
+		return -1;
+	}
+	if ((fmtCtx_->oformat->flags & AVFMT_GLOBALHEADER) && !ctx->extradata_size) {
+		av_log(NULL, AV_LOG_ERROR, "mux %s needs extradata, call audioEncodeSetGlobalHeader(1).\n",
+			fmtCtx_->oformat->name);
+		return -1;
+	}
+	AVCodecParameters *par = avcodec_parameters_alloc();
+	if (!par || avcodec_parameters_from_context(par, ctx) < 0) {
+		avcodec_parameters_free(&par);
+		return -1;
+	}
+	// initial_padding goes along: edit list in m4a, CodecDelay in mkv
+	int ret = audioMuxAddStream(par, ctx->time_base);
+	avcodec_parameters_free(&par);
+	return ret;
+}
+
+int AudioMuxer::audioMuxAddStream(const AVCodecParameters *par, AVRational time_base)
+{
+	if (!fmtCtx_ || headerWritten_) {
+		av_log(NULL, AV_LOG_ERROR, "mux add stream after the header.\n");
+		return -1;
+	}
+	AVStream *st = avformat_new_stream(fmtCtx_, NULL);
+	if (!st || avcodec_parameters_copy(st->codecpar, par) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "mux new stream failure.\n");
+		return -1;
+	}
+	st->codecpar->codec_tag = 0;
+	st->time_base = time_base;    // a hint, the muxer picks its own in avformat_write_header()
+	timeBase_.push_back(time_base);
+	return st->index;
+}
+
+int AudioMuxer::writeHeader()
+{
+	int ret = avformat_write_header(fmtCtx_, &options_);
+	if (ret < 0) {
+		char error[128];
+		av_strerror(ret, error, sizeof(error));
+		av_log(NULL, AV_LOG_ERROR, "mux write header failure.[%s]\n", error);
+		return -1;
+	}
+	headerWritten_ = 1;
+	return 0;
+}
+
+int AudioMuxer::audioMuxWrite(AVPacket *packet, int64_t ingest_us)
+{
+	if (!fmtCtx_ || packet->stream_index < 0 || packet->stream_index >= (int)timeBase_.size())
+		return -1;
+	if (!headerWritten_ && writeHeader() < 0)
+		return -1;
+	if (ingestUs_ == AUDIO_NO_INGEST)
+		ingestUs_ = ingest_us;
+	// the muxer takes ownership of what it gets, give it a new reference and keep the caller's packet
+	if (av_packet_ref(packet_, packet) < 0)
+		return -1;
+	AVStream *st = fmtCtx_->streams[packet->stream_index];
+	av_packet_rescale_ts(packet_, timeBase_[packet->stream_index], st->time_base);
+	int ret = av_interleaved_write_frame(fmtCtx_, packet_);
+	if (ret < 0) {
+		char error[128];
+		av_strerror(ret, error, sizeof(error));
+		av_log(NULL, AV_LOG_ERROR, "mux write packet failure.[%s]\n", error);
+		return -1;
+	}
+	return 0;
+}
+
+int AudioMuxer::audioMuxClose()
+{
+	int ret = 0;
+	if (fmtCtx_) {
+		if (headerWritten_ && av_write_trailer(fmtCtx_) < 0)
+			ret = -1;
+		if (ioCtx_) {
+			avio_flush(ioCtx_);
+			av_freep(&ioCtx_->buffer);
+			avio_context_free(&ioCtx_);
+		}
+		avformat_free_context(fmtCtx_);
+		fmtCtx_ = NULL;
+	}
+	if (sink_.audioSinkClose() < 0)
+		ret = -1;
+	av_packet_free(&packet_);
+	av_dict_free(&options_);
+	timeBase_.clear();
+	headerWritten_ = 0;
+	return ret;
+}
+
+int AudioMuxer::ioWrite(void *opaque, uint8_t *buf, int size)
+{
+	AudioMuxer *mux = (AudioMuxer *)opaque;
+	if (mux->sink_.audioSinkWrite(buf, size, mux->ingestUs_) < 0)
+		return AVERROR(EIO);
+	mux->ingestUs_ = AUDIO_NO_INGEST;
+	mux->size_ = FFMAX(mux->size_, mux->sink_.audioSinkPosition());
+	return size;
+}
+
+int64_t AudioMuxer::ioSeek(void *opaque, int64_t offset, int whence)
+{
+	AudioMuxer *mux = (AudioMuxer *)opaque;
+	int64_t pos;
+	if (whence & AVSEEK_SIZE)
+		return mux->size_;
+	switch (whence & ~AVSEEK_FORCE) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = mux->sink_.audioSinkPosition() + offset;
+		break;
+	case SEEK_END:
+		pos = mux->size_ + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+	if (mux->sink_.audioSinkSeek(pos) < 0)
+		return AVERROR(EIO);
+	return pos;
+}
@@ -0,0 +1,62 @@
+#ifndef __AUDIO_MUX__H_
+#define __AUDIO_MUX__H_
+#include <vector>
+#include "audio_sink.h"
+extern "C"
+{
+#include "libavformat/avformat.h"
+}
+
+/*
+** @brief AudioMuxer container output (adts, m4a, fragmented mp4, mpeg-ts, matroska, ogg) through libavformat.
+** the muxer writes into a custom AVIOContext whose write / seek callbacks feed an AudioFileSink, so the
+** bytes go through one large aio buffer per MB instead of small blocking writes from the muxing thread.
+** m4a is written with the moov at the end (one seek back to patch the mdat size), never with faststart,
+** which would need a second pass reading the whole file back.
+** first call audioMuxOpen(), then audioMuxAddStream() for every stream, audioMuxWrite() for every packet
+** and audioMuxClose() at the end. the header is written with the first packet.
+*/
+class AudioMuxer {
+public:
+	AudioMuxer(int bufferSize = 1 << 20, int bufferCount = 4);
+	~AudioMuxer();
+public:
+	/* format: "adts", "m4a", "mp4", "fmp4" (fragmented, 1s fragments), "mpegts", "matroska",
+	** "ogg" / "opus" (opus, the OpusHead comes from the encoder's extradata; pages are cut every
+	** page_duration, 1 s by default, set it lower for live), NULL guesses it from the file extension */
+	int  audioMuxOpen(string filename, const char *format = NULL);
+	/* muxer private option (movflags, frag_duration, ...), before the first audioMuxWrite() */
+	void audioMuxSetOption(const char *key, const char *value);
+	/* file tag ("comment", "title", ...). m4a writes the tags with the moov at the end, so a tag set
+	** right before audioMuxClose() (the loudness of the program) still lands in the file */
+	int  audioMuxSetMetadata(const char *key, const char *value);
+	/* stream for the packets of an opened encoder, m4a / mkv need audioEncodeSetGlobalHeader(1).
+	** returns the stream index */
+	int  audioMuxAddStream(AudioEncode *encode);
+	/* stream with the given parameters, packets are in time_base */
+	int  audioMuxAddStream(const AVCodecParameters *par, AVRational time_base);
+	/* mux one packet of stream packet->stream_index, the packet is only referenced */
+	int  audioMuxWrite(AVPacket *packet, int64_t ingest_us = AUDIO_NO_INGEST);
+	/* write the trailer, wait for the writer thread and close the file */
+	int  audioMuxClose();
+	void audioMuxGetStats(AudioSinkStats *stats) { sink_.audioSinkGetStats(stats); }
+	/* capture -> written latency of the packets muxed with an ingest time */
+	const AudioLatencyStats& audioMuxGetLatency() const { return sink_.audioSinkGetLatency(); }
+private:
+	static int     ioWrite(void *opaque, uint8_t *buf, int size);
+	static int64_t ioSeek(void *opaque, int64_t offset, int whence);
+	int  writeHeader();
+private:
+	enum { IO_BUFFER_SIZE = 64 * 1024 };
+	AudioFileSink       sink_;
+	AVFormatContext    *fmtCtx_;
+	AVIOContext        *ioCtx_;
+	AVDictionary       *options_;
+	AVPacket           *packet_;
+	vector<AVRational>  timeBase_;       // time base of the packets handed in, per stream
+	int                 headerWritten_;
+	int64_t             ingestUs_;       // oldest capture time not yet handed to the sink
+	int64_t             size_;           // file size, for AVSEEK_SIZE
+};
+
+#endif
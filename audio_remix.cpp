@@ -0,0 +1,125 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include "audio_remix.h"
+#include "audio_dsp.h"
+
+AudioRemix::AudioRemix()
+	:inLayout_(0), outLayout_(0), frame_(NULL), capacity_(0), pool_(AudioBufferPool::audioPoolDefault())
+{
+}
+
+AudioRemix::~AudioRemix()
+{
+	av_frame_free(&frame_);
+}
+
+shared_ptr<const AudioRemix::RemixMatrix> AudioRemix::matrixGet(uint64_t inLayout, uint64_t outLayout, int normalize)
+{
+	typedef pair<pair<uint64_t, uint64_t>, int> RemixKey;
+	static mutex lock;
+	static map<RemixKey, shared_ptr<const RemixMatrix> > cache;
+	lock_guard<mutex> guard(lock);
+	RemixKey key(make_pair(inLayout, outLayout), normalize);
+	map<RemixKey, shared_ptr<const RemixMatrix> >::iterator it = cache.find(key);
+	if (it != cache.end())
+		return it->second;
+
+	int in_channels = av_get_channel_layout_nb_channels(inLayout);
+	int out_channels = av_get_channel_layout_nb_channels(outLayout);
+	vector<double> coef(out_channels * in_channels);
+	// what swr_init() builds: -3 dB center and surround, lfe dropped. maxval 1.0 normalizes the rows so
+	// integer samples can't clip, float output / internal format gets INT_MAX: no normalization
+	double maxval = normalize ? 1.0 : INT_MAX;
+	if (swr_build_matrix(inLayout, outLayout, M_SQRT1_2, M_SQRT1_2, 0, maxval, 1.0, coef.data(), in_channels,
+		AV_MATRIX_ENCODING_NONE, NULL) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "remix: no matrix for layout 0x%llx -> 0x%llx.\n",
+			(unsigned long long)inLayout, (unsigned long long)outLayout);
+		return shared_ptr<const RemixMatrix>();
+	}
+	RemixMatrix *matrix = new RemixMatrix;
+	matrix->inChannels = in_channels;
+	matrix->rows.resize(out_channels);
+	for (int o = 0; o < out_channels; o++) {
+		for (int i = 0; i < in_channels; i++) {
+			double gain = coef[o * in_channels + i];
+			if (fabs(gain) > 1e-6) {
+				RemixTerm term = { i, (float)gain };
+				matrix->rows[o].push_back(term);
+			}
+		}
+	}
+	shared_ptr<const RemixMatrix> shared(matrix);
+	cache[key] = shared;
+	return shared;
+}
+
+int AudioRemix::audioRemixInit(uint64_t inLayout, uint64_t outLayout, AVSampleFormat inFormat, AVSampleFormat outFormat)
+{
+	// swr_init(): the internal format is s16p when both sides are at most 16 bit, the matrix is
+	// normalized when the output or the internal format is an integer one
+	int int_internal = av_get_bytes_per_sample(inFormat) <= 2 && av_get_bytes_per_sample(outFormat) <= 2;
+	int normalize = av_get_packed_sample_fmt(outFormat) < AV_SAMPLE_FMT_FLT || int_internal;
+	matrix_ = matrixGet(inLayout, outLayout, normalize);
+	if (!matrix_)
+		return -1;
+	inLayout_ = inLayout;
+	outLayout_ = outLayout;
+	return 0;
+}
+
+void AudioRemix::audioRemixPlanes(float *const *out, const float *const *in, int n)
+{
+	const AudioDsp *dsp = audioDspGet();
+	for (size_t o = 0; o < matrix_->rows.size(); o++) {
+		const vector<RemixTerm> &row = matrix_->rows[o];
+		float *dst = out[o];
+		switch (row.size()) {
+		case 0:
+			memset(dst, 0, n * sizeof(float));
+			break;
+		case 1:
+			if (row[0].gain == 1.0f)
+				memcpy(dst, in[row[0].in], n * sizeof(float));
+			else
+				dsp->mixSet(dst, in[row[0].in], row[0].gain, n);
+			break;
+		case 2:
+			dsp->mix2(dst, in[row[0].in], row[0].gain, in[row[1].in], row[1].gain, n);
+			break;
+		default:
+			dsp->mix3(dst, in[row[0].in], row[0].gain, in[row[1].in], row[1].gain, in[row[2].in], row[2].gain, n);
+			for (size_t t = 3; t < row.size(); t++)
+				dsp->mixAdd(dst, in[row[t].in], row[t].gain, n);
+			break;
+		}
+	}
+}
+
+int AudioRemix::audioRemixFrame(const AVFrame *src, AVFrame **dst)
+{
+	if (!matrix_ || src->format != AV_SAMPLE_FMT_FLTP || src->channels != matrix_->inChannels) {
+		av_log(NULL, AV_LOG_ERROR, "remix: fltp frames of the in layout.\n");
+		return -1;
+	}
+	if (!frame_ || src->nb_samples > capacity_) {
+		av_frame_free(&frame_);
+		frame_ = pool_->audioPoolGetFrame(outLayout_, AV_SAMPLE_FMT_FLTP, src->nb_samples);
+		if (!frame_) {
+			av_log(NULL, AV_LOG_ERROR, "create remix frame failure.\n");
+			return -1;
+		}
+		capacity_ = src->nb_samples;
+	}
+	frame_->nb_samples = capacity_;
+	if (pool_->audioPoolMakeWritable(frame_) < 0)
+		return -1;
+	audioRemixPlanes((float *const *)frame_->extended_data, (const float *const *)src->extended_data, src->nb_samples);
+	frame_->nb_samples = src->nb_samples;
+	frame_->pts = src->pts;
+	frame_->pkt_duration = src->pkt_duration;
+	frame_->sample_rate = src->sample_rate;
+	frame_->reordered_opaque = src->reordered_opaque;
+	*dst = frame_;
+	return 0;
+}
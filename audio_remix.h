@@ -0,0 +1,53 @@
+#ifndef __AUDIO_REMIX__H_
+#define __AUDIO_REMIX__H_
+#include <memory>
+#include <vector>
+#include "audio_engine.h"
+
+/*
+** @brief AudioRemix channel downmix / upmix of planar float audio with a matrix built once per
+** (in, out) layout pair and formats by swr_build_matrix() with the levels swr_init() would pick: rows
+** are normalized so the sum of a row stays <= 1 only when the samples end up as integers, float output
+** keeps the plain -3 dB gains the way swr does. the matrix lives in a process wide cache, every remixer
+** of the same pair shares it.
+** an output channel is one fused AudioDsp pass over the inputs it takes: 5.1 -> stereo rows are three
+** inputs (front, center, surround: mix3), stereo -> mono is one row of two (mix2), a plain copy row is a
+** memcpy. encoding voice as mono halves the encoder cpu, the stereo -> mono row is the cheapest there is.
+** AudioSample uses it instead of the swr rematrix when its input or output is fltp.
+*/
+class AudioRemix {
+public:
+	AudioRemix();
+	~AudioRemix();
+public:
+	/* inFormat / outFormat: the formats around the conversion the remix is part of (AudioSample's src
+	** and dst), they only decide the normalization. the remixer itself always works on fltp */
+	int  audioRemixInit(uint64_t inLayout, uint64_t outLayout, AVSampleFormat inFormat = AV_SAMPLE_FMT_FLTP,
+		AVSampleFormat outFormat = AV_SAMPLE_FMT_FLTP);
+	/* n samples of every input plane into every output plane, out must not alias in */
+	void audioRemixPlanes(float *const *out, const float *const *in, int n);
+	/* fltp frame -> fltp frame of the out layout owned by the remixer, valid until the next call.
+	** pts, sample rate, duration and the ingest time are copied */
+	int  audioRemixFrame(const AVFrame *src, AVFrame **dst);
+	uint64_t audioRemixInLayout() const { return inLayout_; }
+	uint64_t audioRemixOutLayout() const { return outLayout_; }
+private:
+	struct RemixTerm {
+		int   in;
+		float gain;
+	};
+	struct RemixMatrix {
+		int inChannels;
+		vector<vector<RemixTerm> > rows;     // per output channel, the inputs with a non zero gain
+	};
+	static shared_ptr<const RemixMatrix> matrixGet(uint64_t inLayout, uint64_t outLayout, int normalize);
+private:
+	uint64_t         inLayout_;
+	uint64_t         outLayout_;
+	shared_ptr<const RemixMatrix> matrix_;
+	AVFrame         *frame_;
+	int              capacity_;
+	AudioBufferPool *pool_;
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*
+** audio_remix_check: AudioRemix against the swr rematrix it replaces, stereo -> mono and 5.1 -> stereo.
+** every pair runs twice on the same fltp frames: fltp out (AudioRemix alone against swr fltp -> fltp, the
+** gains are not normalized) and s16 out (AudioSample, remix then swr format conversion, against one swr
+** fltp -> s16, normalized rows). the channels are sines loud enough that an unnormalized sum goes past
+** full scale, a wrong maxval shows up as a level or clipping difference.
+**
+** build: g++ -O2 audio_remix_check.cpp audio_engine.cpp audio_dsp.cpp audio_remix.cpp audio_decimate.cpp -Iinclude -Llib
+**        -lavdevice -lavformat -lavcodec -lswresample -lswscale -lavutil -lpthread -o audio_remix_check
+**        windows: the audio_remix_check project of ffmpeg_audio_capture.sln
+** usage: audio_remix_check, exit 1 when a sample differs by more than 1e-5 (fltp) / 1 lsb (s16)
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "audio_engine.h"
+#include "audio_remix.h"
+
+#define CHECK_RATE    48000
+#define CHECK_SAMPLES 1024
+
+static AVFrame* check_input(uint64_t layout)
+{
+	AVFrame *frame = AudioBufferPool::audioPoolDefault()->audioPoolGetFrame(layout, AV_SAMPLE_FMT_FLTP, CHECK_SAMPLES);
+	if (!frame)
+		return NULL;
+	for (int c = 0; c < frame->channels; c++) {
+		float *dst = (float *)frame->extended_data[c];
+		for (int i = 0; i < CHECK_SAMPLES; i++)
+			dst[i] = 0.7f * (float)sin(2 * M_PI * (220.0 * (c + 1)) * i / CHECK_RATE + c);
+	}
+	frame->sample_rate = CHECK_RATE;
+	frame->pts = 0;
+	return frame;
+}
+
+/* the reference: one swr context doing the rematrix and the format conversion */
+static int check_swr(const AVFrame *in, uint64_t outLayout, AVSampleFormat outFormat, AVFrame **out)
+{
+	SwrContext *swr = swr_alloc_set_opts(NULL, outLayout, outFormat, CHECK_RATE,
+		in->channel_layout, AV_SAMPLE_FMT_FLTP, CHECK_RATE, 0, NULL);
+	if (!swr || swr_init(swr) < 0) {
+		swr_free(&swr);
+		return -1;
+	}
+	*out = AudioBufferPool::audioPoolDefault()->audioPoolGetFrame(outLayout, outFormat, CHECK_SAMPLES);
+	int n = *out ? swr_convert(swr, (*out)->extended_data, CHECK_SAMPLES, (const uint8_t **)in->extended_data, CHECK_SAMPLES) : -1;
+	swr_free(&swr);
+	return n == CHECK_SAMPLES ? 0 : -1;
+}
+
+/* largest difference between two frames of the same layout, in units of the format (lsb for s16) */
+static double check_diff(const AVFrame *a, const AVFrame *b)
+{
+	double worst = 0;
+	int planar = av_sample_fmt_is_planar((AVSampleFormat)a->format);
+	int planes = planar ? a->channels : 1;
+	int n = planar ? CHECK_SAMPLES : CHECK_SAMPLES * a->channels;
+	for (int p = 0; p < planes; p++) {
+		for (int i = 0; i < n; i++) {
+			double d = a->format == AV_SAMPLE_FMT_S16 ?
+				((const int16_t *)a->extended_data[p])[i] - ((const int16_t *)b->extended_data[p])[i] :
+				((const float *)a->extended_data[p])[i] - ((const float *)b->extended_data[p])[i];
+			worst = FFMAX(worst, fabs(d));
+		}
+	}
+	return worst;
+}
+
+int main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	static const struct { const char *name; uint64_t in, out; } pairs[] = {
+		{ "stereo_to_mono", AV_CH_LAYOUT_STEREO, AV_CH_LAYOUT_MONO },
+		{ "5.1_to_stereo", AV_CH_LAYOUT_5POINT1, AV_CH_LAYOUT_STEREO },
+	};
+	static const AVSampleFormat formats[] = { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16 };
+	int failed = 0;
+	for (int p = 0; p < 2; p++) {
+		for (int f = 0; f < 2; f++) {
+			AVSampleFormat format = formats[f];
+			AVFrame *in = check_input(pairs[p].in);
+			AVFrame *ref = NULL, *test = NULL;
+			AudioRemix remix;
+			AudioSample sample(CHECK_RATE, AV_SAMPLE_FMT_FLTP, pairs[p].in, CHECK_RATE, format, pairs[p].out);
+			int ret = !in || check_swr(in, pairs[p].out, format, &ref) < 0 ? -1 : 0;
+			if (ret == 0 && format == AV_SAMPLE_FMT_FLTP)
+				ret = remix.audioRemixInit(pairs[p].in, pairs[p].out) < 0 ? -1 : remix.audioRemixFrame(in, &test);
+			else if (ret == 0)
+				ret = sample.audioSampleInit() < 0 ? -1 : sample.audioSampleConvert(in, &test);
+			if (ret < 0 || !test || test->nb_samples != CHECK_SAMPLES) {
+				printf("%-16s %-5s  FAIL: conversion failed\n", pairs[p].name, av_get_sample_fmt_name(format));
+				failed = 1;
+			} else {
+				double diff = check_diff(test, ref);
+				double limit = format == AV_SAMPLE_FMT_S16 ? 1 : 1e-5;
+				printf("%-16s %-5s  max diff %g%s\n", pairs[p].name, av_get_sample_fmt_name(format), diff,
+					diff > limit ? "  FAIL" : "");
+				failed |= diff > limit;
+			}
+			av_frame_free(&ref);
+			av_frame_free(&in);
+		}
+	}
+	return failed;
+}
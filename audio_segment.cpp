@@ -0,0 +1,383 @@
+#include <string.h>
+#include <stdio.h>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#endif
+#include "audio_segment.h"
+#include "audio_adts.h"
+extern "C"
+{
+#include "libavformat/avformat.h"
+}
+
+// the riff / data sizes are 32 bit: a wav segment rotates before its data reaches 4 GB, whatever the limits
+static const int64_t WAV_MAX_DATA = 0xffffffffLL - 36 - (1 << 20);
+
+AudioSegmentSink::AudioSegmentSink(int bufferSize)
+	:format_(AUDIO_SEGMENT_WAV), index_(0), sampleRate_(0), channels_(0), sampleFormat_(AV_SAMPLE_FMT_NONE),
+	encode_(NULL), maxBytes_(0), maxSamples_(0), maxMs_(0), syncIntervalUs_(1000000), lastSyncUs_(0),
+	direct_(0), buf_(NULL), bufSize_(FFALIGN(FFMAX(bufferSize, (int)SEGMENT_ALIGN), SEGMENT_ALIGN)),
+	bufLen_(0), bufOffset_(0), firstBlock_(NULL), dataBytes_(0), samples_(0), advised_(0)
+{
+#ifdef _MSC_VER
+	fd_ = NULL;
+#else
+	fd_ = -1;
+#endif
+}
+
+AudioSegmentSink::~AudioSegmentSink()
+{
+	audioSegmentClose();
+}
+
+void AudioSegmentSink::audioSegmentSetRotation(int64_t max_bytes, int64_t max_ms)
+{
+	maxBytes_ = max_bytes;
+	maxMs_ = max_ms;
+}
+
+void AudioSegmentSink::audioSegmentSetSync(int interval_ms)
+{
+	syncIntervalUs_ = (int64_t)interval_ms * 1000;
+}
+
+void AudioSegmentSink::audioSegmentSetDirect(int enable)
+{
+	direct_ = enable;
+}
+
+int AudioSegmentSink::audioSegmentOpen(string pattern, int sampleRate, int channels, AVSampleFormat format)
+{
+	if (av_sample_fmt_is_planar(format) || (format != AV_SAMPLE_FMT_S16 && format != AV_SAMPLE_FMT_S32 &&
+		format != AV_SAMPLE_FMT_FLT)) {
+		av_log(NULL, AV_LOG_ERROR, "segment wav needs interleaved s16 / s32 / flt.\n");
+		return -1;
+	}
+	format_ = AUDIO_SEGMENT_WAV;
+	pattern_ = pattern;
+	sampleRate_ = sampleRate;
+	channels_ = channels;
+	sampleFormat_ = format;
+	encode_ = NULL;
+	return openSegment();
+}
+
+int AudioSegmentSink::audioSegmentOpen(string pattern, AudioEncode *encode)
+{
+	AVCodecContext *ctx = encode->audioEncodeGetContext();
+	if (!ctx || !encode->audioEncodeAdts()) {
+		av_log(NULL, AV_LOG_ERROR, "segment adts needs an opened aac encoder.\n");
+		return -1;
+	}
+	format_ = AUDIO_SEGMENT_ADTS;
+	pattern_ = pattern;
+	sampleRate_ = ctx->sample_rate;
+	channels_ = ctx->channels;
+	encode_ = encode;
+	return openSegment();
+}
+
+int AudioSegmentSink::openSegment()
+{
+	char name[1024];
+	if (av_get_frame_filename2(name, sizeof(name), pattern_.c_str(), index_, AV_FRAME_FILENAME_FLAGS_MULTIPLE) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "segment pattern %s has no index.\n", pattern_.c_str());
+		return -1;
+	}
+	name_ = name;
+	string part = name_ + ".part";
+	if (!buf_) {
+#ifdef _MSC_VER
+		buf_ = (uint8_t *)_aligned_malloc(bufSize_, SEGMENT_ALIGN);
+		firstBlock_ = (uint8_t *)_aligned_malloc(SEGMENT_ALIGN, SEGMENT_ALIGN);
+#else
+		if (posix_memalign((void **)&buf_, SEGMENT_ALIGN, bufSize_) != 0)
+			buf_ = NULL;
+		if (posix_memalign((void **)&firstBlock_, SEGMENT_ALIGN, SEGMENT_ALIGN) != 0)
+			firstBlock_ = NULL;
+#endif
+		if (!buf_ || !firstBlock_) {
+			av_log(NULL, AV_LOG_ERROR, "segment alloc buffer failure.\n");
+			return -1;
+		}
+	}
+#ifdef _MSC_VER
+	fd_ = fopen(part.c_str(), "wb+");
+	if (!fd_) {
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (direct_)
+		flags |= O_DIRECT;
+#endif
+	fd_ = open(part.c_str(), flags, 0644);
+	if (fd_ < 0 && direct_ && errno == EINVAL) {
+		// tmpfs and some network file systems refuse O_DIRECT
+		av_log(NULL, AV_LOG_WARNING, "segment %s: no direct io, using fadvise.\n", part.c_str());
+		direct_ = 0;
+		fd_ = open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+	if (fd_ >= 0 && direct_)
+		fcntl(fd_, F_NOCACHE, 1);
+#endif
+	if (fd_ < 0) {
+#endif
+		av_log(NULL, AV_LOG_ERROR, "segment open file %s failure.\n", part.c_str());
+		return -1;
+	}
+	bufLen_ = 0;
+	bufOffset_ = 0;
+	dataBytes_ = 0;
+	samples_ = 0;
+	advised_ = 0;
+	maxSamples_ = av_rescale(maxMs_, sampleRate_, 1000);
+	lastSyncUs_ = av_gettime_relative();
+	if (format_ == AUDIO_SEGMENT_WAV) {
+		// sizes are filled in by patchWavHeader()
+		memset(buf_, 0, WAV_HEADER_SIZE);
+		bufLen_ = WAV_HEADER_SIZE;
+		patchWavHeader();
+	}
+	return 0;
+}
+
+/* write a canonical 44 byte wav header with the current sizes. while block 0 is still in buf_ it is
+** patched there, afterwards in the copy of block 0, which is written back whole (direct io) */
+int AudioSegmentSink::patchWavHeader()
+{
+	int bps = av_get_bytes_per_sample(sampleFormat_);
+	uint32_t data = (uint32_t)FFMIN(dataBytes_, (int64_t)UINT32_MAX - WAV_HEADER_SIZE);
+	uint8_t *h = bufOffset_ == 0 ? buf_ : firstBlock_;
+	memcpy(h, "RIFF", 4);
+	AV_WL32(h + 4, 36 + data);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	AV_WL32(h + 16, 16);
+	AV_WL16(h + 20, sampleFormat_ == AV_SAMPLE_FMT_FLT ? 3 : 1);    // float / pcm
+	AV_WL16(h + 22, channels_);
+	AV_WL32(h + 24, sampleRate_);
+	AV_WL32(h + 28, sampleRate_ * channels_ * bps);
+	AV_WL16(h + 32, channels_ * bps);
+	AV_WL16(h + 34, bps * 8);
+	memcpy(h + 36, "data", 4);
+	AV_WL32(h + 40, data);
+	if (bufOffset_ == 0)
+		return 0;
+	return writeAt(firstBlock_, direct_ ? SEGMENT_ALIGN : WAV_HEADER_SIZE, 0);
+}
+
+int AudioSegmentSink::writeAt(const uint8_t *data, int len, int64_t offset)
+{
+#ifdef _MSC_VER
+	if (_fseeki64(fd_, offset, SEEK_SET) != 0 || fwrite(data, 1, len, fd_) != (size_t)len) {
+		av_log(NULL, AV_LOG_ERROR, "segment write failure.\n");
+		return -1;
+	}
+	return 0;
+#else
+	int done = 0;
+	while (done < len) {
+		ssize_t ret = pwrite(fd_, data + done, len - done, offset + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			av_log(NULL, AV_LOG_ERROR, "segment write failure.[%s]\n", strerror(errno));
+			return -1;
+		}
+		done += (int)ret;
+	}
+	return 0;
+#endif
+}
+
+/* write buf_ at bufOffset_. direct io only writes whole blocks: the last partial block goes out padded,
+** the file is cut back to its real size and the block stays in buf_ to be written again when complete */
+int AudioSegmentSink::flushBuffer()
+{
+	if (bufLen_ == 0)
+		return 0;
+	int len = bufLen_;
+	if (direct_) {
+		len = FFALIGN(bufLen_, SEGMENT_ALIGN);
+		memset(buf_ + bufLen_, 0, len - bufLen_);
+	}
+	if (writeAt(buf_, len, bufOffset_) < 0)
+		return -1;
+	if (bufOffset_ == 0) {
+		memset(firstBlock_, 0, SEGMENT_ALIGN);
+		memcpy(firstBlock_, buf_, FFMIN(len, (int)SEGMENT_ALIGN));
+	}
+	int64_t end = bufOffset_ + bufLen_;
+	if (len != bufLen_) {
+#ifndef _MSC_VER
+		if (ftruncate(fd_, end) < 0) {
+			av_log(NULL, AV_LOG_ERROR, "segment truncate failure.[%s]\n", strerror(errno));
+			return -1;
+		}
+#endif
+		int keep = bufLen_ % SEGMENT_ALIGN;
+		memmove(buf_, buf_ + bufLen_ - keep, keep);
+		bufOffset_ = end - keep;
+		bufLen_ = keep;
+	} else {
+		bufOffset_ = end;
+		bufLen_ = 0;
+	}
+	return 0;
+}
+
+/* everything written so far is on disk when this returns, then it leaves the page cache */
+int AudioSegmentSink::syncSegment()
+{
+	// header first: while block 0 is still buffered the patch goes out with this flush
+	if (format_ == AUDIO_SEGMENT_WAV && patchWavHeader() < 0)
+		return -1;
+	if (flushBuffer() < 0)
+		return -1;
+#ifdef _MSC_VER
+	if (fflush(fd_) != 0 || _commit(_fileno(fd_)) != 0) {
+#elif defined(__APPLE__)
+	if (fsync(fd_) < 0) {
+#else
+	if (fdatasync(fd_) < 0) {
+#endif
+		av_log(NULL, AV_LOG_ERROR, "segment sync failure.\n");
+		return -1;
+	}
+#if !defined(_MSC_VER) && defined(POSIX_FADV_DONTNEED)
+	// only clean pages can be dropped, that is why this comes after the sync
+	if (!direct_ && bufOffset_ > advised_) {
+		posix_fadvise(fd_, advised_, bufOffset_ - advised_, POSIX_FADV_DONTNEED);
+		advised_ = bufOffset_ & ~(int64_t)(SEGMENT_ALIGN - 1);
+	}
+#endif
+	lastSyncUs_ = av_gettime_relative();
+	return 0;
+}
+
+int AudioSegmentSink::closeSegment()
+{
+#ifdef _MSC_VER
+	if (!fd_)
+		return 0;
+#else
+	if (fd_ < 0)
+		return 0;
+#endif
+	int ret = syncSegment();
+#ifdef _MSC_VER
+	fclose(fd_);
+	fd_ = NULL;
+#else
+	close(fd_);
+	fd_ = -1;
+#endif
+	if (ret < 0)
+		return -1;     // stays .part, it is only complete up to the last good sync
+	string part = name_ + ".part";
+	if (rename(part.c_str(), name_.c_str()) != 0) {
+		av_log(NULL, AV_LOG_ERROR, "segment rename %s failure.\n", part.c_str());
+		return -1;
+	}
+#ifndef _MSC_VER
+	// the rename itself is only durable once the directory is synced
+	size_t slash = name_.rfind('/');
+	string dir = slash == string::npos ? "." : name_.substr(0, slash + 1);
+	int dir_fd = open(dir.c_str(), O_RDONLY);
+	if (dir_fd >= 0) {
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+#endif
+	return 0;
+}
+
+int AudioSegmentSink::rotateIfNeeded(int len, int samples)
+{
+	if (dataBytes_ == 0)
+		return 0;     // never leave an empty segment behind
+	int64_t max_bytes = maxBytes_;
+	if (format_ == AUDIO_SEGMENT_WAV)
+		max_bytes = max_bytes > 0 ? FFMIN(max_bytes, WAV_MAX_DATA) : WAV_MAX_DATA;
+	if ((max_bytes > 0 && dataBytes_ + len > max_bytes) || (maxSamples_ > 0 && samples_ + samples > maxSamples_)) {
+		if (closeSegment() < 0)
+			return -1;
+		index_++;
+		return openSegment();
+	}
+	return 0;
+}
+
+int AudioSegmentSink::append(const uint8_t *data, int len)
+{
+	while (len > 0) {
+		int copy = FFMIN(len, bufSize_ - bufLen_);
+		memcpy(buf_ + bufLen_, data, copy);
+		bufLen_ += copy;
+		data += copy;
+		len -= copy;
+		if (bufLen_ == bufSize_ && flushBuffer() < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int AudioSegmentSink::audioSegmentWriteFrame(AVFrame *frame)
+{
+	if (format_ != AUDIO_SEGMENT_WAV || !buf_)
+		return -1;
+	if (frame->format != sampleFormat_ || frame->channels != channels_ ||
+		(frame->sample_rate > 0 && frame->sample_rate != sampleRate_)) {
+		av_log(NULL, AV_LOG_ERROR, "segment frame %s %d ch %d Hz does not match the segment %s %d ch %d Hz.\n",
+			av_get_sample_fmt_name((AVSampleFormat)frame->format), frame->channels, frame->sample_rate,
+			av_get_sample_fmt_name(sampleFormat_), channels_, sampleRate_);
+		return -1;
+	}
+	int len = frame->nb_samples * channels_ * av_get_bytes_per_sample(sampleFormat_);
+	if (rotateIfNeeded(len, frame->nb_samples) < 0 || append(frame->data[0], len) < 0)
+		return -1;
+	dataBytes_ += len;
+	samples_ += frame->nb_samples;
+	if (syncIntervalUs_ > 0 && av_gettime_relative() - lastSyncUs_ >= syncIntervalUs_)
+		return syncSegment();
+	return 0;
+}
+
+int AudioSegmentSink::audioSegmentWritePacket(AVPacket *packet)
+{
+	if (format_ != AUDIO_SEGMENT_ADTS || !buf_)
+		return -1;
+	int samples = packet->duration > 0 ? (int)packet->duration : 1024;
+	uint8_t header[ADTS_HEADER_SIZE];
+	int len = ADTS_HEADER_SIZE + packet->size;
+	if (encode_->packetAddHeader((char *)header, packet->size) < 0 || rotateIfNeeded(len, samples) < 0)
+		return -1;
+	if (append(header, ADTS_HEADER_SIZE) < 0 || append(packet->data, packet->size) < 0)
+		return -1;
+	dataBytes_ += len;
+	samples_ += samples;
+	if (syncIntervalUs_ > 0 && av_gettime_relative() - lastSyncUs_ >= syncIntervalUs_)
+		return syncSegment();
+	return 0;
+}
+
+int AudioSegmentSink::audioSegmentClose()
+{
+	int ret = closeSegment();
+#ifdef _MSC_VER
+	_aligned_free(buf_);
+	_aligned_free(firstBlock_);
+#else
+	free(buf_);
+	free(firstBlock_);
+#endif
+	buf_ = NULL;
+	firstBlock_ = NULL;
+	return ret;
+}
@@ -0,0 +1,83 @@
+#ifndef __AUDIO_SEGMENT__H_
+#define __AUDIO_SEGMENT__H_
+#include "audio_engine.h"
+
+enum AudioSegmentFormat {
+	AUDIO_SEGMENT_WAV,
+	AUDIO_SEGMENT_ADTS,
+};
+
+/*
+** @brief AudioSegmentSink long running recording split into wav / adts segments.
+** a segment is written as <name>.part and renamed to <name> once it is complete and synced, so every
+** file without .part is playable whatever happens to the process. the open segment is fdatasync'ed
+** every sync interval (with the wav sizes patched each time), a crash loses at most that much audio.
+** synced pages are dropped with posix_fadvise(DONTNEED), or O_DIRECT bypasses the page cache, so
+** recording for days does not push out the cache of the other services on the host.
+** set rotation / sync / direct first, then audioSegmentOpen(), audioSegmentWriteFrame() or
+** audioSegmentWritePacket() for the data and audioSegmentClose() at the end.
+*/
+class AudioSegmentSink {
+public:
+	AudioSegmentSink(int bufferSize = 1 << 20);
+	~AudioSegmentSink();
+public:
+	/* wav segments of interleaved pcm (s16, s32, flt). pattern has a printf index: "rec_%05d.wav" */
+	int  audioSegmentOpen(string pattern, int sampleRate, int channels, AVSampleFormat format);
+	/* adts segments of the packets of encode */
+	int  audioSegmentOpen(string pattern, AudioEncode *encode);
+	/* start a new segment after max_bytes of data or max_ms of audio, 0: no limit. wav segments always
+	** rotate before 4 GB of data, the wav sizes are 32 bit */
+	void audioSegmentSetRotation(int64_t max_bytes, int64_t max_ms);
+	/* fdatasync the open segment every interval_ms (default 1000) */
+	void audioSegmentSetSync(int interval_ms);
+	/* O_DIRECT (F_NOCACHE on mac) instead of posix_fadvise, before audioSegmentOpen() */
+	void audioSegmentSetDirect(int enable);
+	/* interleaved frame in the format / channels / rate the segment was opened with, others are refused */
+	int  audioSegmentWriteFrame(AVFrame *frame);
+	int  audioSegmentWritePacket(AVPacket *packet);
+	/* complete the open segment */
+	int  audioSegmentClose();
+	/* index of the open segment */
+	int  audioSegmentIndex() const { return index_; }
+private:
+	int  openSegment();
+	int  closeSegment();
+	int  rotateIfNeeded(int len, int samples);
+	int  append(const uint8_t *data, int len);
+	int  flushBuffer();
+	int  syncSegment();
+	int  patchWavHeader();
+	int  writeAt(const uint8_t *data, int len, int64_t offset);
+private:
+	enum { SEGMENT_ALIGN = 4096, WAV_HEADER_SIZE = 44 };
+	AudioSegmentFormat format_;
+	string      pattern_;
+	string      name_;           // final name of the open segment, the file is name_ + ".part"
+	int         index_;
+	int         sampleRate_;
+	int         channels_;
+	AVSampleFormat sampleFormat_;
+	AudioEncode *encode_;
+	int64_t     maxBytes_;
+	int64_t     maxSamples_;
+	int64_t     maxMs_;
+	int64_t     syncIntervalUs_;
+	int64_t     lastSyncUs_;
+	int         direct_;
+	uint8_t    *buf_;            // SEGMENT_ALIGN aligned, bufSize_ a multiple of it
+	int         bufSize_;
+	int         bufLen_;
+	int64_t     bufOffset_;      // file offset of buf_[0]
+	uint8_t    *firstBlock_;     // copy of the first block on disk, for patching the wav header
+	int64_t     dataBytes_;      // data written to the open segment, wav header excluded
+	int64_t     samples_;        // audio in the open segment
+	int64_t     advised_;        // page cache dropped up to here
+#ifdef _MSC_VER
+	FILE       *fd_;
+#else
+	int         fd_;
+#endif
+};
+
+#endif
@@ -0,0 +1,409 @@
+#include <string.h>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "audio_shm.h"
+
+#define SHM_MAGIC   0x4d485341    // "ASHM"
+#define SHM_VERSION 1
+
+/* ring layout: ShmHeader, then slotCount slots of stride bytes, each ShmSlot + payload */
+struct ShmHeader {
+	atomic<uint32_t> magic;       // stored last by the writer, the other fields are valid once it is set
+	uint32_t         version;
+	AudioShmInfo     info;
+	int32_t          slotSize;
+	int32_t          slotCount;
+	int32_t          stride;
+	alignas(64) atomic<uint64_t> writeSeq;   // newest complete message, 0: none yet
+};
+
+struct ShmSlot {
+	atomic<uint64_t> seq;         // sequence of the message in the slot, 0 while the writer rewrites it
+	int64_t          pts;
+	int64_t          ingest;
+	int32_t          size;
+	int32_t          samples;
+};
+
+#define SHM_HEADER_SIZE FFALIGN(sizeof(ShmHeader), 64)
+
+static ShmSlot *shm_slot(uint8_t *base, uint64_t seq)
+{
+	ShmHeader *header = (ShmHeader *)base;
+	return (ShmSlot *)(base + SHM_HEADER_SIZE + (seq % header->slotCount) * header->stride);
+}
+
+static string shm_name(const string &name)
+{
+#ifdef _MSC_VER
+	return name[0] == '/' ? name.substr(1) : name;
+#else
+	return name[0] == '/' ? name : "/" + name;   // posix names are "/xxx"
+#endif
+}
+
+/////////////////////////// AudioShmWriter ///////////////////////////////////////////////////////////////
+
+AudioShmWriter::AudioShmWriter()
+	:base_(NULL), mapSize_(0), seq_(0)
+{
+#ifdef _MSC_VER
+	mapping_ = NULL;
+#endif
+}
+
+AudioShmWriter::~AudioShmWriter()
+{
+	audioShmClose();
+}
+
+int AudioShmWriter::audioShmCreate(string name, const AudioShmInfo &info, int slotSize, int slotCount)
+{
+	audioShmClose();
+	if (name.empty() || slotSize <= 0 || slotCount < 2) {
+		av_log(NULL, AV_LOG_ERROR, "shm ring needs a name, a slot size and at least 2 slots.\n");
+		return -1;
+	}
+	name_ = shm_name(name);
+	int stride = FFALIGN((int)sizeof(ShmSlot) + slotSize, 64);
+	mapSize_ = SHM_HEADER_SIZE + (size_t)stride * slotCount;
+#ifdef _MSC_VER
+	mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		(DWORD)((uint64_t)mapSize_ >> 32), (DWORD)mapSize_, name_.c_str());
+	if (!mapping_) {
+		av_log(NULL, AV_LOG_ERROR, "create file mapping %s failure.\n", name_.c_str());
+		return -1;
+	}
+	base_ = (uint8_t *)MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, mapSize_);
+#else
+	// a new object every time: readers still mapping an old ring keep the old one and see it go quiet
+	shm_unlink(name_.c_str());
+	int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		av_log(NULL, AV_LOG_ERROR, "shm_open %s failure.\n", name_.c_str());
+		return -1;
+	}
+	void *base = MAP_FAILED;
+	if (ftruncate(fd, mapSize_) == 0)
+		base = mmap(NULL, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	base_ = base == MAP_FAILED ? NULL : (uint8_t *)base;
+#endif
+	if (!base_) {
+		av_log(NULL, AV_LOG_ERROR, "map shm ring %s failure.\n", name_.c_str());
+		audioShmClose();
+		return -1;
+	}
+	memset(base_, 0, SHM_HEADER_SIZE);
+	ShmHeader *header = (ShmHeader *)base_;
+	header->version = SHM_VERSION;
+	header->info = info;
+	header->slotSize = slotSize;
+	header->slotCount = slotCount;
+	header->stride = stride;
+	header->writeSeq.store(0, memory_order_relaxed);
+	for (int i = 0; i < slotCount; i++)
+		shm_slot(base_, i)->seq.store(0, memory_order_relaxed);
+	header->magic.store(SHM_MAGIC, memory_order_release);
+	seq_ = 0;
+	return 0;
+}
+
+int AudioShmWriter::audioShmWrite(const uint8_t *data, int size, int64_t pts, int samples, int64_t ingest_us)
+{
+	if (!base_)
+		return -1;
+	ShmHeader *header = (ShmHeader *)base_;
+	if (size < 0 || size > header->slotSize) {
+		av_log(NULL, AV_LOG_ERROR, "shm message of %d bytes, slots hold %d.\n", size, header->slotSize);
+		return -1;
+	}
+	uint64_t seq = seq_ + 1;
+	ShmSlot *slot = shm_slot(base_, seq);
+	// readers copying the old message see 0 (or seq) when they check again and drop their copy
+	slot->seq.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy((uint8_t *)(slot + 1), data, size);
+	slot->pts = pts;
+	slot->ingest = ingest_us;
+	slot->size = size;
+	slot->samples = samples;
+	slot->seq.store(seq, memory_order_release);
+	header->writeSeq.store(seq, memory_order_release);
+	seq_ = seq;
+	return 0;
+}
+
+int AudioShmWriter::audioShmWriteFrame(AVFrame *frame)
+{
+	if (av_sample_fmt_is_planar((AVSampleFormat)frame->format) && frame->channels > 1) {
+		av_log(NULL, AV_LOG_ERROR, "shm ring carries interleaved pcm only.\n");
+		return -1;
+	}
+	int size = frame->nb_samples * frame->channels * av_get_bytes_per_sample((AVSampleFormat)frame->format);
+	return audioShmWrite(frame->data[0], size, frame->pts, frame->nb_samples, frame->reordered_opaque);
+}
+
+int AudioShmWriter::audioShmWritePacket(AVPacket *packet, int64_t ingest_us)
+{
+	return audioShmWrite(packet->data, packet->size, packet->pts, (int)packet->duration, ingest_us);
+}
+
+void AudioShmWriter::audioShmClose(int unlink)
+{
+#ifdef _MSC_VER
+	// the mapping goes away with the last handle, readers keep it alive
+	if (base_)
+		UnmapViewOfFile(base_);
+	if (mapping_)
+		CloseHandle(mapping_);
+	mapping_ = NULL;
+	(void)unlink;
+#else
+	if (base_)
+		munmap(base_, mapSize_);
+	if (!name_.empty() && unlink)
+		shm_unlink(name_.c_str());
+#endif
+	base_ = NULL;
+	name_.clear();
+}
+
+/////////////////////////// AudioShmReader ///////////////////////////////////////////////////////////////
+
+AudioShmReader::AudioShmReader()
+	:base_(NULL), mapSize_(0), nextSeq_(0), lost_(0), slotSize_(0)
+{
+	memset(&info_, 0, sizeof(info_));
+#ifdef _MSC_VER
+	mapping_ = NULL;
+#endif
+}
+
+AudioShmReader::~AudioShmReader()
+{
+	audioShmClose();
+}
+
+int AudioShmReader::audioShmOpen(string name)
+{
+	audioShmClose();
+	string path = shm_name(name);
+#ifdef _MSC_VER
+	mapping_ = OpenFileMappingA(FILE_MAP_READ, FALSE, path.c_str());
+	if (!mapping_) {
+		av_log(NULL, AV_LOG_ERROR, "open file mapping %s failure.\n", path.c_str());
+		return -1;
+	}
+	base_ = (uint8_t *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION mbi;
+	if (base_ && VirtualQuery(base_, &mbi, sizeof(mbi)))
+		mapSize_ = mbi.RegionSize;
+#else
+	int fd = shm_open(path.c_str(), O_RDONLY, 0);
+	if (fd < 0) {
+		av_log(NULL, AV_LOG_ERROR, "shm_open %s failure.\n", path.c_str());
+		return -1;
+	}
+	struct stat st;
+	void *base = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)SHM_HEADER_SIZE) {
+		mapSize_ = st.st_size;
+		base = mmap(NULL, mapSize_, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	base_ = base == MAP_FAILED ? NULL : (uint8_t *)base;
+#endif
+	if (!base_) {
+		av_log(NULL, AV_LOG_ERROR, "map shm ring %s failure.\n", path.c_str());
+		audioShmClose();
+		return -1;
+	}
+	ShmHeader *header = (ShmHeader *)base_;
+	if (header->magic.load(memory_order_acquire) != SHM_MAGIC || header->version != SHM_VERSION ||
+		SHM_HEADER_SIZE + (size_t)header->stride * header->slotCount > mapSize_) {
+		av_log(NULL, AV_LOG_ERROR, "%s is not a shm ring (or not ready yet).\n", path.c_str());
+		audioShmClose();
+		return -1;
+	}
+	info_ = header->info;
+	slotSize_ = header->slotSize;
+	nextSeq_ = header->writeSeq.load(memory_order_acquire) + 1;
+	lost_ = 0;
+	return 0;
+}
+
+int AudioShmReader::audioShmRead(uint8_t *buf, int capacity, AudioShmMessage *msg)
+{
+	if (!base_)
+		return -1;
+	ShmHeader *header = (ShmHeader *)base_;
+	uint64_t slots = header->slotCount;
+	while (1) {
+		uint64_t head = header->writeSeq.load(memory_order_acquire);
+		if (head + 1 < nextSeq_)
+			nextSeq_ = head + 1;           // the writer started over on the same mapping
+		if (nextSeq_ > head)
+			return AVERROR(EAGAIN);
+		if (head - nextSeq_ >= slots) {
+			lost_ += head - slots + 1 - nextSeq_;
+			nextSeq_ = head - slots + 1;
+		}
+		ShmSlot *slot = shm_slot(base_, nextSeq_);
+		uint64_t seq = slot->seq.load(memory_order_acquire);
+		if (seq != nextSeq_) {
+			// overwritten (or being overwritten) since head was read
+			lost_++;
+			nextSeq_++;
+			continue;
+		}
+		int size = slot->size;
+		if (size < 0 || size > capacity) {
+			av_log(NULL, AV_LOG_ERROR, "shm message of %d bytes, buffer holds %d.\n", size, capacity);
+			return -1;
+		}
+		memcpy(buf, (const uint8_t *)(slot + 1), size);
+		msg->pts = slot->pts;
+		msg->ingest = slot->ingest;
+		msg->samples = slot->samples;
+		msg->size = size;
+		// the copy is only good if the writer did not touch the slot meanwhile
+		atomic_thread_fence(memory_order_acquire);
+		if (slot->seq.load(memory_order_relaxed) != seq) {
+			lost_++;
+			nextSeq_++;
+			continue;
+		}
+		msg->seq = nextSeq_++;
+		return 0;
+	}
+}
+
+void AudioShmReader::audioShmClose()
+{
+#ifdef _MSC_VER
+	if (base_)
+		UnmapViewOfFile(base_);
+	if (mapping_)
+		CloseHandle(mapping_);
+	mapping_ = NULL;
+#else
+	if (base_)
+		munmap(base_, mapSize_);
+#endif
+	base_ = NULL;
+	mapSize_ = 0;
+}
+
+/////////////////////////// AudioShmSource ///////////////////////////////////////////////////////////////
+
+AudioShmSource::AudioShmSource(string name)
+	:name_(name), frame_(NULL), staging_(NULL), stagingLen_(0), stagingPos_(0), stagingPts_(0),
+	stagingIngest_(AUDIO_NO_INGEST), fillSize_(0), bytesPerSample_(0), waitTimeoutMs_(-1),
+	pollIntervalUs_(1000), framePts_(AV_NOPTS_VALUE), frameIngestUs_(AUDIO_NO_INGEST),
+	pool_(new AudioBufferPool())
+{
+}
+
+AudioShmSource::~AudioShmSource()
+{
+	audioDeinit();
+	delete pool_;
+}
+
+int AudioShmSource::audioInit(uint64_t channel_layout, AVSampleFormat format, int samples)
+{
+	if (reader_.audioShmOpen(name_) < 0)
+		return -1;
+	const AudioShmInfo &info = reader_.audioShmGetInfo();
+	int channels = av_get_channel_layout_nb_channels(channel_layout);
+	if (info.kind != AUDIO_SHM_PCM || info.format != format || info.channels != channels) {
+		av_log(NULL, AV_LOG_ERROR, "shm ring %s carries %s %d ch, %s %d ch requested.\n", name_.c_str(),
+			info.kind == AUDIO_SHM_PCM ? av_get_sample_fmt_name((AVSampleFormat)info.format) : "packets",
+			info.channels, av_get_sample_fmt_name(format), channels);
+		reader_.audioShmClose();
+		return -1;
+	}
+	staging_ = (uint8_t *)av_malloc(reader_.audioShmSlotSize());
+	frame_ = pool_->audioPoolGetFrame(channel_layout, format, samples);
+	if (!staging_ || !frame_) {
+		av_log(NULL, AV_LOG_ERROR, "create frame failure.\n");
+		audioDeinit();
+		return -1;
+	}
+	frame_->sample_rate = info.sampleRate;
+	bytesPerSample_ = channels * av_get_bytes_per_sample(format);
+	stagingLen_ = stagingPos_ = fillSize_ = 0;
+	return 0;
+}
+
+void AudioShmSource::audioDeinit()
+{
+	reader_.audioShmClose();
+	av_frame_free(&frame_);
+	av_freep(&staging_);
+}
+
+void AudioShmSource::audioSetWaitTimeout(int timeout_ms)
+{
+	waitTimeoutMs_ = timeout_ms;
+}
+
+int AudioShmSource::readMessage()
+{
+	// same waiting rules as AudioCapture::audioReadPacket(), polling the ring instead of the device
+	int64_t deadline = waitTimeoutMs_ < 0 ? INT64_MAX : av_gettime_relative() + (int64_t)waitTimeoutMs_ * 1000;
+	AudioShmMessage msg;
+	while (1) {
+		int ret = reader_.audioShmRead(staging_, reader_.audioShmSlotSize(), &msg);
+		if (ret == 0)
+			break;
+		if (ret != AVERROR(EAGAIN))
+			return ret;
+		int64_t now = av_gettime_relative();
+		if (now >= deadline)
+			return AVERROR(EAGAIN);
+		av_usleep((unsigned)FFMIN(pollIntervalUs_, deadline - now));
+	}
+	stagingLen_ = msg.size - msg.size % bytesPerSample_;
+	stagingPos_ = 0;
+	stagingPts_ = msg.pts;
+	stagingIngest_ = msg.ingest;
+	return 0;
+}
+
+int AudioShmSource::audioCaptureFrame(AVFrame **frame)
+{
+	if (!frame_)
+		return -1;
+	int frame_size = frame_->nb_samples * bytesPerSample_;
+	if (fillSize_ == 0 && pool_->audioPoolMakeWritable(frame_) < 0)
+		return AVERROR(ENOMEM);
+	while (fillSize_ < frame_size) {
+		if (stagingPos_ >= stagingLen_) {
+			// a timeout keeps what is already in frame_, the next call goes on filling it
+			int ret = readMessage();
+			if (ret != 0)
+				return ret;
+		}
+		if (fillSize_ == 0) {
+			// the writer's pts of the first sample: lost messages show up as a pts jump, not a shift
+			framePts_ = stagingPts_ == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : stagingPts_ + stagingPos_ / bytesPerSample_;
+			frameIngestUs_ = stagingIngest_;
+		}
+		int len = FFMIN(stagingLen_ - stagingPos_, frame_size - fillSize_);
+		memcpy(frame_->data[0] + fillSize_, staging_ + stagingPos_, len);
+		fillSize_ += len;
+		stagingPos_ += len;
+	}
+	fillSize_ = 0;
+	frame_->pts = framePts_;
+	frame_->pkt_duration = frame_->nb_samples;
+	frame_->reordered_opaque = frameIngestUs_;
+	*frame = frame_;
+	return 0;
+}
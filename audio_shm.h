@@ -0,0 +1,129 @@
+#ifndef __AUDIO_SHM__H_
+#define __AUDIO_SHM__H_
+#include "audio_engine.h"
+
+enum AudioShmKind {
+	AUDIO_SHM_PCM,       // interleaved pcm frames, format is an AVSampleFormat
+	AUDIO_SHM_PACKET,    // encoded packets, format is an AVCodecID
+};
+
+/*
+** @brief AudioShmInfo stream description stored in the ring header, readers check it before reading
+*/
+struct AudioShmInfo {
+	int kind;            // AudioShmKind
+	int sampleRate;
+	int channels;
+	int format;
+};
+
+/*
+** @brief AudioShmMessage one frame / packet as read from the ring
+*/
+struct AudioShmMessage {
+	uint64_t seq;        // 1, 2, 3 ... in write order, a gap means the reader was overrun
+	int64_t  pts;        // samples
+	int64_t  ingest;     // capture time (us, av_gettime_relative() clock of the writer host), AUDIO_NO_INGEST
+	int      size;       // payload bytes
+	int      samples;    // samples per channel in the payload
+};
+
+/*
+** @brief AudioShmWriter single writer side of a shared memory ring (POSIX shm_open, named file mapping
+** on windows). every message goes into the next fixed size slot, tagged with its sequence number.
+** the writer never looks at the readers: a slow reader is overrun and finds out by the sequence.
+** first call audioShmCreate(), then audioShmWriteFrame() / audioShmWritePacket(), audioShmClose() at the end.
+*/
+class AudioShmWriter {
+public:
+	AudioShmWriter();
+	~AudioShmWriter();
+public:
+	/* create the ring name with slotCount slots of slotSize payload bytes, an old ring is replaced */
+	int  audioShmCreate(string name, const AudioShmInfo &info, int slotSize, int slotCount);
+	/* interleaved pcm frame from AudioCapture / AudioSample (pts, reordered_opaque go along) */
+	int  audioShmWriteFrame(AVFrame *frame);
+	int  audioShmWritePacket(AVPacket *packet, int64_t ingest_us = AUDIO_NO_INGEST);
+	int  audioShmWrite(const uint8_t *data, int size, int64_t pts, int samples, int64_t ingest_us);
+	/* unmap, and remove the name unless readers should keep finding the last data */
+	void audioShmClose(int unlink = 1);
+	uint64_t audioShmWritten() const { return seq_; }
+private:
+	string   name_;
+	uint8_t *base_;
+	size_t   mapSize_;
+	uint64_t seq_;
+#ifdef _MSC_VER
+	void    *mapping_;
+#endif
+};
+
+/*
+** @brief AudioShmReader one of any number of readers of an AudioShmWriter ring. a read copies the slot
+** out and checks the sequence again afterwards, so it never takes a lock and never slows the writer.
+** a reader starts at the newest message and counts the messages it lost to overruns.
+*/
+class AudioShmReader {
+public:
+	AudioShmReader();
+	~AudioShmReader();
+public:
+	int  audioShmOpen(string name);
+	const AudioShmInfo& audioShmGetInfo() const { return info_; }
+	/* largest payload, the size buf must have */
+	int  audioShmSlotSize() const { return slotSize_; }
+	/* next message into buf, AVERROR(EAGAIN) when there is nothing new */
+	int  audioShmRead(uint8_t *buf, int capacity, AudioShmMessage *msg);
+	/* messages overwritten before this reader got them */
+	int64_t audioShmLost() const { return lost_; }
+	void audioShmClose();
+private:
+	uint8_t     *base_;
+	size_t       mapSize_;
+	uint64_t     nextSeq_;
+	int64_t      lost_;
+	int          slotSize_;
+	AudioShmInfo info_;
+#ifdef _MSC_VER
+	void        *mapping_;
+#endif
+};
+
+/*
+** @brief AudioShmSource reads pcm from a shared memory ring with the AudioCapture interface: same init,
+** same audioCaptureFrame() contract (fixed nb_samples, pooled frames, sample pts, ingest time in
+** reordered_opaque, AVERROR(EAGAIN) on timeout), so the pipeline runs unchanged behind it.
+*/
+class AudioShmSource {
+public:
+	AudioShmSource(string name);
+	~AudioShmSource();
+public:
+	/* the ring must carry pcm in format with the channels of channel_layout */
+	int  audioInit(uint64_t channel_layout, AVSampleFormat format, int samples);
+	void audioDeinit();
+	int  audioCaptureFrame(AVFrame **frame);
+	/* audioCaptureFrame() gives up after timeout_ms without data, -1 (default) waits forever */
+	void audioSetWaitTimeout(int timeout_ms);
+	int64_t audioShmLost() const { return reader_.audioShmLost(); }
+private:
+	int  readMessage();
+private:
+	string          name_;
+	AudioShmReader  reader_;
+	AVFrame        *frame_;
+	uint8_t        *staging_;       // last message
+	int             stagingLen_;
+	int             stagingPos_;
+	int64_t         stagingPts_;
+	int64_t         stagingIngest_;
+	int             fillSize_;
+	int             bytesPerSample_;  // all channels
+	int             waitTimeoutMs_;
+	int64_t         pollIntervalUs_;
+	int64_t         framePts_;
+	int64_t         frameIngestUs_;
+	AudioBufferPool *pool_;
+};
+
+#endif
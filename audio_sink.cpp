@@ -0,0 +1,272 @@
+#include <chrono>
+#ifndef _MSC_VER
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#endif
+#include "audio_sink.h"
+
+static int64_t sink_now_us()
+{
+	return chrono::duration_cast<chrono::microseconds>(
+		chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+AudioFileSink::AudioFileSink(int bufferSize, int bufferCount)
+	:bufferSize_(bufferSize), buffers_(FFMAX(bufferCount, 2)), current_(-1), position_(0),
+	flushIntervalUs_(1000000), lastFlushUs_(0), stop_(false), writeError_(0)
+{
+	memset(&stats_, 0, sizeof(stats_));
+	for (size_t i = 0; i < buffers_.size(); i++) {
+		buffers_[i].data = NULL;
+		buffers_[i].len = 0;
+		buffers_[i].offset = 0;
+		buffers_[i].ingest = NULL;
+		buffers_[i].stamps = 0;
+	}
+#ifdef _MSC_VER
+	fd_ = NULL;
+#else
+	fd_ = -1;
+#endif
+}
+
+AudioFileSink::~AudioFileSink()
+{
+	audioSinkClose();
+}
+
+void AudioFileSink::closeFile()
+{
+#ifdef _MSC_VER
+	if (fd_)
+		fclose(fd_);
+	fd_ = NULL;
+#else
+	if (fd_ >= 0)
+		close(fd_);
+	fd_ = -1;
+#endif
+}
+
+void AudioFileSink::freeBuffers()
+{
+	for (size_t i = 0; i < buffers_.size(); i++) {
+		av_freep(&buffers_[i].data);
+		av_freep(&buffers_[i].ingest);
+	}
+	freeList_.clear();
+	fullList_.clear();
+	current_ = -1;
+}
+
+int AudioFileSink::audioSinkOpen(string filename)
+{
+	if (writer_.joinable()) {
+		av_log(NULL, AV_LOG_ERROR, "sink already open, close it first.\n");
+		return -1;
+	}
+#ifdef _MSC_VER
+	fd_ = fopen(filename.c_str(), "wb+");
+	if (!fd_) {
+#else
+	fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd_ < 0) {
+#endif
+		av_log(NULL, AV_LOG_ERROR, "sink open file %s failure.\n", filename.c_str());
+		return -1;
+	}
+	freeBuffers();
+	for (size_t i = 0; i < buffers_.size(); i++) {
+		buffers_[i].data = (uint8_t *)av_malloc(bufferSize_);   // av_malloc is simd aligned
+		buffers_[i].ingest = (int64_t *)av_malloc_array(MAX_STAMPS, sizeof(int64_t));
+		if (!buffers_[i].data || !buffers_[i].ingest) {
+			av_log(NULL, AV_LOG_ERROR, "sink alloc buffer failure.\n");
+			freeBuffers();
+			closeFile();
+			return -1;
+		}
+		freeList_.push_back((int)i);
+	}
+	position_ = 0;
+	lastFlushUs_ = sink_now_us();
+	stop_ = false;
+	writeError_ = 0;
+	writer_ = thread(&AudioFileSink::writerLoop, this);
+	return 0;
+}
+
+void AudioFileSink::audioSinkSetFlushInterval(int interval_ms)
+{
+	flushIntervalUs_ = (int64_t)interval_ms * 1000;
+}
+
+int AudioFileSink::audioSinkWrite(const uint8_t *data, int len, int64_t ingest_us)
+{
+	if (!writer_.joinable())
+		return -1;
+	while (len > 0) {
+		if (current_ < 0) {
+			unique_lock<mutex> lock(lock_);
+			if (freeList_.empty()) {
+				// every buffer is queued for the writer thread, the disk is behind: wait
+				int64_t start = sink_now_us();
+				freeCond_.wait(lock, [this] { return !freeList_.empty(); });
+				stats_.stalls++;
+				stats_.stallUs += sink_now_us() - start;
+			}
+			current_ = freeList_.front();
+			freeList_.pop_front();
+			buffers_[current_].len = 0;
+			buffers_[current_].offset = position_;
+			buffers_[current_].stamps = 0;
+		}
+		if (ingest_us != AUDIO_NO_INGEST && buffers_[current_].stamps == MAX_STAMPS) {
+			// no room for the stamp: write this buffer out early, the data goes into the next one
+			submitBuffer();
+			lock_guard<mutex> lock(lock_);
+			stats_.flushes++;
+			continue;
+		}
+		SinkBuffer &buf = buffers_[current_];
+		if (ingest_us != AUDIO_NO_INGEST) {
+			buf.ingest[buf.stamps++] = ingest_us;
+			ingest_us = AUDIO_NO_INGEST;   // a write spanning two buffers is stamped in the first
+		}
+		int copy = FFMIN(len, bufferSize_ - buf.len);
+		memcpy(buf.data + buf.len, data, copy);
+		buf.len += copy;
+		position_ += copy;
+		data += copy;
+		len -= copy;
+		if (buf.len == bufferSize_)
+			submitBuffer();
+	}
+	if (flushIntervalUs_ > 0 && current_ >= 0) {
+		int64_t now = sink_now_us();
+		if (now - lastFlushUs_ >= flushIntervalUs_) {
+			submitBuffer();
+			lock_guard<mutex> lock(lock_);
+			stats_.flushes++;
+		}
+	}
+	return writeError_ ? -1 : 0;
+}
+
+int AudioFileSink::audioSinkFlush()
+{
+	if (current_ >= 0)
+		submitBuffer();
+	return writeError_ ? -1 : 0;
+}
+
+int AudioFileSink::audioSinkSeek(int64_t offset)
+{
+	if (offset < 0)
+		return -1;
+	if (offset == position_)
+		return 0;
+	if (current_ >= 0)
+		submitBuffer();
+	position_ = offset;   // the next buffer taken by audioSinkWrite() starts here
+	return writeError_ ? -1 : 0;
+}
+
+int AudioFileSink::submitBuffer()
+{
+	{
+		lock_guard<mutex> lock(lock_);
+		stats_.bytes += buffers_[current_].len;
+		fullList_.push_back(current_);
+	}
+	fullCond_.notify_one();
+	current_ = -1;
+	lastFlushUs_ = sink_now_us();
+	return 0;
+}
+
+void AudioFileSink::writerLoop()
+{
+	unique_lock<mutex> lock(lock_);
+	while (1) {
+		fullCond_.wait(lock, [this] { return stop_ || !fullList_.empty(); });
+		if (fullList_.empty())
+			break;    // stop_ and nothing pending
+		int index = fullList_.front();
+		fullList_.pop_front();
+		lock.unlock();
+
+		SinkBuffer &buf = buffers_[index];
+		int64_t start = sink_now_us();
+		int ret = writeBuffer(buf.data, buf.len, buf.offset);
+		int64_t cost = sink_now_us() - start;
+		if (ret == 0) {
+			int64_t now = av_gettime_relative();
+			for (int i = 0; i < buf.stamps; i++)
+				latency_.audioLatencyRecord(now - buf.ingest[i]);
+		}
+
+		lock.lock();
+		if (ret < 0)
+			writeError_ = ret;
+		stats_.writes++;
+		stats_.writeUs += cost;
+		stats_.maxWriteUs = FFMAX(stats_.maxWriteUs, cost);
+		freeList_.push_back(index);
+		freeCond_.notify_one();
+	}
+}
+
+int AudioFileSink::writeBuffer(const uint8_t *data, int len, int64_t offset)
+{
+#ifdef _MSC_VER
+	// one writer thread, buffers in submit order: only an audioSinkSeek() moves the FILE position
+	if (_ftelli64(fd_) != offset && _fseeki64(fd_, offset, SEEK_SET) != 0) {
+		av_log(NULL, AV_LOG_ERROR, "sink seek failure.\n");
+		return -1;
+	}
+	if (fwrite(data, 1, len, fd_) != (size_t)len) {
+		av_log(NULL, AV_LOG_ERROR, "sink write failure.\n");
+		return -1;
+	}
+	fflush(fd_);
+	return 0;
+#else
+	int done = 0;
+	while (done < len) {
+		ssize_t ret = pwrite(fd_, data + done, len - done, offset + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			av_log(NULL, AV_LOG_ERROR, "sink write failure.[%s]\n", strerror(errno));
+			return -1;
+		}
+		done += (int)ret;
+	}
+	return 0;
+#endif
+}
+
+int AudioFileSink::audioSinkClose()
+{
+	if (!writer_.joinable())
+		return 0;
+	if (current_ >= 0)
+		submitBuffer();
+	{
+		lock_guard<mutex> lock(lock_);
+		stop_ = true;
+	}
+	fullCond_.notify_one();
+	writer_.join();
+	closeFile();
+	freeBuffers();
+	return writeError_ ? -1 : 0;
+}
+
+void AudioFileSink::audioSinkGetStats(AudioSinkStats *stats)
+{
+	lock_guard<mutex> lock(lock_);
+	*stats = stats_;
+}
@@ -0,0 +1,93 @@
+#ifndef __AUDIO_SINK__H_
+#define __AUDIO_SINK__H_
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include "audio_engine.h"
+
+/*
+** @brief AudioSinkStats AudioFileSink write statistics, all times in microseconds
+*/
+struct AudioSinkStats {
+	int64_t bytes;        // bytes handed to the writer thread
+	int64_t writes;       // buffers written to disk
+	int64_t flushes;      // partial buffers pushed out by the flush interval or a full stamp table
+	int64_t stalls;       // audioSinkWrite() had to wait for a free buffer
+	int64_t stallUs;      // total time spent waiting in stalls
+	int64_t writeUs;      // total time spent in write calls
+	int64_t maxWriteUs;   // worst single write
+};
+
+/*
+** @brief AudioFileSink asynchronous double buffered file writer for pcm / adts output.
+** audioSinkWrite() only copies into a large aligned buffer, full buffers are written by a background
+** thread (pwrite, fwrite on windows), so a slow disk does not stall capture and encoding until every
+** buffer is queued.
+** every write with an ingest time is stamped in its buffer for the latency stats, a buffer holding
+** MAX_STAMPS stamps is handed to the writer early, so no stamp is lost for many small writes.
+** first call audioSinkOpen(), then audioSinkWrite() for every frame / packet, audioSinkClose() at the end.
+*/
+class AudioFileSink {
+public:
+	AudioFileSink(int bufferSize = 1 << 20, int bufferCount = 4);
+	~AudioFileSink();
+public:
+	/* fails when the sink is already open, audioSinkClose() first */
+	int  audioSinkOpen(string filename);
+	/* ingest_us: capture time of the data (AVFrame.reordered_opaque / audioEncodeIngestTime()),
+	** recorded in the capture -> written latency once the buffer holding it is on disk */
+	int  audioSinkWrite(const uint8_t *data, int len, int64_t ingest_us = AUDIO_NO_INGEST);
+	/* hand the partially filled buffer to the writer thread now */
+	int  audioSinkFlush();
+	/* continue writing at offset (a muxer patching a size field), the partial buffer is submitted first.
+	** buffers are written in submit order, so a patch lands after the data it overwrites */
+	int  audioSinkSeek(int64_t offset);
+	/* write everything pending, stop the writer thread and close the file */
+	int  audioSinkClose();
+	/* partial buffers are flushed at most every interval_ms (default 1000), 0 only writes full buffers */
+	void audioSinkSetFlushInterval(int interval_ms);
+	void audioSinkGetStats(AudioSinkStats *stats);
+	const AudioLatencyStats& audioSinkGetLatency() const { return latency_; }
+	int64_t audioSinkPosition() const { return position_; }
+private:
+	int  submitBuffer();
+	void writerLoop();
+	int  writeBuffer(const uint8_t *data, int len, int64_t offset);
+	void closeFile();
+	void freeBuffers();
+private:
+	enum { MAX_STAMPS = 1024 };
+	struct SinkBuffer {
+		uint8_t *data;
+		int      len;
+		int64_t  offset;
+		int64_t *ingest;       // MAX_STAMPS capture times of the writes in this buffer
+		int      stamps;
+	};
+	int                 bufferSize_;
+	vector<SinkBuffer>  buffers_;
+	deque<int>          freeList_;
+	deque<int>          fullList_;
+	int                 current_;        // buffer being filled by audioSinkWrite(), -1 none
+	int64_t             position_;       // file offset of the next byte written
+	int64_t             flushIntervalUs_;
+	int64_t             lastFlushUs_;
+	bool                stop_;
+	atomic<int>         writeError_;
+	mutex               lock_;
+	condition_variable  fullCond_;
+	condition_variable  freeCond_;
+	thread              writer_;
+	AudioSinkStats      stats_;
+	AudioLatencyStats   latency_;
+#ifdef _MSC_VER
+	FILE               *fd_;
+#else
+	int                 fd_;
+#endif
+};
+
+#endif
@@ -0,0 +1,656 @@
+#include <string.h>
+#include <errno.h>
+#ifdef _MSC_VER
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "audio_stream.h"
+#include "audio_adts.h"
+
+#ifdef _MSC_VER
+
+/* windows: pipes and files through the crt (_pipe(), _fileno(stdout)), no UNIX sockets. crt fds cannot be
+** made non-blocking, writes and reads block until done, so the queues never fill and timeouts are not kept */
+#define POLLIN  1
+#define POLLOUT 4
+
+static int stream_nonblock(int fd)
+{
+	return _setmode(fd, _O_BINARY) < 0 ? -1 : 0;
+}
+
+static int stream_wait(int, short, int)
+{
+	return 1;
+}
+
+static int stream_pipe_write(int fd, const void *data, int len)
+{
+	return _write(fd, data, len);
+}
+
+#else
+
+static int stream_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* write to a pipe / file without SIGPIPE killing the process when the reader left, and without touching
+** the process wide handler: SIGPIPE is blocked in this thread for the write and one it raised is taken
+** off again. mac sets F_SETNOSIGPIPE on the fd instead */
+static int stream_pipe_write(int fd, const void *data, int len)
+{
+#ifdef F_SETNOSIGPIPE
+	return (int)write(fd, data, len);
+#else
+	sigset_t pipe_set, old_set, pending;
+	sigemptyset(&pipe_set);
+	sigaddset(&pipe_set, SIGPIPE);
+	sigpending(&pending);
+	int was_pending = sigismember(&pending, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+	int ret = (int)write(fd, data, len);
+	if (ret < 0 && errno == EPIPE && !was_pending) {
+		int err = errno;
+		struct timespec zero = { 0, 0 };
+		while (sigtimedwait(&pipe_set, NULL, &zero) < 0 && errno == EINTR)
+			;
+		errno = err;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	return ret;
+#endif
+}
+
+static int stream_address(const string &path, struct sockaddr_un *addr)
+{
+	if (path.size() >= sizeof(addr->sun_path)) {
+		av_log(NULL, AV_LOG_ERROR, "socket path %s is too long.\n", path.c_str());
+		return -1;
+	}
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path.c_str());
+	return 0;
+}
+
+/* wait until fd is readable / writable, timeout_ms -1 forever. 1 ready, 0 timeout */
+static int stream_wait(int fd, short events, int timeout_ms)
+{
+	struct pollfd pfd = { fd, events, 0 };
+	int ret;
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+#endif
+
+/////////////////////////// AudioStreamSink ///////////////////////////////////////////////////////////////
+
+AudioStreamSink::AudioStreamSink(AudioStreamFraming framing, int queueBytes)
+	:framing_(framing), policy_(AUDIO_STREAM_DROP_OLDEST), blockTimeoutMs_(-1), queueBytes_(queueBytes),
+	listenFd_(-1), haveInfo_(0)
+{
+	memset(info_, 0, sizeof(info_));
+}
+
+AudioStreamSink::~AudioStreamSink()
+{
+	audioStreamClose();
+}
+
+int AudioStreamSink::audioStreamListen(string path)
+{
+#ifdef _MSC_VER
+	av_log(NULL, AV_LOG_ERROR, "stream sink %s: UNIX sockets are posix only, use audioStreamOpenFd().\n", path.c_str());
+	return -1;
+#else
+	struct sockaddr_un addr;
+	if (stream_address(path, &addr) < 0)
+		return -1;
+	unlink(path.c_str());      // a socket file left by a previous run
+	listenFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd_ < 0 || bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(listenFd_, 16) < 0 || stream_nonblock(listenFd_) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "listen on %s failure: %s.\n", path.c_str(), strerror(errno));
+		if (listenFd_ >= 0)
+			close(listenFd_);
+		listenFd_ = -1;
+		return -1;
+	}
+	path_ = path;
+	return 0;
+#endif
+}
+
+int AudioStreamSink::audioStreamOpenFd(int fd)
+{
+	// the fd stays as the caller made it (stdout of a shell keeps blocking mode after us), flushConn()
+	// polls it before every write instead
+#ifdef _MSC_VER
+	if (stream_nonblock(fd) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "fd %d: %s.\n", fd, strerror(errno));
+		return -1;
+	}
+#endif
+	// a consumer going away must show up as EPIPE from write(), not kill the process: sockets are sent to
+	// with MSG_NOSIGNAL / SO_NOSIGPIPE, pipes and files written by stream_pipe_write()
+	int sock = 0;
+#ifndef _MSC_VER
+	struct stat st;
+	sock = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+#ifdef SO_NOSIGPIPE
+	int nosig = 1;
+	if (sock)
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nosig, sizeof(nosig));
+#endif
+#ifdef F_SETNOSIGPIPE
+	if (!sock)
+		fcntl(fd, F_SETNOSIGPIPE, 1);
+#endif
+#endif
+	return addConn(fd, 0, sock);
+}
+
+void AudioStreamSink::audioStreamSetPolicy(AudioStreamPolicy policy, int block_timeout_ms)
+{
+	policy_ = policy;
+	blockTimeoutMs_ = block_timeout_ms;
+}
+
+void AudioStreamSink::audioStreamSetInfo(int sampleRate, int channels, int format, int kind)
+{
+	AV_WL32(info_, sampleRate);
+	AV_WL32(info_ + 4, channels);
+	AV_WL32(info_ + 8, format);
+	AV_WL32(info_ + 12, kind);
+	haveInfo_ = 1;
+}
+
+AVBufferRef* AudioStreamSink::rawMessage(int type, const uint8_t *data, int size, int64_t pts, int samples,
+	int64_t ingest)
+{
+	AVBufferRef *buf = av_buffer_alloc(AUDIO_STREAM_HEADER_SIZE + size);
+	if (!buf)
+		return NULL;
+	uint8_t *p = buf->data;
+	AV_WL32(p, AUDIO_STREAM_MAGIC);
+	AV_WL32(p + 4, type);
+	AV_WL32(p + 8, size);
+	AV_WL32(p + 12, samples);
+	AV_WL64(p + 16, pts);
+	AV_WL64(p + 24, ingest);
+	memcpy(p + AUDIO_STREAM_HEADER_SIZE, data, size);
+	return buf;
+}
+
+int AudioStreamSink::addConn(int fd, int owned, int sock)
+{
+	StreamConn *conn = new StreamConn;
+	conn->fd = fd;
+	conn->owned = owned;
+	conn->sock = sock;
+	conn->offset = 0;
+	memset(&conn->stats, 0, sizeof(conn->stats));
+	if (framing_ == AUDIO_STREAM_RAW && haveInfo_) {
+		AVBufferRef *buf = rawMessage(AUDIO_STREAM_INFO, info_, sizeof(info_), AV_NOPTS_VALUE, 0, AUDIO_NO_INGEST);
+		if (!buf) {
+			delete conn;
+			return AVERROR(ENOMEM);
+		}
+		// the info message goes first whatever the policy says
+		conn->queue.push_back({ buf, AUDIO_NO_INGEST });
+		conn->stats.queued += buf->size;
+	}
+	conns_.push_back(conn);
+	return 0;
+}
+
+int AudioStreamSink::acceptConns()
+{
+	if (listenFd_ < 0)
+		return 0;
+#ifndef _MSC_VER
+	while (1) {
+		int fd = accept(listenFd_, NULL, NULL);
+		if (fd < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+#ifdef SO_NOSIGPIPE
+		int nosig = 1;      // mac has no MSG_NOSIGNAL
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nosig, sizeof(nosig));
+#endif
+		if (stream_nonblock(fd) < 0 || addConn(fd, 1, 1) < 0) {
+			close(fd);
+			continue;
+		}
+		av_log(NULL, AV_LOG_INFO, "%s: consumer %d connected.\n", path_.c_str(), (int)conns_.size());
+	}
+#endif
+	return 0;
+}
+
+/* send as much of the queue as the consumer takes without blocking. <0: the consumer is gone.
+** a caller's fd may be blocking: it is polled first, a socket is sent to with MSG_DONTWAIT and a pipe gets
+** at most PIPE_BUF per write, which poll() guarantees to fit */
+int AudioStreamSink::flushConn(StreamConn *conn)
+{
+	while (!conn->queue.empty()) {
+		StreamMsg &msg = conn->queue.front();
+		int left = msg.buf->size - conn->offset;
+		int ret;
+#ifndef _MSC_VER
+		if (!conn->owned) {
+			int ready = stream_wait(conn->fd, POLLOUT, 0);
+			if (ready <= 0)
+				return ready < 0 ? -1 : 0;
+			if (!conn->sock)
+				left = FFMIN(left, PIPE_BUF);
+		}
+		if (conn->sock) {
+#ifdef MSG_NOSIGNAL
+			ret = (int)send(conn->fd, msg.buf->data + conn->offset, left, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+			ret = (int)send(conn->fd, msg.buf->data + conn->offset, left, MSG_DONTWAIT);
+#endif
+		} else
+#endif
+		{
+			ret = stream_pipe_write(conn->fd, msg.buf->data + conn->offset, left);
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		conn->offset += (int)ret;
+		if (conn->offset < msg.buf->size)
+			continue;
+		conn->stats.messages++;
+		conn->stats.bytes += msg.buf->size;
+		conn->stats.queued -= msg.buf->size;
+		if (msg.ingest != AUDIO_NO_INGEST)
+			conn->latency.audioLatencyRecord(av_gettime_relative() - msg.ingest);
+		av_buffer_unref(&msg.buf);
+		conn->queue.pop_front();
+		conn->offset = 0;
+	}
+	return 0;
+}
+
+int AudioStreamSink::enqueue(StreamConn *conn, AVBufferRef *buf, int64_t ingest)
+{
+	if (conn->stats.queued + buf->size > queueBytes_ && !conn->queue.empty()) {
+		if (policy_ == AUDIO_STREAM_BLOCK) {
+			int64_t deadline = blockTimeoutMs_ < 0 ? INT64_MAX : av_gettime_relative() + (int64_t)blockTimeoutMs_ * 1000;
+			while (conn->stats.queued + buf->size > queueBytes_ && !conn->queue.empty()) {
+				int64_t now = av_gettime_relative();
+				if (now >= deadline)
+					break;
+				int timeout = deadline == INT64_MAX ? -1 : (int)FFMIN((deadline - now + 999) / 1000, INT_MAX);
+				if (stream_wait(conn->fd, POLLOUT, timeout) < 0 || flushConn(conn) < 0)
+					return -1;
+			}
+		} else if (policy_ == AUDIO_STREAM_DROP_OLDEST) {
+			// a message already partly on the wire has to be finished, the ones behind it can go
+			size_t keep = conn->offset > 0 ? 1 : 0;
+			while (conn->stats.queued + buf->size > queueBytes_ && conn->queue.size() > keep) {
+				StreamMsg old = conn->queue[keep];
+				conn->queue.erase(conn->queue.begin() + keep);
+				conn->stats.queued -= old.buf->size;
+				conn->stats.dropped++;
+				av_buffer_unref(&old.buf);
+			}
+		}
+		if (conn->stats.queued + buf->size > queueBytes_ && !conn->queue.empty()) {
+			conn->stats.dropped++;
+			return 0;
+		}
+	}
+	AVBufferRef *ref = av_buffer_ref(buf);
+	if (!ref)
+		return AVERROR(ENOMEM);
+	conn->queue.push_back({ ref, ingest });
+	conn->stats.queued += ref->size;
+	return 0;
+}
+
+void AudioStreamSink::closeConn(size_t index)
+{
+	StreamConn *conn = conns_[index];
+	for (size_t i = 0; i < conn->queue.size(); i++)
+		av_buffer_unref(&conn->queue[i].buf);
+	if (conn->owned)
+		close(conn->fd);
+	av_log(NULL, AV_LOG_INFO, "stream consumer gone: %" PRId64 " messages, %" PRId64 " dropped.\n",
+		conn->stats.messages, conn->stats.dropped);
+	delete conn;
+	conns_.erase(conns_.begin() + index);
+}
+
+int AudioStreamSink::publish(AVBufferRef *buf, int64_t ingest)
+{
+	acceptConns();
+	for (size_t i = 0; i < conns_.size();) {
+		StreamConn *conn = conns_[i];
+		if (enqueue(conn, buf, ingest) < 0 || flushConn(conn) < 0) {
+			closeConn(i);
+			continue;
+		}
+		i++;
+	}
+	av_buffer_unref(&buf);
+	return 0;
+}
+
+int AudioStreamSink::audioStreamWriteFrame(AVFrame *frame)
+{
+	if (framing_ != AUDIO_STREAM_RAW ||
+		(av_sample_fmt_is_planar((AVSampleFormat)frame->format) && frame->channels > 1)) {
+		av_log(NULL, AV_LOG_ERROR, "stream frames need raw framing and interleaved pcm.\n");
+		return -1;
+	}
+	int size = frame->nb_samples * frame->channels * av_get_bytes_per_sample((AVSampleFormat)frame->format);
+	if (size > AUDIO_STREAM_MAX_PAYLOAD) {
+		av_log(NULL, AV_LOG_ERROR, "stream frame of %d bytes is larger than %d.\n", size, AUDIO_STREAM_MAX_PAYLOAD);
+		return AVERROR(EINVAL);
+	}
+	AVBufferRef *buf = rawMessage(AUDIO_STREAM_DATA, frame->data[0], size, frame->pts, frame->nb_samples,
+		frame->reordered_opaque);
+	if (!buf)
+		return AVERROR(ENOMEM);
+	return publish(buf, frame->reordered_opaque);
+}
+
+int AudioStreamSink::audioStreamWritePacket(AudioEncode *encoder, AVPacket *packet)
+{
+	int64_t ingest = encoder ? encoder->audioEncodeIngestTime() : AUDIO_NO_INGEST;
+	AVBufferRef *buf;
+	if (framing_ == AUDIO_STREAM_ADTS) {
+		if (!encoder || !encoder->audioEncodeAdts()) {
+			av_log(NULL, AV_LOG_ERROR, "stream adts framing needs an aac encoder, use raw framing.\n");
+			return -1;
+		}
+		buf = av_buffer_alloc(ADTS_HEADER_SIZE + packet->size);
+		if (!buf)
+			return AVERROR(ENOMEM);
+		if (encoder->packetAddHeader((char *)buf->data, packet->size) < 0) {
+			av_buffer_unref(&buf);
+			return -1;
+		}
+		memcpy(buf->data + ADTS_HEADER_SIZE, packet->data, packet->size);
+	} else {
+		if (packet->size > AUDIO_STREAM_MAX_PAYLOAD) {
+			av_log(NULL, AV_LOG_ERROR, "stream packet of %d bytes is larger than %d.\n", packet->size,
+				AUDIO_STREAM_MAX_PAYLOAD);
+			return AVERROR(EINVAL);
+		}
+		buf = rawMessage(AUDIO_STREAM_DATA, packet->data, packet->size, packet->pts, (int)packet->duration, ingest);
+		if (!buf)
+			return AVERROR(ENOMEM);
+	}
+	return publish(buf, ingest);
+}
+
+int AudioStreamSink::audioStreamPoll()
+{
+	acceptConns();
+	for (size_t i = 0; i < conns_.size();) {
+		if (flushConn(conns_[i]) < 0) {
+			closeConn(i);
+			continue;
+		}
+		i++;
+	}
+	return (int)conns_.size();
+}
+
+int AudioStreamSink::audioStreamGetStats(int index, AudioStreamStats *stats) const
+{
+	if (index < 0 || index >= (int)conns_.size())
+		return -1;
+	*stats = conns_[index]->stats;
+	return 0;
+}
+
+const AudioLatencyStats* AudioStreamSink::audioStreamGetLatency(int index) const
+{
+	if (index < 0 || index >= (int)conns_.size())
+		return NULL;
+	return &conns_[index]->latency;
+}
+
+void AudioStreamSink::audioStreamClose()
+{
+	while (!conns_.empty())
+		closeConn(conns_.size() - 1);
+	if (listenFd_ >= 0) {
+		close(listenFd_);
+		unlink(path_.c_str());
+	}
+	listenFd_ = -1;
+	path_.clear();
+}
+
+/////////////////////////// AudioStreamSource ///////////////////////////////////////////////////////////////
+
+AudioStreamSource::AudioStreamSource(AudioStreamFraming framing)
+	:framing_(framing), fd_(-1), owned_(0), buf_(NULL), bufSize_(0), bufStart_(0), bufEnd_(0), eof_(0),
+	ingest_(AUDIO_NO_INGEST), haveInfo_(0)
+{
+	memset(info_, 0, sizeof(info_));
+	memset(&stats_, 0, sizeof(stats_));
+}
+
+AudioStreamSource::~AudioStreamSource()
+{
+	audioStreamClose();
+}
+
+int AudioStreamSource::audioStreamConnect(string path)
+{
+#ifdef _MSC_VER
+	av_log(NULL, AV_LOG_ERROR, "stream source %s: UNIX sockets are posix only, use audioStreamOpenFd().\n", path.c_str());
+	return -1;
+#else
+	struct sockaddr_un addr;
+	if (stream_address(path, &addr) < 0)
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "connect to %s failure: %s.\n", path.c_str(), strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if (audioStreamOpenFd(fd) < 0) {
+		close(fd);
+		return -1;
+	}
+	owned_ = 1;
+	return 0;
+#endif
+}
+
+int AudioStreamSource::audioStreamOpenFd(int fd)
+{
+	audioStreamClose();
+#ifdef _MSC_VER
+	if (stream_nonblock(fd) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "fd %d: %s.\n", fd, strerror(errno));
+		return -1;
+	}
+#endif
+	bufSize_ = 64 * 1024;
+	buf_ = (uint8_t *)av_malloc(bufSize_);
+	if (!buf_)
+		return AVERROR(ENOMEM);
+	fd_ = fd;
+	owned_ = 0;
+	return 0;
+}
+
+/* read what is there into buf_, waiting at most timeout_ms for the first byte. the fd may be blocking
+** (stdin), so poll() comes first and a single read() only takes what is already there */
+int AudioStreamSource::fill(int timeout_ms)
+{
+	if (bufStart_ > 0) {
+		memmove(buf_, buf_ + bufStart_, bufEnd_ - bufStart_);
+		bufEnd_ -= bufStart_;
+		bufStart_ = 0;
+	}
+	if (bufEnd_ == bufSize_) {
+		// one message larger than the buffer. parse() refuses sizes above the maximum, this only guards it
+		if (bufSize_ >= AUDIO_STREAM_HEADER_SIZE + AUDIO_STREAM_MAX_PAYLOAD)
+			return AVERROR_INVALIDDATA;
+		uint8_t *buf = (uint8_t *)av_realloc(buf_, bufSize_ * 2);
+		if (!buf)
+			return AVERROR(ENOMEM);
+		buf_ = buf;
+		bufSize_ *= 2;
+	}
+	while (1) {
+		int ready = stream_wait(fd_, POLLIN, timeout_ms);
+		if (ready < 0)
+			return -1;
+		if (ready == 0)
+			return AVERROR(EAGAIN);
+		int ret = (int)read(fd_, buf_ + bufEnd_, bufSize_ - bufEnd_);
+		if (ret > 0) {
+			bufEnd_ += (int)ret;
+			return 0;
+		}
+		if (ret == 0) {
+			eof_ = 1;
+			return AVERROR_EOF;
+		}
+		if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+	}
+}
+
+/* one complete message out of buf_, AVERROR(EAGAIN) if more bytes are needed */
+int AudioStreamSource::parse(AVPacket *packet)
+{
+	while (1) {
+		const uint8_t *p = buf_ + bufStart_;
+		int avail = bufEnd_ - bufStart_;
+		if (framing_ == AUDIO_STREAM_ADTS) {
+			AdtsHeader header;
+			if (avail < ADTS_HEADER_SIZE)
+				return AVERROR(EAGAIN);
+			if (adtsParseHeader(p, avail, &header) < 0) {
+				bufStart_++;             // resync on the next syncword
+				continue;
+			}
+			if (avail < header.frameLen)
+				return AVERROR(EAGAIN);
+			if (AudioBufferPool::audioPoolDefault()->audioPoolGetPacket(packet, header.frameLen) < 0)
+				return AVERROR(ENOMEM);
+			memcpy(packet->data, p, header.frameLen);
+			packet->duration = adtsFrameSamples(&header);
+			packet->pts = packet->dts = AV_NOPTS_VALUE;
+			bufStart_ += header.frameLen;
+			ingest_ = AUDIO_NO_INGEST;
+			return 0;
+		}
+		if (avail < AUDIO_STREAM_HEADER_SIZE)
+			return AVERROR(EAGAIN);
+		if (AV_RL32(p) != AUDIO_STREAM_MAGIC) {
+			av_log(NULL, AV_LOG_ERROR, "stream lost its framing.\n");
+			return AVERROR_INVALIDDATA;
+		}
+		int type = AV_RL32(p + 4);
+		int size = AV_RL32(p + 8);
+		if (size < 0 || size > AUDIO_STREAM_MAX_PAYLOAD) {
+			av_log(NULL, AV_LOG_ERROR, "stream message of %d bytes, the framing is corrupt.\n", size);
+			return AVERROR_INVALIDDATA;
+		}
+		if (avail < AUDIO_STREAM_HEADER_SIZE + size)
+			return AVERROR(EAGAIN);
+		const uint8_t *payload = p + AUDIO_STREAM_HEADER_SIZE;
+		bufStart_ += AUDIO_STREAM_HEADER_SIZE + size;
+		if (type == AUDIO_STREAM_INFO) {
+			for (int i = 0; i < 4 && i * 4 + 4 <= size; i++)
+				info_[i] = AV_RL32(payload + i * 4);
+			haveInfo_ = 1;
+			continue;
+		}
+		if (AudioBufferPool::audioPoolDefault()->audioPoolGetPacket(packet, size) < 0)
+			return AVERROR(ENOMEM);
+		memcpy(packet->data, payload, size);
+		packet->duration = AV_RL32(p + 12);
+		packet->pts = packet->dts = AV_RL64(p + 16);
+		ingest_ = AV_RL64(p + 24);
+		if (ingest_ != AUDIO_NO_INGEST)
+			latency_.audioLatencyRecord(av_gettime_relative() - ingest_);
+		return 0;
+	}
+}
+
+int AudioStreamSource::audioStreamRead(AVPacket *packet, int timeout_ms)
+{
+	if (fd_ < 0)
+		return -1;
+	int64_t deadline = timeout_ms < 0 ? INT64_MAX : av_gettime_relative() + (int64_t)timeout_ms * 1000;
+	while (1) {
+		int ret = parse(packet);
+		if (ret == 0) {
+			stats_.messages++;
+			stats_.bytes += packet->size;
+			return 0;
+		}
+		if (ret != AVERROR(EAGAIN))
+			return ret;
+		if (eof_) {
+			if (bufEnd_ > bufStart_)
+				stats_.dropped++;      // the writer went away in the middle of a message
+			bufStart_ = bufEnd_;
+			return AVERROR_EOF;
+		}
+		int64_t now = av_gettime_relative();
+		if (now >= deadline)
+			return AVERROR(EAGAIN);
+		int timeout = deadline == INT64_MAX ? -1 : (int)FFMIN((deadline - now + 999) / 1000, INT_MAX);
+		ret = fill(timeout);
+		if (ret < 0 && ret != AVERROR_EOF)
+			return ret;
+	}
+}
+
+int AudioStreamSource::audioStreamGetInfo(int *sampleRate, int *channels, int *format, int *kind) const
+{
+	if (!haveInfo_)
+		return -1;
+	*sampleRate = info_[0];
+	*channels = info_[1];
+	*format = info_[2];
+	*kind = info_[3];
+	return 0;
+}
+
+void AudioStreamSource::audioStreamClose()
+{
+	if (fd_ >= 0 && owned_)
+		close(fd_);
+	fd_ = -1;
+	owned_ = 0;
+	av_freep(&buf_);
+	bufSize_ = bufStart_ = bufEnd_ = 0;
+	eof_ = 0;
+}
+
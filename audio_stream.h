@@ -0,0 +1,150 @@
+#ifndef __AUDIO_STREAM__H_
+#define __AUDIO_STREAM__H_
+#include <deque>
+#include <vector>
+#include "audio_engine.h"
+
+enum AudioStreamFraming {
+	AUDIO_STREAM_ADTS,         // aac packets as plain adts frames, any adts reader (ffplay -) can consume it
+	AUDIO_STREAM_RAW,          // 32 byte header + payload per message, pcm frames or packets of any codec
+};
+
+enum AudioStreamPolicy {
+	AUDIO_STREAM_BLOCK,        // wait for the consumer, up to the block timeout, then drop the new message
+	AUDIO_STREAM_DROP_OLDEST,  // make room by dropping queued messages that were not started yet
+	AUDIO_STREAM_DROP_NEWEST,  // a full queue drops the new message
+};
+
+/* raw framing on the wire, all fields little endian:
+**   magic "ASPK" (4) | type (4) | size (4) | samples (4) | pts (8) | ingest (8) | payload (size)
+** every connection starts with one AUDIO_STREAM_INFO message: rate, channels, format, kind (4 x LE32) */
+#define AUDIO_STREAM_MAGIC       MKTAG('A', 'S', 'P', 'K')
+#define AUDIO_STREAM_HEADER_SIZE 32
+#define AUDIO_STREAM_MAX_PAYLOAD (1 << 20)    // larger sizes are refused on both ends, a corrupt header cannot grow the buffer
+#define AUDIO_STREAM_INFO        0
+#define AUDIO_STREAM_DATA        1
+
+/*
+** @brief AudioStreamStats counters of one connection
+*/
+struct AudioStreamStats {
+	int64_t messages;    // messages completely sent / received
+	int64_t bytes;
+	int64_t dropped;     // messages the backpressure policy threw away (sink) or torn by a disconnect
+	int64_t queued;      // bytes waiting in the connection queue (sink)
+};
+
+/*
+** @brief AudioStreamSink streams frames or packets to local consumers over a UNIX domain socket (any number
+** of connections) or a pipe / stdout. accepted sockets are non-blocking, an fd the caller passes in keeps
+** its flags and is polled before every write: every connection has its own bounded queue and the policy
+** decides what happens when a consumer does not keep up, the caller only waits with AUDIO_STREAM_BLOCK. a message goes into every queue as one shared reference, no copy per consumer.
+** first call audioStreamListen() or audioStreamOpenFd() (and audioStreamSetInfo() for raw framing), then
+** audioStreamWriteFrame() / audioStreamWritePacket(), audioStreamPoll() when idle, audioStreamClose() at the end.
+** SIGPIPE is never raised for a consumer that went away, the process wide handler is left alone.
+** windows has no UNIX sockets here: audioStreamOpenFd() with a crt fd (_pipe(), _fileno(stdout)), blocking.
+*/
+class AudioStreamSink {
+public:
+	AudioStreamSink(AudioStreamFraming framing, int queueBytes = 1 << 20);
+	~AudioStreamSink();
+public:
+	/* listen on a UNIX socket path, consumers are accepted by the write / poll calls */
+	int  audioStreamListen(string path);
+	/* one consumer on an open fd (1 for stdout), the sink neither closes it nor changes its flags */
+	int  audioStreamOpenFd(int fd);
+	/* block_timeout_ms: AUDIO_STREAM_BLOCK waits at most this long per message, -1 forever */
+	void audioStreamSetPolicy(AudioStreamPolicy policy, int block_timeout_ms = -1);
+	/* raw framing: the stream description every consumer gets first. kind 0 pcm (format AVSampleFormat),
+	** 1 packets (format AVCodecID) */
+	void audioStreamSetInfo(int sampleRate, int channels, int format, int kind);
+	/* interleaved pcm, raw framing only */
+	int  audioStreamWriteFrame(AVFrame *frame);
+	/* an encoded packet, adts framing builds the header with encoder->packetAddHeader(). raw framing
+	** takes encoder NULL too (packets from AdtsReader / a transcode), the ingest time is then unknown */
+	int  audioStreamWritePacket(AudioEncode *encoder, AVPacket *packet);
+	/* accept new consumers and send what is queued, without new data */
+	int  audioStreamPoll();
+	int  audioStreamConnections() const { return (int)conns_.size(); }
+	int  audioStreamGetStats(int index, AudioStreamStats *stats) const;
+	/* capture -> sent latency of one connection, recorded when the last byte of a message is sent */
+	const AudioLatencyStats* audioStreamGetLatency(int index) const;
+	void audioStreamClose();
+private:
+	struct StreamMsg {
+		AVBufferRef *buf;
+		int64_t      ingest;
+	};
+	struct StreamConn {
+		int               fd;
+		int               owned;     // accepted here, non-blocking, closed here
+		int               sock;      // a socket (send), otherwise a pipe / file (write)
+		deque<StreamMsg>  queue;
+		int               offset;    // bytes of queue.front() already sent
+		AudioStreamStats  stats;
+		AudioLatencyStats latency;
+	};
+	int  publish(AVBufferRef *buf, int64_t ingest);
+	int  acceptConns();
+	int  addConn(int fd, int owned, int sock);
+	int  enqueue(StreamConn *conn, AVBufferRef *buf, int64_t ingest);
+	int  flushConn(StreamConn *conn);
+	void closeConn(size_t index);
+	AVBufferRef* rawMessage(int type, const uint8_t *data, int size, int64_t pts, int samples, int64_t ingest);
+private:
+	AudioStreamFraming  framing_;
+	AudioStreamPolicy   policy_;
+	int                 blockTimeoutMs_;
+	int                 queueBytes_;
+	int                 listenFd_;
+	string              path_;
+	uint8_t             info_[16];
+	int                 haveInfo_;
+	vector<StreamConn*> conns_;
+};
+
+/*
+** @brief AudioStreamSource reads what an AudioStreamSink writes, from a UNIX socket or a pipe / stdin.
+** the fd is polled before every read (its flags are left alone), audioStreamRead() waits at most the
+** timeout and returns one message as a pooled packet: an adts frame (header included) or the payload
+** of a raw message with its pts, samples (duration) and ingest time.
+*/
+class AudioStreamSource {
+public:
+	AudioStreamSource(AudioStreamFraming framing);
+	~AudioStreamSource();
+public:
+	int  audioStreamConnect(string path);
+	/* an open fd (0 for stdin), neither closed nor changed by the source. windows: a crt fd, reads block
+	** (no timeout) */
+	int  audioStreamOpenFd(int fd);
+	/* AVERROR(EAGAIN) after timeout_ms (-1 forever) without a complete message, AVERROR_EOF when closed */
+	int  audioStreamRead(AVPacket *packet, int timeout_ms = -1);
+	/* ingest time of the last message, AUDIO_NO_INGEST for adts */
+	int64_t audioStreamIngestTime() const { return ingest_; }
+	/* raw framing: stream description, valid after the first read */
+	int  audioStreamGetInfo(int *sampleRate, int *channels, int *format, int *kind) const;
+	void audioStreamGetStats(AudioStreamStats *stats) const { *stats = stats_; }
+	/* capture -> received latency of raw messages (same host, same monotonic clock) */
+	const AudioLatencyStats& audioStreamGetLatency() const { return latency_; }
+	void audioStreamClose();
+private:
+	int  fill(int timeout_ms);
+	int  parse(AVPacket *packet);
+private:
+	AudioStreamFraming framing_;
+	int                fd_;
+	int                owned_;
+	uint8_t           *buf_;
+	int                bufSize_;
+	int                bufStart_;
+	int                bufEnd_;
+	int                eof_;
+	int64_t            ingest_;
+	int                info_[4];
+	int                haveInfo_;
+	AudioStreamStats   stats_;
+	AudioLatencyStats  latency_;
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include <memory>
+#include "audio_transcode.h"
+
+int AudioTranscode::audioTranscodeCanRemux(const AdtsReader &reader, int sampleRate, uint64_t chLayout, int bitRate, int profile)
+{
+	const AdtsHeader &header = reader.audioReaderHeader();
+	if (header.sampleRate != sampleRate || (uint64_t)av_get_default_channel_layout(header.channels) != chLayout)
+		return 0;
+	// adts only signals main / lc / ssr / ltp, he-aac is lc with implicit sbr and never matches a he request
+	if (header.profile != profile)
+		return 0;
+	if (bitRate > 0 && FFABS(reader.audioReaderBitRate() - bitRate) > bitRate / 10)
+		return 0;
+	return 1;
+}
+
+int AudioTranscode::audioTranscodeRun(string input, string output, const char *format,
+	int sampleRate, uint64_t chLayout, int bitRate, int profile)
+{
+	AdtsReader reader;
+	AudioMuxer mux;
+	remuxed_ = 0;
+	packets_ = 0;
+	if (reader.audioReaderOpen(input) < 0 || mux.audioMuxOpen(output, format) < 0)
+		return -1;
+	int ret;
+	if (audioTranscodeCanRemux(reader, sampleRate, chLayout, bitRate, profile)) {
+		remuxed_ = 1;
+		ret = remux(reader, mux);
+	} else {
+		ret = transcode(reader, mux, sampleRate, chLayout, bitRate, profile);
+	}
+	if (mux.audioMuxClose() < 0)
+		ret = -1;
+	return ret;
+}
+
+int AudioTranscode::remux(AdtsReader &reader, AudioMuxer &mux)
+{
+	const AdtsHeader &header = reader.audioReaderHeader();
+	const AVBitStreamFilter *filter = av_bsf_get_by_name("aac_adtstoasc");
+	AVBSFContext *bsf = NULL;
+	if (!filter || av_bsf_alloc(filter, &bsf) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "remux no aac_adtstoasc bsf.\n");
+		return -1;
+	}
+	AVCodecParameters *par = bsf->par_in;
+	par->codec_type = AVMEDIA_TYPE_AUDIO;
+	par->codec_id = AV_CODEC_ID_AAC;
+	par->profile = header.profile;
+	par->sample_rate = header.sampleRate;
+	par->channels = header.channels;
+	par->channel_layout = av_get_default_channel_layout(header.channels);
+	par->frame_size = 1024;
+	bsf->time_base_in = av_make_q(1, header.sampleRate);
+	if (av_bsf_init(bsf) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "remux init bsf failure.\n");
+		av_bsf_free(&bsf);
+		return -1;
+	}
+
+	AVPacket *in = av_packet_alloc();
+	AVPacket *out = av_packet_alloc();
+	AVCodecParameters *stream_par = avcodec_parameters_alloc();
+	int stream = -1, eof = 0, err = 0;
+	if (!in || !out || !stream_par)
+		err = 1;
+	while (!err && !eof) {
+		int ret = reader.audioReaderRead(in);
+		if (ret == AVERROR_EOF)
+			eof = 1;
+		else if (ret < 0)
+			break;
+		// the bsf takes the reference of in, NULL drains it at the end
+		ret = av_bsf_send_packet(bsf, eof ? NULL : in);
+		while (ret >= 0) {
+			ret = av_bsf_receive_packet(bsf, out);
+			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+				break;
+			if (ret < 0) {
+				err = 1;
+				break;
+			}
+			if (stream < 0) {
+				// the AudioSpecificConfig built from the first header comes as side data of the first
+				// packet, the stream gets it as extradata so the muxer has it before the header
+				int size = 0;
+				uint8_t *asc = av_packet_get_side_data(out, AV_PKT_DATA_NEW_EXTRADATA, &size);
+				avcodec_parameters_copy(stream_par, bsf->par_out);
+				if (asc && size > 0) {
+					av_freep(&stream_par->extradata);
+					stream_par->extradata = (uint8_t *)av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+					if (!stream_par->extradata) {
+						err = 1;
+						break;
+					}
+					memcpy(stream_par->extradata, asc, size);
+					stream_par->extradata_size = size;
+					av_packet_free_side_data(out);
+				}
+				stream = mux.audioMuxAddStream(stream_par, bsf->time_base_out);
+				if (stream < 0) {
+					err = 1;
+					break;
+				}
+			}
+			out->stream_index = stream;
+			if (mux.audioMuxWrite(out) < 0) {
+				err = 1;
+				break;
+			}
+			packets_++;
+			av_packet_unref(out);
+		}
+	}
+	if (!eof)
+		err = 1;
+	avcodec_parameters_free(&stream_par);
+	av_packet_free(&in);
+	av_packet_free(&out);
+	av_bsf_free(&bsf);
+	return err ? -1 : 0;
+}
+
+/* audioEncode() / audioEncodeReceive() result: write packets until the encoder wants more */
+int AudioTranscode::writePackets(AudioEncode &encode, AudioMuxer &mux, int ret, AVPacket *packet)
+{
+	while (ret == 0) {
+		if (mux.audioMuxWrite(packet) < 0)
+			return -1;
+		packets_++;
+		ret = encode.audioEncodeReceive(&packet);
+	}
+	return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : -1;
+}
+
+int AudioTranscode::transcode(AdtsReader &reader, AudioMuxer &mux, int sampleRate, uint64_t chLayout, int bitRate, int profile)
+{
+	const AdtsHeader &header = reader.audioReaderHeader();
+	uint64_t in_layout = av_get_default_channel_layout(header.channels);
+	AVCodec *codec = avcodec_find_encoder_by_name(encoderName_.c_str());
+	if (!codec || !codec->sample_fmts) {
+		av_log(NULL, AV_LOG_ERROR, "transcode not find encoder : %s\n", encoderName_.c_str());
+		return -1;
+	}
+	AVSampleFormat encode_fmt = codec->sample_fmts[0];
+	AudioDecode decode("aac", 0);
+	// the resampler is set up from the first decoded frame: implicit sbr decodes at twice the rate of the
+	// adts header, implicit ps decodes a mono header to stereo
+	unique_ptr<AudioSample> sample;
+	int in_rate = 0;
+	AudioEncode encode(encoderName_);
+	encode.audioEncodeSetGlobalHeader(1);
+	if (bitRate <= 0)
+		bitRate = reader.audioReaderBitRate();
+	if (decode.AudioDecodeInit(AV_SAMPLE_FMT_FLTP, in_layout, header.sampleRate, 0, header.profile) < 0 ||
+		encode.audioEncodeInit(encode_fmt, chLayout, sampleRate, bitRate, profile) < 0 ||
+		mux.audioMuxAddStream(&encode) < 0)
+		return -1;
+
+	AVPacket *packet = av_packet_alloc();
+	AVPacket *out = NULL;
+	AVFrame *frame = NULL, *resampled = NULL;
+	int ret = 0, errors = 0;
+	if (!packet)
+		return -1;
+	while (ret == 0) {
+		int read = reader.audioReaderRead(packet);
+		if (read < 0) {
+			ret = read == AVERROR_EOF ? 0 : -1;
+			break;
+		}
+		int dec = decode.audioDecodePacket(packet, &frame);
+		if (dec == AVERROR(EAGAIN))
+			continue;
+		if (dec < 0) {
+			errors++;     // a broken frame is skipped, the pts of the next one still counts samples
+			continue;
+		}
+		uint64_t frame_layout = frame->channel_layout ? frame->channel_layout :
+			(uint64_t)av_get_default_channel_layout(frame->channels);
+		if (!sample) {
+			in_rate = frame->sample_rate;
+			in_layout = frame_layout;
+			sample.reset(new AudioSample(in_rate, AV_SAMPLE_FMT_FLTP, in_layout, sampleRate, encode_fmt, chLayout));
+			if (sample->audioSampleInit() < 0) {
+				ret = -1;
+				break;
+			}
+		} else if (frame->sample_rate != in_rate || frame_layout != in_layout) {
+			av_log(NULL, AV_LOG_ERROR, "transcode input changed from %d Hz 0x%llx to %d Hz 0x%llx.\n", in_rate,
+				(unsigned long long)in_layout, frame->sample_rate, (unsigned long long)frame_layout);
+			ret = -1;
+			break;
+		}
+		if (sample->audioSampleConvert(frame, &resampled) < 0)
+			ret = -1;
+		else if (resampled->nb_samples > 0)
+			ret = writePackets(encode, mux, encode.audioEncode(resampled, &out), out);
+	}
+	// what is left in the resampler and the encoder delay
+	if (ret == 0 && sample && sample->audioSampleConvert(NULL, &resampled) == 0 && resampled->nb_samples > 0)
+		ret = writePackets(encode, mux, encode.audioEncode(resampled, &out), out);
+	if (ret == 0)
+		ret = writePackets(encode, mux, encode.audioEncode(NULL, &out), out);
+	if (errors)
+		av_log(NULL, AV_LOG_WARNING, "transcode skipped %d undecodable frames.\n", errors);
+	av_packet_free(&packet);
+	return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,43 @@
+#ifndef __AUDIO_TRANSCODE__H_
+#define __AUDIO_TRANSCODE__H_
+#include "audio_adts.h"
+#include "audio_mux.h"
+extern "C"
+{
+#include "libavcodec/bsf.h"
+}
+
+/*
+** @brief AudioTranscode adts file -> container file (m4a, fmp4, mkv, ts, adts) with the requested parameters.
+** when the input already has them the aac packets are only rewrapped: aac_adtstoasc turns the adts
+** headers into the AudioSpecificConfig and the packets go straight to the muxer, no decode / encode.
+** otherwise AudioDecode -> AudioSample -> AudioEncode, the resampler takes the rate and layout of the
+** first decoded frame (he-aac with implicit sbr / ps decodes to more than the adts header says), a
+** stream whose decoded parameters change later is refused.
+** call audioTranscodeRun(), audioTranscodeRemuxed() tells which path it took.
+*/
+class AudioTranscode {
+public:
+	AudioTranscode(string encoderName = "aac"):encoderName_(encoderName), remuxed_(0), packets_(0){}
+	~AudioTranscode(){}
+public:
+	/* bitRate 0 keeps the input bit rate, format NULL guesses it from the output extension */
+	int  audioTranscodeRun(string input, string output, const char *format,
+		int sampleRate, uint64_t chLayout, int bitRate, int profile);
+	/* 1 when the adts stream can be rewrapped as is for these output parameters.
+	** the bit rate is compared with the estimate of the reader, 10% tolerance */
+	static int audioTranscodeCanRemux(const AdtsReader &reader, int sampleRate, uint64_t chLayout, int bitRate, int profile);
+	int     audioTranscodeRemuxed() const { return remuxed_; }
+	/* packets written by the last run */
+	int64_t audioTranscodePackets() const { return packets_; }
+private:
+	int  remux(AdtsReader &reader, AudioMuxer &mux);
+	int  transcode(AdtsReader &reader, AudioMuxer &mux, int sampleRate, uint64_t chLayout, int bitRate, int profile);
+	int  writePackets(AudioEncode &encode, AudioMuxer &mux, int ret, AVPacket *packet);
+private:
+	string  encoderName_;
+	int     remuxed_;
+	int64_t packets_;
+};
+
+#endif
@@ -8,6 +8,11 @@
 #pragma comment(lib, "Strmiids.lib")
 #endif
 #include "audio_engine.h"
+#include "audio_sink.h"
+#include "audio_adts.h"
+#include "audio_mux.h"
+#include "audio_dvr.h"
+#include "audio_loudness.h"
 
 void getAudioDevices(char* name)
 {
@@ -79,18 +84,16 @@ void convert(const char* strIn, char* strOut, int sourceCodepage, int targetCode
 #if 0
 int main() {
 	char device_name[128] = { 0 };
-	char adts_buffer[7] = { 0 };
 	AVFrame* frame = NULL;
 	AVFrame* resample_frame = NULL;
 	AVPacket* packet = NULL;
-	const char* file_name = "capture.pcm";
-	FILE* fd = fopen(file_name, "wb+");
-
-	const char* file_name1 = "sample.pcm";
-	FILE* fd1 = fopen(file_name1, "wb+");
-
-	const char* file_name2 = "encode.aac";
-	FILE* fd2 = fopen(file_name2, "wb+");
+	//写文件交给后台线程，磁盘卡顿不会卡住采集和编码
+	AudioFileSink fd, fd1;
+	fd.audioSinkOpen("capture.pcm");
+	fd1.audioSinkOpen("sample.pcm");
+	//adts 头和 packet 数据一起 writev 出去，不拷贝 payload
+	AdtsSink fd2;
+	fd2.audioAdtsOpen("encode.aac");
 #ifdef _MSC_VER	
 	char name[128] = { 0 };
 	char name_utf8[128] = { 0 };
@@ -118,28 +121,41 @@ int main() {
 
 	string encoderName("aac");
 	AudioEncode* audioEncode = new AudioEncode(encoderName);
+	audioEncode->audioEncodeSetGlobalHeader(1);   // m4a 要 extradata
 	ret = audioEncode->audioEncodeInit(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 44100, 16000, FF_PROFILE_AAC_HE);
 	if (ret != 0) {
 		printf("audio encode init fail.\n");
 		return 0;
 	}
+	//同一份 packet 再封装一份 m4a，经过 AudioFileSink 的大 buffer 写盘
+	AudioMuxer fd3;
+	if (fd3.audioMuxOpen("encode.m4a") < 0 || fd3.audioMuxAddStream(audioEncode) < 0) {
+		printf("audio mux open fail.\n");
+		return 0;
+	}
+	//最近一段编码数据留在内存里，随时可以存成文件
+	AudioDvr dvr;
+	dvr.audioDvrInit(audioEncode);
+	//送给编码器的 fltp 数据顺便量一下响度，编码结束就有结果，不用再解码一遍
+	AudioLoudness loudness;
+	loudness.audioLoudnessInit(44100, AV_CH_LAYOUT_STEREO);
 	while (1) {
 		ret = audioCapture->audioCaptureFrame(&frame);
 		if (ret < 0) {
-			if (ret == -35)
+			if (ret == AVERROR(EAGAIN))
 				continue;
 			exit(0);
 		}
-		fwrite(frame->data[0], 1, frame->linesize[0], fd);
+		fd.audioSinkWrite(frame->data[0], frame->linesize[0], frame->reordered_opaque);
 
 		printf("ssss frame linesize size = %d\n", frame->linesize[0]);
 		audioSample->audioSampleConvert(frame, &resample_frame);
-		//重采样的数据是 planar 模式 AV_SAMPLE_FMT_FLTP
-		fwrite(resample_frame->data[0], 1, resample_frame->linesize[0], fd1);
-		fwrite(resample_frame->data[1], 1, resample_frame->linesize[0], fd1);
+		//重采样的数据是 planar 模式 AV_SAMPLE_FMT_FLTP，nb_samples 不固定，linesize 是 buffer 容量
+		int plane_size = resample_frame->nb_samples * av_get_bytes_per_sample(AV_SAMPLE_FMT_FLTP);
+		fd1.audioSinkWrite(resample_frame->data[0], plane_size);
+		fd1.audioSinkWrite(resample_frame->data[1], plane_size);
 		printf("sample frame linesize size = %d\n", resample_frame->linesize[0]);
-		fflush(fd);
-		fflush(fd1);
+		loudness.audioLoudnessFrame(resample_frame);
 
 		ret = audioEncode->audioEncode(resample_frame, &packet);
 		if (ret == AVERROR(EAGAIN))
@@ -148,13 +164,41 @@ int main() {
 		}
 		if (ret == -1)
 			break;
-		printf("encode packet size = %d\n", packet->size);
-		audioEncode->packetAddHeader(adts_buffer, packet->size);
-		fwrite(adts_buffer, 1, 7, fd2);
-		fwrite(packet->data, 1, packet->size, fd2);
-		fflush(fd2);
+		do {
+			printf("encode packet size = %d\n", packet->size);
+			fd2.audioAdtsWrite(audioEncode, packet);
+			fd3.audioMuxWrite(packet, audioEncode->audioEncodeIngestTime());
+			dvr.audioDvrPush(packet);
+		} while (audioEncode->audioEncodeReceive(&packet) == 0);
+	}
+	//结束之后要送一个空数据，让编码器吐出缓存的数据。
+	while (audioEncode->audioEncode(NULL, &packet) == 0) {
+		fd2.audioAdtsWrite(audioEncode, packet);
+		fd3.audioMuxWrite(packet);
 	}
-	audioEncode->audioEncode(NULL, &packet); //结束之后要送一个空数据，让编码器吐出缓存的数据。
+	int64_t priming, samples, padding;
+	audioEncode->audioEncodeGetGapless(&priming, &samples, &padding);
+	printf("gapless priming:%lld samples:%lld padding:%lld\n", (long long)priming, (long long)samples, (long long)padding);
+	AudioSinkStats stats;
+	fd.audioSinkGetStats(&stats);
+	printf("capture.pcm writes:%lld max write:%lldus stalls:%lld stall time:%lldus\n",
+		stats.writes, stats.maxWriteUs, stats.stalls, stats.stallUs);
+	fd.audioSinkClose();
+	fd1.audioSinkClose();
+	fd2.audioAdtsClose();
+	AudioLoudnessResult r128;
+	loudness.audioLoudnessGet(&r128);
+	char r128_tag[128];
+	snprintf(r128_tag, sizeof(r128_tag), "R128 I:%.1f LUFS LRA:%.1f LU TP:%.1f dBTP",
+		r128.integrated, r128.lra, r128.truePeak);
+	printf("loudness %s\n", r128_tag);
+	fd3.audioMuxSetMetadata("comment", r128_tag);
+	fd3.audioMuxClose();
+	dvr.audioDvrDumpLast(60 * 1000, "last_minute.m4a");
+	//采集到编码完成、采集到写盘的延迟分布
+	audioEncode->audioEncodeGetLatency().audioLatencyPrint("capture->encoded");
+	fd2.audioAdtsGetLatency().audioLatencyPrint("capture->written(encode.aac)");
+	fd.audioSinkGetLatency().audioLatencyPrint("capture->written(capture.pcm)");
 }
 #else
 
@@ -203,14 +247,20 @@ int main(int argc, char* argv[])
 		audioSample->audioSampleConvert(decframe, &resample_frame);
 
 		int planar = av_sample_fmt_is_planar(AV_SAMPLE_FMT_S16);
+		int plane_size = av_samples_get_buffer_size(NULL, planar ? 1 : resample_frame->channels,
+			resample_frame->nb_samples, AV_SAMPLE_FMT_S16, 1);
 		if (planar) {
-			fwrite(resample_frame->data[0], 1, resample_frame->linesize[0], out_fd);
-			fwrite(resample_frame->data[1], 1, resample_frame->linesize[0], out_fd);
+			fwrite(resample_frame->data[0], 1, plane_size, out_fd);
+			fwrite(resample_frame->data[1], 1, plane_size, out_fd);
 		}
 		else {
-			fwrite(resample_frame->data[0], 1, resample_frame->linesize[0], out_fd);
+			fwrite(resample_frame->data[0], 1, plane_size, out_fd);
 		}	
 	}
+	AudioPoolStats pool_stats;
+	AudioBufferPool::audioPoolDefault()->audioPoolGetStats(&pool_stats);
+	printf("buffer pool gets:%lld hits:%lld misses:%lld pools:%d\n", (long long)pool_stats.gets,
+		(long long)(pool_stats.gets - pool_stats.misses), (long long)pool_stats.misses, pool_stats.pools);
 
 __FAIL:
 
@@ -8,6 +8,7 @@
 #pragma comment(lib, "Strmiids.lib")
 #endif
 #include "audio_engine.h"
+#include "audio_segment.h"
 
 void getAudioDevices(char* name)
 {
@@ -77,8 +78,10 @@ void convert(const char* strIn, char* strOut, int sourceCodepage, int targetCode
 int main() {
 	char device_name[128] = { 0 };
 	AVFrame *frame = NULL;
-	char *file_name = "capture.pcm";
-	FILE *fd = fopen(file_name, "wb+");
+	//ʱ¼ưСʱ wav ֶΣÿһΣ̱ඪ 1 룬Ѿгķֶζܲ
+	AudioSegmentSink segment;
+	segment.audioSegmentSetRotation(0, 60 * 60 * 1000);
+	segment.audioSegmentSetSync(1000);
 #ifdef _MSC_VER	
 	char name[128] = { 0 };
 	char name_utf8[128] = { 0 };
@@ -99,14 +102,28 @@ int main() {
 		printf("init fail.\n");
 		return 0;
 	}
+	int segment_opened = 0;
 	while (1) {
 		ret = audioCapture->audioCaptureFrame(&frame);
 		if (ret < 0) {
-			if (ret == -35)
+			if (ret == AVERROR(EAGAIN))
 				continue;
+			segment.audioSegmentClose();
+			exit(0);
+		}
+		//ʡʽ豸ʵʸĵһ֡Ϊ׼
+		if (!segment_opened) {
+			if (segment.audioSegmentOpen("capture_%05d.wav", frame->sample_rate, frame->channels,
+				(AVSampleFormat)frame->format) < 0) {
+				printf("open segment fail.\n");
+				return 0;
+			}
+			segment_opened = 1;
+		}
+		if (segment.audioSegmentWriteFrame(frame) < 0) {
+			segment.audioSegmentClose();
 			exit(0);
 		}
-		fwrite(frame->data[0], 1, frame->linesize[0], fd); 
 		printf("frame linesize size = %d\n", frame->linesize[0]);
 	}
 